@@ -1,9 +1,23 @@
 #include "Application.h"
 #include "CommandFirewall.h"
 #include "CommandParser.h"
+#include "EventLog.h"
+#include "LatencyStats.h"
 #include "LlamaManager.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "OutputDigest.h"
+#include "PerfSampler.h"
+#include "ProcessMemory.h"
+#include "ReplayAIProvider.h"
 #include "ShellManager.h"
+#include "TraceRecorder.h"
+#include "imgui_internal.h" // Selection of the read-only terminal pane
+#include <algorithm>
+#include <cctype>
 #include <future>
+#include <optional>
+#include <sstream>
 
 // Custom handler to prevent Ctrl+C from crashing the app
 BOOL WINAPI ConsoleCtrlHandler(DWORD dwCtrlType) {
@@ -17,19 +31,47 @@ BOOL WINAPI ConsoleCtrlHandler(DWORD dwCtrlType) {
 Application::Application() {
   SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
 
+  // First run: derive the profile from the CPU topology and keep it, so it
+  // can be edited or refined with /calibrate
+  if (!m_Profile.Load(kProfilePath)) {
+    m_Profile = InferenceProfile::Auto(CpuTopology::Detect(),
+                                       llama_supports_gpu_offload());
+    m_Profile.Save(kProfilePath);
+  }
+  LOG_INFOF("Inference profile: %s", m_Profile.Describe().c_str());
+
+  // Before the model load thread can post its "ready" message
+  RestoreSession();
+  // Journaled on the job thread: the output can be a megabyte, too much to
+  // write and flush between two frames
+  m_Jobs.SetFinishedSink([this](JobScheduler::Finished &done) {
+    if (done.info.startNs) // Not stopped while still queued
+      m_ChatJournal.Append(ChatJournal::Execution{
+          done.info.command, std::move(done.output), done.info.exitCode});
+  });
+
+  // Initialize with default (Index 0 is now Qwen). Loading and warmup run
+  // in the background while the window and renderer come up.
+  SwitchToModel(0);
+
   m_Window = std::make_unique<Window>(WIDTH + 200, HEIGHT, "Terminal Co-Pilot");
   m_Input = std::make_unique<InputManager>(m_Window->GetWin32Handle());
   m_Gui = std::make_unique<GuiRenderer>(m_Window->GetNativeHandle());
 
-  // Initialize with default (Index 0 is now Qwen)
-  SwitchToModel(0);
-
   m_IsAdmin = IsRunningAsAdmin();
+
+  m_ResponseCache.Load("cache/response_cache.bin");
+  m_CommandHistory.Open("cache/command_history.log");
+
+  // Prometheus text file for node_exporter's textfile collector or any
+  // scraper that can read a file; works without a network.
+  Metrics::Get().StartFileExport("logs/metrics.prom",
+                                 std::chrono::seconds(10));
 }
 
 Application::~Application() {
   // Graceful Termination
-  m_StopExecution = true;
+  m_Jobs.StopAll();
   m_IsThinking = false;
 
   // Wait for background tasks to complete or check termination
@@ -37,23 +79,56 @@ Application::~Application() {
     m_ModelLoadThread.wait();
   if (m_AiThread.valid())
     m_AiThread.wait();
-  if (m_ExecThread.valid())
-    m_ExecThread.wait();
+  WaitForPrefill();
+  Metrics::Get().StopFileExport();
+  m_ResponseCache.Save("cache/response_cache.bin");
+  if (!m_SemanticCachePath.empty())
+    m_SemanticCache.Save(m_SemanticCachePath);
 
   SetConsoleCtrlHandler(ConsoleCtrlHandler, FALSE);
 }
 
-void Application::SwitchToModel(int index) {
+void Application::SwitchToModel(int index, bool calibrate) {
   if (index < 0 || index >= (int)m_ModelFiles.size())
     return;
 
+  WaitForPrefill();
   m_SelectedModelIndex = index;
   m_IsLoadingModel = true;
+  m_IsCalibrating = calibrate;
   m_aiResponse = "Loading " + m_ModelOptions[index] + "...";
+  const int64_t switchStartNs = EventLog::NowNs();
 
-  m_ModelLoadThread = std::async(std::launch::async, [this, index]() {
-    auto localAI = std::make_unique<LlamaManager>(m_ModelFiles[index],
-                                                  m_ModelOptions[index]);
+  m_ModelLoadThread = std::async(std::launch::async, [this, index, calibrate,
+                                                      switchStartNs]() {
+    PeakRssProbe probe;
+    {
+      // Free the old context and KV cache before loading; its weights stay
+      // warm in m_Models if the budget allows
+      std::lock_guard<std::mutex> lock(m_ResponseMutex);
+      m_AI.reset();
+      m_Recorder = nullptr;
+    }
+    LlamaOptions options;
+    options.Apply(m_Profile);
+    options.candidates = m_Candidates;
+    ModelManager::ModelPtr model =
+        m_Models.Acquire(m_ModelFiles[index], options);
+    if (calibrate && model) {
+      // Each candidate gets a fresh context on the same weights
+      auto measure = [&](const InferenceProfile &candidate) {
+        LlamaOptions trial = options;
+        trial.Apply(candidate);
+        return LlamaManager(model, m_ModelOptions[index], trial)
+            .MeasureThroughput();
+      };
+      m_Profile =
+          InferenceProfile::Calibrate(m_Profile, CpuTopology::Detect(), measure);
+      m_Profile.Save(kProfilePath);
+      options.Apply(m_Profile);
+    }
+    auto localAI =
+        std::make_unique<LlamaManager>(model, m_ModelOptions[index], options);
 
     if (m_ModelOptions[index].find("Qwen") != std::string::npos) {
       localAI->SetTemplate(LlamaManager::GetQwenTemplate());
@@ -62,15 +137,58 @@ void Application::SwitchToModel(int index) {
     } else {
       localAI->SetTemplate(LlamaManager::GetTinyLlamaTemplate());
     }
+    // "Ready" means the first request is as fast as any other
+    if (!localAI->Warmup())
+      LOG_WARNF("Warmup failed for %s", m_ModelOptions[index].c_str());
+
+    // Embeddings are per model: persist the old model's paraphrase cache
+    // and map in the new one's (no request can run while loading)
+    if (!m_SemanticCachePath.empty())
+      m_SemanticCache.Save(m_SemanticCachePath);
+    m_SemanticCachePath = SemanticCachePath(m_ModelOptions[index]);
+    m_SemanticCache.Load(m_SemanticCachePath);
+
+    const uint64_t peakRss = probe.Stop();
+    static MetricGauge &peakGauge = Metrics::Get().Gauge(
+        "cmdai_model_switch_peak_rss_bytes",
+        "Peak resident memory during the last model switch");
+    peakGauge.Set((double)peakRss);
+    const double readySeconds = (EventLog::NowNs() - switchStartNs) / 1e9;
+    if (!calibrate)
+      Metrics::Get()
+          .Gauge("cmdai_model_time_to_ready_seconds",
+                 "From selecting a model to it being warmed up",
+                 "model=\"" + m_ModelOptions[index] + "\"")
+          .Set(readySeconds);
 
     std::lock_guard<std::mutex> lock(m_ResponseMutex);
     m_AI = std::move(localAI);
     m_IsLoadingModel = false;
-    m_aiResponse = m_ModelOptions[index] + " is ready.";
-    m_ChatHistory.push_back({"AI", m_aiResponse, "", false, false, {}});
+    char readyIn[32];
+    snprintf(readyIn, sizeof(readyIn), " in %.1f s", readySeconds);
+    m_aiResponse = m_ModelOptions[index] + " is ready" + readyIn +
+                   ". (peak " + std::to_string(peakRss >> 20) + " MB, " +
+                   std::to_string(m_Models.ResidentBytes() >> 20) +
+                   " MB of models loaded)";
+    if (m_IsCalibrating.exchange(false))
+      m_aiResponse += "\nCalibrated: " + m_Profile.Describe();
+    AddMessage(ChatStore::Role::AI, m_aiResponse);
   });
 }
 
+void Application::WaitForPrefill() {
+  if (m_PrefillThread.valid())
+    m_PrefillThread.wait();
+  m_PrefilledInput.clear();
+}
+
+std::string Application::SemanticCachePath(const std::string &modelName) {
+  std::string slug;
+  for (char c : modelName)
+    slug += std::isalnum((unsigned char)c) ? c : '_';
+  return "cache/semantic_" + slug + ".bin";
+}
+
 bool Application::IsRunningAsAdmin() {
   BOOL fIsRunAsAdmin = FALSE;
   HANDLE hToken = NULL;
@@ -91,6 +209,7 @@ void Application::Run() {
   static char inputBuffer[512] = "";
 
   while (!m_Window->ShouldClose()) {
+    TraceSpan frameSpan("Frame", "ui");
     if (m_Window->ProcessOSMessages(1)) {
       if (m_Window->IsVisible())
         m_Window->Hide();
@@ -101,51 +220,94 @@ void Application::Run() {
     }
 
     if (!m_Window->IsVisible()) {
+      m_PerfSampler.Reset();
       std::this_thread::sleep_for(std::chrono::milliseconds(16));
       continue;
     }
+    m_PerfSampler.FrameTick();
 
     // 2. Async Response Handling
+    std::optional<TraceSpan> phase;
+    phase.emplace("AsyncResults", "ui");
     if (m_IsThinking && m_AiThread.valid()) {
       if (m_AiThread.wait_for(std::chrono::seconds(0)) ==
           std::future_status::ready) {
-        std::string fullResponse = m_AiThread.get();
-        ParsedCommand pc = CommandParser::Parse(fullResponse);
+        InferenceResult result = m_AiThread.get();
+        EventLog::RequestScope requestScope(m_ActiveRequestId);
+        LatencyStats::ModelScope modelScope(m_ActiveModelSlot);
+        ParsedCommand pc;
+        if (result.semanticHit) {
+          pc = {result.hit.entry.command, result.hit.entry.explanation, true};
+        } else if (result.response == IAIProvider::kCancelled) {
+          pc.explanation = "Cancelled.";
+        } else {
+          EventLog::ScopedEvent ev(EventId::Parse);
+          pc = CommandParser::Parse(result.response);
+          ev.SetField(0, pc.success);
+        }
 
         if (pc.success) {
           m_LastGeneratedCommand = pc.command;
           m_CommandExplanation = pc.explanation;
-          m_CurrentSafety = ShellManager::AssessCommand(m_LastGeneratedCommand);
+          {
+            EventLog::ScopedEvent ev(EventId::Assess);
+            m_CurrentSafety =
+                ShellManager::AssessCommand(m_LastGeneratedCommand);
+            ev.SetField(0, m_CurrentSafety.riskScore);
+            ev.SetField(1, m_CurrentSafety.isValid);
+          }
+          static MetricHistogram &riskScores = Metrics::Get().Histogram(
+              "cmdai_command_risk_score", "AssessCommand risk score (0-10)",
+              {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+          riskScores.Observe(m_CurrentSafety.riskScore);
           m_aiResponse =
               m_CurrentSafety.isValid ? "Validated." : "Verification warning.";
+          if (result.semanticHit) {
+            static MetricCounter &semanticHits = Metrics::Get().Counter(
+                "cmdai_semantic_cache_hits_total",
+                "Prompts answered from a cached paraphrase");
+            semanticHits.Add();
+            m_aiResponse = "Matched a similar request (" +
+                           std::to_string((int)(result.hit.similarity * 100)) +
+                           "%).";
+          } else if (pc.command != "DENIED" && !m_ActiveCacheKey.empty())
+            m_ResponseCache.Insert(
+                m_ActiveCacheKey,
+                {m_LastGeneratedCommand, pc.explanation,
+                 m_CurrentSafety.riskScore, m_CurrentSafety.isValid,
+                 m_CurrentSafety.riskReason});
         } else {
-          m_aiResponse = "Analysis failed.";
+          m_aiResponse = pc.explanation.empty() ? "Analysis failed."
+                                                : pc.explanation;
           m_LastGeneratedCommand = "";
           m_CurrentSafety = {};
         }
 
         {
           std::lock_guard<std::mutex> lock(m_ResponseMutex);
-          m_ChatHistory.push_back({"AI", pc.explanation, pc.command, false,
-                                   pc.success, m_CurrentSafety});
+          ChatStore::Message msg =
+              AnswerMessage(pc.explanation, pc.command, pc.success);
+          msg.fromCache = result.semanticHit;
+          if (pc.success) {
+            msg.cacheKey = m_ActiveCacheKey;
+            msg.cacheIntent = result.semanticHit ? result.hit.entry.intent
+                                                 : m_ActiveIntent;
+          }
+          AddMessage(msg, pc.success ? std::move(result.embedding) : nullptr);
         }
+        EventLog::Get().Emit(EventId::RequestEnd,
+                             {EventLog::NowNs() - m_RequestStartNs});
 
         m_IsThinking = false;
+        m_IsExplaining = false;
         m_ScrollToBottom = true;
       }
     }
 
-    if (m_IsExecuting && m_ExecThread.valid()) {
-      if (m_ExecThread.wait_for(std::chrono::seconds(0)) ==
-          std::future_status::ready) {
-        auto res = m_ExecThread.get();
-        m_TerminalOutput = res.output;
-        m_IsExecuting = false;
-        m_ScrollToBottom = true;
-      }
-    }
+    PollJobs();
 
     // 3. Render Prep
+    phase.emplace("BuildUI", "ui");
     int dw, dh;
     glfwGetFramebufferSize(m_Window->GetNativeHandle(), &dw, &dh);
     glViewport(0, 0, dw, dh);
@@ -155,6 +317,8 @@ void Application::Run() {
 
     if (ImGui::IsKeyPressed(ImGuiKey_Escape))
       m_Window->Hide();
+    if (ImGui::IsKeyPressed(ImGuiKey_F3, false))
+      m_ShowPerfOverlay = !m_ShowPerfOverlay;
 
     ImGui::SetNextWindowSize(ImVec2((float)dw, (float)dh));
     ImGui::SetNextWindowPos(ImVec2(0, 0));
@@ -174,8 +338,7 @@ void Application::Run() {
     ImGui::Begin("MainPanel", nullptr, flags);
 
     // Global Status
-    bool canOperateStatus =
-        !m_IsThinking && !m_IsExecuting && !m_IsLoadingModel;
+    bool canOperateStatus = !m_IsThinking && !m_IsLoadingModel;
 
     // --- TOP-LEFT: MODEL SELECTION ---
     ImGui::SetCursorPos(ImVec2(15, 10));
@@ -225,21 +388,35 @@ void Application::Run() {
 
     // (canOperateStatus moved to top of frame)
 
-    // RIGHT GROUP: Reset
+    // RIGHT GROUP: Stats + Reset
     {
-      ImGui::SameLine(ImGui::GetContentRegionAvail().x - 70);
+      ImGui::SameLine(ImGui::GetContentRegionAvail().x - 140);
+      if (ImGui::Button(m_ShowStats ? "Stats <" : "Stats", ImVec2(65, 26)))
+        m_ShowStats = !m_ShowStats;
+      if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("Per-stage latency (type /stats to dump)");
+
+      ImGui::SameLine();
 
       // Reset button
       if (!canOperateStatus)
         ImGui::BeginDisabled();
       if (ImGui::Button("Reset", ImVec2(65, 26))) {
         m_AI->ResetContext();
+        m_PrefilledInput.clear();
         m_aiResponse = "Context Cleared.";
         m_LastGeneratedCommand = "";
+        // Running jobs carry on and stay listed
+        m_Jobs.RemoveFinished();
+        m_TerminalJob = m_TerminalSeen = 0;
         m_TerminalOutput = "";
+        m_TerminalCommand.clear();
         {
           std::lock_guard<std::mutex> lock(m_ResponseMutex);
-          m_ChatHistory.clear();
+          m_ChatHistory.Clear();
+          m_ChatEmbeddings.clear();
+          // Out of the window, still in the journal
+          m_ChatOlderRecords = m_ChatJournal.Records();
         }
       }
       if (!canOperateStatus)
@@ -271,9 +448,14 @@ void Application::Run() {
       ImGui::BeginChild("LoadingPane", ImVec2(-1, availableHeight), true);
       ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f),
                          "SYSTEM INITIALIZING...");
-      ImGui::TextWrapped("Loading %s GGUF into memory. This may take a few "
-                         "seconds depending on your hardware...",
-                         m_ModelOptions[m_SelectedModelIndex].c_str());
+      if (m_IsCalibrating)
+        ImGui::TextWrapped("Measuring thread, batch and KV cache settings on "
+                           "%s. This takes a minute or two...",
+                           m_ModelOptions[m_SelectedModelIndex].c_str());
+      else
+        ImGui::TextWrapped("Loading %s GGUF into memory. This may take a few "
+                           "seconds depending on your hardware...",
+                           m_ModelOptions[m_SelectedModelIndex].c_str());
       ImGui::EndChild();
     } else {
       // AI PANE
@@ -284,19 +466,26 @@ void Application::Run() {
       // 1. Render History
       {
         std::lock_guard<std::mutex> lock(m_ResponseMutex);
-        for (const auto &msg : m_ChatHistory) {
+        bool showEarlier = m_ChatOlderRecords > 0 &&
+                           ImGui::SmallButton("Show earlier messages");
+        // Straight from the store: no per-message strings built per frame
+        for (size_t i = 0; i < m_ChatHistory.Size(); ++i) {
+          const ChatStore::Message &msg = m_ChatHistory[i];
+          const char *text = msg.content.data();
+          const char *textEnd = text + msg.content.size();
+          ImGui::PushID((int)msg.id);
           bool isSystemEvent =
-              (msg.content.find("is ready") != std::string::npos ||
-               msg.content.find("Cleared") != std::string::npos);
+              (msg.content.find("is ready") != std::string_view::npos ||
+               msg.content.find("Cleared") != std::string_view::npos);
 
           if (isSystemEvent) {
-            float txtWidth = ImGui::CalcTextSize(msg.content.c_str()).x;
+            float txtWidth = ImGui::CalcTextSize(text, textEnd).x;
             ImGui::SetCursorPosX((paneWidthStatus * 0.5f) - (txtWidth * 0.5f));
             ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1, 1, 1, 0.4f));
-            ImGui::Text("%s", msg.content.c_str());
+            ImGui::TextUnformatted(text, textEnd);
             ImGui::PopStyleColor();
-          } else if (msg.isUser) {
-            float width = ImGui::CalcTextSize(msg.content.c_str()).x;
+          } else if (msg.IsUser()) {
+            float width = ImGui::CalcTextSize(text, textEnd).x;
             float maxWidth = paneWidthStatus * 0.75f;
             if (width > maxWidth)
               width = maxWidth;
@@ -306,13 +495,13 @@ void Application::Run() {
 
             ImGui::SetCursorPosX(ImGui::GetContentRegionAvail().x - width - 15);
             ImGui::PushTextWrapPos(ImGui::GetCursorPos().x + width);
-            ImGui::TextWrapped("%s", msg.content.c_str());
+            ImGui::TextUnformatted(text, textEnd);
             ImGui::PopTextWrapPos();
           } else {
             ImGui::TextColored(ImVec4(0.7f, 0.5f, 0.95f, 1.0f), "cmdAI");
             ImGui::PushTextWrapPos(ImGui::GetCursorPos().x +
                                    (paneWidthStatus - 25));
-            ImGui::TextWrapped("%s", msg.content.c_str());
+            ImGui::TextUnformatted(text, textEnd);
             ImGui::PopTextWrapPos();
 
             if (msg.hasCommand) {
@@ -326,11 +515,10 @@ void Application::Run() {
                                       ImVec4(0.08f, 0.08f, 0.1f, 1.0f));
                 ImGui::PushStyleVar(ImGuiStyleVar_FrameRounding, 4.0f);
 
-                char cmdId[32];
-                sprintf(cmdId, "##cmd_hist_%p", &msg);
+                // Read-only, and the store keeps a NUL after the command
                 ImGui::InputTextMultiline(
-                    cmdId, (char *)msg.command.c_str(),
-                    msg.command.length() + 1,
+                    "##cmd_hist", (char *)msg.command.data(),
+                    msg.command.size() + 1,
                     ImVec2(paneWidthStatus - 85,
                            ImGui::GetTextLineHeight() * 2.5f),
                     ImGuiInputTextFlags_ReadOnly);
@@ -341,59 +529,52 @@ void Application::Run() {
                 ImGui::SetCursorPosX(ImGui::GetCursorPosX() + 5);
 
                 // --- INTEGRATED ACTION BAR ---
-                if (ImGui::Button(
-                        (std::string("Copy##") + std::to_string((size_t)&msg))
-                            .c_str(),
-                        ImVec2(60, 26))) {
-                  ImGui::SetClipboardText(msg.command.c_str());
+                if (ImGui::Button("Copy", ImVec2(60, 26))) {
+                  ImGui::SetClipboardText(msg.command.data());
                 }
                 if (ImGui::IsItemHovered())
                   ImGui::SetTooltip("Copy command");
 
                 ImGui::SameLine();
-                bool execStateAtStart = m_IsExecuting;
-                if (execStateAtStart)
-                  ImGui::BeginDisabled();
-
                 ImGui::PushStyleColor(ImGuiCol_Button,
                                       ImVec4(0.12f, 0.48f, 1.0f, 1.0f));
-                if (ImGui::Button(
-                        (std::string("Run >##") + std::to_string((size_t)&msg))
-                            .c_str(),
-                        ImVec2(60, 26))) {
-                  m_IsExecuting = true;
-                  m_TerminalOutput = "";
-                  m_StopExecution = false;
-                  std::string cmdToRun = msg.command;
-                  m_ExecThread =
-                      std::async(std::launch::async, [this, cmdToRun]() {
-                        return ShellManager::Execute(
-                            cmdToRun, &m_StopExecution,
-                            [this](const std::string &f) {
-                              std::lock_guard<std::mutex> lock(m_ResponseMutex);
-                              m_TerminalOutput += f;
-                              m_ScrollToBottom = true;
-                            });
-                      });
-                }
+                if (ImGui::Button("Run >", ImVec2(60, 26)))
+                  RunCommand(msg);
                 ImGui::PopStyleColor();
 
                 if (ImGui::IsItemHovered())
-                  ImGui::SetTooltip("Execute in terminal");
-                if (execStateAtStart)
-                  ImGui::EndDisabled();
+                  ImGui::SetTooltip("Run as a new job in the terminal");
 
                 // Safety context within the block
-                if (msg.safety.riskScore > 0) {
+                if (msg.riskScore > 0) {
                   ImGui::SameLine();
                   ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 0.9f),
-                                     "Risk: %d/10", msg.safety.riskScore);
+                                     "Risk: %d/10", msg.riskScore);
+                }
+
+                if (!msg.cacheKey.empty() || !msg.cacheIntent.empty()) {
+                  ImGui::SameLine();
+                  if (ImGui::Button("Wrong", ImVec2(60, 26))) {
+                    const std::string intent(msg.cacheIntent);
+                    m_ResponseCache.Invalidate(std::string(msg.cacheKey));
+                    m_SemanticCache.Invalidate(intent);
+                    m_CommandHistory.Forget(intent, std::string(msg.command));
+                    m_SuggestQuery.clear(); // Refresh suggestions
+                  }
+                  if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip(msg.fromCache
+                                          ? "Cached answer: forget it and "
+                                            "ask the model next time"
+                                          : "Don't reuse this answer");
                 }
               }
             }
           }
           ImGui::Separator();
+          ImGui::PopID();
         }
+        if (showEarlier) // Not while the loop above walks the window
+          ShowEarlierMessages();
 
         if (m_ScrollToBottom) {
           ImGui::SetScrollHereY(1.0f);
@@ -403,10 +584,25 @@ void Application::Run() {
       if (m_IsThinking) {
         float time = (float)ImGui::GetTime();
         float opacity = (sinf(time * 4.0f) + 1.0f) * 0.5f;
-        ImGui::TextColored(ImVec4(0.0f, 0.8f, 1.0f, 0.5f + opacity * 0.5f),
-                           "AI is processing your intent...");
-        ImGui::ProgressBar(0.9f, ImVec2(-1, 4), "");
-      } else if (m_ChatHistory.empty()) {
+        // Long prompts (explained output) are read in chunks; show how far
+        float progress = m_AI ? m_AI->PrefillProgress() : 1.0f;
+        if (m_IsExplaining && progress < 1.0f)
+          ImGui::TextColored(ImVec4(0.0f, 0.8f, 1.0f, 0.5f + opacity * 0.5f),
+                             "Reading the output... %d%%",
+                             (int)(progress * 100));
+        else
+          ImGui::TextColored(ImVec4(0.0f, 0.8f, 1.0f, 0.5f + opacity * 0.5f),
+                             "AI is processing your intent...");
+        ImGui::SameLine();
+        if (m_CancelRequested)
+          ImGui::TextDisabled("cancelling...");
+        else if (ImGui::SmallButton("Cancel")) {
+          m_CancelRequested = true;
+          m_AI->Cancel();
+        }
+        ImGui::ProgressBar(m_IsExplaining ? progress : 0.9f, ImVec2(-1, 4),
+                           "");
+      } else if (m_ChatHistory.Empty()) {
         std::lock_guard<std::mutex> lock(m_ResponseMutex);
         if (!m_aiResponse.empty()) {
           ImGui::TextWrapped("%s", m_aiResponse.c_str());
@@ -432,6 +628,16 @@ void Application::Run() {
 
       // TERMINAL PANE
       float paneWidth2Status = pane2Width;
+      const std::vector<JobInfo> jobs = m_Jobs.List();
+      bool shownRunning = false;
+      for (const JobInfo &job : jobs)
+        if (job.id == m_TerminalJob)
+          shownRunning = !job.Finished();
+      const float jobListHeight =
+          jobs.empty() ? 0.0f
+                       : std::min(jobs.size(), kJobListRows) *
+                                 ImGui::GetTextLineHeightWithSpacing() +
+                             ImGui::GetStyle().WindowPadding.y * 2;
       ImGui::BeginGroup();
       // Fixed Header Area
       ImGui::BeginChild("ExecHeader", ImVec2(paneWidth2Status, 35), true,
@@ -441,18 +647,35 @@ void Application::Run() {
       ImGui::SetCursorPos(ImVec2(10, 8));
       ImGui::TextColored(ImVec4(0.6f, 0.6f, 0.7f, 1.0f), "TERMINAL");
 
-      // Stop Button - Centralized Pro style
-      if (m_IsExecuting) {
+      // Stop Button - Centralized Pro style, for the job shown
+      if (shownRunning) {
         ImGui::SameLine((paneWidth2Status * 0.5f) - 40);
         float time = (float)ImGui::GetTime();
         float pulse = (sinf(time * 8.0f) + 1.2f) * 0.5f;
         ImVec4 stopColor = ImVec4(0.9f, 0.2f, 0.2f, 0.3f + pulse * 0.3f);
         ImGui::PushStyleColor(ImGuiCol_Button, stopColor);
         if (ImGui::Button("Stop", ImVec2(80, 24)))
-          m_StopExecution = true;
+          m_Jobs.Stop(m_TerminalJob);
         ImGui::PopStyleColor();
       }
 
+      // Explain Button - asks about the output (or its selection), with the
+      // command bar text as the question
+      ImGui::SameLine(paneWidth2Status - 205);
+      bool canExplain = canOperateStatus && m_AI && !m_TerminalOutput.empty();
+      if (!canExplain)
+        ImGui::BeginDisabled();
+      if (ImGui::Button("Explain", ImVec2(75, 26))) {
+        ExplainOutput(inputBuffer);
+        memset(inputBuffer, 0, 512);
+      }
+      if (!canExplain)
+        ImGui::EndDisabled();
+      if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled))
+        ImGui::SetTooltip(m_OutputSelEnd > m_OutputSelBegin
+                              ? "Ask the model about the selected output"
+                              : "Ask the model about this output");
+
       // Copy Button - Right Aligned
       ImGui::SameLine(paneWidth2Status - 120);
       ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1, 1, 1, 0.6f));
@@ -462,25 +685,55 @@ void Application::Run() {
       ImGui::PopStyleColor();
       ImGui::EndChild();
 
-      // Scrolling Output Area
       float headerHeight = 35.0f;
       float spacing = ImGui::GetStyle().ItemSpacing.y;
+      if (!jobs.empty()) {
+        RenderJobList(jobs, paneWidth2Status, jobListHeight);
+        headerHeight += jobListHeight + spacing;
+      }
+
+      // Scrolling Output Area
       ImGui::BeginChild("ExecContent",
                         ImVec2(0, availableHeight - headerHeight - spacing),
                         true, 0);
       {
-        std::lock_guard<std::mutex> lock(m_ResponseMutex);
-        std::string outTxt =
-            m_TerminalOutput.empty() ? "(No output)" : m_TerminalOutput;
+        // Read-only, so the widget can show the output in place rather
+        // than a per-frame copy of up to a megabyte
+        static char noOutput[] = "(No output)";
+        char *outTxt = m_TerminalOutput.empty() ? noOutput
+                                                : m_TerminalOutput.data();
+        size_t outSize = m_TerminalOutput.empty() ? sizeof(noOutput)
+                                                  : m_TerminalOutput.size() + 1;
 
         ImGui::PushStyleColor(ImGuiCol_FrameBg, ImVec4(0, 0, 0, 0));
         ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.9f, 0.9f, 0.9f, 1.0f));
-        ImGui::InputTextMultiline("##term_out", (char *)outTxt.c_str(),
-                                  outTxt.length() + 1, ImVec2(-1, -1),
+        ImGui::InputTextMultiline("##term_out", outTxt, outSize,
+                                  ImVec2(-1, -1),
                                   ImGuiInputTextFlags_ReadOnly);
         ImGui::PopStyleColor(2);
+
+        // Keep the selection for Explain, which is drawn above this pane
+        // and so sees the previous frame's
+        m_OutputSelBegin = m_OutputSelEnd = 0;
+        ImGuiInputTextState *state =
+            ImGui::GetInputTextState(ImGui::GetItemID());
+        if (state && state->HasSelection() && !m_TerminalOutput.empty()) {
+          int a = std::min(state->GetSelectionStart(),
+                           state->GetSelectionEnd());
+          int b = std::max(state->GetSelectionStart(),
+                           state->GetSelectionEnd());
+#if IMGUI_VERSION_NUM < 19100
+          // Older versions edit UTF-16; convert to byte offsets
+          a = ImTextCountUtf8BytesFromStr(state->TextW.Data,
+                                          state->TextW.Data + a);
+          b = ImTextCountUtf8BytesFromStr(state->TextW.Data,
+                                          state->TextW.Data + b);
+#endif
+          m_OutputSelBegin = std::min((size_t)a, m_TerminalOutput.size());
+          m_OutputSelEnd = std::min((size_t)b, m_TerminalOutput.size());
+        }
       }
-      if (m_IsExecuting)
+      if (shownRunning)
         ImGui::TextColored(ImVec4(0.3f, 0.6f, 1.0f, 1.0f), "\n> RUNNING...");
       if (m_ScrollToBottom) {
         ImGui::SetScrollHereY(1.0f);
@@ -499,6 +752,7 @@ void Application::Run() {
     ImGui::PushStyleVar(ImGuiStyleVar_FrameRounding, 30.0f);
     ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(20, 15));
 
+    ImVec2 barPos = ImGui::GetCursorScreenPos();
     ImGui::BeginChild("CommandBar", ImVec2(barWidth, 60), true,
                       ImGuiWindowFlags_NoScrollbar |
                           ImGuiWindowFlags_NoBackground);
@@ -528,32 +782,121 @@ void Application::Run() {
     ImGui::PopStyleVar();
     ImGui::PopStyleColor();
 
+    // Slash commands are handled locally instead of asking the model
+    if (executePressed && inputBuffer[0] == '/' &&
+        HandleLocalCommand(inputBuffer)) {
+      executePressed = false;
+      memset(inputBuffer, 0, 512);
+    }
+
     if (executePressed) {
       std::string userIn(inputBuffer);
-      auto firewallRes = CommandFirewall::Assess(userIn);
+      m_ActiveRequestId = EventLog::NewRequestId();
+      m_RequestStartNs = EventLog::NowNs();
+      // Provider name, so /mock and /replay samples stay separate
+      const std::string providerName =
+          m_AI ? m_AI->GetModelName() : m_ModelOptions[m_SelectedModelIndex];
+      m_ActiveModelSlot = LatencyStats::Get().ModelSlot(providerName);
+      EventLog::RequestScope requestScope(m_ActiveRequestId);
+      LatencyStats::ModelScope modelScope(m_ActiveModelSlot);
+      static MetricCounter &requestsTotal = Metrics::Get().Counter(
+          "cmdai_requests_total", "Prompts submitted from the command bar");
+      requestsTotal.Add();
+      EventLog::Get().Emit(EventId::RequestBegin, {(int64_t)userIn.size()},
+                           providerName);
+
+      CommandFirewall::BlockResult firewallRes;
+      {
+        EventLog::ScopedEvent ev(EventId::FirewallAssess);
+        firewallRes = CommandFirewall::Assess(userIn);
+        ev.SetField(0, firewallRes.blocked);
+      }
       {
         std::lock_guard<std::mutex> lock(m_ResponseMutex);
-        m_ChatHistory.push_back({"User", userIn, "", true, false, {}});
+        AddMessage(ChatStore::Role::User, userIn);
+      }
+
+      // Intent the user ran a command for before: no inference, any model
+      CommandHistory::Suggestion known;
+      bool historyHit =
+          !firewallRes.blocked && m_CommandHistory.Resolve(userIn, known);
+
+      // Same intent answered before by this model: no inference
+      ResponseCache::Entry cached;
+      bool cacheHit = false;
+      if (!firewallRes.blocked && !historyHit) {
+        m_ActiveCacheKey = ResponseCache::MakeKey(userIn, providerName,
+                                                  m_AI->GetPromptFormat());
+        cacheHit = m_ResponseCache.Lookup(m_ActiveCacheKey, cached);
+        m_ActiveIntent = userIn;
       }
 
       if (firewallRes.blocked) {
+        static MetricCounter &firewallBlocks = Metrics::Get().Counter(
+            "cmdai_firewall_blocks_total", "Prompts rejected by the firewall");
+        firewallBlocks.Add();
         m_aiResponse = "";
         m_LastGeneratedCommand = "FIREWALL_BLOCK";
         m_CommandExplanation = firewallRes.reason;
         {
           std::lock_guard<std::mutex> lock(m_ResponseMutex);
-          m_ChatHistory.push_back(
-              {"AI", firewallRes.reason, "", false, false, {}});
+          AddMessage(ChatStore::Role::AI, firewallRes.reason);
         }
+        EventLog::Get().Emit(EventId::RequestEnd,
+                             {EventLog::NowNs() - m_RequestStartNs});
+      } else if (historyHit) {
+        AnswerFromHistory(known);
+        EventLog::Get().Emit(EventId::RequestEnd,
+                             {EventLog::NowNs() - m_RequestStartNs});
+      } else if (cacheHit) {
+        static MetricCounter &cacheHits = Metrics::Get().Counter(
+            "cmdai_response_cache_hits_total",
+            "Prompts answered from the response cache");
+        cacheHits.Add();
+        m_LastGeneratedCommand = cached.command;
+        m_CommandExplanation = cached.explanation;
+        m_CurrentSafety = {cached.riskValid, cached.riskScore,
+                           cached.riskReason};
+        m_aiResponse = "Cached.";
+        {
+          std::lock_guard<std::mutex> lock(m_ResponseMutex);
+          ChatStore::Message msg =
+              AnswerMessage(cached.explanation, cached.command, true);
+          msg.cacheKey = m_ActiveCacheKey;
+          msg.fromCache = true;
+          msg.cacheIntent = userIn;
+          AddMessage(msg);
+        }
+        EventLog::Get().Emit(EventId::RequestEnd,
+                             {EventLog::NowNs() - m_RequestStartNs});
+        m_ScrollToBottom = true;
       } else {
         m_IsThinking = true;
+        m_CancelRequested = false;
+        m_AI->ResetCancel();
         m_aiResponse = "";
-        m_AiThread = std::async(std::launch::async, [this, userIn]() {
-          return m_AI->GenerateCommand(userIn, [this](const std::string &t) {
-            std::lock_guard<std::mutex> lock(m_ResponseMutex);
-            m_aiResponse += t;
-            m_ScrollToBottom = true;
-          });
+        m_PrefilledInput.clear(); // Consumed by this request
+        uint64_t requestId = m_ActiveRequestId;
+        int modelSlot = m_ActiveModelSlot;
+        m_AiThread = std::async(std::launch::async, [this, userIn, requestId,
+                                                     modelSlot]() {
+          EventLog::RequestScope requestScope(requestId);
+          LatencyStats::ModelScope modelScope(modelSlot);
+          TraceRecorder::SetThreadName("Inference");
+          InferenceResult result;
+          // A paraphrase of an accepted request skips decoding entirely;
+          // providers without embeddings fall straight through
+          std::vector<float> embedding;
+          if (m_AI->Embed(userIn, embedding)) {
+            result.semanticHit = m_SemanticCache.Lookup(embedding, result.hit);
+            result.embedding = std::make_shared<const std::vector<float>>(
+                std::move(embedding));
+            if (result.semanticHit)
+              return result;
+          }
+          result.response = m_AI->GenerateCommand(
+              userIn, [this](const std::string &t) { OnStreamedPiece(t); });
+          return result;
         });
       }
       memset(inputBuffer, 0, 512);
@@ -565,10 +908,601 @@ void Application::Run() {
     ImGui::PopStyleVar(2);
     ImGui::PopStyleColor();
 
+    // History suggestions, refreshed as the user types. The bar sits at the
+    // bottom edge, so the list opens upwards from it.
+    if (m_SuggestQuery != inputBuffer) {
+      m_SuggestQuery = inputBuffer;
+      m_LastEditNs = EventLog::NowNs();
+      m_Suggestions.clear();
+      if (inputBuffer[0] != '/')
+        m_Suggestions = m_CommandHistory.Suggest(m_SuggestQuery, 5);
+    }
+    if (!m_Suggestions.empty() && canOperateStatus && !m_IsThinking) {
+      ImGui::SetNextWindowPos(ImVec2(barPos.x + 15, barPos.y),
+                              ImGuiCond_Always, ImVec2(0, 1));
+      ImGui::SetNextWindowBgAlpha(0.95f);
+      ImGui::Begin("##suggestions", nullptr,
+                   ImGuiWindowFlags_NoDecoration |
+                       ImGuiWindowFlags_AlwaysAutoResize |
+                       ImGuiWindowFlags_NoFocusOnAppearing |
+                       ImGuiWindowFlags_NoSavedSettings |
+                       ImGuiWindowFlags_NoNav);
+      int chosen = -1;
+      for (size_t i = 0; i < m_Suggestions.size(); ++i) {
+        const CommandHistory::Suggestion &s = m_Suggestions[i];
+        if (ImGui::Selectable(
+                (s.command + "##suggest" + std::to_string(i)).c_str(), false,
+                0, ImVec2(ImGui::CalcTextSize(s.command.c_str()).x, 0)))
+          chosen = (int)i;
+        ImGui::SameLine(0, 20);
+        ImGui::TextDisabled("%s (%ux)", s.intent.c_str(), s.uses);
+      }
+      ImGui::End();
+
+      if (chosen >= 0) {
+        CommandHistory::Suggestion known = m_Suggestions[chosen];
+        m_ActiveRequestId = EventLog::NewRequestId();
+        m_RequestStartNs = EventLog::NowNs();
+        EventLog::RequestScope requestScope(m_ActiveRequestId);
+        EventLog::Get().Emit(EventId::RequestBegin,
+                             {(int64_t)known.intent.size()}, "history");
+        {
+          std::lock_guard<std::mutex> lock(m_ResponseMutex);
+          AddMessage(ChatStore::Role::User,
+                     known.intent.empty() ? known.command : known.intent);
+        }
+        AnswerFromHistory(known);
+        EventLog::Get().Emit(EventId::RequestEnd,
+                             {EventLog::NowNs() - m_RequestStartNs});
+        memset(inputBuffer, 0, 512);
+      }
+    }
+
+    // Once typing pauses, let the model prefill the intent so far; Send then
+    // only has the changed tail and the end-of-turn tags left to prefill
+    bool prefillIdle = !m_PrefillThread.valid() ||
+                       m_PrefillThread.wait_for(std::chrono::seconds(0)) ==
+                           std::future_status::ready;
+    if (prefillIdle && m_AI && !m_IsThinking && !m_IsLoadingModel &&
+        inputBuffer[0] != '\0' && inputBuffer[0] != '/' &&
+        m_PrefilledInput != inputBuffer &&
+        EventLog::NowNs() - m_LastEditNs > kPrefillDebounceMs * 1000000) {
+      std::string partial(inputBuffer);
+      m_PrefilledInput = partial;
+      m_PrefillThread = std::async(std::launch::async, [this, partial]() {
+        TraceRecorder::SetThreadName("Prefill");
+        m_AI->Prefill(partial);
+      });
+    }
+
     ImGui::PopStyleColor(2);
     ImGui::PopStyleVar(5);
     ImGui::End();
+
+    if (m_ShowStats)
+      RenderStatsPanel();
+    if (m_ShowPerfOverlay)
+      RenderPerfOverlay();
+
+    phase.emplace("Present", "ui");
     m_Gui->EndFrame();
     m_Window->SwapBuffers();
   }
 }
+
+void Application::OnStreamedPiece(const std::string &piece) {
+  std::unique_lock<std::mutex> lock(m_ResponseMutex, std::defer_lock);
+  {
+    TraceSpan wait("Wait m_ResponseMutex", "lock");
+    lock.lock();
+  }
+  m_aiResponse += piece;
+  m_ScrollToBottom = true;
+}
+
+void Application::ExplainOutput(const std::string &question) {
+  const std::string ask = question.empty() ? "Explain this output." : question;
+  m_ActiveRequestId = EventLog::NewRequestId();
+  m_RequestStartNs = EventLog::NowNs();
+  const std::string providerName = m_AI->GetModelName();
+  m_ActiveModelSlot = LatencyStats::Get().ModelSlot(providerName);
+  EventLog::RequestScope requestScope(m_ActiveRequestId);
+  static MetricCounter &explainTotal = Metrics::Get().Counter(
+      "cmdai_explain_requests_total", "Terminal output sent to the model");
+  explainTotal.Add();
+  EventLog::Get().Emit(EventId::RequestBegin, {(int64_t)ask.size()},
+                       "explain");
+
+  // The digest depends on the context left, so neither cache applies, and
+  // a command run from the answer is not filed under the question
+  m_ActiveCacheKey.clear();
+  m_ActiveIntent.clear();
+  const bool selection = m_OutputSelEnd > m_OutputSelBegin;
+  {
+    std::lock_guard<std::mutex> lock(m_ResponseMutex);
+    AddMessage(ChatStore::Role::User,
+               ask + (selection ? " (selected output of " : " (output of ") +
+                   m_TerminalCommand + ")");
+  }
+
+  m_IsThinking = true;
+  m_IsExplaining = true;
+  m_CancelRequested = false;
+  m_AI->ResetCancel();
+  m_aiResponse = "";
+  m_PrefilledInput.clear();
+  // As of now: a running job keeps adding to m_TerminalOutput
+  const size_t begin = std::min(m_OutputSelBegin, m_TerminalOutput.size());
+  const std::string output = m_TerminalOutput.substr(
+      begin, selection ? m_OutputSelEnd - begin : std::string::npos);
+  const std::string command = m_TerminalCommand;
+  const uint64_t requestId = m_ActiveRequestId;
+  const int modelSlot = m_ActiveModelSlot;
+  m_AiThread = std::async(std::launch::async, [this, ask, command, output,
+                                               requestId, modelSlot]() {
+    EventLog::RequestScope requestScope(requestId);
+    LatencyStats::ModelScope modelScope(modelSlot);
+    TraceRecorder::SetThreadName("Inference");
+    InferenceResult result;
+    const std::string header = "The command `" + command + "` printed:\n";
+    const std::string footer =
+        "\n" + ask +
+        " Put the answer in \"why\" and a useful next command, if any, in "
+        "\"cmd\".";
+    auto budgetLeft = [&]() {
+      size_t budget = m_AI->TurnTokenBudget();
+      size_t framing = m_AI->CountTokens(header + footer);
+      return budget > framing ? budget - framing : 0;
+    };
+    size_t budget = budgetLeft();
+    if (budget < kExplainMinTokens) {
+      // A long conversation leaves no room; the output matters more
+      m_AI->ResetContext();
+      budget = budgetLeft();
+      std::lock_guard<std::mutex> lock(m_ResponseMutex);
+      AddMessage(ChatStore::Role::AI,
+                 "Earlier conversation cleared to make room for the output.");
+    }
+
+    OutputDigest digest;
+    {
+      TraceSpan span("Digest output", "explain");
+      digest = OutputDigest::Build(
+          output, std::min(budget, kExplainMaxTokens),
+          [this](std::string_view text) { return m_AI->CountTokens(text); });
+    }
+    LOG_INFOF("Explaining %zu lines as %zu tokens (%zu folded, %zu omitted)",
+              digest.lines, digest.tokens, digest.foldedLines,
+              digest.omittedLines);
+    if (m_CancelRequested) {
+      result.response = IAIProvider::kCancelled;
+      return result;
+    }
+    result.response = m_AI->GenerateCommand(
+        header + digest.text + footer,
+        [this](const std::string &t) { OnStreamedPiece(t); });
+    return result;
+  });
+}
+
+void Application::RestoreSession() {
+  const int64_t startNs = EventLog::NowNs();
+  if (!m_ChatJournal.Open(kChatJournalPath)) {
+    LOG_WARN("Chat journal unavailable; this session will not be kept");
+    return;
+  }
+  m_ChatOlderRecords = m_ChatJournal.ReadBefore(m_ChatJournal.Records(),
+                                                kChatPage, m_ChatHistory);
+  // The terminal pane comes back too, so the output can still be explained
+  ChatJournal::Execution last;
+  if (m_ChatJournal.LastExecution(last)) {
+    m_TerminalCommand = last.command;
+    m_TerminalOutput = last.output;
+  }
+  const double seconds = (EventLog::NowNs() - startNs) / 1e9;
+  Metrics::Get()
+      .Gauge("cmdai_session_restore_seconds",
+             "Opening the chat journal and reading the visible messages")
+      .Set(seconds);
+  LOG_INFOF("Restored %zu of %zu journal records (%llu KB) in %.1f ms",
+            m_ChatHistory.Size(), m_ChatJournal.Records(),
+            (unsigned long long)(m_ChatJournal.Bytes() >> 10), seconds * 1e3);
+}
+
+void Application::ShowEarlierMessages() {
+  m_ChatOlderRecords =
+      m_ChatJournal.ReadBefore(m_ChatOlderRecords, kChatPage, m_ChatHistory);
+}
+
+void Application::RunCommand(const ChatStore::Message &msg) {
+  const std::string command(msg.command);
+  m_CommandHistory.Record(std::string(msg.cacheIntent), command);
+  // Running a generated command accepts it for paraphrases
+  auto embedding = m_ChatEmbeddings.find(msg.id);
+  if (embedding != m_ChatEmbeddings.end() && !msg.fromCache)
+    m_SemanticCache.Insert(*embedding->second,
+                           {std::string(msg.cacheIntent), command,
+                            std::string(msg.content)});
+  ShowJob(m_Jobs.Submit(command, msg.requestId, msg.modelSlot));
+}
+
+void Application::ShowJob(uint64_t id) {
+  JobInfo info;
+  if (!m_Jobs.Info(id, info))
+    return;
+  m_TerminalJob = id;
+  m_TerminalSeen = 0;
+  m_TerminalOutput.clear();
+  m_TerminalCommand = info.command;
+  m_OutputSelBegin = m_OutputSelEnd = 0;
+  m_Jobs.ReadOutput(id, m_TerminalSeen, m_TerminalOutput);
+  m_ScrollToBottom = true;
+}
+
+void Application::PollJobs() {
+  if (m_TerminalJob &&
+      m_Jobs.ReadOutput(m_TerminalJob, m_TerminalSeen, m_TerminalOutput))
+    m_ScrollToBottom = true;
+}
+
+void Application::RenderJobList(const std::vector<JobInfo> &jobs, float width,
+                                float height) {
+  ImGui::BeginChild("JobList", ImVec2(width, height), true);
+  const int64_t now = EventLog::NowNs();
+  char status[24];
+  char label[160];
+  // Newest first
+  for (auto it = jobs.rbegin(); it != jobs.rend(); ++it) {
+    const JobInfo &job = *it;
+    ImVec4 color(0.6f, 0.6f, 0.7f, 1.0f); // Queued, or exited with 0
+    if (job.status == JobStatus::Exited) {
+      snprintf(status, sizeof(status), "exit %d", job.exitCode);
+      if (job.exitCode != 0)
+        color = ImVec4(1.0f, 0.5f, 0.0f, 0.9f);
+    } else {
+      snprintf(status, sizeof(status), "%s", JobInfo::StatusName(job.status));
+      if (job.status == JobStatus::Running)
+        color = ImVec4(0.3f, 0.6f, 1.0f, 1.0f);
+      else if (job.status != JobStatus::Queued)
+        color = ImVec4(1.0f, 0.5f, 0.0f, 0.9f);
+    }
+    snprintf(label, sizeof(label),
+             "#%-3llu %-8s %6.1fs  cpu %5.1fs %6.1f MB  %s",
+             (unsigned long long)job.id, status, job.Seconds(now),
+             job.cpuSeconds, job.peakMemoryBytes / (1024.0 * 1024.0),
+             job.command.c_str());
+
+    ImGui::PushID((int)job.id);
+    ImGui::PushStyleColor(ImGuiCol_Text, color);
+    if (ImGui::Selectable(label, job.id == m_TerminalJob, 0,
+                          ImVec2(width - 75, 0)))
+      ShowJob(job.id);
+    ImGui::PopStyleColor();
+    if (ImGui::IsItemHovered())
+      ImGui::SetTooltip("%s\n%.1f KB of output", job.command.c_str(),
+                        job.outputBytes / 1024.0);
+    if (!job.Finished()) {
+      ImGui::SameLine(width - 65);
+      if (ImGui::SmallButton("Stop"))
+        m_Jobs.Stop(job.id);
+    }
+    ImGui::PopID();
+  }
+  ImGui::EndChild();
+}
+
+ChatStore::Message Application::AnswerMessage(std::string_view explanation,
+                                              std::string_view command,
+                                              bool hasCommand) const {
+  ChatStore::Message msg;
+  msg.content = explanation;
+  msg.command = command;
+  msg.hasCommand = hasCommand;
+  msg.riskValid = m_CurrentSafety.isValid;
+  msg.riskScore = m_CurrentSafety.riskScore;
+  msg.riskReason = m_CurrentSafety.riskReason;
+  msg.requestId = m_ActiveRequestId;
+  msg.modelSlot = (int16_t)m_ActiveModelSlot;
+  return msg;
+}
+
+void Application::AddMessage(ChatStore::Role role, std::string_view content) {
+  ChatStore::Message msg;
+  msg.role = role;
+  msg.content = content;
+  AddMessage(msg);
+}
+
+void Application::AddMessage(
+    ChatStore::Message msg,
+    std::shared_ptr<const std::vector<float>> embedding) {
+  msg.time = CommandHistory::Now();
+  msg.journalRecord = m_ChatJournal.Append(msg);
+  uint32_t id = m_ChatHistory.Add(msg);
+  if (embedding)
+    m_ChatEmbeddings[id] = std::move(embedding);
+
+  if (m_ChatHistory.Size() > kChatWindowMax) {
+    // Dropped from memory only; "Show earlier" reads them back. A page at
+    // a time, since dropping copies the rest into a fresh arena.
+    const size_t drop = m_ChatHistory.Size() - kChatWindowMax + kChatPage;
+    for (size_t i = 0; i < drop; ++i)
+      m_ChatEmbeddings.erase(m_ChatHistory[i].id);
+    m_ChatHistory.DropFront(drop);
+    size_t first = m_ChatHistory.Front().journalRecord;
+    m_ChatOlderRecords = first == ChatJournal::kNone ? 0 : first;
+  }
+}
+
+void Application::AnswerFromHistory(const CommandHistory::Suggestion &known) {
+  static MetricCounter &historyHits = Metrics::Get().Counter(
+      "cmdai_history_hits_total", "Prompts answered from the command history");
+  historyHits.Add();
+  m_LastGeneratedCommand = known.command;
+  m_CommandExplanation = "Ran " + std::to_string(known.uses) +
+                         (known.uses == 1 ? " time" : " times") +
+                         " before for \"" + known.intent + "\".";
+  // Assessed again: the risk rules may have changed since it was run
+  m_CurrentSafety = ShellManager::AssessCommand(m_LastGeneratedCommand);
+  m_aiResponse = "From history.";
+  {
+    std::lock_guard<std::mutex> lock(m_ResponseMutex);
+    ChatStore::Message msg =
+        AnswerMessage(m_CommandExplanation, m_LastGeneratedCommand, true);
+    msg.fromCache = true;
+    msg.cacheIntent = known.intent;
+    AddMessage(msg);
+  }
+  m_ScrollToBottom = true;
+}
+
+void Application::RenderStatsPanel() {
+  ImGui::SetNextWindowSize(ImVec2(560, 260), ImGuiCond_FirstUseEver);
+  if (!ImGui::Begin("Latency Stats", &m_ShowStats)) {
+    ImGui::End();
+    return;
+  }
+
+  LatencyStats &stats = LatencyStats::Get();
+  if (ImGui::Button("Dump", ImVec2(65, 22)))
+    stats.Dump("logs/latency_stats.txt");
+  ImGui::SameLine();
+  if (ImGui::Button("Clear", ImVec2(65, 22)))
+    stats.Reset();
+
+  ImGuiTableFlags tableFlags = ImGuiTableFlags_RowBg |
+                               ImGuiTableFlags_BordersInnerV |
+                               ImGuiTableFlags_ScrollY;
+  if (ImGui::BeginTable("##latency", 6, tableFlags)) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Stage");
+    ImGui::TableSetupColumn("Count");
+    ImGui::TableSetupColumn("p50 ms");
+    ImGui::TableSetupColumn("p95 ms");
+    ImGui::TableSetupColumn("p99 ms");
+    ImGui::TableSetupColumn("max ms");
+    ImGui::TableHeadersRow();
+
+    for (int m = 0; m < stats.ModelCount(); ++m) {
+      bool headerShown = false;
+      for (int s = 0; s < (int)Stage::Count; ++s) {
+        const LatencyHistogram *h = stats.Find(m, (Stage)s);
+        if (!h || h->Count() == 0)
+          continue;
+        if (!headerShown) {
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn();
+          ImGui::TextColored(ImVec4(0.7f, 0.5f, 0.95f, 1.0f), "%s",
+                             stats.ModelName(m).c_str());
+          headerShown = true;
+        }
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("  %s", LatencyStats::StageName((Stage)s));
+        ImGui::TableNextColumn();
+        ImGui::Text("%llu", (unsigned long long)h->Count());
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", h->PercentileNs(50) / 1e6);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", h->PercentileNs(95) / 1e6);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", h->PercentileNs(99) / 1e6);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", h->Max() / 1e6);
+      }
+    }
+    ImGui::EndTable();
+  }
+  ImGui::End();
+}
+
+void Application::RenderPerfOverlay() {
+  static MetricGauge &decodeRate = Metrics::Get().Gauge(
+      "cmdai_decode_tokens_per_second", "Decode rate of the last request");
+  static MetricGauge &prefillRate = Metrics::Get().Gauge(
+      "cmdai_prefill_tokens_per_second", "Prompt rate of the last request");
+  static MetricGauge &ttft = Metrics::Get().Gauge(
+      "cmdai_time_to_first_token_seconds", "TTFT of the last request");
+  static MetricGauge &kvUsed = Metrics::Get().Gauge(
+      "cmdai_kv_cache_used_tokens", "Tokens held in the KV cache");
+  // Capacity is labelled per model; re-resolve only when the model changes.
+  static int capacityModel = -1;
+  static MetricGauge *kvCapacity = nullptr;
+  if (capacityModel != m_SelectedModelIndex) {
+    capacityModel = m_SelectedModelIndex;
+    kvCapacity = &Metrics::Get().Gauge(
+        "cmdai_kv_cache_capacity_tokens",
+        "Context window size of the loaded model",
+        "model=\"" + m_ModelOptions[m_SelectedModelIndex] + "\"");
+  }
+
+  const float padding = 10.0f;
+  ImVec2 display = ImGui::GetIO().DisplaySize;
+  ImGui::SetNextWindowPos(ImVec2(display.x - padding, 45), ImGuiCond_Always,
+                          ImVec2(1.0f, 0.0f));
+  ImGui::SetNextWindowBgAlpha(0.8f);
+  ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration |
+                           ImGuiWindowFlags_AlwaysAutoResize |
+                           ImGuiWindowFlags_NoSavedSettings |
+                           ImGuiWindowFlags_NoFocusOnAppearing |
+                           ImGuiWindowFlags_NoNav;
+  if (!ImGui::Begin("##PerfOverlay", nullptr, flags)) {
+    ImGui::End();
+    return;
+  }
+
+  const PerfSampler &ps = m_PerfSampler;
+  char overlay[64];
+  ImGui::TextColored(ImVec4(0.6f, 0.6f, 0.7f, 1.0f), "PERF (F3)");
+  snprintf(overlay, sizeof(overlay), "frame %.1f ms  avg %.1f  max %.1f",
+           ps.LatestFrameMs(), ps.AverageFrameMs(), ps.MaxFrameMs());
+  ImGui::PlotLines("##frame", ps.FrameTimes(), (int)ps.Count(),
+                   (int)ps.Offset(), overlay, 0.0f, 50.0f, ImVec2(260, 40));
+  snprintf(overlay, sizeof(overlay), "UI CPU %.1f ms", ps.LatestCpuMs());
+  ImGui::PlotLines("##cpu", ps.CpuTimes(), (int)ps.Count(), (int)ps.Offset(),
+                   overlay, 0.0f, 50.0f, ImVec2(260, 40));
+
+  ImGui::Text("decode  %6.1f tok/s", decodeRate.Value());
+  ImGui::Text("prefill %6.1f tok/s", prefillRate.Value());
+  ImGui::Text("TTFT    %6.0f ms", ttft.Value() * 1e3);
+
+  double capacity = kvCapacity->Value() > 0 ? kvCapacity->Value() : 2048.0;
+  snprintf(overlay, sizeof(overlay), "KV %.0f / %.0f", kvUsed.Value(),
+           capacity);
+  ImGui::ProgressBar((float)(kvUsed.Value() / capacity), ImVec2(260, 0),
+                     overlay);
+
+  ImGui::Text("terminal buffer %.1f KB, %zu job(s) running",
+              m_TerminalOutput.size() / 1024.0, m_Jobs.Running());
+  ImGui::End();
+}
+
+bool Application::HandleLocalCommand(const std::string &input) {
+  std::string note;
+  if (input == "/stats") {
+    // Dump the latency table and open the panel
+    const std::string statsPath = "logs/latency_stats.txt";
+    note = LatencyStats::Get().Dump(statsPath)
+               ? "Latency stats written to " + statsPath
+               : "Could not write " + statsPath;
+    m_ShowStats = true;
+  } else if (input == "/perf") {
+    m_ShowPerfOverlay = !m_ShowPerfOverlay;
+    return true;
+  } else if (input == "/trace") {
+    // Toggle the timeline recorder; the second call writes the trace
+    const std::string tracePath = "logs/trace.json";
+    if (!TraceRecorder::IsActive()) {
+      TraceRecorder::Start();
+      TraceRecorder::SetThreadName("UI");
+      note = "Trace recording started. Type /trace again to save it.";
+    } else if (TraceRecorder::Stop(tracePath)) {
+      note = "Trace written to " + tracePath +
+             " (open in ui.perfetto.dev or chrome://tracing)";
+    } else {
+      note = "Could not write " + tracePath;
+    }
+  } else if (input.rfind("/models", 0) == 0) {
+    // "/models [budget GB]" lists loaded models and can change the budget
+    double budgetGb = 0;
+    std::istringstream args(input.substr(7));
+    std::string word;
+    if (args >> word && word == "budget" && args >> budgetGb && budgetGb > 0)
+      m_Models.SetBudget((uint64_t)(budgetGb * (1ull << 30)));
+    note = "Model budget " + std::to_string(m_Models.Budget() >> 20) +
+           " MB, process RSS " +
+           std::to_string(ProcessMemory::CurrentRssBytes() >> 20) + " MB";
+    for (const ModelManager::Resident &model : m_Models.Models())
+      note += "\n  " + model.path + ": " + std::to_string(model.bytes >> 20) +
+              " MB" + (model.inUse ? " (active)" : " (warm)");
+  } else if (input == "/calibrate") {
+    // Benchmarks candidate profiles on the current model and keeps the best
+    if (m_IsThinking || m_IsLoadingModel) {
+      note = "Busy, try again when the current request has finished.";
+    } else {
+      SwitchToModel(m_SelectedModelIndex, true);
+      note = "Calibrating " + m_ModelOptions[m_SelectedModelIndex] +
+             " for this machine...";
+    }
+  } else if (input.rfind("/candidates", 0) == 0) {
+    // "/candidates [n]": best-of-n sampling; the context is rebuilt for it
+    int n = 0;
+    std::istringstream args(input.substr(11));
+    if (!(args >> n)) {
+      note = "Sampling " + std::to_string(m_Candidates) +
+             " candidate(s) per request.";
+    } else if (m_IsThinking || m_IsLoadingModel) {
+      note = "Busy, try again when the current request has finished.";
+    } else {
+      m_Candidates = std::max(1, std::min(n, LlamaManager::kMaxCandidates));
+      SwitchToModel(m_SelectedModelIndex);
+      note = "Sampling " + std::to_string(m_Candidates) +
+             " candidate(s) per request; reloading " +
+             m_ModelOptions[m_SelectedModelIndex] + "...";
+    }
+  } else if (input.rfind("/jobs", 0) == 0) {
+    // "/jobs [n]": how many commands may run at once; the rest queue
+    int n = 0;
+    std::istringstream args(input.substr(5));
+    if (args >> n)
+      m_Jobs.SetMaxRunning(n);
+    note = "Running up to " + std::to_string(m_Jobs.MaxRunning()) +
+           " command(s) at once; " + std::to_string(m_Jobs.Running()) +
+           " running now.";
+  } else if (input == "/record" || input.rfind("/replay", 0) == 0 ||
+             input.rfind("/mock", 0) == 0) {
+    // Provider swaps; never while a request is using m_AI
+    WaitForPrefill();
+    if (m_IsThinking || m_IsLoadingModel || !m_AI) {
+      note = "Busy, try again when the current request has finished.";
+    } else if (input == "/record") {
+      // Toggle recording of the current provider's streamed responses
+      const std::string recordingPath = "logs/session.replay";
+      std::lock_guard<std::mutex> lock(m_ResponseMutex);
+      if (!m_Recorder) {
+        auto recorder = std::make_unique<RecordingAIProvider>(std::move(m_AI));
+        m_Recorder = recorder.get();
+        m_AI = std::move(recorder);
+        note = "Recording responses. Type /record again to save them.";
+      } else {
+        std::vector<RecordedResponse> recorded = m_Recorder->Recorded();
+        m_AI = m_Recorder->Release();
+        m_Recorder = nullptr;
+        note = ResponseRecording::Save(recordingPath, recorded)
+                   ? std::to_string(recorded.size()) +
+                         " responses written to " + recordingPath
+                   : "Could not write " + recordingPath;
+      }
+    } else if (input.rfind("/replay", 0) == 0) {
+      // "/replay [file] [speed]" swaps in the recorded session
+      std::string path = "logs/session.replay";
+      double speed = 1.0;
+      std::istringstream args(input.substr(7));
+      args >> path >> speed;
+      std::vector<RecordedResponse> responses;
+      if (!ResponseRecording::Load(path, responses) || responses.empty()) {
+        note = "Nothing to replay in " + path;
+      } else {
+        std::lock_guard<std::mutex> lock(m_ResponseMutex);
+        m_AI = std::make_unique<ReplayAIProvider>(std::move(responses), speed);
+        m_Recorder = nullptr;
+        note = "Replaying " + path + ". Pick a model to go back.";
+      }
+    } else {
+      // "/mock [tokens per second]" swaps in the synthetic provider
+      double rate = 30.0;
+      std::istringstream(input.substr(5)) >> rate;
+      std::lock_guard<std::mutex> lock(m_ResponseMutex);
+      m_AI = std::make_unique<SyntheticAIProvider>(rate);
+      m_Recorder = nullptr;
+      note = "Synthetic provider at " + std::to_string((int)rate) +
+             " tok/s. Pick a model to go back.";
+    }
+  } else {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_ResponseMutex);
+  AddMessage(ChatStore::Role::AI, note);
+  return true;
+}
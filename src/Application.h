@@ -1,7 +1,16 @@
 #pragma once
+#include "ChatJournal.h"
+#include "ChatStore.h"
+#include "CommandHistory.h"
 #include "GuiRenderer.h"
 #include "IAIProvider.h"
+#include "InferenceProfile.h"
 #include "InputManager.h"
+#include "JobScheduler.h"
+#include "ModelManager.h"
+#include "PerfSampler.h"
+#include "ResponseCache.h"
+#include "SemanticCache.h"
 #include "ShellManager.h"
 #include "Window.h"
 #include <atomic>
@@ -9,8 +18,12 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+class RecordingAIProvider;
+
 class Application {
 public:
   Application();
@@ -31,28 +44,69 @@ private:
       "qwen2.5-coder-1.5b-instruct-q4_k_m.gguf",
       "phi-3.5-mini-instruct-q4_k_m.gguf"};
 
-  void SwitchToModel(int index);
+  // 'calibrate' tunes m_Profile on the model before handing it over
+  void SwitchToModel(int index, bool calibrate = false);
+  // Weights of the active model plus recently used ones, within a RAM budget
+  ModelManager m_Models;
+  // Threads, batch and KV settings for this machine
+  static constexpr const char *kProfilePath = "config/inference.ini";
+  InferenceProfile m_Profile;
+  std::atomic<bool> m_IsCalibrating = false;
+  // Completions sampled per request, best one kept (/candidates)
+  int m_Candidates = 1;
 
   const int WIDTH = 600;
   const int HEIGHT = 400;
 
   // AI & Execution State
   std::future<void> m_ModelLoadThread;
-  std::future<std::string> m_AiThread;
-  std::future<ShellManager::ExecuteResult> m_ExecThread;
+  // What the inference thread hands back: a generated response, or the
+  // semantic cache's answer when a paraphrase was close enough.
+  struct InferenceResult {
+    std::string response;
+    bool semanticHit = false;
+    SemanticCache::Hit hit;
+    std::shared_ptr<const std::vector<float>> embedding;
+  };
+  std::future<InferenceResult> m_AiThread;
+  // Speculative prefill of the intent being typed (IAIProvider::Prefill),
+  // started once typing pauses for kPrefillDebounceMs
+  static constexpr int64_t kPrefillDebounceMs = 150;
+  std::future<void> m_PrefillThread;
+  std::string m_PrefilledInput;
+  int64_t m_LastEditNs = 0;
+  void WaitForPrefill(); // Before anything replaces m_AI
   std::atomic<bool> m_IsThinking = false;
-  std::atomic<bool> m_IsExecuting = false;
   std::atomic<bool> m_IsLoadingModel = false;
-  std::atomic<bool> m_StopExecution = {false};
-  struct ChatMessage {
-    std::string role;
-    std::string content;
-    std::string command;
-    bool isUser;
-    bool hasCommand = false;
-    ShellManager::RiskAssessment safety;
-  };
-  std::vector<ChatMessage> m_ChatHistory;
+  std::atomic<bool> m_CancelRequested = false; // Cancel under the progress bar
+  uint64_t m_ActiveRequestId = 0;
+  int64_t m_RequestStartNs = 0;
+  int m_ActiveModelSlot = 0; // LatencyStats attribution
+  ChatStore m_ChatHistory;
+  // Intent embeddings by message id, stored in the semantic cache when the
+  // message's command is run
+  std::unordered_map<uint32_t, std::shared_ptr<const std::vector<float>>>
+      m_ChatEmbeddings;
+
+  // Every message and command result since the first run. m_ChatHistory
+  // is a window onto the newest messages: kChatPage are read at startup,
+  // a page more per "Show earlier", and the oldest drop out of it again
+  // past kChatWindowMax.
+  static constexpr const char *kChatJournalPath = "cache/chat.journal";
+  static constexpr size_t kChatPage = 100;
+  static constexpr size_t kChatWindowMax = 400;
+  ChatJournal m_ChatJournal;
+  size_t m_ChatOlderRecords = 0; // Journal records before the window
+  void RestoreSession();
+  void ShowEarlierMessages();
+  // Adds to the window and the journal; call with m_ResponseMutex held
+  void AddMessage(ChatStore::Message msg,
+                  std::shared_ptr<const std::vector<float>> embedding = {});
+  void AddMessage(ChatStore::Role role, std::string_view content);
+  // An answer carrying the current request's risk and attribution
+  ChatStore::Message AnswerMessage(std::string_view explanation,
+                                   std::string_view command,
+                                   bool hasCommand) const;
 
   std::mutex m_ResponseMutex;
   std::string m_aiResponse = "cmdAI initialized. Ready.";
@@ -61,8 +115,70 @@ private:
 
   bool IsRunningAsAdmin();
   bool m_IsAdmin = false;
+
+  // Commands run from the chat, several at once ("/jobs n" sets how many).
+  // The terminal pane shows one of them, picked from the job list.
+  JobScheduler m_Jobs;
+  uint64_t m_TerminalJob = 0;  // 0: none, or the journal's last result
+  uint64_t m_TerminalSeen = 0; // Its output stream, copied up to here
+  void RunCommand(const ChatStore::Message &msg);
+  void ShowJob(uint64_t id);
+  // Copies new output of the shown job
+  void PollJobs();
+  static constexpr size_t kJobListRows = 3; // Taller lists scroll
+  void RenderJobList(const std::vector<JobInfo> &jobs, float width,
+                     float height);
+  // Copy of the shown job's output (bounded like it); UI thread only
   std::string m_TerminalOutput = "";
+  std::string m_TerminalCommand; // What printed m_TerminalOutput
+  // Byte range of m_TerminalOutput selected in the terminal pane, as of
+  // the last frame; empty means all of it
+  size_t m_OutputSelBegin = 0;
+  size_t m_OutputSelEnd = 0;
+
+  // Sends the output (or the selection) to the model with 'question',
+  // digested to fit the context: repeats folded, the middle cut. Output
+  // tokens are capped so answers stay quick on long logs.
+  static constexpr size_t kExplainMaxTokens = 1536;
+  // Less room than this left in the conversation clears it first
+  static constexpr size_t kExplainMinTokens = 256;
+  std::atomic<bool> m_IsExplaining = false;
+  void ExplainOutput(const std::string &question);
+  void OnStreamedPiece(const std::string &piece);
   std::atomic<bool> m_ScrollToBottom = false;
   ShellManager::RiskAssessment m_CurrentSafety;
   float m_PaneSplitRatio = 0.5f;
+
+  // Latency stats panel (toggled from the top bar, dumped with /stats)
+  bool m_ShowStats = false;
+  void RenderStatsPanel();
+
+  // Frame-time / inference overlay (F3 or /perf)
+  bool m_ShowPerfOverlay = false;
+  PerfSampler m_PerfSampler;
+  void RenderPerfOverlay();
+
+  // Exact-match answers for repeated intents, persisted across sessions
+  ResponseCache m_ResponseCache{512};
+  std::string m_ActiveCacheKey;
+  std::string m_ActiveIntent;
+  // Paraphrase matches for the loaded model (cache/semantic_<model>.bin)
+  SemanticCache m_SemanticCache;
+  std::string m_SemanticCachePath;
+  static std::string SemanticCachePath(const std::string &modelName);
+
+  // Commands the user ran, for suggestions under the command bar and for
+  // answering known intents without the model (cache/command_history.log)
+  CommandHistory m_CommandHistory;
+  std::string m_SuggestQuery; // Input the suggestions were computed for
+  std::vector<CommandHistory::Suggestion> m_Suggestions;
+  void AnswerFromHistory(const CommandHistory::Suggestion &known);
+
+  // Set while /record wraps m_AI; owned by m_AI.
+  RecordingAIProvider *m_Recorder = nullptr;
+
+  // Handles "/stats", "/perf", "/trace", "/models", "/calibrate",
+  // "/candidates", "/jobs", "/record", "/replay" and "/mock"; false if
+  // 'input' is not a local command.
+  bool HandleLocalCommand(const std::string &input);
 };
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "BinaryIO.h"
+#include <filesystem>
+#include <fstream>
+
+void BinaryIO::PutU32(std::string &out, uint32_t v) {
+  char bytes[4] = {(char)(v & 0xFF), (char)((v >> 8) & 0xFF),
+                   (char)((v >> 16) & 0xFF), (char)((v >> 24) & 0xFF)};
+  out.append(bytes, 4);
+}
+
+void BinaryIO::PutU64(std::string &out, uint64_t v) {
+  PutU32(out, (uint32_t)v);
+  PutU32(out, (uint32_t)(v >> 32));
+}
+
+void BinaryIO::PutString(std::string &out, std::string_view s) {
+  PutU32(out, (uint32_t)s.size());
+  out += s;
+}
+
+uint32_t BinaryIO::GetU32(const char *data) {
+  const unsigned char *p = (const unsigned char *)data;
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint64_t BinaryIO::GetU64(const char *data) {
+  return GetU32(data) | (uint64_t)GetU32(data + 4) << 32;
+}
+
+uint32_t BinaryIO::Reader::U32() {
+  const char *p = Bytes(4);
+  return p ? GetU32(p) : 0;
+}
+
+uint64_t BinaryIO::Reader::U64() {
+  const char *p = Bytes(8);
+  return p ? GetU64(p) : 0;
+}
+
+std::string_view BinaryIO::Reader::String(size_t maxBytes) {
+  uint32_t len = U32();
+  if (len > maxBytes)
+    ok = false;
+  const char *p = ok ? Bytes(len) : nullptr;
+  return p ? std::string_view(p, len) : std::string_view();
+}
+
+const char *BinaryIO::Reader::Bytes(size_t n) {
+  if (!ok || n > size - pos) {
+    ok = false;
+    return nullptr;
+  }
+  const char *p = data + pos;
+  pos += n;
+  return p;
+}
+
+bool BinaryIO::WriteFileAtomic(const std::string &path,
+                               std::string_view data) {
+  std::error_code ec;
+  std::filesystem::path target(path);
+  if (!target.parent_path().empty())
+    std::filesystem::create_directories(target.parent_path(), ec);
+  const std::string tmp = path + ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    if (!file)
+      return false;
+    file.write(data.data(), (std::streamsize)data.size());
+    if (!file)
+      return false;
+  }
+  std::filesystem::rename(tmp, target, ec);
+  return !ec;
+}
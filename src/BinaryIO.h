@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Encoding shared by the on-disk formats (response and semantic caches,
+// the vector index, the chat journal): integers are little-endian whatever
+// the host, strings are a U32 length and the bytes. Bulk float and id
+// arrays are copied as they are, which is the same order on every target
+// this builds for.
+class BinaryIO {
+public:
+  static void PutU32(std::string &out, uint32_t v);
+  static void PutU64(std::string &out, uint64_t v);
+  static void PutString(std::string &out, std::string_view s);
+  static uint32_t GetU32(const char *data);
+  static uint64_t GetU64(const char *data);
+
+  // Bounds-checked reader over a buffer. Once a read runs past the end,
+  // 'ok' is false and every later read returns zero or empty.
+  struct Reader {
+    const char *data;
+    size_t size;
+    size_t pos = 0;
+    bool ok = true;
+
+    uint32_t U32();
+    uint64_t U64();
+    // Views the buffer; strings over 'maxBytes' fail the read.
+    std::string_view String(size_t maxBytes = SIZE_MAX);
+    // The next 'n' bytes, or null if fewer are left.
+    const char *Bytes(size_t n);
+  };
+
+  // Replaces 'path' with 'data' through path + ".tmp" and a rename, so a
+  // reader or a crash sees the old file or the new one, never a mix.
+  // Creates the parent directories.
+  static bool WriteFileAtomic(const std::string &path, std::string_view data);
+};
@@ -0,0 +1,23 @@
+#include "CandidateRanker.h"
+#include "CommandParser.h"
+#include "ShellManager.h"
+
+int CandidateRanker::Rank(const std::string &response, bool first) {
+  ParsedCommand pc = CommandParser::Parse(response);
+  if (!pc.success)
+    return 3000;
+  if (pc.command == "DENIED")
+    return first ? -1 : 1000;
+  ShellManager::RiskAssessment risk = ShellManager::AssessCommand(pc.command);
+  return risk.riskScore + (risk.isValid ? 0 : 2000);
+}
+
+bool CandidateRanker::Finish(int k, const std::string &response,
+                             bool firstDone) {
+  int rank = Rank(response, k == 0);
+  if (rank < m_BestRank) {
+    m_Best = k;
+    m_BestRank = rank;
+  }
+  return m_BestRank <= 0 && firstDone;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <climits>
+#include <string>
+
+// Picks the answer of a best-of-N request as its candidates finish.
+// Candidate 0 samples exactly like a single request; the others are forks
+// that may rescue it from an answer that cannot run.
+class CandidateRanker {
+public:
+  // Lower is better: unparsable answers last, then commands that fail
+  // validation, then by risk score. Candidate 0's refusal stands; a fork's
+  // refusal only beats a command that does not exist.
+  static int Rank(const std::string &response, bool first);
+
+  // Scores candidate 'k' once it has finished. True when nothing still
+  // running can beat the best so far: it is a runnable, riskless command
+  // (or candidate 0's refusal) and candidate 0, which could still refuse,
+  // is done.
+  bool Finish(int k, const std::string &response, bool firstDone);
+
+  int Best() const { return m_Best; }
+  int BestRank() const { return m_BestRank; }
+
+private:
+  int m_Best = 0;
+  int m_BestRank = INT_MAX;
+};
@@ -0,0 +1,356 @@
+#include "ChatJournal.h"
+#include "BinaryIO.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+namespace {
+
+constexpr char kMagic[8] = {'C', 'M', 'D', 'J', 'R', 'N', 'L', '1'};
+// Payload size, checksum, type
+constexpr size_t kHeaderBytes = 9;
+constexpr uint64_t kOffsetMask = (1ull << 56) - 1;
+
+uint64_t MakeEntry(uint64_t offset, uint8_t type) {
+  return offset | (uint64_t)type << 56;
+}
+
+uint32_t Checksum(uint8_t type, std::string_view payload) {
+  uint32_t h = 2166136261u; // FNV-1a
+  h = (h ^ type) * 16777619u;
+  for (char c : payload)
+    h = (h ^ (unsigned char)c) * 16777619u;
+  return h;
+}
+
+int64_t Now() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+uint64_t FileSize(const std::string &path) {
+  std::error_code ec;
+  uint64_t size = std::filesystem::file_size(path, ec);
+  return ec ? 0 : size;
+}
+
+} // namespace
+
+bool ChatJournal::Open(const std::string &path) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  std::error_code ec;
+  std::filesystem::path target(path);
+  if (!target.parent_path().empty())
+    std::filesystem::create_directories(target.parent_path(), ec);
+  m_Path = path;
+  if (!Load(path))
+    return false;
+  if (m_Size <= kMaxBytes)
+    return true;
+  // Loaded again however far Compact got: it closes the files before its
+  // renames, and a failed second rename leaves an index Load rebuilds
+  Compact(path);
+  return Load(path);
+}
+
+void ChatJournal::Close() {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Journal.close();
+  m_Index.close();
+  m_Map.Close();
+  m_IndexMap.Close();
+  m_MappedRecords = 0;
+  m_Appended.clear();
+  m_Size = 0;
+}
+
+bool ChatJournal::Load(const std::string &path) {
+  m_Journal.close();
+  m_Index.close();
+  m_Map.Close();
+  m_IndexMap.Close();
+  m_MappedRecords = 0;
+  m_Appended.clear();
+
+  const std::string indexPath = path + ".idx";
+  m_Size = FileSize(path);
+  if (m_Size < sizeof(kMagic) || !m_Map.Open(path) ||
+      std::memcmp(m_Map.Data(), kMagic, sizeof(kMagic)) != 0) {
+    // Missing or not a journal: start a new one
+    m_Map.Close();
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(kMagic, sizeof(kMagic));
+    std::ofstream index(indexPath, std::ios::binary | std::ios::trunc);
+    if (!file || !index)
+      return false;
+    m_Size = sizeof(kMagic);
+  } else {
+    // Only the last record is checked; anything off means a crash cut a
+    // write short, and the scan recovers every record before it
+    const uint64_t indexBytes = FileSize(indexPath);
+    bool consistent = indexBytes % 8 == 0;
+    if (consistent && indexBytes == 0) {
+      consistent = m_Size == sizeof(kMagic);
+    } else if (consistent) {
+      consistent = m_IndexMap.Open(indexPath);
+      if (consistent) {
+        uint64_t offset =
+            BinaryIO::GetU64(m_IndexMap.Data() + indexBytes - 8) & kOffsetMask;
+        const uint64_t payload = offset + kHeaderBytes;
+        consistent =
+            offset >= sizeof(kMagic) && payload <= m_Size &&
+            payload + BinaryIO::GetU32(m_Map.Data() + offset) == m_Size;
+      }
+    }
+    if (!consistent && !Rebuild(path))
+      return false;
+    m_MappedRecords = m_IndexMap.Size() / 8;
+  }
+
+  m_Journal.open(path, std::ios::binary | std::ios::app);
+  m_Index.open(indexPath, std::ios::binary | std::ios::app);
+  return m_Journal.is_open() && m_Index.is_open();
+}
+
+bool ChatJournal::Rebuild(const std::string &path) {
+  std::string index;
+  uint64_t offset = sizeof(kMagic);
+  while (offset + kHeaderBytes <= m_Size) {
+    const char *header = m_Map.Data() + offset;
+    uint32_t len = BinaryIO::GetU32(header);
+    uint8_t type = (uint8_t)header[8];
+    if (len > m_Size - offset - kHeaderBytes ||
+        (type != kMessage && type != kExecution))
+      break;
+    std::string_view payload(header + kHeaderBytes, len);
+    if (BinaryIO::GetU32(header + 4) != Checksum(type, payload))
+      break;
+    BinaryIO::PutU64(index, MakeEntry(offset, type));
+    offset += kHeaderBytes + len;
+  }
+
+  m_Map.Close();
+  m_IndexMap.Close();
+  std::error_code ec;
+  if (offset < m_Size) { // Torn tail
+    std::filesystem::resize_file(path, offset, ec);
+    if (ec)
+      return false;
+    m_Size = offset;
+  }
+  const std::string indexPath = path + ".idx";
+  if (!BinaryIO::WriteFileAtomic(indexPath, index))
+    return false;
+  m_Map.Open(path);
+  if (!index.empty())
+    m_IndexMap.Open(indexPath);
+  return true;
+}
+
+void ChatJournal::Compact(const std::string &path) {
+  // Keep the newest records that fit in half the limit, so the next
+  // compaction is as far away as this one
+  const size_t records = m_MappedRecords;
+  size_t first = records;
+  while (first > 0 && m_Size - (IndexEntry(first - 1) & kOffsetMask) <=
+                          kMaxBytes / 2)
+    --first;
+  if (first == 0)
+    return;
+
+  const uint64_t from =
+      first < records ? IndexEntry(first) & kOffsetMask : m_Size;
+  const uint64_t shift = from - sizeof(kMagic);
+  const std::string tmp = path + ".tmp";
+  const std::string indexTmp = path + ".idx.tmp";
+  {
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    file.write(kMagic, sizeof(kMagic));
+    if (first < records)
+      file.write(m_Map.Data() + from, (std::streamsize)(m_Size - from));
+    std::string index;
+    for (size_t i = first; i < records; ++i) {
+      uint64_t entry = IndexEntry(i);
+      BinaryIO::PutU64(index, MakeEntry((entry & kOffsetMask) - shift,
+                                        (uint8_t)(entry >> 56)));
+    }
+    std::ofstream indexFile(indexTmp, std::ios::binary | std::ios::trunc);
+    indexFile.write(index.data(), (std::streamsize)index.size());
+    if (!file || !indexFile)
+      return;
+  }
+
+  // Nothing may hold the files open while they are replaced
+  m_Journal.close();
+  m_Index.close();
+  m_Map.Close();
+  m_IndexMap.Close();
+  // A crash between the renames leaves an index that fails the check in
+  // Load, and the journal is rescanned
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (!ec)
+    std::filesystem::rename(indexTmp, path + ".idx", ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    std::filesystem::remove(indexTmp, ec);
+  }
+}
+
+size_t ChatJournal::Append(const ChatStore::Message &message) {
+  std::string payload;
+  BinaryIO::PutString(payload, message.IsUser() ? "User" : "AI");
+  BinaryIO::PutString(payload, message.content);
+  BinaryIO::PutString(payload, message.command);
+  BinaryIO::PutString(payload, message.riskReason);
+  BinaryIO::PutString(payload, message.cacheKey);
+  BinaryIO::PutString(payload, message.cacheIntent);
+  BinaryIO::PutU32(payload, (message.IsUser() ? 1 : 0) |
+                                (message.hasCommand ? 2 : 0) |
+                                (message.fromCache ? 4 : 0) |
+                                (message.riskValid ? 8 : 0));
+  BinaryIO::PutU32(payload, (uint32_t)message.riskScore);
+  BinaryIO::PutU64(payload, message.requestId);
+  BinaryIO::PutU64(payload, (uint64_t)(message.time ? message.time : Now()));
+  return Write(kMessage, payload);
+}
+
+size_t ChatJournal::Append(const Execution &execution) {
+  std::string payload;
+  BinaryIO::PutString(payload, execution.command);
+  // The end of a long output is where errors and summaries are
+  const std::string &output = execution.output;
+  size_t skip =
+      output.size() > kMaxOutputBytes ? output.size() - kMaxOutputBytes : 0;
+  BinaryIO::PutU32(payload, (uint32_t)(output.size() - skip));
+  payload.append(output, skip, std::string::npos);
+  BinaryIO::PutU32(payload, (uint32_t)execution.exitCode);
+  BinaryIO::PutU64(payload,
+                   (uint64_t)(execution.time ? execution.time : Now()));
+  return Write(kExecution, payload);
+}
+
+size_t ChatJournal::Write(RecordType type, const std::string &payload) {
+  std::string header;
+  BinaryIO::PutU32(header, (uint32_t)payload.size());
+  BinaryIO::PutU32(header, Checksum(type, payload));
+  header += (char)type;
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (!m_Journal.is_open() || m_Size + header.size() + payload.size() >
+                                  kOffsetMask)
+    return kNone;
+  m_Journal.write(header.data(), (std::streamsize)header.size());
+  m_Journal.write(payload.data(), (std::streamsize)payload.size());
+  m_Journal.flush();
+  const uint64_t entry = MakeEntry(m_Size, type);
+  std::string bytes;
+  BinaryIO::PutU64(bytes, entry);
+  m_Index.write(bytes.data(), (std::streamsize)bytes.size());
+  m_Index.flush();
+  if (!m_Journal || !m_Index) {
+    // Out of step with the files from here on; Open repairs them
+    m_Journal.close();
+    m_Index.close();
+    return kNone;
+  }
+  m_Size += header.size() + payload.size();
+  m_Appended.push_back(entry);
+  return m_MappedRecords + m_Appended.size() - 1;
+}
+
+size_t ChatJournal::Records() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_MappedRecords + m_Appended.size();
+}
+
+uint64_t ChatJournal::Bytes() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Size;
+}
+
+uint64_t ChatJournal::IndexEntry(size_t record) const {
+  if (record < m_MappedRecords)
+    return BinaryIO::GetU64(m_IndexMap.Data() + record * 8);
+  return m_Appended[record - m_MappedRecords];
+}
+
+bool ChatJournal::Payload(uint64_t entry, bool canRemap,
+                          std::string_view &out) {
+  const uint64_t offset = entry & kOffsetMask;
+  if (offset + kHeaderBytes > m_Map.Size() ||
+      offset + kHeaderBytes + BinaryIO::GetU32(m_Map.Data() + offset) >
+          m_Map.Size()) {
+    // Written after the mapping was made
+    if (!canRemap || !m_Map.Open(m_Path) ||
+        offset + kHeaderBytes > m_Map.Size())
+      return false;
+  }
+  const char *header = m_Map.Data() + offset;
+  uint32_t len = BinaryIO::GetU32(header);
+  if (len > m_Map.Size() - offset - kHeaderBytes)
+    return false;
+  out = std::string_view(header + kHeaderBytes, len);
+  return BinaryIO::GetU32(header + 4) == Checksum((uint8_t)header[8], out);
+}
+
+size_t ChatJournal::ReadBefore(size_t end, size_t max, ChatStore &out) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  // The page holds views into the mapping until 'out' copies them, so it
+  // is remapped here if at all, never halfway
+  if (m_Map.Size() < m_Size)
+    m_Map.Open(m_Path);
+  std::vector<ChatStore::Message> page;
+  size_t i = std::min(end, m_MappedRecords + m_Appended.size());
+  while (i > 0 && page.size() < max) {
+    const uint64_t entry = IndexEntry(--i);
+    std::string_view payload;
+    if ((entry >> 56) != kMessage || !Payload(entry, false, payload))
+      continue;
+    BinaryIO::Reader reader{payload.data(), payload.size()};
+    ChatStore::Message m;
+    reader.String(); // Role; the flags say the same
+    m.content = reader.String();
+    m.command = reader.String();
+    m.riskReason = reader.String();
+    m.cacheKey = reader.String();
+    m.cacheIntent = reader.String();
+    uint32_t flags = reader.U32();
+    m.role = flags & 1 ? ChatStore::Role::User : ChatStore::Role::AI;
+    m.hasCommand = flags & 2;
+    m.fromCache = flags & 4;
+    m.riskValid = flags & 8;
+    m.riskScore = (int32_t)reader.U32();
+    m.requestId = reader.U64();
+    m.time = (int64_t)reader.U64();
+    m.journalRecord = i;
+    if (reader.ok)
+      page.push_back(m);
+  }
+  std::reverse(page.begin(), page.end());
+  out.Prepend(page);
+  return i;
+}
+
+bool ChatJournal::LastExecution(Execution &out) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  for (size_t i = m_MappedRecords + m_Appended.size(); i > 0; --i) {
+    const uint64_t entry = IndexEntry(i - 1);
+    std::string_view payload;
+    if ((entry >> 56) != kExecution || !Payload(entry, true, payload))
+      continue;
+    BinaryIO::Reader reader{payload.data(), payload.size()};
+    Execution e;
+    e.command = std::string(reader.String());
+    e.output = std::string(reader.String());
+    e.exitCode = (int)reader.U32();
+    e.time = (int64_t)reader.U64();
+    if (reader.ok) {
+      out = std::move(e);
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "ChatStore.h"
+#include "MappedFile.h"
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The conversation, kept across Reset and restarts. Messages (with their
+// command and risk assessment) and command results are appended to a
+// journal of checksummed records; a sidecar index holds one offset per
+// record. Opening maps both files and reads only the last record's header,
+// so it costs the same at 50 records or 50k; records are decoded only when
+// asked for, and only the pages they sit on are ever touched.
+//
+// A crash can leave a torn record or an index out of step with the journal;
+// Open drops the torn tail and rebuilds the index by scanning. A journal
+// past kMaxBytes is compacted on Open down to its newest records.
+//
+// Safe to call from several threads at once.
+class ChatJournal {
+public:
+  struct Execution {
+    std::string command;
+    std::string output; // The last kMaxOutputBytes of it
+    int exitCode = 0;
+    int64_t time = 0;
+  };
+
+  static constexpr size_t kNone = (size_t)-1;
+  static constexpr uint64_t kMaxBytes = 64ull << 20;
+  static constexpr size_t kMaxOutputBytes = 1 << 20;
+
+  ChatJournal() = default;
+  ~ChatJournal() { Close(); }
+  ChatJournal(const ChatJournal &) = delete;
+  ChatJournal &operator=(const ChatJournal &) = delete;
+
+  // Journal at 'path', index at 'path' + ".idx"; both created if missing.
+  bool Open(const std::string &path);
+  void Close();
+
+  // Record number of the appended entry, kNone if it was not written.
+  size_t Append(const ChatStore::Message &message);
+  size_t Append(const Execution &execution);
+
+  size_t Records() const;
+  // Puts up to 'max' messages from the records before 'end' in front of
+  // 'out', decoding straight out of the mapping into its arena. Returns
+  // where the next older page ends: the record of the first message read,
+  // or 0 once nothing older is left.
+  size_t ReadBefore(size_t end, size_t max, ChatStore &out);
+  // Most recent command result, if any was recorded.
+  bool LastExecution(Execution &out);
+
+  uint64_t Bytes() const;
+
+private:
+  enum RecordType : uint8_t { kMessage = 1, kExecution = 2 };
+
+  bool Load(const std::string &path);
+  bool Rebuild(const std::string &path);
+  // Leaves the files closed once it starts replacing them, whether or not
+  // the renames succeed; Load after it
+  void Compact(const std::string &path);
+  size_t Write(RecordType type, const std::string &payload);
+  uint64_t IndexEntry(size_t record) const;
+  // Payload of a record, remapping the journal if it was written after
+  // the current mapping was made. Callers still holding views into the
+  // mapping pass 'canRemap' false and get false for such a record instead.
+  // False on a bad checksum too.
+  bool Payload(uint64_t entry, bool canRemap, std::string_view &out);
+
+  mutable std::mutex m_Mutex;
+  std::string m_Path;
+  MappedFile m_Map;      // Journal, as of the last (re)map
+  MappedFile m_IndexMap; // Index, as of Open
+  size_t m_MappedRecords = 0;
+  std::vector<uint64_t> m_Appended; // Index entries written since Open
+  uint64_t m_Size = 0;              // Journal bytes, including appends
+  std::ofstream m_Journal;
+  std::ofstream m_Index;
+};
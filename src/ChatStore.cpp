@@ -0,0 +1,104 @@
+#include "ChatStore.h"
+#include <algorithm>
+#include <cstring>
+
+uint32_t ChatStore::Add(const Message &message) {
+  Message &stored = Copy(message);
+  stored.id = m_NextId++;
+  return stored.id;
+}
+
+void ChatStore::Prepend(const std::vector<Message> &older) {
+  if (older.empty())
+    return;
+  std::vector<Message> all;
+  all.reserve(older.size() + m_Messages.size());
+  for (Message m : older) {
+    m.id = m_NextId++;
+    all.push_back(m);
+  }
+  all.insert(all.end(), m_Messages.begin(), m_Messages.end());
+  Rebuild(all);
+}
+
+void ChatStore::DropFront(size_t count) {
+  count = std::min(count, m_Messages.size());
+  if (count == 0)
+    return;
+  Rebuild(std::vector<Message>(m_Messages.begin() + count, m_Messages.end()));
+}
+
+void ChatStore::Clear() {
+  std::vector<Message>().swap(m_Messages);
+  m_Blocks.clear();
+  m_BlockBytes = 0;
+  m_Free = nullptr;
+  m_FreeBytes = 0;
+  m_TextBytes = 0;
+  m_Interned.clear();
+}
+
+size_t ChatStore::Bytes() const {
+  return m_BlockBytes + m_Messages.capacity() * sizeof(Message);
+}
+
+ChatStore::Message &ChatStore::Copy(const Message &message) {
+  Message stored = message;
+  stored.content = Store(message.content);
+  stored.command = Intern(message.command);
+  stored.riskReason = Intern(message.riskReason);
+  stored.cacheKey = Intern(message.cacheKey);
+  stored.cacheIntent = Intern(message.cacheIntent);
+  m_Messages.push_back(stored);
+  return m_Messages.back();
+}
+
+std::string_view ChatStore::Store(std::string_view text) {
+  if (text.empty())
+    return std::string_view("", 0);
+  const size_t need = text.size() + 1;
+  if (need > m_FreeBytes) {
+    // A long message gets a block of its own; the current one keeps
+    // filling with the short ones around it
+    const size_t size = std::max(need, kBlockBytes);
+    m_Blocks.push_back(std::make_unique<char[]>(size));
+    m_BlockBytes += size;
+    char *block = m_Blocks.back().get();
+    if (size - need >= m_FreeBytes) {
+      m_Free = block;
+      m_FreeBytes = size;
+    } else {
+      std::memcpy(block, text.data(), text.size());
+      block[text.size()] = '\0';
+      m_TextBytes += need;
+      return std::string_view(block, text.size());
+    }
+  }
+  char *out = m_Free;
+  std::memcpy(out, text.data(), text.size());
+  out[text.size()] = '\0';
+  m_Free += need;
+  m_FreeBytes -= need;
+  m_TextBytes += need;
+  return std::string_view(out, text.size());
+}
+
+std::string_view ChatStore::Intern(std::string_view text) {
+  if (text.empty())
+    return std::string_view("", 0);
+  auto it = m_Interned.find(text);
+  if (it != m_Interned.end())
+    return *it;
+  std::string_view stored = Store(text);
+  m_Interned.insert(stored);
+  return stored;
+}
+
+void ChatStore::Rebuild(const std::vector<Message> &messages) {
+  ChatStore fresh;
+  fresh.m_NextId = m_NextId;
+  fresh.m_Messages.reserve(messages.size());
+  for (const Message &m : messages)
+    fresh.Copy(m);
+  *this = std::move(fresh);
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// The chat window's messages, packed for the render loop. Text lives in a
+// chunked arena (blocks never move, so views stay valid until the message
+// is dropped) and every string is NUL-terminated there, so data() can go
+// straight to ImGui. Commands, risk reasons and cache keys repeat a lot and
+// are interned: one copy however many messages carry them. A message is a
+// fixed-size record of views, so growing the record vector copies bytes,
+// not strings, and adding a message allocates only when a block fills up.
+//
+// Not thread-safe; Application guards it with m_ResponseMutex.
+class ChatStore {
+public:
+  enum class Role : uint8_t { AI, User };
+
+  struct Message {
+    std::string_view content;
+    std::string_view command;
+    std::string_view riskReason;
+    std::string_view cacheKey;    // ResponseCache entry, for "Wrong"
+    std::string_view cacheIntent; // Semantic cache / history entry
+    uint64_t requestId = 0;       // EventLog correlation
+    int64_t time = 0;             // Unix seconds
+    size_t journalRecord = (size_t)-1; // ChatJournal::kNone until written
+    uint32_t id = 0;                   // Unique in this store, set by Add
+    int32_t riskScore = 0;
+    int16_t modelSlot = 0; // LatencyStats attribution
+    Role role = Role::AI;
+    bool hasCommand = false;
+    bool fromCache = false;
+    bool riskValid = false;
+
+    bool IsUser() const { return role == Role::User; }
+  };
+
+  ChatStore() = default;
+  ChatStore(const ChatStore &) = delete;
+  ChatStore &operator=(const ChatStore &) = delete;
+  ChatStore(ChatStore &&) = default;
+  ChatStore &operator=(ChatStore &&) = default;
+
+  // Copies the message's text in; returns its id.
+  uint32_t Add(const Message &message);
+  // Puts 'older' (oldest first) before the current messages. Their text
+  // may point anywhere, including into a mapped file.
+  void Prepend(const std::vector<Message> &older);
+  // Drops the oldest 'count' messages and releases their text.
+  void DropFront(size_t count);
+  void Clear();
+
+  size_t Size() const { return m_Messages.size(); }
+  bool Empty() const { return m_Messages.empty(); }
+  const Message &operator[](size_t i) const { return m_Messages[i]; }
+  const Message &Front() const { return m_Messages.front(); }
+
+  // Arena blocks plus the record vector; what the window costs in memory
+  size_t Bytes() const;
+  size_t TextBytes() const { return m_TextBytes; } // Used part of the arena
+
+private:
+  static constexpr size_t kBlockBytes = 16 << 10;
+
+  Message &Copy(const Message &message);
+  std::string_view Store(std::string_view text);
+  std::string_view Intern(std::string_view text);
+  // Moves 'messages' (views into this store or elsewhere) into a fresh
+  // arena, so dropped text goes away with the old blocks
+  void Rebuild(const std::vector<Message> &messages);
+
+  std::vector<Message> m_Messages;
+  std::vector<std::unique_ptr<char[]>> m_Blocks;
+  size_t m_BlockBytes = 0; // Sum of block sizes
+  char *m_Free = nullptr;  // Rest of the block being filled
+  size_t m_FreeBytes = 0;
+  size_t m_TextBytes = 0;
+  std::unordered_set<std::string_view> m_Interned; // Views into the arena
+  uint32_t m_NextId = 1;
+};
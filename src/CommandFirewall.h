@@ -1,5 +1,5 @@
 #pragma once
-#include <algorithm>
+#include "TextScan.h"
 #include <string>
 #include <vector>
 
@@ -15,9 +15,6 @@ public:
     if (input.empty())
       return res;
 
-    std::string lower = input;
-    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
-
     // 1. Technical Subjects & Objects
     static const std::vector<std::string> techSubjects = {
         "user",       "account", "pass",     "file",     "folder",     "dir",
@@ -59,7 +56,7 @@ public:
     // --- THE HYBRID HEURISTIC ---
     bool isDirectCommand = false;
     for (const auto &cmd : directWhitelist) {
-      if (lower == cmd) {
+      if (TextScan::EqualsCaseInsensitive(input, cmd)) {
         isDirectCommand = true;
         break;
       }
@@ -69,7 +66,7 @@ public:
 
     bool hasTechSubject = false;
     for (const auto &subject : techSubjects) {
-      if (lower.find(subject) != std::string::npos) {
+      if (TextScan::ContainsCaseInsensitive(input, subject)) {
         hasTechSubject = true;
         break;
       }
@@ -77,7 +74,7 @@ public:
 
     bool hasCliAction = false;
     for (const auto &action : cliActions) {
-      if (lower.find(action) != std::string::npos) {
+      if (TextScan::ContainsCaseInsensitive(input, action)) {
         hasCliAction = true;
         break;
       }
@@ -85,7 +82,7 @@ public:
 
     bool isCorrection = false;
     for (const auto &term : correctionTerms) {
-      if (lower.find(term) != std::string::npos) {
+      if (TextScan::ContainsCaseInsensitive(input, term)) {
         isCorrection = true;
         break;
       }
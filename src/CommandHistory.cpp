@@ -0,0 +1,288 @@
+#include "CommandHistory.h"
+#include "BinaryIO.h"
+#include "ResponseCache.h"
+#include "TextScan.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+
+namespace {
+
+std::string Lowercase(const std::string &s) {
+  std::string out(s);
+  for (char &c : out)
+    if (c >= 'A' && c <= 'Z')
+      c = (char)(c - 'A' + 'a');
+  return out;
+}
+
+uint32_t Trigram(const char *p) {
+  return (uint32_t)(unsigned char)p[0] | (uint32_t)(unsigned char)p[1] << 8 |
+         (uint32_t)(unsigned char)p[2] << 16;
+}
+
+// Distinct trigrams of 's', sorted.
+std::vector<uint32_t> Trigrams(std::string_view s) {
+  std::vector<uint32_t> grams;
+  for (size_t i = 0; i + 3 <= s.size(); ++i)
+    grams.push_back(Trigram(s.data() + i));
+  std::sort(grams.begin(), grams.end());
+  grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+  return grams;
+}
+
+} // namespace
+
+int64_t CommandHistory::Now() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+uint32_t CommandHistory::Frecency(uint32_t uses, int64_t lastUsed,
+                                  int64_t now) {
+  constexpr int64_t kDay = 24 * 60 * 60;
+  int64_t age = now - lastUsed;
+  uint32_t weight = age <= 4 * kDay    ? 100
+                    : age <= 14 * kDay ? 70
+                    : age <= 31 * kDay ? 50
+                    : age <= 90 * kDay ? 30
+                                       : 10;
+  return uses * weight;
+}
+
+bool CommandHistory::Open(const std::string &path) {
+  if (m_Journal.is_open())
+    m_Journal.close();
+  Clear();
+
+  size_t lines = 0;
+  {
+    std::ifstream file(path, std::ios::binary);
+    std::string line;
+    while (std::getline(file, line)) {
+      // lastUsed \t uses \t intent \t command; uses 0 records a Forget
+      size_t t1 = line.find('\t');
+      size_t t2 = t1 == std::string::npos ? t1 : line.find('\t', t1 + 1);
+      size_t t3 = t2 == std::string::npos ? t2 : line.find('\t', t2 + 1);
+      if (t3 == std::string::npos)
+        continue;
+      ++lines;
+      int64_t lastUsed = std::atoll(line.c_str());
+      uint32_t uses = (uint32_t)std::strtoul(line.c_str() + t1 + 1, nullptr, 10);
+      std::string_view fields(line);
+      std::string intent =
+          TextScan::UnescapeField(fields.substr(t2 + 1, t3 - t2 - 1));
+      std::string command = TextScan::UnescapeField(fields.substr(t3 + 1));
+      if (uses == 0)
+        Remove(intent, command);
+      else
+        Add(intent, command, uses, lastUsed);
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::path target(path);
+  if (!target.parent_path().empty())
+    std::filesystem::create_directories(target.parent_path(), ec);
+  if (lines > 2 * m_Live + 64)
+    Compact(path);
+  m_Journal.open(path, std::ios::binary | std::ios::app);
+  return m_Journal.is_open();
+}
+
+void CommandHistory::Record(const std::string &intent,
+                            const std::string &command, int64_t now) {
+  if (command.empty())
+    return;
+  Add(intent, command, 1, now);
+  Append(1, now, intent, command);
+}
+
+bool CommandHistory::Forget(const std::string &intent,
+                            const std::string &command) {
+  if (!Remove(intent, command))
+    return false;
+  Append(0, 0, intent, command);
+  return true;
+}
+
+bool CommandHistory::Resolve(const std::string &intent, Suggestion &out,
+                             int64_t now) const {
+  auto it = m_ByIntent.find(ResponseCache::NormalizeIntent(intent));
+  if (it == m_ByIntent.end() || it->second.empty())
+    return false;
+  uint32_t best = 0;
+  uint32_t bestScore = 0;
+  for (uint32_t id : it->second) {
+    uint32_t score = Frecency(m_Stats[id].uses, m_Stats[id].lastUsed, now);
+    if (score >= bestScore) {
+      best = id;
+      bestScore = score;
+    }
+  }
+  out = {m_Intents[best], m_Commands[best], m_Stats[best].uses, bestScore};
+  return true;
+}
+
+std::vector<CommandHistory::Suggestion>
+CommandHistory::Suggest(std::string_view query, size_t max,
+                        int64_t now) const {
+  std::vector<Suggestion> out;
+  // Leading space anchors the query to a word start
+  std::string needle = " " + ResponseCache::NormalizeIntent(query);
+  if (needle.size() < 3 || max == 0)
+    return out;
+
+  std::vector<const std::vector<uint32_t> *> lists;
+  for (uint32_t gram : Trigrams(needle)) {
+    auto it = m_Trigrams.find(gram);
+    if (it == m_Trigrams.end())
+      return out;
+    lists.push_back(&it->second);
+  }
+  std::sort(lists.begin(), lists.end(),
+            [](const auto *a, const auto *b) { return a->size() < b->size(); });
+  // A single trigram is the whole needle; otherwise the grams may be
+  // scattered and the text has to be checked
+  const bool verify = lists.size() > 1;
+
+  // Min-heap of the best candidates so far. Kept larger than 'max' so
+  // several intents for one command do not crowd out other commands.
+  using Ranked = std::pair<uint32_t, uint32_t>; // score, id
+  const size_t keep = max * 4;
+  std::vector<Ranked> heap;
+  heap.reserve(keep + 1);
+  std::vector<size_t> cursors(lists.size(), 0);
+
+  bool exhausted = false;
+  for (uint32_t id : *lists[0]) {
+    bool inAll = true;
+    for (size_t l = 1; l < lists.size() && inAll; ++l) {
+      const std::vector<uint32_t> &list = *lists[l];
+      size_t &cur = cursors[l];
+      cur = std::lower_bound(list.begin() + cur, list.end(), id) - list.begin();
+      // Past the end, every later id is missing from this list too
+      exhausted = cur == list.size();
+      inAll = !exhausted && list[cur] == id;
+    }
+    if (exhausted)
+      break;
+    if (!inAll || m_Stats[id].uses == 0)
+      continue;
+    uint32_t score = Frecency(m_Stats[id].uses, m_Stats[id].lastUsed, now);
+    // Ties go to the later id, i.e. the newer pair
+    if (heap.size() == keep && score < heap.front().first)
+      continue;
+    if (verify && m_Text[id].find(needle) == std::string::npos)
+      continue;
+    heap.emplace_back(score, id);
+    std::push_heap(heap.begin(), heap.end(), std::greater<Ranked>());
+    if (heap.size() > keep) {
+      std::pop_heap(heap.begin(), heap.end(), std::greater<Ranked>());
+      heap.pop_back();
+    }
+  }
+  std::sort(heap.begin(), heap.end(), std::greater<Ranked>());
+  for (const Ranked &r : heap) {
+    const std::string &command = m_Commands[r.second];
+    bool seen = std::any_of(out.begin(), out.end(), [&](const Suggestion &s) {
+      return s.command == command;
+    });
+    if (seen)
+      continue;
+    out.push_back({m_Intents[r.second], command, m_Stats[r.second].uses,
+                   r.first});
+    if (out.size() == max)
+      break;
+  }
+  return out;
+}
+
+void CommandHistory::Clear() {
+  m_Intents.clear();
+  m_Commands.clear();
+  m_Text.clear();
+  m_Stats.clear();
+  m_Live = 0;
+  m_Keys.clear();
+  m_ByIntent.clear();
+  m_Trigrams.clear();
+}
+
+uint32_t CommandHistory::Add(const std::string &intent,
+                             const std::string &command, uint32_t uses,
+                             int64_t lastUsed) {
+  std::string norm = ResponseCache::NormalizeIntent(intent);
+  auto [it, inserted] =
+      m_Keys.emplace(ResponseCache::JoinKey({norm, command}),
+                     (uint32_t)m_Stats.size());
+  uint32_t id = it->second;
+  if (!inserted) {
+    Stats &s = m_Stats[id];
+    if (s.uses == 0) { // Forgotten earlier, run again since
+      ++m_Live;
+      m_ByIntent[norm].push_back(id);
+    }
+    s.uses += uses;
+    s.lastUsed = std::max(s.lastUsed, lastUsed);
+    return id;
+  }
+
+  m_Intents.push_back(intent);
+  m_Commands.push_back(command);
+  m_Text.push_back(" " + norm + "\n " + Lowercase(command));
+  m_Stats.push_back({uses, lastUsed});
+  ++m_Live;
+  m_ByIntent[norm].push_back(id);
+  IndexText(id);
+  return id;
+}
+
+bool CommandHistory::Remove(const std::string &intent,
+                            const std::string &command) {
+  std::string norm = ResponseCache::NormalizeIntent(intent);
+  auto it = m_Keys.find(ResponseCache::JoinKey({norm, command}));
+  if (it == m_Keys.end() || m_Stats[it->second].uses == 0)
+    return false;
+  // Postings keep the id; Suggest skips entries with no uses
+  m_Stats[it->second].uses = 0;
+  --m_Live;
+  std::vector<uint32_t> &ids = m_ByIntent[norm];
+  ids.erase(std::remove(ids.begin(), ids.end(), it->second), ids.end());
+  if (ids.empty())
+    m_ByIntent.erase(norm);
+  return true;
+}
+
+void CommandHistory::IndexText(uint32_t id) {
+  // Ids only grow, so every posting list stays sorted
+  for (uint32_t gram : Trigrams(m_Text[id]))
+    m_Trigrams[gram].push_back(id);
+}
+
+bool CommandHistory::Compact(const std::string &path) {
+  std::string text;
+  for (size_t id = 0; id < m_Stats.size(); ++id) {
+    if (m_Stats[id].uses == 0)
+      continue;
+    text += std::to_string(m_Stats[id].lastUsed) + '\t' +
+            std::to_string(m_Stats[id].uses) + '\t' +
+            TextScan::EscapeField(m_Intents[id]) + '\t' +
+            TextScan::EscapeField(m_Commands[id]) + '\n';
+  }
+  return BinaryIO::WriteFileAtomic(path, text);
+}
+
+void CommandHistory::Append(uint32_t uses, int64_t lastUsed,
+                            const std::string &intent,
+                            const std::string &command) {
+  if (!m_Journal.is_open())
+    return;
+  m_Journal << lastUsed << '\t' << uses << '\t'
+            << TextScan::EscapeField(intent) << '\t'
+            << TextScan::EscapeField(command) << '\n';
+  m_Journal.flush();
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Every command the user actually ran, with the intent that produced it,
+// ranked by frecency (use count weighted by recency). Feeds the suggestions
+// under the command bar and answers intents that were run before without
+// asking the model. Survives Reset and restarts via an append-only journal.
+//
+// Matching is by word prefix over the normalized intent and the command:
+// "ip con" finds "show ip configuration" and "ipconfig /all". A trigram
+// index narrows candidates, so lookups stay well under a millisecond at
+// 100k entries.
+//
+// Not thread-safe; the UI thread owns it.
+class CommandHistory {
+public:
+  struct Suggestion {
+    std::string intent;
+    std::string command;
+    uint32_t uses = 0;
+    uint32_t score = 0; // Frecency
+  };
+
+  CommandHistory() = default;
+  CommandHistory(const CommandHistory &) = delete;
+  CommandHistory &operator=(const CommandHistory &) = delete;
+
+  static int64_t Now(); // Unix seconds
+  // Firefox-style: uses times a weight that falls off over 4/14/31/90 days.
+  static uint32_t Frecency(uint32_t uses, int64_t lastUsed, int64_t now);
+
+  // Loads the journal and appends every later change to it. The journal is
+  // compacted here once superseded lines outnumber live entries.
+  bool Open(const std::string &path);
+
+  void Record(const std::string &intent, const std::string &command,
+              int64_t now = Now());
+  // Drops one intent/command pair (the user flagged it as wrong).
+  bool Forget(const std::string &intent, const std::string &command);
+
+  // Most frecent command previously run for this exact (normalized) intent.
+  bool Resolve(const std::string &intent, Suggestion &out,
+               int64_t now = Now()) const;
+  // Best matches for a partly typed intent or command, one per command.
+  // Queries shorter than two characters match nothing.
+  std::vector<Suggestion> Suggest(std::string_view query, size_t max,
+                                  int64_t now = Now()) const;
+
+  size_t Size() const { return m_Live; }
+  void Clear();
+
+private:
+  struct Stats {
+    uint32_t uses;
+    int64_t lastUsed;
+  };
+
+  uint32_t Add(const std::string &intent, const std::string &command,
+               uint32_t uses, int64_t lastUsed);
+  bool Remove(const std::string &intent, const std::string &command);
+  void IndexText(uint32_t id);
+  bool Compact(const std::string &path);
+  void Append(uint32_t uses, int64_t lastUsed, const std::string &intent,
+              const std::string &command);
+
+  std::vector<std::string> m_Intents;
+  std::vector<std::string> m_Commands;
+  std::vector<std::string> m_Text; // " <intent>\n <command>", lowercase
+  std::vector<Stats> m_Stats;      // uses == 0 once forgotten
+  size_t m_Live = 0;
+
+  // ResponseCache::JoinKey of the normalized intent and command -> id
+  std::unordered_map<std::string, uint32_t> m_Keys;
+  // Normalized intent -> ids, for Resolve
+  std::unordered_map<std::string, std::vector<uint32_t>> m_ByIntent;
+  // Packed trigram -> ascending ids containing it
+  std::unordered_map<uint32_t, std::vector<uint32_t>> m_Trigrams;
+
+  std::ofstream m_Journal;
+};
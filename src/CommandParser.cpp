@@ -1,95 +1,128 @@
 #include "CommandParser.h"
 #include "Logger.h"
-#include <algorithm>
-#include <cctype>
-#include <sstream>
-#include <vector>
+#include "TextScan.h"
 
-ParsedCommand CommandParser::Parse(const std::string &input) {
-  ParsedCommand result;
-  if (input.empty())
-    return result;
+namespace {
 
-  LOG_DEBUG("AI RAW RESPONSE:\n" + input);
-  std::string fullResponse = input;
+// All trimming works on views: narrowing a string_view is free, whereas the
+// old substr/erase approach reallocated on every step.
+void Trim(std::string_view &s) {
+  if (s.empty())
+    return;
 
-  auto trim = [](std::string &s) {
-    if (s.empty())
-      return;
+  // 1. Initial whitespace/backtick/prompt-char trim
+  constexpr std::string_view ignored = " \n\r\t`$>";
+  size_t first = s.find_first_not_of(ignored);
+  if (first == std::string_view::npos) {
+    s = {};
+    return;
+  }
+  size_t last = s.find_last_not_of(ignored);
+  s = s.substr(first, (last - first + 1));
 
-    // 1. Initial whitespace/backtick/prompt-char trim
-    const std::string ignored = " \n\r\t`$>";
-    size_t first = s.find_first_not_of(ignored);
-    if (first == std::string::npos) {
-      s.clear();
-      return;
-    }
-    size_t last = s.find_last_not_of(ignored);
-    s = s.substr(first, (last - first + 1));
-
-    // 2. Scrub Comments
-    if (s.find('#') == 0) {
-      size_t nextLine = s.find('\n');
-      if (nextLine != std::string::npos)
-        s.erase(0, nextLine + 1);
-    }
+  // 2. Scrub Comments
+  if (s.find('#') == 0) {
+    size_t nextLine = s.find('\n');
+    if (nextLine != std::string_view::npos)
+      s.remove_prefix(nextLine + 1);
+  }
 
-    // 3. Improved Scrub Windows prompts
-    // We look for '>' anywhere in the first few segments to be safe
-    size_t gt = s.find('>');
-    if (gt != std::string::npos &&
-        gt < 60) { // Check up to 60 characters for path prefix
-      std::string prefix = s.substr(0, gt);
-      if (prefix.find(':') != std::string::npos ||
-          prefix.find('\\') != std::string::npos) {
-        s.erase(0, gt + 1);
-        size_t nextStart = s.find_first_not_of(" \t");
-        if (nextStart != std::string::npos)
-          s.erase(0, nextStart);
-        else
-          s.clear();
-      }
+  // 3. Improved Scrub Windows prompts
+  // We look for '>' anywhere in the first few segments to be safe
+  size_t gt = s.find('>');
+  if (gt != std::string_view::npos &&
+      gt < 60) { // Check up to 60 characters for path prefix
+    std::string_view prefix = s.substr(0, gt);
+    if (prefix.find(':') != std::string_view::npos ||
+        prefix.find('\\') != std::string_view::npos) {
+      s.remove_prefix(gt + 1);
+      size_t nextStart = s.find_first_not_of(" \t");
+      if (nextStart != std::string_view::npos)
+        s.remove_prefix(nextStart);
+      else
+        s = {};
     }
-  };
+  }
+}
+
+// Extracts the string value of "key" from a flat JSON block. Returns a view
+// into 'json' unless the value contains escapes, in which case the unescaped
+// text is appended to 'scratch' and the view points there instead.
+std::string_view ExtractJsonValue(std::string_view json,
+                                  std::string_view quotedKey,
+                                  std::string &scratch) {
+  size_t kp = TextScan::Find(json, quotedKey);
+  if (kp == std::string_view::npos)
+    return {};
+  size_t colon = json.find(':', kp + quotedKey.length());
+  if (colon == std::string_view::npos)
+    return {};
+  size_t valStart = json.find('\"', colon);
+  if (valStart == std::string_view::npos)
+    return {};
+
+  size_t begin = valStart + 1;
+  size_t i = begin;
+  for (; i < json.length(); ++i) {
+    if (json[i] == '\"')
+      return json.substr(begin, i - begin); // Fast path: nothing to unescape
+    if (json[i] == '\\')
+      break;
+  }
+  if (i >= json.length())
+    return {};
+
+  // Slow path: materialize. Reserve for both keys up front so the first
+  // value's view survives the second value being appended.
+  if (scratch.empty() && scratch.capacity() < json.length() * 2)
+    scratch.reserve(json.length() * 2);
+  size_t outStart = scratch.length();
+  scratch.append(json.data() + begin, i - begin);
+  bool esc = false;
+  for (; i < json.length(); ++i) {
+    if (esc) {
+      scratch += json[i];
+      esc = false;
+    } else if (json[i] == '\\')
+      esc = true;
+    else if (json[i] == '\"')
+      return std::string_view(scratch).substr(outStart);
+    else
+      scratch += json[i];
+  }
+  scratch.resize(outStart);
+  return {};
+}
+
+} // namespace
+
+ParsedCommand CommandParser::Parse(const std::string &input) {
+  if (input.empty())
+    return {};
+
+  LOG_DEBUGF("AI RAW RESPONSE:\n%.*s", (int)input.size(), input.data());
+  std::string scratch;
+  return ParseView(input, scratch).ToOwned();
+}
+
+ParsedCommandView CommandParser::ParseView(std::string_view fullResponse,
+                                           std::string &scratch) {
+  ParsedCommandView result;
+  scratch.clear();
+  if (fullResponse.empty())
+    return result;
+
+  constexpr auto npos = std::string_view::npos;
 
   // TIER 1: JSON Block Extraction
   size_t openB = fullResponse.find('{');
   size_t closeB = fullResponse.rfind('}');
-  if (openB != std::string::npos && closeB != std::string::npos &&
-      closeB > openB) {
-    std::string json = fullResponse.substr(openB, closeB - openB + 1);
-    auto extract = [&](const std::string &key) {
-      std::string k = "\"" + key + "\"";
-      size_t kp = json.find(k);
-      if (kp == std::string::npos)
-        return std::string("");
-      size_t colon = json.find(':', kp + k.length());
-      if (colon == std::string::npos)
-        return std::string("");
-      size_t valStart = json.find('\"', colon);
-      if (valStart == std::string::npos)
-        return std::string("");
-      std::string val;
-      bool esc = false;
-      bool foundClose = false;
-      for (size_t i = valStart + 1; i < json.length(); ++i) {
-        if (esc) {
-          val += json[i];
-          esc = false;
-        } else if (json[i] == '\\')
-          esc = true;
-        else if (json[i] == '\"') {
-          foundClose = true;
-          break;
-        } else
-          val += json[i];
-      }
-      return foundClose ? val : std::string("");
-    };
-    std::string cmd = extract("cmd");
-    std::string why = extract("why");
-    trim(cmd);
-    trim(why);
+  if (openB != npos && closeB != npos && closeB > openB) {
+    std::string_view json = fullResponse.substr(openB, closeB - openB + 1);
+    std::string_view cmd = ExtractJsonValue(json, "\"cmd\"", scratch);
+    std::string_view why = ExtractJsonValue(json, "\"why\"", scratch);
+    Trim(cmd);
+    Trim(why);
     if (!cmd.empty()) {
       result.command = cmd;
       result.explanation =
@@ -100,17 +133,16 @@ ParsedCommand CommandParser::Parse(const std::string &input) {
   }
 
   // TIER 2: Semantic Tags [CMD] and [WHY]
-  size_t cp = fullResponse.find("[CMD]");
-  if (cp != std::string::npos) {
-    size_t wp = fullResponse.find("[WHY]");
+  size_t cp = TextScan::Find(fullResponse, "[CMD]");
+  if (cp != npos) {
+    size_t wp = TextScan::Find(fullResponse, "[WHY]");
     size_t start = cp + 5;
-    size_t end =
-        (wp != std::string::npos && wp > cp) ? wp : fullResponse.length();
-    std::string cmd = fullResponse.substr(start, end - start);
-    std::string why =
-        (wp != std::string::npos) ? fullResponse.substr(wp + 5) : "";
-    trim(cmd);
-    trim(why);
+    size_t end = (wp != npos && wp > cp) ? wp : fullResponse.length();
+    std::string_view cmd = fullResponse.substr(start, end - start);
+    std::string_view why =
+        (wp != npos) ? fullResponse.substr(wp + 5) : std::string_view();
+    Trim(cmd);
+    Trim(why);
     if (!cmd.empty()) {
       result.command = cmd;
       result.explanation = why.empty() ? "Extracted from semantic tags." : why;
@@ -120,17 +152,17 @@ ParsedCommand CommandParser::Parse(const std::string &input) {
   }
 
   // TIER 3: Markdown Code Blocks
-  size_t ts = fullResponse.find("```");
-  if (ts != std::string::npos) {
-    size_t cs = fullResponse.find_first_of("\n", ts);
-    if (cs == std::string::npos)
+  size_t ts = TextScan::Find(fullResponse, "```");
+  if (ts != npos) {
+    size_t cs = fullResponse.find('\n', ts);
+    if (cs == npos)
       cs = ts + 3;
     else
       cs += 1;
-    size_t te = fullResponse.find("```", cs);
-    if (te != std::string::npos) {
-      std::string cmd = fullResponse.substr(cs, te - cs);
-      trim(cmd);
+    size_t te = TextScan::Find(fullResponse, "```", cs);
+    if (te != npos) {
+      std::string_view cmd = fullResponse.substr(cs, te - cs);
+      Trim(cmd);
       if (!cmd.empty()) {
         result.command = cmd;
         result.explanation = "Extracted from markdown code block.";
@@ -142,11 +174,11 @@ ParsedCommand CommandParser::Parse(const std::string &input) {
 
   // TIER 4: Inline Code
   size_t st = fullResponse.find('`');
-  if (st != std::string::npos) {
+  if (st != npos) {
     size_t et = fullResponse.find('`', st + 1);
-    if (et != std::string::npos) {
-      std::string cmd = fullResponse.substr(st + 1, et - st - 1);
-      trim(cmd);
+    if (et != npos) {
+      std::string_view cmd = fullResponse.substr(st + 1, et - st - 1);
+      Trim(cmd);
       if (!cmd.empty()) {
         result.command = cmd;
         result.explanation = "Extracted from inline backticks.";
@@ -157,13 +189,9 @@ ParsedCommand CommandParser::Parse(const std::string &input) {
   }
 
   // TIER 5: Fallback
-  std::string firstLine;
-  size_t nl = fullResponse.find_first_of("\n\r");
-  if (nl != std::string::npos)
-    firstLine = fullResponse.substr(0, nl);
-  else
-    firstLine = fullResponse;
-  trim(firstLine);
+  std::string_view firstLine =
+      fullResponse.substr(0, TextScan::FindFirstOf(fullResponse, "\n\r"));
+  Trim(firstLine);
   if (!firstLine.empty() && firstLine.length() > 2) {
     // DISQUALIFIER: Avoid malformed JSON { or [ as fallbacks
     if (firstLine.front() == '{' || firstLine.front() == '[')
@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 
 struct ParsedCommand {
     std::string command;
@@ -7,7 +8,25 @@ struct ParsedCommand {
     bool success = false;
 };
 
+// Zero-copy parse result. Views point into the caller's input buffer, into a
+// static explanation literal, or (only when a JSON value contained escapes)
+// into the caller-supplied scratch string. Valid as long as those live.
+struct ParsedCommandView {
+    std::string_view command;
+    std::string_view explanation;
+    bool success = false;
+
+    ParsedCommand ToOwned() const {
+        return {std::string(command), std::string(explanation), success};
+    }
+};
+
 class CommandParser {
 public:
     static ParsedCommand Parse(const std::string& fullResponse);
+
+    // Allocation-free in the common case. 'scratch' is only written to when a
+    // JSON value needs unescaping; reuse it across calls to keep it that way.
+    static ParsedCommandView ParseView(std::string_view fullResponse,
+                                       std::string& scratch);
 };
@@ -0,0 +1,331 @@
+#include "EventLog.h"
+#include "BinaryIO.h"
+#include "LatencyStats.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+namespace {
+
+thread_local uint64_t t_CurrentRequestId = 0;
+std::atomic<uint64_t> g_NextRequestId{1};
+
+constexpr char kMagic[8] = {'A', 'I', 'E', 'V', 'T', 'L', 'O', 'G'};
+constexpr size_t kHeaderBytes = 8 + 4 + 4 + 8 + 8;
+constexpr size_t kEventHeaderBytes = 4 + 4 + 8 + 8;
+constexpr size_t kStringHeaderBytes = 4 + 4 + 4;
+constexpr size_t kWriteThreshold = 64 * 1024;
+
+// Stage events also feed the latency histograms, so one timer covers both.
+bool StageForEvent(EventId id, Stage &stage) {
+  switch (id) {
+  case EventId::FirewallAssess:
+    stage = Stage::FirewallAssess;
+    return true;
+  case EventId::Tokenize:
+    stage = Stage::Tokenize;
+    return true;
+  case EventId::Prefill:
+    stage = Stage::Prefill;
+    return true;
+  case EventId::Parse:
+    stage = Stage::Parse;
+    return true;
+  case EventId::Assess:
+    stage = Stage::Assess;
+    return true;
+  case EventId::Execute:
+    stage = Stage::Execute;
+    return true;
+  default:
+    return false;
+  }
+}
+
+std::string RotatedPath(const std::string &path, int index) {
+  if (index == 0)
+    return path;
+  std::filesystem::path p(path);
+  return (p.parent_path() /
+          (p.stem().string() + "." + std::to_string(index) +
+           p.extension().string()))
+      .string();
+}
+
+} // namespace
+
+EventLog::EventLog(std::string path, size_t maxFileBytes, int maxFiles)
+    : m_Path(std::move(path)), m_MaxFileBytes(maxFileBytes),
+      m_MaxFiles(maxFiles < 1 ? 1 : maxFiles) {
+  m_EpochNs = NowNs();
+  m_WallEpochNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::system_clock::now().time_since_epoch())
+                      .count();
+  std::random_device rd;
+  m_SessionId = ((uint64_t)rd() << 32) ^ (uint64_t)rd() ^
+                (uint64_t)m_WallEpochNs;
+  // Small size bounds need finer write batches for rotation to track them.
+  m_WriteThreshold = std::min(kWriteThreshold, std::max<size_t>(
+                                                   m_MaxFileBytes / 4, 256));
+  m_Buffer.reserve(m_WriteThreshold * 2);
+}
+
+EventLog::~EventLog() { Flush(); }
+
+EventLog &EventLog::Get() {
+  static EventLog instance("logs/events.bin");
+  return instance;
+}
+
+int64_t EventLog::NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint64_t EventLog::NewRequestId() {
+  return g_NextRequestId.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t EventLog::CurrentRequestId() { return t_CurrentRequestId; }
+
+EventLog::RequestScope::RequestScope(uint64_t requestId)
+    : m_Previous(t_CurrentRequestId) {
+  t_CurrentRequestId = requestId;
+}
+
+EventLog::RequestScope::~RequestScope() { t_CurrentRequestId = m_Previous; }
+
+void EventLog::ScopedEvent::SetField(size_t index, int64_t value) {
+  if (index >= kMaxFields - 1)
+    return;
+  m_Fields[index] = value;
+  if (index + 1 > m_FieldCount)
+    m_FieldCount = index + 1;
+}
+
+EventLog::ScopedEvent::~ScopedEvent() {
+  int64_t elapsed = NowNs() - m_Start;
+  Stage stage;
+  if (StageForEvent(m_Id, stage))
+    LatencyStats::Get().Record(stage, elapsed);
+
+  EventLog &log = EventLog::Get();
+  if (!log.IsEnabled())
+    return;
+  int64_t fields[kMaxFields];
+  fields[0] = elapsed;
+  std::memcpy(fields + 1, m_Fields, m_FieldCount * sizeof(int64_t));
+  log.EmitAt(m_Id, m_Start, fields, m_FieldCount + 1, m_Text);
+}
+
+void EventLog::EmitAt(EventId id, int64_t startNs, const int64_t *fields,
+                      size_t fieldCount, std::string_view text) {
+  if (!IsEnabled())
+    return;
+  if (fieldCount > kMaxFields)
+    fieldCount = kMaxFields;
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  // The string record, if new, goes before the event that uses it
+  const uint32_t stringId = text.empty() ? 0 : InternLocked(text);
+  const char head[4] = {(char)kKindEvent, (char)id, (char)fieldCount, 0};
+  m_Buffer.append(head, sizeof(head));
+  BinaryIO::PutU32(m_Buffer, stringId);
+  BinaryIO::PutU64(m_Buffer,
+                   (uint64_t)(startNs > m_EpochNs ? startNs - m_EpochNs : 0));
+  BinaryIO::PutU64(m_Buffer, t_CurrentRequestId);
+  for (size_t i = 0; i < fieldCount; ++i)
+    BinaryIO::PutU64(m_Buffer, (uint64_t)fields[i]);
+
+  // Requests are the natural unit of analysis; make each one durable.
+  if (id == EventId::RequestEnd || m_Buffer.size() >= m_WriteThreshold)
+    WriteBufferLocked();
+}
+
+void EventLog::Flush() {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  WriteBufferLocked();
+}
+
+uint32_t EventLog::InternLocked(std::string_view text) {
+  auto it = m_Strings.find(text);
+  if (it != m_Strings.end())
+    return it->second;
+
+  uint32_t id = (uint32_t)m_Strings.size() + 1;
+  m_Strings.emplace(m_StringText.emplace_back(text), id);
+  const char head[4] = {(char)kKindString, 0, 0, 0};
+  m_Buffer.append(head, sizeof(head));
+  BinaryIO::PutU32(m_Buffer, id);
+  BinaryIO::PutString(m_Buffer, text);
+  return id;
+}
+
+void EventLog::ClearStringsLocked() {
+  m_Strings.clear();
+  m_StringText.clear();
+}
+
+void EventLog::OpenFile() {
+  std::filesystem::path dir = std::filesystem::path(m_Path).parent_path();
+  if (!dir.empty())
+    std::filesystem::create_directories(dir);
+
+  std::error_code ec;
+  auto existing = std::filesystem::file_size(m_Path, ec);
+  // Each session starts its own file so the header's epoch applies to every
+  // record in it; a non-empty file from an earlier session is rotated out.
+  if (!ec && existing > 0)
+    RotateFiles();
+
+  m_File.open(m_Path, std::ios::binary | std::ios::trunc);
+  std::string header(kMagic, sizeof(kMagic));
+  BinaryIO::PutU32(header, kVersion);
+  BinaryIO::PutU32(header, 0); // Reserved
+  BinaryIO::PutU64(header, m_SessionId);
+  BinaryIO::PutU64(header, (uint64_t)m_WallEpochNs);
+  m_File.write(header.data(), (std::streamsize)header.size());
+  m_FileBytes = kHeaderBytes;
+  ClearStringsLocked();
+}
+
+void EventLog::RotateFiles() {
+  std::error_code ec;
+  std::filesystem::remove(RotatedPath(m_Path, m_MaxFiles - 1), ec);
+  for (int i = m_MaxFiles - 2; i >= 0; --i)
+    std::filesystem::rename(RotatedPath(m_Path, i), RotatedPath(m_Path, i + 1),
+                            ec);
+}
+
+void EventLog::WriteBufferLocked() {
+  if (m_Buffer.empty())
+    return;
+  if (!m_File.is_open()) {
+    // The buffered records reference strings interned for this file; keep
+    // them and let OpenFile reset the table only for future files.
+    auto strings = std::move(m_Strings);
+    auto text = std::move(m_StringText); // Moves no string
+    OpenFile();
+    m_Strings = std::move(strings);
+    m_StringText = std::move(text);
+  }
+
+  m_File.write(m_Buffer.data(), (std::streamsize)m_Buffer.size());
+  m_File.flush();
+  m_FileBytes += m_Buffer.size();
+  m_Buffer.clear();
+
+  if (m_FileBytes >= m_MaxFileBytes) {
+    m_File.close();
+    ClearStringsLocked(); // Next file re-defines the strings it uses
+  }
+}
+
+const char *EventLog::EventName(EventId id) {
+  switch (id) {
+  case EventId::RequestBegin:
+    return "RequestBegin";
+  case EventId::FirewallAssess:
+    return "FirewallAssess";
+  case EventId::Tokenize:
+    return "Tokenize";
+  case EventId::Prefill:
+    return "Prefill";
+  case EventId::Decode:
+    return "Decode";
+  case EventId::Parse:
+    return "Parse";
+  case EventId::Assess:
+    return "Assess";
+  case EventId::Execute:
+    return "Execute";
+  case EventId::RequestEnd:
+    return "RequestEnd";
+  case EventId::SpeculativePrefill:
+    return "SpeculativePrefill";
+  }
+  return "Unknown";
+}
+
+std::vector<const char *> EventLog::FieldNames(EventId id) {
+  switch (id) {
+  case EventId::RequestBegin:
+    return {"inputBytes"};
+  case EventId::FirewallAssess:
+    return {"durationNs", "blocked"};
+  case EventId::Tokenize:
+  case EventId::SpeculativePrefill:
+    return {"durationNs", "tokenCount"};
+  case EventId::Prefill:
+    return {"durationNs", "tokenCount", "reusedTokens"};
+  case EventId::Decode:
+    return {"durationNs", "tokensGenerated", "ttftNs"};
+  case EventId::Parse:
+    return {"durationNs", "success"};
+  case EventId::Assess:
+    return {"durationNs", "riskScore", "isValid"};
+  case EventId::Execute:
+    return {"durationNs", "exitCode", "outputBytes"};
+  case EventId::RequestEnd:
+    return {"totalNs"};
+  }
+  return {};
+}
+
+bool EventLog::ReadFile(const std::string &path,
+                        const std::function<void(const Record &)> &onRecord) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+
+  char header[kHeaderBytes];
+  if (!in.read(header, sizeof(header)) ||
+      std::memcmp(header, kMagic, sizeof(kMagic)) != 0 ||
+      BinaryIO::GetU32(header + 8) != kVersion)
+    return false;
+  const int64_t wallEpochNs = (int64_t)BinaryIO::GetU64(header + 24);
+
+  std::unordered_map<uint32_t, std::string> strings;
+  char fields[kMaxFields * 8];
+  Record rec;
+  rec.sessionId = BinaryIO::GetU64(header + 16);
+  for (;;) {
+    int kind = in.peek();
+    if (kind == std::char_traits<char>::eof())
+      return true;
+
+    if (kind == kKindString) {
+      char h[kStringHeaderBytes];
+      if (!in.read(h, sizeof(h)))
+        return false;
+      std::string text(BinaryIO::GetU32(h + 8), '\0');
+      if (!in.read(&text[0], (std::streamsize)text.size()))
+        return false;
+      strings[BinaryIO::GetU32(h + 4)] = std::move(text);
+    } else if (kind == kKindEvent) {
+      char h[kEventHeaderBytes];
+      if (!in.read(h, sizeof(h)))
+        return false;
+      const size_t fieldCount = (uint8_t)h[2];
+      if (fieldCount > kMaxFields ||
+          !in.read(fields, (std::streamsize)(fieldCount * 8)))
+        return false;
+      rec.fields.resize(fieldCount);
+      for (size_t i = 0; i < fieldCount; ++i)
+        rec.fields[i] = (int64_t)BinaryIO::GetU64(fields + i * 8);
+      const uint32_t stringId = BinaryIO::GetU32(h + 4);
+      const uint64_t tsNs = BinaryIO::GetU64(h + 8);
+      rec.id = (EventId)(uint8_t)h[1];
+      rec.requestId = BinaryIO::GetU64(h + 16);
+      rec.monotonicNs = (int64_t)tsNs;
+      rec.wallTimeNs = wallEpochNs + (int64_t)tsNs;
+      auto it = strings.find(stringId);
+      rec.text = (stringId && it != strings.end()) ? it->second : "";
+      onRecord(rec);
+    } else {
+      return false;
+    }
+  }
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Pipeline stages recorded per request. Field layout per event is fixed so
+// the decoder can label columns; every stage event starts with durationNs.
+enum class EventId : uint8_t {
+  RequestBegin = 1, // {inputBytes}                          str: model name
+  FirewallAssess,   // {durationNs, blocked}
+  Tokenize,         // {durationNs, tokenCount}
+  Prefill,          // {durationNs, tokenCount, reusedTokens}
+  Decode,           // {durationNs, tokensGenerated, ttftNs}
+  Parse,            // {durationNs, success}
+  Assess,           // {durationNs, riskScore, isValid}
+  Execute,          // {durationNs, exitCode, outputBytes}   str: command
+  RequestEnd,       // {totalNs}
+  SpeculativePrefill, // {durationNs, tokenCount} while the user types
+};
+
+// Compact binary event log with size-based rotation (logs/events.bin,
+// events.1.bin, ...). Far cheaper than formatted text lines; decode offline
+// with the EventDecoder tool.
+//
+// File layout (little endian, written with BinaryIO):
+//   Header  : "AIEVTLOG" u32 version, u32 reserved, u64 sessionId,
+//             i64 wallClockEpochNs (system_clock at steady epoch)
+//   Records : u8 kind, then
+//     kind 1 (event):  u8 eventId, u8 fieldCount, u8 pad, u32 stringId,
+//                      u64 tsNs (steady, since epoch), u64 requestId,
+//                      i64 fields[fieldCount]
+//     kind 2 (string): u8 pad[3], u32 stringId, u32 length, bytes
+class EventLog {
+public:
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kMaxFields = 8;
+  static constexpr uint8_t kKindEvent = 1;
+  static constexpr uint8_t kKindString = 2;
+
+  struct Record {
+    EventId id;
+    uint64_t sessionId;
+    uint64_t requestId;
+    int64_t wallTimeNs; // Unix epoch
+    int64_t monotonicNs;
+    std::vector<int64_t> fields;
+    std::string text;
+  };
+
+  EventLog(std::string path, size_t maxFileBytes = 8 * 1024 * 1024,
+           int maxFiles = 4);
+  ~EventLog();
+
+  static EventLog &Get();
+
+  void SetEnabled(bool enabled) { m_Enabled = enabled; }
+  bool IsEnabled() const { return m_Enabled.load(std::memory_order_relaxed); }
+
+  // Records an event for the calling thread's current request, stamped
+  // with the current time. EmitAt takes the stamp (a NowNs() value).
+  void Emit(EventId id, std::initializer_list<int64_t> fields,
+            std::string_view text = {}) {
+    EmitAt(id, NowNs(), fields.begin(), fields.size(), text);
+  }
+  void EmitAt(EventId id, int64_t startNs, const int64_t *fields,
+              size_t fieldCount, std::string_view text = {});
+  void Flush();
+
+  uint64_t GetSessionId() const { return m_SessionId; }
+  static int64_t NowNs();
+
+  // Request correlation: stages on any thread tag their events with the id
+  // installed by the enclosing RequestScope.
+  static uint64_t NewRequestId();
+  static uint64_t CurrentRequestId();
+
+  class RequestScope {
+  public:
+    explicit RequestScope(uint64_t requestId);
+    ~RequestScope();
+
+  private:
+    uint64_t m_Previous;
+  };
+
+  // Emits {elapsedNs, extra...} for 'id' on destruction, and records the
+  // elapsed time into the matching LatencyStats stage.
+  class ScopedEvent {
+  public:
+    explicit ScopedEvent(EventId id) : m_Id(id), m_Start(NowNs()) {}
+    ~ScopedEvent();
+    void SetField(size_t index, int64_t value);
+    void SetText(std::string_view text) { m_Text = text; }
+    int64_t ElapsedNs() const { return NowNs() - m_Start; }
+
+  private:
+    EventId m_Id;
+    int64_t m_Start;
+    int64_t m_Fields[kMaxFields - 1] = {};
+    size_t m_FieldCount = 0;
+    std::string_view m_Text;
+  };
+
+  static const char *EventName(EventId id);
+  static std::vector<const char *> FieldNames(EventId id);
+
+  // Streams every record of one file; returns false on a bad header or a
+  // truncated file (records before the damage are still delivered).
+  static bool ReadFile(const std::string &path,
+                       const std::function<void(const Record &)> &onRecord);
+
+private:
+  void OpenFile();
+  void RotateFiles();
+  void WriteBufferLocked();
+  uint32_t InternLocked(std::string_view text);
+  void ClearStringsLocked();
+
+  std::string m_Path;
+  size_t m_MaxFileBytes;
+  int m_MaxFiles;
+  size_t m_WriteThreshold;
+  uint64_t m_SessionId;
+  int64_t m_EpochNs;     // NowNs() at construction
+  int64_t m_WallEpochNs; // system_clock at the same instant
+  std::atomic<bool> m_Enabled{true};
+
+  std::mutex m_Mutex;
+  std::ofstream m_File;
+  size_t m_FileBytes = 0;
+  std::string m_Buffer; // Encoded records not yet written
+  // Per file. Keys view m_StringText, whose strings never move, so a
+  // lookup of a string already written does not allocate.
+  std::unordered_map<std::string_view, uint32_t> m_Strings;
+  std::deque<std::string> m_StringText;
+};
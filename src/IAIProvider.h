@@ -1,6 +1,9 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <functional>
+#include <vector>
 
 /**
  * @brief Interface for AI Models (Local, Cloud, Mock)
@@ -28,4 +31,63 @@ public:
      * @brief Returns a friendly name for the model (e.g. "Phi-3.5", "Gemini Pro")
      */
     virtual std::string GetModelName() const = 0;
+
+    /**
+     * @brief Identifies the prompt format (chat template) in use, so cached
+     * answers are never shared between differently prompted models
+     */
+    virtual std::string GetPromptFormat() const { return ""; }
+
+    /**
+     * @brief Embeds text as a unit-length vector for the semantic cache
+     * @return false if the provider cannot embed (the cache is then skipped)
+     */
+    virtual bool Embed(const std::string& text, std::vector<float>& out) {
+        (void)text;
+        (void)out;
+        return false;
+    }
+
+    /**
+     * @brief Hint with the intent as typed so far, so the provider can start
+     * prefilling it in the background. GenerateCommand answers the same
+     * either way; it only has less left to do.
+     */
+    virtual void Prefill(const std::string& partialInput) { (void)partialInput; }
+
+    /**
+     * @brief Tokens the next turn may use without overflowing the context,
+     * after leaving room for the answer; SIZE_MAX if there is no limit
+     */
+    virtual size_t TurnTokenBudget() { return SIZE_MAX; }
+
+    /**
+     * @brief Tokens 'text' takes in this provider's vocabulary; about four
+     * bytes per token for providers without a tokenizer
+     */
+    virtual size_t CountTokens(std::string_view text) const {
+        return text.size() / 4 + 1;
+    }
+
+    /**
+     * @brief Fraction (0-1) of the running request's prompt evaluated so
+     * far. May be called from any thread.
+     */
+    virtual float PrefillProgress() const { return 1.0f; }
+
+    /**
+     * @brief Asks the running GenerateCommand to stop at its next chunk or
+     * token; it then returns kCancelled with the conversation unchanged.
+     * May be called from any thread.
+     */
+    virtual void Cancel() {}
+
+    /**
+     * @brief Forgets earlier Cancel() calls. The UI calls it as it starts a
+     * request, so a Cancel pressed before GenerateCommand begins (during
+     * embedding, or while waiting for the context) still stops it.
+     */
+    virtual void ResetCancel() {}
+
+    static constexpr const char* kCancelled = "Error: Cancelled.";
 };
@@ -0,0 +1,333 @@
+#include "InferenceProfile.h"
+#include "Logger.h"
+#include <algorithm>
+#include <bitset>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace {
+
+// Moving off an f16 KV cache must gain at least this much
+constexpr double kQuantizedKvMinGain = 0.05;
+
+std::string Trim(const std::string &s) {
+  size_t b = s.find_first_not_of(" \t\r");
+  size_t e = s.find_last_not_of(" \t\r");
+  return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+}
+
+std::vector<int32_t> Distinct(std::vector<int32_t> values) {
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  return values;
+}
+
+#ifndef _WIN32
+// "0-3,8,10-11" -> {0,1,2,3,8,10,11}
+std::set<uint32_t> ParseCpuList(const std::string &list) {
+  std::set<uint32_t> cpus;
+  std::istringstream in(list);
+  std::string range;
+  while (std::getline(in, range, ',')) {
+    size_t dash = range.find('-');
+    uint32_t lo = (uint32_t)std::strtoul(range.c_str(), nullptr, 10);
+    uint32_t hi = dash == std::string::npos
+                      ? lo
+                      : (uint32_t)std::strtoul(range.c_str() + dash + 1,
+                                               nullptr, 10);
+    for (uint32_t c = lo; c <= hi; ++c)
+      cpus.insert(c);
+  }
+  return cpus;
+}
+
+bool ReadFirstLine(const std::string &path, std::string &out) {
+  std::ifstream file(path);
+  return (bool)std::getline(file, out);
+}
+#endif
+
+} // namespace
+
+CpuTopology CpuTopology::Detect() {
+  CpuTopology cpu;
+  cpu.logical = std::max(1u, std::thread::hardware_concurrency());
+  cpu.physical = cpu.performance = cpu.logical;
+#ifdef _WIN32
+  DWORD len = 0;
+  GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &len);
+  std::vector<char> buf(len);
+  if (len == 0 ||
+      !GetLogicalProcessorInformationEx(
+          RelationProcessorCore,
+          (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)buf.data(), &len))
+    return cpu;
+  // One record per core; P-cores have the highest efficiency class
+  std::vector<BYTE> classes;
+  uint32_t logical = 0;
+  for (DWORD off = 0; off < len;) {
+    auto *info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)(buf.data() + off);
+    classes.push_back(info->Processor.EfficiencyClass);
+    for (WORD g = 0; g < info->Processor.GroupCount; ++g)
+      logical += (uint32_t)std::bitset<64>(info->Processor.GroupMask[g].Mask)
+                     .count();
+    off += info->Size;
+  }
+  if (classes.empty())
+    return cpu;
+  BYTE fastest = *std::max_element(classes.begin(), classes.end());
+  cpu.logical = std::max(1u, logical);
+  cpu.physical = (uint32_t)classes.size();
+  cpu.performance =
+      (uint32_t)std::count(classes.begin(), classes.end(), fastest);
+#else
+  // Intel hybrid parts list their P-core threads here
+  std::string line;
+  std::set<uint32_t> pThreads;
+  if (ReadFirstLine("/sys/devices/cpu_core/cpus", line))
+    pThreads = ParseCpuList(line);
+
+  struct Core {
+    long package, id, capacity;
+    bool pCore;
+  };
+  std::vector<Core> cores;
+  std::set<std::pair<long, long>> seen;
+  std::string online;
+  if (!ReadFirstLine("/sys/devices/system/cpu/online", online))
+    return cpu;
+  std::set<uint32_t> cpus = ParseCpuList(online);
+  for (uint32_t c : cpus) {
+    const std::string dir =
+        "/sys/devices/system/cpu/cpu" + std::to_string(c) + "/";
+    std::string package, id, capacity;
+    if (!ReadFirstLine(dir + "topology/physical_package_id", package) ||
+        !ReadFirstLine(dir + "topology/core_id", id))
+      return cpu;
+    // ARM big.LITTLE ranks cores by capacity
+    ReadFirstLine(dir + "cpu_capacity", capacity);
+    Core core{std::atol(package.c_str()), std::atol(id.c_str()),
+              std::atol(capacity.c_str()), pThreads.count(c) > 0};
+    if (seen.insert({core.package, core.id}).second)
+      cores.push_back(core);
+  }
+  if (cores.empty())
+    return cpu;
+  long maxCapacity = 0;
+  for (const Core &core : cores)
+    maxCapacity = std::max(maxCapacity, core.capacity);
+  uint32_t performance = 0;
+  for (const Core &core : cores)
+    performance += pThreads.empty() ? core.capacity == maxCapacity : core.pCore;
+  cpu.logical = (uint32_t)cpus.size();
+  cpu.physical = (uint32_t)cores.size();
+  cpu.performance = std::max(1u, performance);
+#endif
+  return cpu;
+}
+
+InferenceProfile InferenceProfile::Auto(const CpuTopology &cpu,
+                                        bool gpuOffload) {
+  InferenceProfile p;
+  p.gpuLayers = gpuOffload ? 99 : 0;
+  p.threads = (int32_t)std::max(1u, cpu.performance);
+  p.batchThreads = (int32_t)std::max(1u, cpu.physical);
+  p.ubatchSize = 512;
+  p.kvType = KvCacheType::F16;
+  p.flashAttn = FlashAttention::Auto;
+  return p;
+}
+
+double InferenceProfile::RequestSeconds(const Throughput &t) {
+  if (t.prefillTokensPerSecond <= 0 || t.decodeTokensPerSecond <= 0)
+    return 1e9; // Failed to run
+  return kCalibrationPromptTokens / t.prefillTokensPerSecond +
+         kCalibrationGenTokens / t.decodeTokensPerSecond;
+}
+
+InferenceProfile InferenceProfile::Calibrate(const InferenceProfile &start,
+                                             const CpuTopology &cpu,
+                                             const MeasureFn &measure) {
+  InferenceProfile best = start;
+  best.Normalize();
+  Throughput bestRun = measure(best);
+  LOG_INFOF("Calibration start: %s (%.1f prefill, %.1f decode tok/s)",
+            best.Describe().c_str(), bestRun.prefillTokensPerSecond,
+            bestRun.decodeTokensPerSecond);
+
+  // Tries each value of one setting and keeps it if 'better' says so
+  auto tune = [&](auto field, const auto &values, auto better) {
+    for (const auto &value : values) {
+      InferenceProfile candidate = best;
+      candidate.*field = value;
+      candidate.Normalize();
+      if (candidate.*field == best.*field &&
+          candidate.flashAttn == best.flashAttn)
+        continue;
+      Throughput run = measure(candidate);
+      LOG_INFOF("Calibration: %s (%.1f prefill, %.1f decode tok/s)",
+                candidate.Describe().c_str(), run.prefillTokensPerSecond,
+                run.decodeTokensPerSecond);
+      if (better(run, bestRun, candidate)) {
+        best = candidate;
+        bestRun = run;
+      }
+    }
+  };
+
+  const int32_t perf = (int32_t)std::max(1u, cpu.performance);
+  const int32_t phys = (int32_t)std::max(1u, cpu.physical);
+  const int32_t logical = (int32_t)std::max(1u, cpu.logical);
+  tune(&InferenceProfile::threads,
+       Distinct({std::max(1, perf / 2), perf, phys, logical}),
+       [](const Throughput &a, const Throughput &b, const InferenceProfile &) {
+         return a.decodeTokensPerSecond > b.decodeTokensPerSecond;
+       });
+  tune(&InferenceProfile::batchThreads,
+       Distinct({perf, phys, logical}),
+       [](const Throughput &a, const Throughput &b, const InferenceProfile &) {
+         return a.prefillTokensPerSecond > b.prefillTokensPerSecond;
+       });
+  std::vector<uint32_t> ubatches;
+  for (uint32_t u : {128u, 256u, 512u})
+    if (u <= best.contextSize)
+      ubatches.push_back(u);
+  tune(&InferenceProfile::ubatchSize, ubatches,
+       [](const Throughput &a, const Throughput &b, const InferenceProfile &) {
+         return a.prefillTokensPerSecond > b.prefillTokensPerSecond;
+       });
+  tune(&InferenceProfile::flashAttn,
+       std::vector<FlashAttention>{FlashAttention::Off, FlashAttention::On},
+       [](const Throughput &a, const Throughput &b, const InferenceProfile &) {
+         return RequestSeconds(a) < RequestSeconds(b);
+       });
+  tune(&InferenceProfile::kvType,
+       std::vector<KvCacheType>{KvCacheType::Q8_0, KvCacheType::Q4_0},
+       [](const Throughput &a, const Throughput &b,
+          const InferenceProfile &candidate) {
+         double gain = candidate.kvType == KvCacheType::F16
+                           ? 0
+                           : kQuantizedKvMinGain;
+         return RequestSeconds(a) < RequestSeconds(b) * (1 - gain);
+       });
+  LOG_INFOF("Calibration result: %s", best.Describe().c_str());
+  return best;
+}
+
+void InferenceProfile::Normalize() {
+  if (kvType != KvCacheType::F16)
+    flashAttn = FlashAttention::On;
+}
+
+bool InferenceProfile::Load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file)
+    return false;
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t eq = line.find('=');
+    if (line.empty() || line[0] == '#' || eq == std::string::npos)
+      continue;
+    const std::string key = Trim(line.substr(0, eq));
+    const std::string value = Trim(line.substr(eq + 1));
+    const long n = std::atol(value.c_str());
+    if (key == "gpu_layers")
+      gpuLayers = (int32_t)n;
+    else if (key == "context")
+      contextSize = (uint32_t)std::max(256L, n);
+    else if (key == "threads")
+      threads = (int32_t)std::max(0L, n);
+    else if (key == "batch_threads")
+      batchThreads = (int32_t)std::max(0L, n);
+    else if (key == "batch")
+      batchSize = (uint32_t)std::max(0L, n);
+    else if (key == "ubatch")
+      ubatchSize = (uint32_t)std::max(1L, n);
+    else if (key == "kv_type" && !ParseKvType(value, kvType))
+      LOG_WARNF("Unknown kv_type '%s' in %s", value.c_str(), path.c_str());
+    else if (key == "flash_attn" && !ParseFlashAttention(value, flashAttn))
+      LOG_WARNF("Unknown flash_attn '%s' in %s", value.c_str(), path.c_str());
+  }
+  Normalize();
+  return true;
+}
+
+bool InferenceProfile::Save(const std::string &path) const {
+  std::error_code ec;
+  std::filesystem::path target(path);
+  if (!target.parent_path().empty())
+    std::filesystem::create_directories(target.parent_path(), ec);
+  std::ofstream file(path, std::ios::trunc);
+  if (!file)
+    return false;
+  file << "# Inference profile. Edit by hand or type /calibrate to measure.\n"
+       << "# threads decode the answer; batch_threads process the prompt.\n"
+       << "gpu_layers = " << gpuLayers << "\n"
+       << "context = " << contextSize << "\n"
+       << "threads = " << threads << "\n"
+       << "batch_threads = " << batchThreads << "\n"
+       << "batch = " << batchSize << "\n"
+       << "ubatch = " << ubatchSize << "\n"
+       << "kv_type = " << KvTypeName(kvType) << "\n"
+       << "flash_attn = " << FlashAttentionName(flashAttn) << "\n";
+  return (bool)file;
+}
+
+std::string InferenceProfile::Describe() const {
+  std::ostringstream out;
+  out << "gpu_layers=" << gpuLayers << " threads=" << threads << "/"
+      << batchThreads << " ubatch=" << ubatchSize
+      << " kv=" << KvTypeName(kvType)
+      << " flash_attn=" << FlashAttentionName(flashAttn);
+  return out.str();
+}
+
+const char *InferenceProfile::KvTypeName(KvCacheType type) {
+  switch (type) {
+  case KvCacheType::Q8_0:
+    return "q8_0";
+  case KvCacheType::Q4_0:
+    return "q4_0";
+  default:
+    return "f16";
+  }
+}
+
+bool InferenceProfile::ParseKvType(const std::string &name, KvCacheType &out) {
+  for (KvCacheType t : {KvCacheType::F16, KvCacheType::Q8_0, KvCacheType::Q4_0})
+    if (name == KvTypeName(t)) {
+      out = t;
+      return true;
+    }
+  return false;
+}
+
+const char *InferenceProfile::FlashAttentionName(FlashAttention mode) {
+  switch (mode) {
+  case FlashAttention::Off:
+    return "off";
+  case FlashAttention::On:
+    return "on";
+  default:
+    return "auto";
+  }
+}
+
+bool InferenceProfile::ParseFlashAttention(const std::string &name,
+                                           FlashAttention &out) {
+  for (FlashAttention m :
+       {FlashAttention::Auto, FlashAttention::Off, FlashAttention::On})
+    if (name == FlashAttentionName(m)) {
+      out = m;
+      return true;
+    }
+  return false;
+}
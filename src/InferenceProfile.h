@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Cores the inference threads can use. Hybrid CPUs (Intel P/E cores, ARM
+// big.LITTLE) report their fast cores as 'performance'; elsewhere it
+// equals 'physical'.
+struct CpuTopology {
+  uint32_t logical = 1;
+  uint32_t physical = 1;
+  uint32_t performance = 1;
+
+  static CpuTopology Detect();
+};
+
+enum class KvCacheType { F16, Q8_0, Q4_0 };
+enum class FlashAttention { Auto, Off, On };
+
+// How this machine runs the model: offload, threads, batch sizes and the
+// KV cache format. Derived from the CPU topology on first run, refined by
+// Calibrate() and kept in config/inference.ini.
+struct InferenceProfile {
+  int32_t gpuLayers = 0; // Layers to offload; 0 runs fully on the CPU
+  uint32_t contextSize = 2048;
+  int32_t threads = 0;      // Decode; 0 keeps the llama.cpp default
+  int32_t batchThreads = 0; // Prompt processing; 0 uses 'threads'
+  uint32_t batchSize = 0;   // Most tokens per decode call; 0 is the context
+  uint32_t ubatchSize = 512; // Tokens per compute pass
+  KvCacheType kvType = KvCacheType::F16;
+  FlashAttention flashAttn = FlashAttention::Auto;
+
+  struct Throughput {
+    double prefillTokensPerSecond = 0;
+    double decodeTokensPerSecond = 0;
+  };
+  // Runs one candidate profile on the real model
+  using MeasureFn = std::function<Throughput(const InferenceProfile &)>;
+
+  // Calibration workload: a typical intent prompt and short answer
+  static constexpr int kCalibrationPromptTokens = 256;
+  static constexpr int kCalibrationGenTokens = 32;
+
+  // Decode is bound by memory bandwidth and every thread waits for the
+  // slowest, so it runs on the performance cores; prompt processing is
+  // compute bound and gets every physical core.
+  static InferenceProfile Auto(const CpuTopology &cpu, bool gpuOffload);
+
+  // Tunes one setting at a time, keeping the best result so far: decode
+  // threads, prompt threads, ubatch, then KV type and flash attention.
+  // A quantized KV cache costs accuracy, so it must be clearly faster.
+  static InferenceProfile Calibrate(const InferenceProfile &start,
+                                    const CpuTopology &cpu,
+                                    const MeasureFn &measure);
+  // Seconds for the calibration workload at these rates; lower is better.
+  static double RequestSeconds(const Throughput &t);
+
+  // key = value lines; unknown keys are ignored so old files still load.
+  bool Load(const std::string &path);
+  bool Save(const std::string &path) const;
+  std::string Describe() const; // One line for logs and chat
+
+  // Quantized V caches need flash attention; turns it on if required.
+  void Normalize();
+
+  static const char *KvTypeName(KvCacheType type);
+  static bool ParseKvType(const std::string &name, KvCacheType &out);
+  static const char *FlashAttentionName(FlashAttention mode);
+  static bool ParseFlashAttention(const std::string &name,
+                                  FlashAttention &out);
+};
@@ -0,0 +1,579 @@
+#include "JobScheduler.h"
+#include "EventLog.h"
+#include "LatencyStats.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "ShellManager.h"
+#include "TraceRecorder.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <windows.h>
+#include <psapi.h>
+
+namespace {
+
+constexpr DWORD kReadBytes = 16 << 10;
+// Exit and stop checks while jobs run; also the port's idle timeout
+constexpr DWORD kPollMs = 20;
+constexpr int64_t kPollNs = kPollMs * 1000000ll;
+constexpr int64_t kSampleNs = 250000000; // CPU and memory refresh
+// After the process exits, how long its pipe may stay open before the
+// read is abandoned (something it started kept the write end)
+constexpr int64_t kDrainNs = 100000000;
+
+uint64_t Ticks(const FILETIME &t) {
+  return ((uint64_t)t.dwHighDateTime << 32) | t.dwLowDateTime;
+}
+
+} // namespace
+
+void JobOutput::Trim(std::string &text, size_t maxBytes) {
+  if (text.size() <= maxBytes + maxBytes / 4)
+    return;
+  size_t cut = text.size() - maxBytes;
+  while (cut < text.size() && ((unsigned char)text[cut] & 0xC0) == 0x80)
+    cut++;
+  text.erase(0, cut);
+}
+
+void JobOutput::Append(const char *data, size_t size) {
+  m_Text.append(data, size);
+  m_Total += size;
+  Trim(m_Text, m_MaxBytes);
+}
+
+bool JobOutput::ReadSince(uint64_t &seen, std::string &out) const {
+  if (seen == m_Total)
+    return false;
+  const uint64_t first = Dropped(); // Stream position of m_Text[0]
+  if (seen < first || seen > m_Total)
+    out = m_Text;
+  else
+    out.append(m_Text, (size_t)(seen - first), std::string::npos);
+  Trim(out, m_MaxBytes);
+  seen = m_Total;
+  return true;
+}
+
+double JobInfo::Seconds(int64_t nowNs) const {
+  if (startNs == 0)
+    return 0;
+  return ((endNs ? endNs : nowNs) - startNs) / 1e9;
+}
+
+const char *JobInfo::StatusName(JobStatus status) {
+  switch (status) {
+  case JobStatus::Queued:
+    return "queued";
+  case JobStatus::Running:
+    return "running";
+  case JobStatus::Exited:
+    return "exited";
+  case JobStatus::Failed:
+    return "failed";
+  case JobStatus::Stopped:
+    return "stopped";
+  }
+  return "?";
+}
+
+struct JobScheduler::Job {
+  JobInfo info;
+  JobOutput output{kMaxOutputBytes};
+  bool stopRequested = false;
+
+  // I/O thread only
+  HANDLE process = nullptr;
+  HANDLE jobObject = nullptr; // Null if the process could not be put in one
+  HANDLE pipe = nullptr;      // Read end; null once it has closed
+  OVERLAPPED overlapped = {};
+  bool reading = false; // A read is pending on 'pipe'
+  bool terminated = false;
+  bool exited = false;
+  int64_t exitNs = 0;
+  int64_t sampledNs = 0;
+  char buffer[kReadBytes];
+};
+
+JobScheduler::JobScheduler() {
+  m_Port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+  if (!m_Port) {
+    LOG_ERRORF("Job scheduler unavailable (CreateIoCompletionPort error %lu)",
+               GetLastError());
+    return;
+  }
+  m_IoThread = std::thread(&JobScheduler::IoLoop, this);
+}
+
+JobScheduler::~JobScheduler() {
+  m_Quit = true;
+  StopAll();
+  Wake();
+  if (m_IoThread.joinable())
+    m_IoThread.join();
+  if (m_Port)
+    CloseHandle(m_Port);
+}
+
+void JobScheduler::SetMaxRunning(int maxRunning) {
+  m_MaxRunning = std::max(1, std::min(maxRunning, kMaxMaxRunning));
+  Wake(); // Room for queued jobs, maybe
+}
+
+uint64_t JobScheduler::Submit(const std::string &command, uint64_t requestId,
+                              int modelSlot) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto job = std::make_unique<Job>();
+  Job &added = *job;
+  added.info.id = m_NextId++;
+  added.info.command = command;
+  added.info.requestId = requestId;
+  added.info.modelSlot = modelSlot;
+  added.info.queuedNs = EventLog::NowNs();
+  m_Jobs.push_back(std::move(job));
+  if (!m_Port || m_Quit) {
+    static const char kNoThread[] = "Error: The job scheduler is not running.";
+    added.output.Append(kNoThread, sizeof(kNoThread) - 1);
+    added.info.outputBytes = added.output.Total();
+    added.info.status = JobStatus::Failed;
+    added.info.endNs = added.info.queuedNs;
+    End(added);
+    PruneLocked();
+  } else {
+    CountLocked();
+    Wake();
+  }
+  return added.info.id;
+}
+
+void JobScheduler::Stop(uint64_t id) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  Job *job = FindLocked(id);
+  if (!job)
+    return;
+  if (job->info.status == JobStatus::Queued) {
+    job->info.status = JobStatus::Stopped;
+    job->info.endNs = EventLog::NowNs();
+    End(*job);
+    PruneLocked();
+  } else if (job->info.status == JobStatus::Running) {
+    job->stopRequested = true;
+    Wake();
+  }
+}
+
+void JobScheduler::StopAll() {
+  std::vector<uint64_t> ids;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (const auto &job : m_Jobs)
+      if (!job->info.Finished())
+        ids.push_back(job->info.id);
+  }
+  for (uint64_t id : ids)
+    Stop(id);
+}
+
+void JobScheduler::RemoveFinished() {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Jobs.erase(std::remove_if(m_Jobs.begin(), m_Jobs.end(),
+                              [](const std::unique_ptr<Job> &job) {
+                                return job->info.Finished();
+                              }),
+               m_Jobs.end());
+}
+
+std::vector<JobInfo> JobScheduler::List() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  std::vector<JobInfo> list;
+  list.reserve(m_Jobs.size());
+  for (const auto &job : m_Jobs)
+    list.push_back(job->info);
+  return list;
+}
+
+bool JobScheduler::Info(uint64_t id, JobInfo &out) const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  const Job *job = FindLocked(id);
+  if (!job)
+    return false;
+  out = job->info;
+  return true;
+}
+
+bool JobScheduler::ReadOutput(uint64_t id, uint64_t &seen,
+                              std::string &out) const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  const Job *job = FindLocked(id);
+  return job && job->output.ReadSince(seen, out);
+}
+
+std::vector<JobScheduler::Finished> JobScheduler::TakeFinished() {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  std::vector<Finished> taken;
+  taken.swap(m_Finished);
+  return taken;
+}
+
+void JobScheduler::SetFinishedSink(std::function<void(Finished &)> sink) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_FinishedSink = std::move(sink);
+  Wake(); // For anything that ended before
+}
+
+size_t JobScheduler::Running() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return std::count_if(m_Jobs.begin(), m_Jobs.end(),
+                       [](const std::unique_ptr<Job> &job) {
+                         return job->info.status == JobStatus::Running;
+                       });
+}
+
+bool JobScheduler::Wait(uint64_t id, int timeoutMs) const {
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  auto ended = [&]() {
+    const Job *job = FindLocked(id);
+    return !job || job->info.Finished();
+  };
+  m_Ended.wait_for(lock, std::chrono::milliseconds(timeoutMs), ended);
+  // Only finished jobs are pruned
+  const Job *job = FindLocked(id);
+  return job ? job->info.Finished() : id != 0 && id < m_NextId;
+}
+
+void JobScheduler::IoLoop() {
+  TraceRecorder::SetThreadName("ShellJobs");
+  static MetricCounter &outputBytes = Metrics::Get().Counter(
+      "cmdai_output_bytes_total", "Process output captured from pipes");
+  int64_t lastPollNs = 0;
+  for (;;) {
+    DWORD bytes = 0;
+    ULONG_PTR key = 0;
+    OVERLAPPED *overlapped = nullptr;
+    BOOL ok =
+        GetQueuedCompletionStatus(m_Port, &bytes, &key, &overlapped, kPollMs);
+
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    bool pipeClosed = false;
+    if (overlapped) {
+      // A read finished; the key is its job, which stays listed until
+      // its pipe is closed
+      Job &job = *(Job *)key;
+      job.reading = false;
+      if (ok) {
+        TraceSpan span("Deliver output", "shell");
+        job.output.Append(job.buffer, bytes);
+        job.info.outputBytes = job.output.Total();
+        outputBytes.Add(bytes);
+        IssueRead(job);
+      } else {
+        // Broken pipe: every holder of the write end is gone. Aborted:
+        // Poll stopped waiting for that.
+        CloseHandle(job.pipe);
+        job.pipe = nullptr;
+        pipeClosed = true;
+      }
+    }
+
+    // Every kPollMs, even while output keeps the port busy
+    const int64_t now = EventLog::NowNs();
+    if (!overlapped || pipeClosed || now - lastPollNs >= kPollNs) {
+      Poll(now);
+      lastPollNs = now;
+    }
+    StartQueued(lock);
+    PruneLocked();
+    if (m_FinishedSink && !m_Finished.empty())
+      DeliverFinished(lock);
+
+    if (m_Quit && std::none_of(m_Jobs.begin(), m_Jobs.end(),
+                               [](const std::unique_ptr<Job> &job) {
+                                 return !job->info.Finished();
+                               }))
+      break;
+  }
+}
+
+void JobScheduler::StartQueued(std::unique_lock<std::mutex> &lock) {
+  while (!m_Quit) {
+    int running = 0;
+    Job *next = nullptr;
+    for (const auto &job : m_Jobs) {
+      if (job->info.status == JobStatus::Running)
+        running++;
+      else if (job->info.status == JobStatus::Queued && !next)
+        next = job.get();
+    }
+    if (!next || running >= m_MaxRunning)
+      break;
+
+    // Running from here on, so Stop waits for Poll rather than dropping
+    // a job that is halfway through starting
+    next->info.status = JobStatus::Running;
+    next->info.startNs = EventLog::NowNs();
+    CountLocked();
+    std::string error;
+    lock.unlock();
+    const bool launched = Launch(*next, error);
+    lock.lock();
+
+    if (launched) {
+      IssueRead(*next);
+    } else {
+      next->output.Append(error.data(), error.size());
+      next->info.outputBytes = next->output.Total();
+      next->info.status = JobStatus::Failed;
+      next->info.endNs = EventLog::NowNs();
+      End(*next);
+    }
+  }
+}
+
+bool JobScheduler::Launch(Job &job, std::string &error) {
+  TraceSpan span("Launch job", "shell");
+  LatencyStats::ModelScope modelScope(job.info.modelSlot);
+  static MetricCounter &spawned = Metrics::Get().Counter(
+      "cmdai_processes_spawned_total", "Shell processes started");
+  static MetricCounter &spawnFailures = Metrics::Get().Counter(
+      "cmdai_process_spawn_failures_total", "CreateProcess calls that failed");
+  const std::string fullCmdLine = ShellManager::CommandLine(job.info.command);
+
+  // A named pipe, because anonymous ones cannot be read overlapped
+  char name[64];
+  snprintf(name, sizeof(name), "\\\\.\\pipe\\cmdai-job-%lu-%llu",
+           GetCurrentProcessId(), (unsigned long long)job.info.id);
+  HANDLE read = CreateNamedPipeA(
+      name, PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED |
+                FILE_FLAG_FIRST_PIPE_INSTANCE,
+      PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, 0,
+      kReadBytes, 0, NULL);
+  if (read == INVALID_HANDLE_VALUE) {
+    error = "Error: Could not create the output pipe (Error Code: " +
+            std::to_string(GetLastError()) + ").";
+    return false;
+  }
+  SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+  HANDLE write = CreateFileA(name, GENERIC_WRITE, 0, &sa, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, NULL);
+  if (write == INVALID_HANDLE_VALUE ||
+      !CreateIoCompletionPort(read, m_Port, (ULONG_PTR)&job, 0)) {
+    error = "Error: Could not connect the output pipe (Error Code: " +
+            std::to_string(GetLastError()) + ").";
+    if (write != INVALID_HANDLE_VALUE)
+      CloseHandle(write);
+    CloseHandle(read);
+    return false;
+  }
+
+  STARTUPINFOA si = {sizeof(STARTUPINFOA)};
+  si.cb = sizeof(STARTUPINFOA);
+  si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
+  si.hStdOutput = write;
+  si.hStdError = write;
+  si.wShowWindow = SW_HIDE;
+
+  PROCESS_INFORMATION pi = {0};
+  std::vector<char> cmdBuffer(fullCmdLine.begin(), fullCmdLine.end());
+  cmdBuffer.push_back('\0');
+  BOOL created;
+  {
+    // Suspended until it is in its job object, so nothing it starts can
+    // slip out. Only this thread creates inheritable handles here, so
+    // jobs do not pick up each other's pipes.
+    ScopedTimer spawnTimer(Stage::Spawn);
+    created = CreateProcessA(NULL, cmdBuffer.data(), NULL, NULL, TRUE,
+                             CREATE_NO_WINDOW | CREATE_SUSPENDED, NULL, NULL,
+                             &si, &pi);
+  }
+  CloseHandle(write); // The child's copy is the only one; EOF when it goes
+  if (!created) {
+    spawnFailures.Add();
+    error = "Error: Failed to launch process (Error Code: " +
+            std::to_string(GetLastError()) + ").\n" +
+            "Command: " + fullCmdLine + "\n" +
+            "Check if the executable exists and is in your PATH.";
+    CloseHandle(read);
+    return false;
+  }
+  spawned.Add();
+
+  // Fails inside a job that does not allow nesting (before Windows 8);
+  // the process alone is then stopped and measured
+  HANDLE jobObject = CreateJobObjectA(NULL, NULL);
+  if (jobObject && !AssignProcessToJobObject(jobObject, pi.hProcess)) {
+    CloseHandle(jobObject);
+    jobObject = nullptr;
+  }
+  ResumeThread(pi.hThread);
+  CloseHandle(pi.hThread);
+
+  job.process = pi.hProcess;
+  job.jobObject = jobObject;
+  job.pipe = read;
+  return true;
+}
+
+void JobScheduler::IssueRead(Job &job) {
+  if (!job.pipe)
+    return;
+  // Completes through the port even when the data is already there
+  job.overlapped = OVERLAPPED{};
+  if (ReadFile(job.pipe, job.buffer, kReadBytes, NULL, &job.overlapped) ||
+      GetLastError() == ERROR_IO_PENDING) {
+    job.reading = true;
+    return;
+  }
+  // Broken pipe: the output is all read
+  CloseHandle(job.pipe);
+  job.pipe = nullptr;
+}
+
+void JobScheduler::Poll(int64_t nowNs) {
+  for (const auto &entry : m_Jobs) {
+    Job &job = *entry;
+    if (job.info.status != JobStatus::Running || !job.process)
+      continue;
+
+    if (job.stopRequested && !job.terminated) {
+      job.terminated = true;
+      if (job.jobObject)
+        TerminateJobObject(job.jobObject, 1);
+      else
+        TerminateProcess(job.process, 1);
+      static const char kNote[] = "\n[PROCESS TERMINATED BY USER]\n";
+      job.output.Append(kNote, sizeof(kNote) - 1);
+      job.info.outputBytes = job.output.Total();
+    }
+    if (!job.exited &&
+        WaitForSingleObject(job.process, 0) == WAIT_OBJECT_0) {
+      job.exited = true;
+      job.exitNs = nowNs;
+    }
+    if (!job.exited) {
+      if (nowNs - job.sampledNs >= kSampleNs)
+        Sample(job);
+      continue;
+    }
+
+    if (job.pipe) {
+      // Wait for the rest of the output, but not for whatever the command
+      // left running with the pipe
+      if (nowNs - job.exitNs >= kDrainNs && job.reading)
+        CancelIoEx(job.pipe, &job.overlapped);
+      continue;
+    }
+    Finish(job, nowNs);
+  }
+}
+
+void JobScheduler::Sample(Job &job) {
+  job.sampledNs = EventLog::NowNs();
+  if (job.jobObject) {
+    // Includes processes in the tree that have already exited
+    JOBOBJECT_BASIC_ACCOUNTING_INFORMATION accounting;
+    if (QueryInformationJobObject(job.jobObject,
+                                  JobObjectBasicAccountingInformation,
+                                  &accounting, sizeof(accounting), NULL))
+      job.info.cpuSeconds = (accounting.TotalUserTime.QuadPart +
+                             accounting.TotalKernelTime.QuadPart) /
+                            1e7;
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+    if (QueryInformationJobObject(job.jobObject,
+                                  JobObjectExtendedLimitInformation, &limits,
+                                  sizeof(limits), NULL))
+      job.info.peakMemoryBytes = limits.PeakJobMemoryUsed;
+    return;
+  }
+  FILETIME created, exited, kernel, user;
+  if (GetProcessTimes(job.process, &created, &exited, &kernel, &user))
+    job.info.cpuSeconds = (Ticks(kernel) + Ticks(user)) / 1e7;
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(job.process, &counters, sizeof(counters)))
+    job.info.peakMemoryBytes = counters.PeakPagefileUsage;
+}
+
+void JobScheduler::Finish(Job &job, int64_t nowNs) {
+  Sample(job);
+  DWORD exitCode = (DWORD)-1;
+  GetExitCodeProcess(job.process, &exitCode);
+  CloseHandle(job.process);
+  job.process = nullptr;
+  if (job.jobObject) {
+    CloseHandle(job.jobObject);
+    job.jobObject = nullptr;
+  }
+  job.info.exitCode = (int)exitCode;
+  job.info.status = job.terminated ? JobStatus::Stopped : JobStatus::Exited;
+  job.info.endNs = nowNs;
+  End(job);
+}
+
+void JobScheduler::End(Job &job) {
+  m_Finished.push_back({job.info, job.output.Text()});
+  if (m_Finished.size() > kMaxFinished) // Nobody is taking them
+    m_Finished.erase(m_Finished.begin());
+
+  if (job.info.startNs) {
+    const int64_t elapsed = job.info.endNs - job.info.startNs;
+    LatencyStats::Get().Record(job.info.modelSlot, Stage::Execute, elapsed);
+    EventLog::RequestScope requestScope(job.info.requestId);
+    const int64_t fields[] = {elapsed, job.info.exitCode,
+                              (int64_t)job.info.outputBytes};
+    EventLog::Get().EmitAt(EventId::Execute, job.info.startNs, fields, 3,
+                           job.info.command);
+  }
+  CountLocked();
+  m_Ended.notify_all();
+}
+
+void JobScheduler::DeliverFinished(std::unique_lock<std::mutex> &lock) {
+  std::vector<Finished> finished;
+  finished.swap(m_Finished);
+  std::function<void(Finished &)> sink = m_FinishedSink;
+  lock.unlock();
+  for (Finished &done : finished)
+    sink(done);
+  lock.lock();
+}
+
+void JobScheduler::Wake() {
+  if (m_Port)
+    PostQueuedCompletionStatus(m_Port, 0, 0, NULL);
+}
+
+JobScheduler::Job *JobScheduler::FindLocked(uint64_t id) const {
+  for (const auto &job : m_Jobs)
+    if (job->info.id == id)
+      return job.get();
+  return nullptr;
+}
+
+void JobScheduler::CountLocked() {
+  static MetricGauge &running =
+      Metrics::Get().Gauge("cmdai_jobs_running", "Shell jobs running now");
+  static MetricGauge &queued = Metrics::Get().Gauge(
+      "cmdai_jobs_queued", "Shell jobs waiting for a free slot");
+  int runningJobs = 0, queuedJobs = 0;
+  for (const auto &job : m_Jobs) {
+    runningJobs += job->info.status == JobStatus::Running;
+    queuedJobs += job->info.status == JobStatus::Queued;
+  }
+  running.Set(runningJobs);
+  queued.Set(queuedJobs);
+}
+
+void JobScheduler::PruneLocked() {
+  size_t finished = std::count_if(m_Jobs.begin(), m_Jobs.end(),
+                                  [](const std::unique_ptr<Job> &job) {
+                                    return job->info.Finished();
+                                  });
+  for (auto it = m_Jobs.begin(); finished > kMaxFinished;) {
+    if ((*it)->info.Finished()) {
+      it = m_Jobs.erase(it);
+      finished--;
+    } else {
+      ++it;
+    }
+  }
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The newest bytes of a job's output. Appends past the limit drop the
+// oldest text, trimmed in batches so the copy is amortised; readers keep a
+// position in the whole stream and pick up only what is new to them.
+class JobOutput {
+public:
+  explicit JobOutput(size_t maxBytes) : m_MaxBytes(maxBytes) {}
+
+  void Append(const char *data, size_t size);
+  // Appends to 'out' what was written after stream position 'seen' (all of
+  // the kept text if 'seen' fell out of it), trims 'out' to the same limit
+  // and moves 'seen' to the end. False if there was nothing new.
+  bool ReadSince(uint64_t &seen, std::string &out) const;
+
+  const std::string &Text() const { return m_Text; }
+  uint64_t Total() const { return m_Total; } // Bytes ever appended
+  uint64_t Dropped() const { return m_Total - m_Text.size(); }
+
+  // Drops the front of 'text' once it is a quarter past 'maxBytes', down to
+  // 'maxBytes' and never in the middle of a UTF-8 sequence.
+  static void Trim(std::string &text, size_t maxBytes);
+
+private:
+  std::string m_Text;
+  size_t m_MaxBytes;
+  uint64_t m_Total = 0;
+};
+
+enum class JobStatus : uint8_t { Queued, Running, Exited, Failed, Stopped };
+
+struct JobInfo {
+  uint64_t id = 0;
+  std::string command;
+  JobStatus status = JobStatus::Queued;
+  int exitCode = -1;
+  int64_t queuedNs = 0; // EventLog::NowNs() stamps
+  int64_t startNs = 0;
+  int64_t endNs = 0;
+  double cpuSeconds = 0;         // User + kernel, whole process tree
+  uint64_t peakMemoryBytes = 0;  // Committed memory high-water mark
+  uint64_t outputBytes = 0;      // Everything printed, kept or not
+  uint64_t requestId = 0;        // EventLog correlation
+  int modelSlot = 0;             // LatencyStats attribution
+
+  bool Finished() const {
+    return status != JobStatus::Queued && status != JobStatus::Running;
+  }
+  // Runtime so far, or until the job ended
+  double Seconds(int64_t nowNs) const;
+  static const char *StatusName(JobStatus status);
+};
+
+// Runs shell commands (ShellManager::CommandLine) as concurrent jobs. Up
+// to MaxRunning() run at once; the rest wait in submission order. Each job
+// is its own Win32 job object, so Stop and the CPU and memory figures
+// cover whatever the command started, not just cmd.exe.
+//
+// One thread serves every job: pipe reads are overlapped and complete on a
+// single I/O completion port, so a job costs a pipe and a few handles
+// rather than a reader thread. The same thread launches queued jobs,
+// applies stops and reaps exits.
+//
+// Safe to call from several threads at once.
+class JobScheduler {
+public:
+  static constexpr size_t kMaxOutputBytes = 1 << 20; // Kept per job
+  static constexpr int kDefaultMaxRunning = 4;
+  static constexpr int kMaxMaxRunning = 32;
+  static constexpr size_t kMaxFinished = 32; // Finished jobs kept listed
+
+  // A job that ended, with the kept tail of its output
+  struct Finished {
+    JobInfo info;
+    std::string output;
+  };
+
+  JobScheduler();
+  ~JobScheduler(); // Stops every job and waits for them
+  JobScheduler(const JobScheduler &) = delete;
+  JobScheduler &operator=(const JobScheduler &) = delete;
+
+  void SetMaxRunning(int maxRunning); // Clamped to 1..kMaxMaxRunning
+  int MaxRunning() const { return m_MaxRunning; }
+
+  // Queues 'command'; returns its job id (never 0).
+  uint64_t Submit(const std::string &command, uint64_t requestId = 0,
+                  int modelSlot = 0);
+  // A queued job is dropped; a running one has its process tree killed.
+  void Stop(uint64_t id);
+  void StopAll();
+  // Forgets finished jobs (running and queued ones stay)
+  void RemoveFinished();
+
+  // Every job still listed, oldest first, without output
+  std::vector<JobInfo> List() const;
+  bool Info(uint64_t id, JobInfo &out) const;
+  // JobOutput::ReadSince for job 'id'; false if nothing new or no such job
+  bool ReadOutput(uint64_t id, uint64_t &seen, std::string &out) const;
+  // Jobs that ended since the last call, in the order they ended
+  std::vector<Finished> TakeFinished();
+  // From now on, hands each ended job to 'sink' on the I/O thread, without
+  // the lock held, instead of keeping it for TakeFinished. For work such
+  // as writing the output to disk that should not stall the caller.
+  void SetFinishedSink(std::function<void(Finished &)> sink);
+  size_t Running() const;
+  // Blocks until job 'id' has ended; false on timeout or an id that was
+  // never submitted.
+  bool Wait(uint64_t id, int timeoutMs) const;
+
+private:
+  struct Job;
+
+  // Everything below runs on the I/O thread, with m_Mutex held unless
+  // noted; only that thread touches a job's handles.
+  void IoLoop();
+  // Launches queued jobs while there is room; unlocks around each launch
+  void StartQueued(std::unique_lock<std::mutex> &lock);
+  // Without m_Mutex. Creates the pipe, process and job object.
+  bool Launch(Job &job, std::string &error);
+  void IssueRead(Job &job);
+  // Applies stops, notices exits and reaps jobs whose pipe has closed
+  void Poll(int64_t nowNs);
+  void Sample(Job &job); // CPU and memory so far
+  void Finish(Job &job, int64_t nowNs);
+  // Unlocks around the sink calls
+  void DeliverFinished(std::unique_lock<std::mutex> &lock);
+  // Any thread, m_Mutex held: files the ended job for TakeFinished and
+  // reports it. Leaves it listed; PruneLocked drops old ones outside any
+  // walk over m_Jobs.
+  void End(Job &job);
+  void Wake();
+  Job *FindLocked(uint64_t id) const;
+  void CountLocked(); // Running/queued gauges
+  void PruneLocked();
+
+  mutable std::mutex m_Mutex;
+  mutable std::condition_variable m_Ended;
+  std::vector<std::unique_ptr<Job>> m_Jobs; // By id
+  std::vector<Finished> m_Finished;         // Not yet taken
+  std::function<void(Finished &)> m_FinishedSink;
+  uint64_t m_NextId = 1;
+  std::atomic<int> m_MaxRunning{kDefaultMaxRunning};
+  std::atomic<bool> m_Quit{false};
+  void *m_Port = nullptr; // I/O completion port
+  std::thread m_IoThread;
+};
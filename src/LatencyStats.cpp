@@ -0,0 +1,253 @@
+#include "LatencyStats.h"
+#include "EventLog.h"
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+thread_local int t_ModelSlot = 0;
+
+int HighestBit(uint64_t v) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse64(&index, v);
+  return (int)index;
+#else
+  return 63 - __builtin_clzll(v);
+#endif
+}
+
+// Renders a duration with a unit that keeps 3-4 significant digits.
+std::string FormatNs(double ns) {
+  char buf[32];
+  if (ns < 1e3)
+    std::snprintf(buf, sizeof(buf), "%.0fns", ns);
+  else if (ns < 1e6)
+    std::snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+  else if (ns < 1e9)
+    std::snprintf(buf, sizeof(buf), "%.1fms", ns / 1e6);
+  else
+    std::snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+  return buf;
+}
+
+} // namespace
+
+// --- LatencyHistogram ---
+
+size_t LatencyHistogram::BucketIndex(int64_t ns) {
+  constexpr int64_t kSubBuckets = int64_t(1) << kSubBucketBits;
+  if (ns <= 0)
+    return 0;
+  if (ns >= kMaxValue)
+    ns = kMaxValue - 1;
+  if (ns < kSubBuckets)
+    return (size_t)ns; // Exact below the first power-of-two split
+  int shift = HighestBit((uint64_t)ns) - kSubBucketBits;
+  return (size_t)((shift + 1) * kSubBuckets + ((ns >> shift) - kSubBuckets));
+}
+
+int64_t LatencyHistogram::BucketMidpoint(size_t index) {
+  constexpr size_t kSubBuckets = size_t(1) << kSubBucketBits;
+  if (index < kSubBuckets)
+    return (int64_t)index;
+  int shift = (int)(index / kSubBuckets) - 1;
+  int64_t low = (int64_t)(kSubBuckets + index % kSubBuckets) << shift;
+  return low + ((int64_t(1) << shift) >> 1);
+}
+
+void LatencyHistogram::Record(int64_t ns) {
+  if (ns < 0)
+    ns = 0;
+  m_Buckets[BucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+  m_Count.fetch_add(1, std::memory_order_relaxed);
+  m_Sum.fetch_add(ns, std::memory_order_relaxed);
+  int64_t max = m_Max.load(std::memory_order_relaxed);
+  while (ns > max &&
+         !m_Max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::Reset() {
+  for (auto &b : m_Buckets)
+    b.store(0, std::memory_order_relaxed);
+  m_Count = 0;
+  m_Sum = 0;
+  m_Max = 0;
+}
+
+double LatencyHistogram::MeanNs() const {
+  uint64_t count = Count();
+  return count ? (double)m_Sum.load(std::memory_order_relaxed) / count : 0.0;
+}
+
+int64_t LatencyHistogram::PercentileNs(double p) const {
+  // Count from the buckets themselves: concurrent writers may have bumped a
+  // bucket without yet bumping m_Count, or the other way round.
+  uint64_t total = 0;
+  for (const auto &b : m_Buckets)
+    total += b.load(std::memory_order_relaxed);
+  if (total == 0)
+    return 0;
+
+  p = p < 0 ? 0 : (p > 100 ? 100 : p);
+  uint64_t rank = (uint64_t)std::ceil(p / 100.0 * (double)total);
+  if (rank == 0)
+    rank = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    seen += m_Buckets[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      int64_t mid = BucketMidpoint(i);
+      int64_t max = Max();
+      return (max > 0 && mid > max) ? max : mid;
+    }
+  }
+  return Max();
+}
+
+// --- LatencyStats ---
+
+LatencyStats::LatencyStats() {
+  m_Names[0] = "(no model)";
+  m_Models[0] = std::make_unique<StageSet>();
+  m_ModelCount = 1;
+}
+
+LatencyStats &LatencyStats::Get() {
+  static LatencyStats instance;
+  return instance;
+}
+
+int LatencyStats::ModelSlot(std::string_view name) {
+  std::lock_guard<std::mutex> lock(m_RegisterMutex);
+  int count = m_ModelCount.load(std::memory_order_relaxed);
+  for (int i = 1; i < count; ++i) {
+    if (m_Names[i] == name)
+      return i;
+  }
+  if (count == kMaxModels)
+    return 0;
+  m_Names[count] = std::string(name);
+  m_Models[count] = std::make_unique<StageSet>();
+  m_ModelCount.store(count + 1, std::memory_order_release);
+  return count;
+}
+
+LatencyStats::ModelScope::ModelScope(int slot) : m_Previous(t_ModelSlot) {
+  t_ModelSlot = slot;
+}
+
+LatencyStats::ModelScope::~ModelScope() { t_ModelSlot = m_Previous; }
+
+void LatencyStats::Record(Stage stage, int64_t ns) {
+  Record(t_ModelSlot, stage, ns);
+}
+
+void LatencyStats::Record(int slot, Stage stage, int64_t ns) {
+  if (stage >= Stage::Count)
+    return;
+  if (slot < 0 || slot >= ModelCount())
+    slot = 0;
+  (*m_Models[slot])[static_cast<size_t>(stage)].Record(ns);
+}
+
+const LatencyHistogram *LatencyStats::Find(int slot, Stage stage) const {
+  if (slot < 0 || slot >= ModelCount() || stage >= Stage::Count)
+    return nullptr;
+  return &(*m_Models[slot])[static_cast<size_t>(stage)];
+}
+
+void LatencyStats::Reset() {
+  int count = ModelCount();
+  for (int i = 0; i < count; ++i) {
+    for (auto &h : *m_Models[i])
+      h.Reset();
+  }
+}
+
+std::string LatencyStats::ModelName(int slot) const {
+  std::lock_guard<std::mutex> lock(m_RegisterMutex);
+  return (slot >= 0 && slot < kMaxModels) ? m_Names[slot] : std::string();
+}
+
+const char *LatencyStats::StageName(Stage stage) {
+  switch (stage) {
+  case Stage::FirewallAssess:
+    return "FirewallAssess";
+  case Stage::Tokenize:
+    return "Tokenize";
+  case Stage::Prefill:
+    return "Prefill";
+  case Stage::TimeToFirstToken:
+    return "TimeToFirstToken";
+  case Stage::DecodeToken:
+    return "DecodeToken";
+  case Stage::Embed:
+    return "Embed";
+  case Stage::Parse:
+    return "Parse";
+  case Stage::Assess:
+    return "Assess";
+  case Stage::Spawn:
+    return "Spawn";
+  case Stage::Execute:
+    return "Execute";
+  default:
+    return "Unknown";
+  }
+}
+
+std::string LatencyStats::Format() const {
+  std::string out;
+  char line[160];
+  std::snprintf(line, sizeof(line), "%-22s %-17s %8s %10s %10s %10s %10s\n",
+                "model", "stage", "count", "p50", "p95", "p99", "max");
+  out += line;
+
+  int count = ModelCount();
+  for (int m = 0; m < count; ++m) {
+    std::string name = ModelName(m);
+    for (size_t s = 0; s < static_cast<size_t>(Stage::Count); ++s) {
+      const LatencyHistogram &h = (*m_Models[m])[s];
+      if (h.Count() == 0)
+        continue;
+      std::snprintf(line, sizeof(line),
+                    "%-22.22s %-17s %8llu %10s %10s %10s %10s\n", name.c_str(),
+                    StageName(static_cast<Stage>(s)),
+                    (unsigned long long)h.Count(),
+                    FormatNs((double)h.PercentileNs(50)).c_str(),
+                    FormatNs((double)h.PercentileNs(95)).c_str(),
+                    FormatNs((double)h.PercentileNs(99)).c_str(),
+                    FormatNs((double)h.Max()).c_str());
+      out += line;
+    }
+  }
+  return out;
+}
+
+bool LatencyStats::Dump(const std::string &path) const {
+  std::error_code ec;
+  std::filesystem::path parent = std::filesystem::path(path).parent_path();
+  if (!parent.empty())
+    std::filesystem::create_directories(parent, ec);
+  std::ofstream file(path, std::ios::trunc);
+  if (!file)
+    return false;
+  file << Format();
+  return (bool)file;
+}
+
+// --- ScopedTimer ---
+
+ScopedTimer::ScopedTimer(Stage stage)
+    : m_Stage(stage), m_Start(EventLog::NowNs()) {}
+
+ScopedTimer::~ScopedTimer() {
+  LatencyStats::Get().Record(m_Stage, EventLog::NowNs() - m_Start);
+}
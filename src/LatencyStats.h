@@ -0,0 +1,110 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Request pipeline stages with their own latency distribution.
+enum class Stage : uint8_t {
+  FirewallAssess,
+  Tokenize,
+  Prefill,
+  TimeToFirstToken,
+  DecodeToken, // One llama_decode step during generation
+  Embed,       // Intent embedding for the semantic cache
+  Parse,
+  Assess,
+  Spawn, // CreateProcess only
+  Execute,
+  Count
+};
+
+// Log-linear (HDR-style) histogram of nanosecond durations. Every power of
+// two is split into 32 linear sub-buckets, so any recorded value is within
+// ~3% of its bucket's midpoint from 1ns up to ~18 minutes. Record() is a
+// couple of relaxed atomic adds and never blocks.
+class LatencyHistogram {
+public:
+  static constexpr int kSubBucketBits = 5;
+  static constexpr int64_t kMaxValue = int64_t(1) << 40;
+  static constexpr size_t kBucketCount =
+      (40 - kSubBucketBits + 1) << kSubBucketBits;
+
+  void Record(int64_t ns);
+  void Reset();
+
+  uint64_t Count() const { return m_Count.load(std::memory_order_relaxed); }
+  int64_t Max() const { return m_Max.load(std::memory_order_relaxed); }
+  double MeanNs() const;
+  // p in [0, 100]. Returns 0 when empty.
+  int64_t PercentileNs(double p) const;
+
+  static size_t BucketIndex(int64_t ns);
+  static int64_t BucketMidpoint(size_t index);
+
+private:
+  std::array<std::atomic<uint64_t>, kBucketCount> m_Buckets{};
+  std::atomic<uint64_t> m_Count{0};
+  std::atomic<int64_t> m_Sum{0};
+  std::atomic<int64_t> m_Max{0};
+};
+
+// Per-model, per-stage latency histograms. Threads attribute their samples
+// to the model installed by the enclosing ModelScope (slot 0 otherwise).
+class LatencyStats {
+public:
+  static constexpr int kMaxModels = 8;
+
+  static LatencyStats &Get();
+
+  // Returns the slot for 'name', registering it on first use. Not for the
+  // hot path: resolve once per request and pass the slot to ModelScope.
+  int ModelSlot(std::string_view name);
+
+  class ModelScope {
+  public:
+    explicit ModelScope(int slot);
+    ~ModelScope();
+
+  private:
+    int m_Previous;
+  };
+
+  void Record(Stage stage, int64_t ns);
+  void Record(int slot, Stage stage, int64_t ns);
+  const LatencyHistogram *Find(int slot, Stage stage) const;
+  void Reset();
+
+  int ModelCount() const { return m_ModelCount.load(std::memory_order_acquire); }
+  std::string ModelName(int slot) const;
+  static const char *StageName(Stage stage);
+
+  // Fixed-width table: one row per (model, stage) with samples.
+  std::string Format() const;
+  bool Dump(const std::string &path) const;
+
+private:
+  LatencyStats();
+
+  using StageSet =
+      std::array<LatencyHistogram, static_cast<size_t>(Stage::Count)>;
+
+  mutable std::mutex m_RegisterMutex;
+  std::array<std::string, kMaxModels> m_Names;
+  std::array<std::unique_ptr<StageSet>, kMaxModels> m_Models;
+  std::atomic<int> m_ModelCount{0};
+};
+
+// Records the enclosing scope's duration into 'stage' for the current model.
+class ScopedTimer {
+public:
+  explicit ScopedTimer(Stage stage);
+  ~ScopedTimer();
+
+private:
+  Stage m_Stage;
+  int64_t m_Start;
+};
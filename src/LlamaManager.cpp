@@ -1,203 +1,843 @@
 #include "LlamaManager.h"
+#include "CandidateRanker.h"
+#include "EventLog.h"
+#include "LatencyStats.h"
 #include "Logger.h"
+#include "Metrics.h"
+#include "ModelManager.h"
+#include "TextScan.h"
+#include "TraceRecorder.h"
+#include "VectorIndex.h"
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
+namespace {
+constexpr llama_seq_id kChatSeq = 0;
+constexpr llama_seq_id kSpecSeq = 1;
+// Best-of-N forks follow: candidate k > 0 decodes on kSpecSeq + k
+
+ggml_type KvGgmlType(KvCacheType type) {
+  switch (type) {
+  case KvCacheType::Q8_0:
+    return GGML_TYPE_Q8_0;
+  case KvCacheType::Q4_0:
+    return GGML_TYPE_Q4_0;
+  default:
+    return GGML_TYPE_F16;
+  }
+}
+
+llama_flash_attn_type FlashAttnType(FlashAttention mode) {
+  switch (mode) {
+  case FlashAttention::On:
+    return LLAMA_FLASH_ATTN_TYPE_ENABLED;
+  case FlashAttention::Off:
+    return LLAMA_FLASH_ATTN_TYPE_DISABLED;
+  default:
+    return LLAMA_FLASH_ATTN_TYPE_AUTO;
+  }
+}
+
+llama_sampler *MakeSampler(float temperature, uint32_t seed) {
+  llama_sampler *chain =
+      llama_sampler_chain_init(llama_sampler_chain_default_params());
+  llama_sampler_chain_add(
+      chain, llama_sampler_init_penalties(2048, 1.15f, 0.10f, 0.10f));
+  llama_sampler_chain_add(chain, llama_sampler_init_top_k(40));
+  llama_sampler_chain_add(chain, llama_sampler_init_top_p(0.95f, 1));
+  llama_sampler_chain_add(chain, llama_sampler_init_temp(temperature));
+  llama_sampler_chain_add(chain, llama_sampler_init_dist(seed));
+  return chain;
+}
+} // namespace
+
+void LlamaOptions::Apply(const InferenceProfile &profile) {
+  InferenceProfile p = profile;
+  p.Normalize();
+  gpuLayers = p.gpuLayers;
+  contextSize = p.contextSize;
+  threads = p.threads;
+  batchThreads = p.batchThreads;
+  batchSize = p.batchSize;
+  ubatchSize = p.ubatchSize;
+  kvType = p.kvType;
+  flashAttn = p.flashAttn;
+}
+
 LlamaManager::LlamaManager(const std::string &modelPath,
-                           const std::string &modelName)
+                           const std::string &modelName,
+                           const LlamaOptions &options)
     : m_modelName(modelName) {
-  llama_backend_init();
-  auto m_params = llama_model_default_params();
-  m_params.n_gpu_layers = 99; // Enable GPU acceleration (offload all layers)
-  m_model = llama_model_load_from_file(modelPath.c_str(), m_params);
+  const int64_t loadStartNs = EventLog::NowNs();
+  m_modelRef = ModelManager::LoadModel(modelPath, options);
+  Init(options, loadStartNs);
+}
 
+LlamaManager::LlamaManager(std::shared_ptr<llama_model> model,
+                           const std::string &modelName,
+                           const LlamaOptions &options)
+    : m_modelRef(std::move(model)), m_modelName(modelName) {
+  Init(options, EventLog::NowNs());
+}
+
+void LlamaManager::Init(const LlamaOptions &options, int64_t loadStartNs) {
+  m_model = m_modelRef.get();
+  const int32_t candidates =
+      std::max(1, std::min(options.candidates, kMaxCandidates));
   if (m_model) {
     auto c_params = llama_context_default_params();
-    c_params.n_ctx = 2048;
+    c_params.n_ctx = options.contextSize;
+    // Chat, the speculative sequence and any best-of-N forks, sharing one
+    // KV buffer so adopting or forking cells is a metadata copy
+    c_params.n_seq_max = 1 + (uint32_t)candidates;
+    c_params.kv_unified = true;
+    if (options.threads > 0) {
+      c_params.n_threads = options.threads;
+      c_params.n_threads_batch = options.threads;
+    }
+    if (options.batchThreads > 0)
+      c_params.n_threads_batch = options.batchThreads;
+    // A whole turn is decoded in one call, so the logical batch has to
+    // cover the context
+    c_params.n_batch =
+        options.batchSize > 0 ? options.batchSize : options.contextSize;
+    if (options.ubatchSize > 0)
+      c_params.n_ubatch = std::min(options.ubatchSize, c_params.n_batch);
+    c_params.type_k = KvGgmlType(options.kvType);
+    c_params.type_v = KvGgmlType(options.kvType);
+    c_params.flash_attn_type = FlashAttnType(options.flashAttn);
     m_ctx = llama_init_from_model(m_model, c_params);
   }
-  m_n_predict = 256;
+  m_n_predict = options.maxTokens;
+  m_seed = options.seed;
+  if (m_ctx)
+    CreateWorkspace((int32_t)(options.batchSize > 0 ? options.batchSize
+                                                    : options.contextSize),
+                    candidates);
+
+  const std::string modelLabel = "model=\"" + m_modelName + "\"";
+  Metrics::Get()
+      .Gauge("cmdai_model_load_seconds", "Time to load the model and context",
+             modelLabel)
+      .Set((EventLog::NowNs() - loadStartNs) / 1e9);
+  if (m_ctx)
+    Metrics::Get()
+        .Gauge("cmdai_kv_cache_capacity_tokens",
+               "Context window size of the loaded model", modelLabel)
+        .Set((double)llama_n_ctx(m_ctx));
 
   // Default to TinyLlama template as it matches current usage
   m_template = GetTinyLlamaTemplate();
 }
 
+void LlamaManager::CreateWorkspace(int32_t batchCapacity,
+                                   int32_t candidates) {
+  m_work.batchCapacity = batchCapacity;
+  m_work.batch = llama_batch_init(batchCapacity, 0, 1);
+
+  // Sized for a full context so neither grows while decoding
+  const size_t n_ctx = llama_n_ctx(m_ctx);
+  m_historyTokens.reserve(n_ctx);
+  m_work.tokens.reserve(n_ctx);
+  m_work.piece.resize(256);
+  m_work.chunk.reserve(256);
+
+  m_work.candidates.resize((size_t)candidates);
+  for (int32_t k = 0; k < candidates; k++) {
+    Candidate &c = m_work.candidates[k];
+    // The forks run hotter, each on its own seed, so they disagree with
+    // candidate 0 where it is unsure
+    const uint32_t seed = m_seed == LLAMA_DEFAULT_SEED ? m_seed : m_seed + k;
+    c.sampler = MakeSampler(k == 0 ? 0.2f : 0.7f, seed);
+    c.seq = k == 0 ? kChatSeq : kSpecSeq + k;
+    c.tokens.reserve((size_t)m_n_predict);
+    c.response.reserve((size_t)m_n_predict * 16);
+  }
+}
+
 ChatTemplate LlamaManager::GetTinyLlamaTemplate() {
   return {"<|system|>\n", "<|end|>\n",       "<|user|>\n",
-          "<|end|>\n",    "<|assistant|>\n", "<|end|>\n"};
+          "<|end|>\n",    "<|assistant|>\n", "<|end|>\n",
+          "tinyllama"};
 }
 
 ChatTemplate LlamaManager::GetPhi3Template() {
   return {
       "<|system|>\n",    "<|end|>\n", "<|user|>\n", "<|end|>\n",
-      "<|assistant|>\n", "<|end|>\n" // Phi-3 uses similar tags to ChatML often
-  };
+      "<|assistant|>\n", "<|end|>\n", // Phi-3 uses similar tags to ChatML often
+      "phi3"};
 }
 
 ChatTemplate LlamaManager::GetQwenTemplate() {
   return {"<|im_start|>system\n",    "<|im_end|>\n",
           "<|im_start|>user\n",      "<|im_end|>\n",
-          "<|im_start|>assistant\n", "<|im_end|>\n"};
+          "<|im_start|>assistant\n", "<|im_end|>\n",
+          "qwen"};
 }
 
 void LlamaManager::ResetContext() {
-  m_historyTokens.clear();
+  std::lock_guard<std::mutex> lock(m_ctxMutex);
+  // The warmed-up system prompt is the same for every conversation
+  m_historyTokens.resize(m_systemTokens);
+  m_spec.Clear();
+  Metrics::Get()
+      .Gauge("cmdai_kv_cache_used_tokens", "Tokens held in the KV cache")
+      .Set((double)m_systemTokens);
   if (m_ctx) {
     // Updated API for new llama.cpp version: get memory and remove tokens for
     // sequence 0
     llama_memory_t mem = llama_get_memory(m_ctx);
-    llama_memory_seq_rm(mem, 0, -1, -1);
+    llama_memory_seq_rm(mem, kChatSeq, (llama_pos)m_systemTokens, -1);
+    llama_memory_seq_rm(mem, kSpecSeq, -1, -1);
+  }
+}
+
+void LlamaManager::SetTemplate(const ChatTemplate &tmpl) {
+  std::lock_guard<std::mutex> lock(m_ctxMutex);
+  m_template = tmpl;
+  m_historyTokens.clear();
+  m_spec.Clear();
+  m_systemTokens = 0;
+  if (m_ctx)
+    llama_memory_clear(llama_get_memory(m_ctx), true);
+}
+
+bool LlamaManager::Warmup() {
+  if (!m_model || !m_ctx)
+    return false;
+  const int64_t startNs = EventLog::NowNs();
+  {
+    std::lock_guard<std::mutex> lock(m_ctxMutex);
+    TraceSpan span("llama warmup", "llama");
+    llama_memory_t mem = llama_get_memory(m_ctx);
+    llama_memory_clear(mem, true);
+    m_historyTokens.clear();
+    m_spec.Clear();
+    m_systemTokens = 0;
+
+    // The system prompt is the first request's prefill anyway; decoding it
+    // here reads every weight (faulting in the mapping) and builds the
+    // batch graph
+    std::vector<llama_token> &tokens = m_work.tokens;
+    Tokenize(SystemBlock(), true, tokens);
+    const int n = (int)tokens.size();
+    if (n == 0 || n >= (int)llama_n_ctx(m_ctx) / 2 ||
+        n > m_work.batchCapacity)
+      return false;
+    llama_batch &batch = m_work.batch;
+    batch.n_tokens = n;
+    for (int i = 0; i < n; i++) {
+      batch.token[i] = tokens[i];
+      batch.pos[i] = i;
+      batch.n_seq_id[i] = 1;
+      batch.seq_id[i][0] = kChatSeq;
+      batch.logits[i] = (i == n - 1);
+    }
+    bool ok = llama_decode(m_ctx, batch) == 0;
+
+    // And a single-token step for the decode graph, then roll it back
+    if (ok) {
+      batch.n_tokens = 1;
+      batch.token[0] = tokens[n - 1];
+      batch.pos[0] = n;
+      batch.logits[0] = true;
+      ok = llama_decode(m_ctx, batch) == 0;
+      llama_memory_seq_rm(mem, kChatSeq, n, -1);
+    }
+    if (!ok) {
+      llama_memory_clear(mem, true);
+      return false;
+    }
+    m_historyTokens.assign(tokens.begin(), tokens.end());
+    m_systemTokens = m_historyTokens.size();
+    Metrics::Get()
+        .Gauge("cmdai_kv_cache_used_tokens", "Tokens held in the KV cache")
+        .Set((double)m_systemTokens);
   }
+
+  // First Embed would otherwise create its context mid-request
+  std::vector<float> embedding;
+  Embed("warm up", embedding);
+
+  Metrics::Get()
+      .Gauge("cmdai_model_warmup_seconds",
+             "Time spent warming up the model after loading",
+             "model=\"" + m_modelName + "\"")
+      .Set((EventLog::NowNs() - startNs) / 1e9);
+  return true;
 }
 
 LlamaManager::~LlamaManager() {
+  for (Candidate &c : m_work.candidates)
+    llama_sampler_free(c.sampler);
+  if (m_work.batchCapacity > 0)
+    llama_batch_free(m_work.batch);
+  if (m_embedCtx)
+    llama_free(m_embedCtx);
   if (m_ctx)
     llama_free(m_ctx);
-  if (m_model)
-    llama_model_free(m_model);
-  llama_backend_free();
+  // The weights go with the last reference; the backend stays up for the
+  // process (ModelManager::InitBackend)
 }
 
-std::string LlamaManager::GenerateCommand(
-    const std::string &input,
-    std::function<void(const std::string &)> callback) {
-  if (!m_model || !m_ctx)
-    return "Error: Model not loaded.";
+bool LlamaManager::Embed(const std::string &text, std::vector<float> &out) {
+  if (!m_model)
+    return false;
+  constexpr uint32_t kEmbedContext = 512; // Intents are a sentence or two
 
+  if (!m_embedCtx) {
+    auto c_params = llama_context_default_params();
+    c_params.n_ctx = kEmbedContext;
+    c_params.n_batch = kEmbedContext;
+    c_params.n_ubatch = kEmbedContext;
+    c_params.embeddings = true;
+    c_params.pooling_type = LLAMA_POOLING_TYPE_MEAN;
+    m_embedCtx = llama_init_from_model(m_model, c_params);
+    if (!m_embedCtx)
+      return false;
+  }
+
+  ScopedTimer timer(Stage::Embed);
+  TraceSpan span("llama_embed", "llama");
   const struct llama_vocab *vocab = llama_model_get_vocab(m_model);
+  std::vector<llama_token> tokens(text.size() + 8);
+  int n = llama_tokenize(vocab, text.c_str(), (int)text.size(), tokens.data(),
+                         (int)tokens.size(), true, false);
+  if (n <= 0)
+    return false;
+  n = std::min(n, (int)kEmbedContext);
 
-  // 1. Format the new turn using the assigned template
-  std::string turnMessage = "";
+  llama_memory_seq_rm(llama_get_memory(m_embedCtx), 0, -1, -1);
+  llama_batch batch = llama_batch_init(n, 0, 1);
+  batch.n_tokens = n;
+  for (int i = 0; i < n; i++) {
+    batch.token[i] = tokens[i];
+    batch.pos[i] = i;
+    batch.n_seq_id[i] = 1;
+    batch.seq_id[i][0] = 0;
+    batch.logits[i] = true; // Every position feeds the mean pool
+  }
+  int rc = llama_decode(m_embedCtx, batch);
+  llama_batch_free(batch);
+  if (rc != 0)
+    return false;
 
-  if (m_historyTokens.empty()) {
-    // --- MASTER SYSTEM PROMPT (Applied to ALL models) ---
-    // This ensures consistent behavior and flat JSON schema across the app.
-    std::string masterPrompt =
-        "You are a specialized Windows CLI AI Assistant. Your ONLY purpose is "
-        "to assist with Windows command-line operations, system "
-        "administration, and automation.\n"
-        "CRITICAL RULES:\n"
-        "1. Output exactly one FLAT JSON object: {\"cmd\": \"...\", \"why\": "
-        "\"...\"}\n"
-        "2. Ensure parameters are accurate for Windows. Example: use 'powercfg "
-        "/batteryreport' NOT '-batterystats'.\n"
-        "3. If the user says a command was wrong, listen and fix it in the NEW "
-        "response.\n"
-        "4. RAW commands only (no wrapping). Use '&&' or ';' for multi-step.\n"
-        "5. NO conversational filler.\n"
-        "6. IF THE USER ASKS ANYTHING UNRELATED to Windows CLI, REJECT it "
-        "immediately with {\"cmd\": \"DENIED\", \"why\": \"...\"}.\n"
-        "EXAMPLES:\n"
-        "User: show my ip and active ports\n"
-        "Assistant: {\"cmd\": \"ipconfig && netstat -an\", \"why\": \"Lists IP "
-        "configuration and active network connections.\"}\n";
-
-    // Model-specific logic tweaks (if any) can be appended if necessary,
-    // but the Master rules above overwrite them.
-    if (m_modelName.find("Phi") != std::string::npos) {
-      masterPrompt += "\nNote: As a Phi model, prioritize conciseness and "
-                      "avoid any preamble.";
-    }
+  const float *pooled = llama_get_embeddings_seq(m_embedCtx, 0);
+  if (!pooled)
+    return false;
+  out.assign(pooled, pooled + llama_model_n_embd(m_model));
+  VectorIndex::Normalize(out.data(), out.size());
+  return true;
+}
 
-    turnMessage += m_template.systemStart + masterPrompt + m_template.systemEnd;
+std::string LlamaManager::SystemBlock() const {
+  // --- MASTER SYSTEM PROMPT (Applied to ALL models) ---
+  // This ensures consistent behavior and flat JSON schema across the app.
+  std::string masterPrompt =
+      "You are a specialized Windows CLI AI Assistant. Your ONLY purpose is "
+      "to assist with Windows command-line operations, system "
+      "administration, and automation.\n"
+      "CRITICAL RULES:\n"
+      "1. Output exactly one FLAT JSON object: {\"cmd\": \"...\", \"why\": "
+      "\"...\"}\n"
+      "2. Ensure parameters are accurate for Windows. Example: use 'powercfg "
+      "/batteryreport' NOT '-batterystats'.\n"
+      "3. If the user says a command was wrong, listen and fix it in the NEW "
+      "response.\n"
+      "4. RAW commands only (no wrapping). Use '&&' or ';' for multi-step.\n"
+      "5. NO conversational filler.\n"
+      "6. IF THE USER ASKS ANYTHING UNRELATED to Windows CLI, REJECT it "
+      "immediately with {\"cmd\": \"DENIED\", \"why\": \"...\"}.\n"
+      "EXAMPLES:\n"
+      "User: show my ip and active ports\n"
+      "Assistant: {\"cmd\": \"ipconfig && netstat -an\", \"why\": \"Lists IP "
+      "configuration and active network connections.\"}\n";
+
+  // Model-specific logic tweaks (if any) can be appended if necessary,
+  // but the Master rules above overwrite them.
+  if (m_modelName.find("Phi") != std::string::npos) {
+    masterPrompt += "\nNote: As a Phi model, prioritize conciseness and "
+                    "avoid any preamble.";
   }
 
+  return m_template.systemStart + masterPrompt + m_template.systemEnd;
+}
+
+std::string LlamaManager::BuildTurn(const std::string &input,
+                                    bool complete) const {
+  std::string turnMessage = "";
+
+  if (m_historyTokens.empty())
+    turnMessage += SystemBlock();
+
   // SECURITY OPTIMIZATION: Sanitize template tokens to prevent prompt injection
+  // (single in-place pass; tags re-formed by a removal are removed too)
   std::string sanitizedInput = input;
-  std::vector<std::string> templateTags = {"<|",         "im_start", "im_end",
-                                           "assistant|", "user|",    "system|"};
-  for (const auto &tag : templateTags) {
-    size_t pos = 0;
-    while ((pos = sanitizedInput.find(tag, pos)) != std::string::npos) {
-      sanitizedInput.erase(pos, tag.length());
+  TextScan::RemoveAll(sanitizedInput, {"<|", "im_start", "im_end",
+                                       "assistant|", "user|", "system|"});
+
+  turnMessage += m_template.userStart + sanitizedInput;
+  if (complete)
+    turnMessage += m_template.userEnd + m_template.assistantStart;
+  return turnMessage;
+}
+
+void LlamaManager::Tokenize(const std::string &text, bool addSpecial,
+                            std::vector<llama_token> &out) const {
+  const struct llama_vocab *vocab = llama_model_get_vocab(m_model);
+  out.resize(text.length() + 8);
+  int n = llama_tokenize(vocab, text.c_str(), (int)text.length(), out.data(),
+                         (int)out.size(), addSpecial, true);
+  out.resize(n > 0 ? n : 0);
+}
+
+int LlamaManager::TokenToPiece(llama_token token) {
+  const struct llama_vocab *vocab = llama_model_get_vocab(m_model);
+  std::string &piece = m_work.piece;
+  int n = llama_token_to_piece(vocab, token, &piece[0], (int)piece.size(), 0,
+                               true);
+  if (n < 0) { // Longer than any piece so far
+    piece.resize((size_t)-n);
+    n = llama_token_to_piece(vocab, token, &piece[0], (int)piece.size(), 0,
+                             true);
+  }
+  return n > 0 ? n : 0;
+}
+
+size_t LlamaManager::TurnTokenBudget() {
+  std::lock_guard<std::mutex> lock(m_ctxMutex);
+  if (!m_model || !m_ctx)
+    return 0;
+  size_t used = m_historyTokens.size();
+  if (used == 0)
+    used += CountTokens(SystemBlock());
+  used += CountTokens(m_template.userStart + m_template.userEnd +
+                      m_template.assistantStart);
+  used += (size_t)m_n_predict; // The answer
+  const size_t n_ctx = llama_n_ctx(m_ctx);
+  return used < n_ctx ? n_ctx - used : 0;
+}
+
+size_t LlamaManager::CountTokens(std::string_view text) const {
+  if (!m_model)
+    return IAIProvider::CountTokens(text);
+  // With no room for tokens llama_tokenize only returns minus the count
+  const struct llama_vocab *vocab = llama_model_get_vocab(m_model);
+  int n = llama_tokenize(vocab, text.data(), (int)text.size(), nullptr, 0,
+                         false, true);
+  return (size_t)(n < 0 ? -n : n);
+}
+
+float LlamaManager::PrefillProgress() const {
+  const int total = m_prefillTotal;
+  return total > 0 ? (float)m_prefillDone / (float)total : 1.0f;
+}
+
+void LlamaManager::Prefill(const std::string &partialInput) {
+  std::lock_guard<std::mutex> lock(m_ctxMutex);
+  if (!m_model || !m_ctx)
+    return;
+  static MetricCounter &speculatedTotal = Metrics::Get().Counter(
+      "cmdai_tokens_prefilled_speculative_total",
+      "Prompt tokens evaluated while the user was typing");
+
+  std::vector<llama_token> &tokens = m_work.tokens;
+  Tokenize(BuildTurn(partialInput, false), m_historyTokens.empty(), tokens);
+  SpeculativePrefix::DropUnstableTail(tokens);
+  const llama_pos base = (llama_pos)m_historyTokens.size();
+  // Leave the reply its room; a turn this long is not worth speculating on
+  if ((size_t)base + tokens.size() + (size_t)m_n_predict >=
+      (size_t)llama_n_ctx(m_ctx))
+    return;
+
+  // Roll back only what the edit changed
+  llama_memory_t mem = llama_get_memory(m_ctx);
+  const size_t held = m_spec.Size();
+  const size_t keep = m_spec.Reconcile(tokens);
+  if (keep < held)
+    llama_memory_seq_rm(mem, kSpecSeq, base + (llama_pos)keep, -1);
+  if (keep == tokens.size())
+    return;
+  if (keep == 0) {
+    // The speculative turn attends to the conversation so far
+    llama_memory_seq_rm(mem, kSpecSeq, -1, -1);
+    if (base > 0)
+      llama_memory_seq_cp(mem, kChatSeq, kSpecSeq, 0, base);
+  }
+
+  const int n = (int)(tokens.size() - keep);
+  if (n > m_work.batchCapacity)
+    return;
+  llama_batch &batch = m_work.batch;
+  batch.n_tokens = n;
+  for (int i = 0; i < n; i++) {
+    batch.token[i] = tokens[keep + i];
+    batch.pos[i] = base + (llama_pos)keep + i;
+    batch.n_seq_id[i] = 1;
+    batch.seq_id[i][0] = kSpecSeq;
+    batch.logits[i] = (i == n - 1);
+  }
+  int rc;
+  {
+    EventLog::ScopedEvent ev(EventId::SpeculativePrefill);
+    TraceSpan span("llama_decode (speculative)", "llama");
+    ev.SetField(0, n);
+    rc = llama_decode(m_ctx, batch);
+  }
+  if (rc != 0) {
+    llama_memory_seq_rm(mem, kSpecSeq, -1, -1);
+    m_spec.Clear();
+    return;
+  }
+  m_spec.Extend(tokens);
+  speculatedTotal.Add((uint64_t)n);
+}
+
+InferenceProfile::Throughput LlamaManager::MeasureThroughput(int promptTokens,
+                                                             int genTokens) {
+  InferenceProfile::Throughput result;
+  std::lock_guard<std::mutex> lock(m_ctxMutex);
+  if (!m_model || !m_ctx)
+    return result;
+  const int n_ctx = (int)llama_n_ctx(m_ctx);
+  promptTokens = std::max(1, std::min(promptTokens, n_ctx / 2));
+  genTokens = std::max(1, std::min(genTokens, n_ctx - promptTokens));
+
+  // A real turn, repeated up to the requested length
+  std::vector<llama_token> turn;
+  Tokenize(BuildTurn("find every log file over 100 MB in my user folder and "
+                     "show which program wrote it",
+                     true),
+           true, turn);
+  if (turn.empty())
+    return result;
+  std::vector<llama_token> prompt;
+  while ((int)prompt.size() < promptTokens)
+    prompt.insert(prompt.end(), turn.begin(), turn.end());
+  prompt.resize(promptTokens);
+
+  llama_memory_t mem = llama_get_memory(m_ctx);
+  llama_memory_clear(mem, true);
+  m_historyTokens.clear();
+  m_spec.Clear();
+  m_systemTokens = 0;
+
+  llama_batch batch = llama_batch_init(promptTokens, 0, 1);
+  auto decode = [&](int first, int count, bool logits) {
+    batch.n_tokens = count;
+    for (int i = 0; i < count; i++) {
+      batch.token[i] = prompt[first + i];
+      batch.pos[i] = first + i;
+      batch.n_seq_id[i] = 1;
+      batch.seq_id[i][0] = kChatSeq;
+      batch.logits[i] = logits && i == count - 1;
     }
+    return llama_decode(m_ctx, batch) == 0;
+  };
+
+  // The first decode allocates compute buffers; keep it off the clock
+  bool ok = decode(0, std::min(8, promptTokens), false);
+  llama_memory_clear(mem, true);
+
+  int64_t start = EventLog::NowNs();
+  ok = ok && decode(0, promptTokens, true);
+  int64_t prefillNs = EventLog::NowNs() - start;
+
+  // Greedy and past end-of-generation, so every profile decodes the same
+  // number of tokens
+  llama_sampler *sampler = llama_sampler_init_greedy();
+  start = EventLog::NowNs();
+  for (int i = 0; ok && i < genTokens; i++) {
+    prompt.push_back(llama_sampler_sample(sampler, m_ctx, -1));
+    ok = decode(promptTokens + i, 1, true);
+  }
+  int64_t decodeNs = EventLog::NowNs() - start;
+  llama_sampler_free(sampler);
+  llama_batch_free(batch);
+  llama_memory_clear(mem, true);
+
+  if (ok && prefillNs > 0 && decodeNs > 0) {
+    result.prefillTokensPerSecond = promptTokens * 1e9 / prefillNs;
+    result.decodeTokensPerSecond = genTokens * 1e9 / decodeNs;
   }
+  return result;
+}
+
+std::string LlamaManager::GenerateCommand(
+    const std::string &input,
+    std::function<void(const std::string &)> callback) {
+  if (!m_model || !m_ctx)
+    return "Error: Model not loaded.";
+
+  static MetricCounter &prefilledTotal = Metrics::Get().Counter(
+      "cmdai_tokens_prefilled_total", "Prompt tokens evaluated");
+  static MetricCounter &generatedTotal = Metrics::Get().Counter(
+      "cmdai_tokens_generated_total", "Tokens sampled during generation");
+  static MetricGauge &tokensPerSecond = Metrics::Get().Gauge(
+      "cmdai_decode_tokens_per_second", "Decode rate of the last request");
+  static MetricGauge &prefillPerSecond = Metrics::Get().Gauge(
+      "cmdai_prefill_tokens_per_second", "Prompt rate of the last request");
+  static MetricGauge &lastTtft = Metrics::Get().Gauge(
+      "cmdai_time_to_first_token_seconds", "TTFT of the last request");
+  static MetricGauge &kvUsed = Metrics::Get().Gauge(
+      "cmdai_kv_cache_used_tokens", "Tokens held in the KV cache");
 
-  turnMessage += m_template.userStart + sanitizedInput + m_template.userEnd +
-                 m_template.assistantStart;
+  const int64_t requestStartNs = EventLog::NowNs();
+  const struct llama_vocab *vocab = llama_model_get_vocab(m_model);
+  m_prefillDone = 0;
+  m_prefillTotal = 0;
+
+  std::lock_guard<std::mutex> ctxLock(m_ctxMutex);
+  const std::string turnMessage = BuildTurn(input, true);
 
   // Tokenize
-  std::vector<llama_token> newTokens(turnMessage.length() + 8);
-  int n_new = llama_tokenize(
-      vocab, turnMessage.c_str(), (int)turnMessage.length(), newTokens.data(),
-      (int)newTokens.size(), m_historyTokens.empty(), true);
-  newTokens.resize(n_new);
-
-  // Batch process new tokens
-  llama_batch batch = llama_batch_init(2048, 0, 1);
-  batch.n_tokens = n_new;
-  for (int i = 0; i < n_new; i++) {
-    batch.token[i] = newTokens[i];
-    batch.pos[i] = (llama_pos)(m_historyTokens.size() + i);
-    batch.n_seq_id[i] = 1;
-    batch.seq_id[i][0] = 0;
-    batch.logits[i] = (i == n_new - 1);
+  std::vector<llama_token> &newTokens = m_work.tokens;
+  {
+    EventLog::ScopedEvent ev(EventId::Tokenize);
+    TraceSpan span("llama_tokenize", "llama");
+    Tokenize(turnMessage, m_historyTokens.empty(), newTokens);
+    ev.SetField(0, (int64_t)newTokens.size());
   }
+  const int n_total = (int)newTokens.size();
+  if (n_total == 0)
+    return "Error: Tokenization failed.";
 
-  if (llama_decode(m_ctx, batch) != 0) {
-    llama_batch_free(batch);
-    return "Error: Decode failed.";
+  // Adopt what was speculatively prefilled while the user typed: move the
+  // matching cells to the chat sequence and drop the rest. At least the
+  // last token is decoded here, for its logits.
+  const llama_pos base = (llama_pos)m_historyTokens.size();
+  llama_memory_t mem = llama_get_memory(m_ctx);
+  const int reused = (int)m_spec.Adopt(newTokens);
+  if (reused > 0)
+    llama_memory_seq_cp(mem, kSpecSeq, kChatSeq, base, base + reused);
+  llama_memory_seq_rm(mem, kSpecSeq, -1, -1);
+  const int n_new = n_total - reused;
+  if ((size_t)base + (size_t)n_total >= (size_t)llama_n_ctx(m_ctx)) {
+    llama_memory_seq_rm(mem, kChatSeq, base, -1);
+    return "Error: Prompt too long.";
+  }
+
+  // Batch process new tokens, n_batch at a time. Pasted command output can
+  // span several batches; progress and cancellation are checked between
+  // them.
+  llama_batch &batch = m_work.batch;
+  const int capacity = m_work.batchCapacity;
+  int lastRow = 0; // Row of the final prompt token, which has the logits
+  m_prefillTotal = n_new;
+  {
+    EventLog::ScopedEvent ev(EventId::Prefill);
+    TraceSpan span("llama_decode (prefill)", "llama");
+    ev.SetField(0, n_new);
+    ev.SetField(1, reused);
+    for (int first = 0; first < n_new; first += capacity) {
+      const int n = std::min(capacity, n_new - first);
+      bool failed = m_cancel;
+      if (!failed) {
+        batch.n_tokens = n;
+        for (int i = 0; i < n; i++) {
+          batch.token[i] = newTokens[reused + first + i];
+          batch.pos[i] = base + reused + first + i;
+          batch.n_seq_id[i] = 1;
+          batch.seq_id[i][0] = kChatSeq;
+          batch.logits[i] = (first + i == n_new - 1);
+        }
+        failed = llama_decode(m_ctx, batch) != 0;
+      }
+      if (failed) {
+        // Leave the conversation as it was before this turn
+        llama_memory_seq_rm(mem, kChatSeq, base, -1);
+        m_prefillTotal = 0;
+        return m_cancel ? kCancelled : "Error: Decode failed.";
+      }
+      lastRow = n - 1;
+      m_prefillDone = first + n;
+    }
+    int64_t prefillNs = ev.ElapsedNs();
+    if (prefillNs > 0)
+      prefillPerSecond.Set(n_new * 1e9 / prefillNs);
   }
 
   m_historyTokens.insert(m_historyTokens.end(), newTokens.begin(),
                          newTokens.end());
-  LOG_INFO("Generating response for model: " + m_modelName);
+  prefilledTotal.Add((uint64_t)n_new);
+  LOG_INFOF("Generating response for model: %s", m_modelName.c_str());
 
-  // Sampling
-  struct llama_sampler *sampler =
-      llama_sampler_chain_init(llama_sampler_chain_default_params());
-  llama_sampler_chain_add(
-      sampler, llama_sampler_init_penalties(2048, 1.15f, 0.10f, 0.10f));
-  llama_sampler_chain_add(sampler, llama_sampler_init_top_k(40));
-  llama_sampler_chain_add(sampler, llama_sampler_init_top_p(0.95f, 1));
-  llama_sampler_chain_add(sampler, llama_sampler_init_temp(0.2f));
-  llama_sampler_chain_add(sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
-
-  std::string response = "";
-  llama_token lastToken = -1;
-  int repeatCount = 0;
-
-  for (int i = 0; i < m_n_predict; i++) {
-    llama_token id = llama_sampler_sample(sampler, m_ctx, -1);
-
-    if (id == lastToken) {
-      repeatCount++;
-      if (repeatCount >= 3)
-        break;
-    } else {
-      repeatCount = 0;
-      lastToken = id;
+  // Every candidate continues from the prompt's cells; the forks share
+  // them rather than copying. Each needs room for a full answer.
+  const llama_pos promptEnd = (llama_pos)m_historyTokens.size();
+  const int room = (int)llama_n_ctx(m_ctx) - (int)promptEnd;
+  const int n_cand = std::max(
+      1, std::min((int)m_work.candidates.size(),
+                  room / std::max(1, m_n_predict)));
+  for (int k = 0; k < n_cand; k++) {
+    Candidate &c = m_work.candidates[k];
+    // Sampling: penalties forget the last request, dist re-seeds
+    llama_sampler_reset(c.sampler);
+    c.tokens.clear();
+    c.response.clear();
+    c.lastToken = -1;
+    c.repeatCount = 0;
+    c.logitsIndex = lastRow;
+    c.done = false;
+    if (k > 0)
+      llama_memory_seq_cp(mem, kChatSeq, c.seq, -1, -1);
+  }
+
+  const bool stream = callback && n_cand == 1;
+  size_t emitted = 0; // Bytes of the response already passed to the callback
+  bool sawPiece = false;
+  int active = n_cand;
+  CandidateRanker ranker;
+  int tokensGenerated = 0;
+  EventLog::ScopedEvent decodeEvent(EventId::Decode);
+  // Scores a finished candidate; true once nothing left can beat the best
+  auto finish = [&](int k) {
+    return n_cand > 1 && ranker.Finish(k, m_work.candidates[k].response,
+                                       m_work.candidates[0].done);
+  };
+
+  bool settled = false;
+  bool cancelled = false;
+  for (int step = 0; step < m_n_predict && active > 0 && !settled; step++) {
+    if (m_cancel) {
+      cancelled = true;
+      break;
     }
+    batch.n_tokens = 0;
+    for (int k = 0; k < n_cand && !settled; k++) {
+      Candidate &c = m_work.candidates[k];
+      if (c.done)
+        continue;
+      llama_token id;
+      {
+        TraceSpan span("llama_sampler_sample", "llama");
+        id = llama_sampler_sample(c.sampler, m_ctx, c.logitsIndex);
+      }
 
-    if (llama_vocab_is_eog(vocab, id))
+      bool stop = false;
+      if (id == c.lastToken) {
+        stop = ++c.repeatCount >= 3;
+      } else {
+        c.repeatCount = 0;
+        c.lastToken = id;
+      }
+      stop = stop || llama_vocab_is_eog(vocab, id);
+
+      int n = stop ? 0 : TokenToPiece(id);
+      if (n > 0) {
+        std::string_view piece(m_work.piece.data(), (size_t)n);
+        // Check for template end tags in response
+        stop = piece.find("<|") != std::string_view::npos;
+        if (!stop) {
+          if (!sawPiece) {
+            sawPiece = true;
+            int64_t ttft = EventLog::NowNs() - requestStartNs;
+            decodeEvent.SetField(1, ttft);
+            LatencyStats::Get().Record(Stage::TimeToFirstToken, ttft);
+            lastTtft.Set(ttft / 1e9);
+          }
+          c.response.append(piece);
+          // Byte-fallback tokens can split a character; hold the partial
+          // bytes
+          size_t complete = TextScan::Utf8CompletePrefix(c.response);
+          if (stream && complete > emitted) {
+            m_work.chunk.assign(c.response, emitted, complete - emitted);
+            callback(m_work.chunk);
+            emitted = complete;
+          }
+        }
+      }
+      if (stop) {
+        c.done = true;
+        --active;
+        settled = finish(k);
+        continue;
+      }
+      decodeEvent.SetField(0, ++tokensGenerated);
+
+      c.tokens.push_back(id);
+      const int row = batch.n_tokens++;
+      batch.token[row] = id;
+      batch.pos[row] = promptEnd + (llama_pos)c.tokens.size() - 1;
+      batch.n_seq_id[row] = 1;
+      batch.seq_id[row][0] = c.seq;
+      batch.logits[row] = true;
+      c.logitsIndex = row;
+    }
+    if (settled || batch.n_tokens == 0)
       break;
 
-    char buf[256];
-    int n = llama_token_to_piece(vocab, id, buf, sizeof(buf), 0, true);
-    if (n > 0) {
-      std::string piece(buf, n);
-      // Check for template end tags in response
-      if (piece.find("<|") != std::string::npos)
-        break;
-      response += piece;
-      if (callback)
-        callback(piece);
+    int64_t stepStart = EventLog::NowNs();
+    int rc;
+    {
+      TraceSpan span("llama_decode", "llama");
+      rc = llama_decode(m_ctx, batch);
     }
+    LatencyStats::Get().Record(Stage::DecodeToken,
+                               EventLog::NowNs() - stepStart);
+    if (rc != 0)
+      break;
+  }
 
-    m_historyTokens.push_back(id);
-    batch.n_tokens = 1;
-    batch.token[0] = id;
-    batch.pos[0] = (llama_pos)(m_historyTokens.size() - 1);
-    batch.n_seq_id[0] = 1;
-    batch.seq_id[0][0] = 0;
-    batch.logits[0] = true;
+  if (cancelled) {
+    // Drop the turn and every fork; the chat is as it was before
+    for (int k = 1; k < n_cand; k++)
+      llama_memory_seq_rm(mem, m_work.candidates[k].seq, -1, -1);
+    llama_memory_seq_rm(mem, kChatSeq, base, -1);
+    m_historyTokens.resize((size_t)base);
+    generatedTotal.Add((uint64_t)tokensGenerated);
+    kvUsed.Set((double)base);
+    LOG_INFOF("Request cancelled after %d tokens", tokensGenerated);
+    return kCancelled;
+  }
 
-    if (llama_decode(m_ctx, batch) != 0)
-      break;
+  if (n_cand > 1) {
+    // Answers cut off by the token limit compete too
+    for (int k = 0; k < n_cand && !settled; k++)
+      if (!m_work.candidates[k].done) {
+        m_work.candidates[k].done = true;
+        finish(k);
+      }
+    // The chat sequence keeps only the winner's cells
+    const int best = ranker.Best();
+    if (best != 0) {
+      static MetricCounter &rescuedTotal = Metrics::Get().Counter(
+          "cmdai_best_of_n_rescues_total",
+          "Requests answered by a candidate other than the first");
+      rescuedTotal.Add();
+      llama_memory_seq_rm(mem, kChatSeq, promptEnd, -1);
+      llama_memory_seq_cp(mem, m_work.candidates[best].seq, kChatSeq,
+                          promptEnd, -1);
+    }
+    for (int k = 1; k < n_cand; k++)
+      llama_memory_seq_rm(mem, m_work.candidates[k].seq, -1, -1);
+    LOG_DEBUGF("Best of %d: candidate %d (rank %d)", n_cand, best,
+               ranker.BestRank());
+  }
+  const Candidate &winner = m_work.candidates[ranker.Best()];
+  m_historyTokens.insert(m_historyTokens.end(), winner.tokens.begin(),
+                         winner.tokens.end());
+  const std::string &response = winner.response;
+  if (callback && emitted < response.size()) {
+    m_work.chunk.assign(response, emitted, std::string::npos);
+    callback(m_work.chunk);
   }
 
-  llama_sampler_free(sampler);
-  llama_batch_free(batch);
-  LOG_DEBUG("Model response complete: " + response);
+  generatedTotal.Add((uint64_t)tokensGenerated);
+  int64_t decodeNs = decodeEvent.ElapsedNs();
+  if (decodeNs > 0 && tokensGenerated > 0)
+    tokensPerSecond.Set(tokensGenerated * 1e9 / decodeNs);
+  kvUsed.Set((double)m_historyTokens.size());
+  if (m_firstRequest) {
+    // Separate from time-to-ready: shows what warmup left for the user
+    m_firstRequest = false;
+    Metrics::Get()
+        .Gauge("cmdai_first_request_seconds",
+               "Duration of the first request after loading",
+               "model=\"" + m_modelName + "\"")
+        .Set((EventLog::NowNs() - requestStartNs) / 1e9);
+  }
+  LOG_DEBUGF("Model response complete: %s", response.c_str());
   return response;
 }
@@ -1,8 +1,13 @@
 #pragma once
 #include "IAIProvider.h"
+#include "InferenceProfile.h"
+#include "SpeculativePrefix.h"
 #include "common.h"
 #include "llama.h"
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -13,23 +18,86 @@ struct ChatTemplate {
   std::string userEnd;
   std::string assistantStart;
   std::string assistantEnd;
+  std::string name; // Preset name, part of the response cache key
+};
+
+// Load-time settings. The app and benchmarks fill the machine-specific
+// part from an InferenceProfile.
+struct LlamaOptions {
+  int32_t gpuLayers = 99; // Layers to offload; 0 runs fully on the CPU
+  uint32_t contextSize = 2048;
+  int32_t threads = 0;      // Decode; 0 keeps the llama.cpp default
+  int32_t batchThreads = 0; // Prompt processing; 0 uses 'threads'
+  uint32_t batchSize = 0;   // Most tokens per decode call; 0 is the context
+  uint32_t ubatchSize = 0;  // 0 keeps the llama.cpp default
+  KvCacheType kvType = KvCacheType::F16;
+  FlashAttention flashAttn = FlashAttention::Auto;
+  int32_t maxTokens = 256;
+  // Completions sampled per request (best-of-N); 1 samples only one.
+  // Fixed for the lifetime of the context.
+  int32_t candidates = 1;
+  uint32_t seed = LLAMA_DEFAULT_SEED; // Fix it for reproducible runs
+  bool useMmap = true;   // Map the weights instead of copying them into RAM
+  bool useMlock = false; // Pin mapped weights so they are never paged out
+  bool prefetch = true;  // Ask the OS to read the mapped file ahead
+
+  void Apply(const InferenceProfile &profile);
 };
 
 class LlamaManager : public IAIProvider {
 public:
   LlamaManager(const std::string &modelPath,
-               const std::string &modelName = "Local Model");
+               const std::string &modelName = "Local Model",
+               const LlamaOptions &options = LlamaOptions());
+  // Shares weights already loaded (see ModelManager); only the context,
+  // and with it the KV cache, belongs to this instance.
+  LlamaManager(std::shared_ptr<llama_model> model,
+               const std::string &modelName = "Local Model",
+               const LlamaOptions &options = LlamaOptions());
   ~LlamaManager();
 
+  static constexpr int32_t kMaxCandidates = 8;
+
   // IAIProvider Implementation
+  // With several candidates, each forks the prompt's KV cells and all of
+  // them decode in one batch per step. Every answer is parsed and assessed
+  // and the best valid, lowest-risk one is returned; it is only known at
+  // the end, so 'callback' then receives it in a single call. Prompts longer
+  // than one batch are decoded n_batch tokens at a time; progress and
+  // Cancel() are checked between pieces.
   std::string GenerateCommand(
       const std::string &input,
       std::function<void(const std::string &)> callback = nullptr) override;
   void ResetContext() override;
   std::string GetModelName() const override { return m_modelName; }
+  std::string GetPromptFormat() const override { return m_template.name; }
+  // Mean-pooled hidden state of 'text' from a small side context, so the
+  // chat context and its KV cache are left untouched.
+  bool Embed(const std::string &text, std::vector<float> &out) override;
+  // Decodes the stable prefix of a partly typed intent on a scratch
+  // sequence; GenerateCommand adopts whatever still matches.
+  void Prefill(const std::string &partialInput) override;
+  size_t TurnTokenBudget() override;
+  size_t CountTokens(std::string_view text) const override;
+  float PrefillProgress() const override;
+  void Cancel() override { m_cancel = true; }
+  void ResetCancel() override { m_cancel = false; }
+
+  // Prompt and decode rates on the calibration workload, measured on a
+  // cleared context (which is left cleared). Zero rates if decoding fails.
+  InferenceProfile::Throughput MeasureThroughput(
+      int promptTokens = InferenceProfile::kCalibrationPromptTokens,
+      int genTokens = InferenceProfile::kCalibrationGenTokens);
 
   // Template selection
-  void SetTemplate(const ChatTemplate &tmpl) { m_template = tmpl; }
+  // Drops the conversation, including a warmed-up system prompt.
+  void SetTemplate(const ChatTemplate &tmpl);
+  // Pays the first request's one-time costs up front: faults the mapped
+  // weights in and builds the compute graphs with a real decode, leaves
+  // the system prompt in the KV cache (kept across ResetContext) and opens
+  // the embedding context. Call after SetTemplate, before handing the
+  // provider to the UI. False if decoding failed.
+  bool Warmup();
 
   // Presets
   static ChatTemplate GetTinyLlamaTemplate();
@@ -37,12 +105,66 @@ public:
   static ChatTemplate GetQwenTemplate();
 
 private:
+  void Init(const LlamaOptions &options, int64_t loadStartNs);
+  void CreateWorkspace(int32_t batchCapacity, int32_t candidates);
+  // The prompt for one user turn; 'complete' adds the end-of-turn and
+  // assistant tags, which a turn still being typed must not have.
+  std::string BuildTurn(const std::string &input, bool complete) const;
+  std::string SystemBlock() const;
+  // Tokenizes into 'out', reusing its capacity.
+  void Tokenize(const std::string &text, bool addSpecial,
+                std::vector<llama_token> &out) const;
+  // Text of 'token' in m_work.piece; returns its length (0 if none).
+  int TokenToPiece(llama_token token);
+
+  std::shared_ptr<llama_model> m_modelRef; // Keeps m_model alive
   llama_model *m_model = nullptr;
   llama_context *m_ctx = nullptr;
+  llama_context *m_embedCtx = nullptr; // Created on first Embed()
   std::vector<llama_token> m_historyTokens;
+  // Leading m_historyTokens decoded by Warmup: the system prompt, which
+  // ResetContext keeps
+  size_t m_systemTokens = 0;
+  bool m_firstRequest = true; // Reported as cmdai_first_request_seconds
+  // Speculative turn decoded on sequence 1, right after m_historyTokens.
+  // Prefill runs on its own thread, so m_ctx is only used under the mutex.
+  SpeculativePrefix m_spec;
+  std::mutex m_ctxMutex;
+  // Set by the UI thread; cleared only by ResetCancel
+  std::atomic<bool> m_cancel = false;
+  std::atomic<int> m_prefillDone = 0;
+  std::atomic<int> m_prefillTotal = 0;
+
+  // One completion being sampled on its own sequence
+  struct Candidate {
+    llama_sampler *sampler = nullptr; // Chain reset per request
+    llama_seq_id seq = 0;
+    std::vector<llama_token> tokens; // Sampled so far
+    std::string response;            // Their text
+    llama_token lastToken = -1;
+    int repeatCount = 0;
+    int32_t logitsIndex = -1; // Batch row holding its next logits
+    bool done = false;
+  };
+
+  // Buffers every GenerateCommand and Prefill reuse, so steady-state
+  // decoding never touches the heap. Guarded by m_ctxMutex like m_ctx.
+  struct Workspace {
+    llama_batch batch{};
+    int32_t batchCapacity = 0; // n_batch: the most tokens one decode takes
+    std::vector<llama_token> tokens; // Turn being prefilled
+    std::string piece;               // One token's text
+    std::string chunk;               // Complete UTF-8 for the callback
+    // [0] samples on the chat sequence like a single request; the rest
+    // are best-of-N forks
+    std::vector<Candidate> candidates;
+  };
+  Workspace m_work;
+
   std::string m_modelName;
   ChatTemplate m_template;
 
   // Parameters for generation
   int32_t m_n_predict = 256;
+  uint32_t m_seed = LLAMA_DEFAULT_SEED;
 };
\ No newline at end of file
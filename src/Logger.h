@@ -5,67 +5,342 @@
 #include <iostream>
 #include <filesystem>
 #include <chrono>
-#include <iomanip>
-#include <sstream>
 #include <ctime>
+#include <cstdint>
+#include <cstdarg>
+#include <cstdio>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <thread>
 
+// Compile-time floor: LOG_* calls below this level compile to nothing.
+// 0=DEBUG 1=INFO 2=WARNING 3=ERR. Release builds drop DEBUG by default.
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL 1
+#else
+#define LOG_MIN_LEVEL 0
+#endif
+#endif
+
+// Asynchronous logger. Producers push into a bounded lock-free MPSC ring and
+// return immediately; a background writer thread formats, batches and writes
+// to logs/app.log, flushing periodically and immediately on ERR.
 class Logger {
 public:
     enum Level { DEBUG, INFO, WARNING, ERR };
 
+    static constexpr bool IsCompiledIn(Level level) { return (int)level >= LOG_MIN_LEVEL; }
+
+    // What producers do when the ring is full. ERR messages always block.
+    enum class OverflowPolicy { Drop, Block };
+
+    static constexpr size_t kQueueCapacity = 8192; // Power of two
+    static constexpr std::chrono::milliseconds kFlushInterval{250};
+    // Retry period for a Flush held up by a claimed but unpublished slot
+    static constexpr std::chrono::milliseconds kFlushRetry{1};
+
     static Logger& Get() {
         static Logger instance;
         return instance;
     }
 
-    void Log(Level level, const std::string& message) {
-        std::lock_guard<std::mutex> lock(m_Mutex);
-        
-        auto now = std::chrono::system_clock::now();
-        auto time = std::chrono::system_clock::to_time_t(now);
-        std::tm tm;
-#ifdef _WIN32
-        localtime_s(&tm, &time);
-#else
-        tm = *std::localtime(&time);
+    // Runtime floor, checked by the LOG_* macros before the message
+    // expression is evaluated.
+    bool IsEnabled(Level level) const { return level >= m_MinLevel.load(std::memory_order_relaxed); }
+    void SetMinLevel(Level level) { m_MinLevel = level; }
+    Level GetMinLevel() const { return m_MinLevel; }
+
+    void Log(Level level, std::string message) {
+        size_t pos;
+        Slot* slot = Claim(level, pos);
+        if (!slot) return;
+        slot->message = std::move(message);
+        Publish(slot, pos, level);
+    }
+
+    // printf-style. Formats straight into the ring slot's retained buffer, so
+    // steady-state logging does not allocate.
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((format(printf, 3, 4)))
 #endif
+    void Logf(Level level, const char* fmt, ...) {
+        size_t pos;
+        Slot* slot = Claim(level, pos);
+        if (!slot) return;
 
-        std::string levelStr;
-        switch (level) {
-            case DEBUG: levelStr = "[DEBUG]"; break;
-            case INFO:  levelStr = "[INFO]"; break;
-            case WARNING: levelStr = "[WARN]"; break;
-            case ERR:   levelStr = "[ERROR]"; break;
+        std::string& out = slot->message;
+        if (out.capacity() < 256) out.reserve(256);
+        out.resize(out.capacity());
+        va_list args;
+        va_start(args, fmt);
+        int n = std::vsnprintf(&out[0], out.size() + 1, fmt, args);
+        va_end(args);
+        if (n > (int)out.size()) {
+            out.resize((size_t)n);
+            va_start(args, fmt);
+            std::vsnprintf(&out[0], out.size() + 1, fmt, args);
+            va_end(args);
         }
+        out.resize(n > 0 ? (size_t)n : 0);
+        Publish(slot, pos, level);
+    }
 
-        std::stringstream ss;
-        ss << std::put_time(&tm, "%Y-%m-%d %H:%M:%S") << " " << levelStr << " " << message << std::endl;
-        
-        if (m_File.is_open()) {
-            m_File << ss.str();
-            m_File.flush();
-        }
+    void SetOverflowPolicy(OverflowPolicy policy) { m_Policy = policy; }
+    size_t GetDroppedCount() const { return m_TotalDropped.load() + m_Dropped.load(); }
 
-        // Silent in console unless it's an Error
-        if (level == ERR) {
-            std::cerr << ss.str();
-        }
+    // Blocks until everything logged before this call is on disk.
+    void Flush() {
+        size_t target = m_EnqueuePos.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(m_WakeMutex);
+        if (target > m_FlushTarget)
+            m_FlushTarget = target;
+        m_WakePending = true;
+        m_WakeCv.notify_one();
+        m_FlushedCv.wait(lock, [&] { return m_FlushedPos >= target || m_Stop; });
     }
 
 private:
-    Logger() {
+    struct Slot {
+        std::atomic<size_t> seq{0};
+        Level level = INFO;
+        std::chrono::system_clock::time_point time;
+        std::string message;
+    };
+
+    Logger() : m_Slots(new Slot[kQueueCapacity]) {
+        for (size_t i = 0; i < kQueueCapacity; ++i)
+            m_Slots[i].seq.store(i, std::memory_order_relaxed);
+
         std::filesystem::create_directory("logs");
         m_File.open("logs/app.log", std::ios::app);
+        m_Writer = std::thread([this] { WriterLoop(); });
     }
     ~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(m_WakeMutex);
+            m_Stop = true;
+        }
+        m_WakeCv.notify_one();
+        if (m_Writer.joinable()) m_Writer.join();
         if (m_File.is_open()) m_File.close();
     }
 
+    // Vyukov bounded queue: each slot's sequence number tells producers
+    // whether it is free for their ticket, so no lock is ever taken.
+    Slot* TryClaim(size_t& pos) {
+        pos = m_EnqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot* slot = &m_Slots[pos & (kQueueCapacity - 1)];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (m_EnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    return slot;
+            } else if (diff < 0) {
+                return nullptr; // Full
+            } else {
+                pos = m_EnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns a slot owned by the caller until Publish, or nullptr if the
+    // message was dropped under OverflowPolicy::Drop.
+    Slot* Claim(Level level, size_t& pos) {
+        bool forceBlock = (level == ERR);
+        for (;;) {
+            if (Slot* slot = TryClaim(pos)) {
+                slot->level = level;
+                slot->time = std::chrono::system_clock::now();
+                return slot;
+            }
+            if (!forceBlock && m_Policy.load(std::memory_order_relaxed) == OverflowPolicy::Drop) {
+                m_Dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            Wake();
+            std::this_thread::yield();
+        }
+    }
+
+    void Publish(Slot* slot, size_t pos, Level level) {
+        slot->seq.store(pos + 1, std::memory_order_release);
+
+        // Only wake the writer when it matters; otherwise it polls on its
+        // flush interval, keeping the producer path free of syscalls.
+        if (level == ERR)
+            Wake();
+    }
+
+    void Wake() {
+        {
+            std::lock_guard<std::mutex> lock(m_WakeMutex);
+            m_WakePending = true;
+        }
+        m_WakeCv.notify_one();
+    }
+
+    // Renders "YYYY-mm-dd HH:MM:SS" once per second instead of per message.
+    const std::string& Timestamp(std::chrono::system_clock::time_point tp) {
+        std::time_t time = std::chrono::system_clock::to_time_t(tp);
+        if (time != m_CachedTime) {
+            std::tm tm;
+#ifdef _WIN32
+            localtime_s(&tm, &time);
+#else
+            localtime_r(&time, &tm);
+#endif
+            char buf[32];
+            std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+            m_CachedStamp = buf;
+            m_CachedTime = time;
+        }
+        return m_CachedStamp;
+    }
+
+    static const char* LevelTag(Level level) {
+        switch (level) {
+            case DEBUG: return "[DEBUG]";
+            case INFO:  return "[INFO]";
+            case WARNING: return "[WARN]";
+            case ERR:   return "[ERROR]";
+        }
+        return "";
+    }
+
+    // Drains every published slot into m_Batch. Returns true if any was ERR.
+    bool Drain() {
+        bool sawError = false;
+        for (;;) {
+            Slot& slot = m_Slots[m_DequeuePos & (kQueueCapacity - 1)];
+            if (slot.seq.load(std::memory_order_acquire) != m_DequeuePos + 1)
+                break;
+
+            size_t lineStart = m_Batch.size();
+            m_Batch += Timestamp(slot.time);
+            m_Batch += ' ';
+            m_Batch += LevelTag(slot.level);
+            m_Batch += ' ';
+            m_Batch += slot.message;
+            m_Batch += '\n';
+
+            // Silent in console unless it's an Error
+            if (slot.level == ERR) {
+                std::cerr.write(m_Batch.data() + lineStart, m_Batch.size() - lineStart);
+                sawError = true;
+            }
+
+            // Keep small buffers for Logf to reuse; release huge one-offs.
+            if (slot.message.capacity() > 4096)
+                std::string().swap(slot.message);
+            else
+                slot.message.clear();
+            slot.seq.store(m_DequeuePos + kQueueCapacity, std::memory_order_release);
+            ++m_DequeuePos;
+        }
+
+        size_t dropped = m_Dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            m_TotalDropped.fetch_add(dropped, std::memory_order_relaxed);
+            m_Batch += Timestamp(std::chrono::system_clock::now());
+            m_Batch += " [WARN] Logger queue full, dropped " + std::to_string(dropped) + " messages\n";
+        }
+        return sawError;
+    }
+
+    void WriterLoop() {
+        auto lastFlush = std::chrono::steady_clock::now();
+        bool flushBehind = false;
+        bool unflushed = false; // Written since the last m_File.flush()
+        for (;;) {
+            bool stop, flushRequested;
+            {
+                // A Flush that Drain could not finish is waiting on a producer
+                // between Claim and Publish, which does not wake us; poll for
+                // it briefly instead of spinning on the unmet target.
+                std::unique_lock<std::mutex> lock(m_WakeMutex);
+                m_WakeCv.wait_for(lock, flushBehind ? kFlushRetry : kFlushInterval,
+                                  [this] { return m_Stop || m_WakePending; });
+                m_WakePending = false;
+                stop = m_Stop;
+                flushRequested = m_FlushTarget > m_FlushedPos;
+            }
+
+            bool sawError = Drain();
+            if (!m_Batch.empty() && m_File.is_open()) {
+                m_File.write(m_Batch.data(), (std::streamsize)m_Batch.size());
+                unflushed = true;
+            }
+            m_Batch.clear();
+
+            auto now = std::chrono::steady_clock::now();
+            if (unflushed && (sawError || flushRequested || stop ||
+                              now - lastFlush >= kFlushInterval)) {
+                m_File.flush();
+                unflushed = false;
+                lastFlush = now;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_WakeMutex);
+                m_FlushedPos = m_DequeuePos;
+                flushBehind = m_FlushTarget > m_FlushedPos;
+            }
+            m_FlushedCv.notify_all();
+            if (stop)
+                return;
+        }
+    }
+
+    std::unique_ptr<Slot[]> m_Slots;
+    alignas(64) std::atomic<size_t> m_EnqueuePos{0};
+    alignas(64) size_t m_DequeuePos = 0; // Writer thread only
+    std::atomic<size_t> m_Dropped{0};
+    std::atomic<size_t> m_TotalDropped{0};
+    std::atomic<OverflowPolicy> m_Policy{OverflowPolicy::Drop};
+    std::atomic<Level> m_MinLevel{(Level)LOG_MIN_LEVEL};
+
+    std::mutex m_WakeMutex;
+    std::condition_variable m_WakeCv;
+    std::condition_variable m_FlushedCv;
+    bool m_WakePending = false;
+    size_t m_FlushTarget = 0;
+    bool m_Stop = false;
+    size_t m_FlushedPos = 0;
+
     std::ofstream m_File;
-    std::mutex m_Mutex;
+    std::thread m_Writer;
+    std::string m_Batch;            // Writer thread only
+    std::time_t m_CachedTime = 0;   // Writer thread only
+    std::string m_CachedStamp;      // Writer thread only
 };
 
-#define LOG_DEBUG(msg) Logger::Get().Log(Logger::DEBUG, msg)
-#define LOG_INFO(msg)  Logger::Get().Log(Logger::INFO, msg)
-#define LOG_WARN(msg)  Logger::Get().Log(Logger::WARNING, msg)
-#define LOG_ERROR(msg) Logger::Get().Log(Logger::ERR, msg)
+// Both checks happen before 'msg' (or the format arguments) are evaluated, so
+// a filtered call costs one relaxed load, and a compiled-out one nothing.
+#define LOG_AT(level, msg)                                                   \
+    do {                                                                     \
+        if constexpr (Logger::IsCompiledIn(level)) {                         \
+            if (Logger::Get().IsEnabled(level))                              \
+                Logger::Get().Log(level, msg);                               \
+        }                                                                    \
+    } while (0)
+
+#define LOGF_AT(level, ...)                                                  \
+    do {                                                                     \
+        if constexpr (Logger::IsCompiledIn(level)) {                         \
+            if (Logger::Get().IsEnabled(level))                              \
+                Logger::Get().Logf(level, __VA_ARGS__);                      \
+        }                                                                    \
+    } while (0)
+
+#define LOG_DEBUG(msg) LOG_AT(Logger::DEBUG, msg)
+#define LOG_INFO(msg)  LOG_AT(Logger::INFO, msg)
+#define LOG_WARN(msg)  LOG_AT(Logger::WARNING, msg)
+#define LOG_ERROR(msg) LOG_AT(Logger::ERR, msg)
+
+#define LOG_DEBUGF(...) LOGF_AT(Logger::DEBUG, __VA_ARGS__)
+#define LOG_INFOF(...)  LOGF_AT(Logger::INFO, __VA_ARGS__)
+#define LOG_WARNF(...)  LOGF_AT(Logger::WARNING, __VA_ARGS__)
+#define LOG_ERRORF(...) LOGF_AT(Logger::ERR, __VA_ARGS__)
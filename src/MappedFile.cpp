@@ -0,0 +1,84 @@
+#include "MappedFile.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::Open(const std::string &path) {
+  Close();
+#ifdef _WIN32
+  // Writers may keep appending (ChatJournal maps its own journal)
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping) {
+    CloseHandle(file);
+    return false;
+  }
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!view) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  m_File = file;
+  m_Mapping = mapping;
+  m_Data = (const char *)view;
+  m_Size = (size_t)size.QuadPart;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void *view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // The mapping keeps the file referenced
+  if (view == MAP_FAILED)
+    return false;
+  m_Data = (const char *)view;
+  m_Size = (size_t)st.st_size;
+#endif
+  return true;
+}
+
+void MappedFile::Close() {
+  if (!m_Data)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(m_Data);
+  CloseHandle(m_Mapping);
+  CloseHandle(m_File);
+  m_Mapping = nullptr;
+  m_File = nullptr;
+#else
+  munmap((void *)m_Data, m_Size);
+#endif
+  m_Data = nullptr;
+  m_Size = 0;
+}
+
+void MappedFile::Prefetch() const {
+  if (!m_Data)
+    return;
+#ifdef _WIN32
+  WIN32_MEMORY_RANGE_ENTRY range{(void *)m_Data, m_Size};
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+  posix_madvise((void *)m_Data, m_Size, POSIX_MADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. Loaders parse straight out of
+// the page cache instead of copying the file through a stream first.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile() { Close(); }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // False if the file is missing, empty or cannot be mapped.
+  bool Open(const std::string &path);
+  void Close();
+
+  const char *Data() const { return m_Data; }
+  size_t Size() const { return m_Size; }
+
+  // Asks the OS to start reading the whole file into the page cache
+  // (madvise WILLNEED / PrefetchVirtualMemory) without waiting for it.
+  void Prefetch() const;
+
+private:
+  const char *m_Data = nullptr;
+  size_t m_Size = 0;
+#ifdef _WIN32
+  void *m_File = nullptr;
+  void *m_Mapping = nullptr;
+#endif
+};
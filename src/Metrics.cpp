@@ -0,0 +1,188 @@
+#include "Metrics.h"
+#include "BinaryIO.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+namespace {
+
+std::string FormatValue(double v) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.17g", v);
+  return buf;
+}
+
+// name{labels,extra} with empty parts omitted.
+std::string Series(const std::string &name, const std::string &labels,
+                   const std::string &extra = "") {
+  if (labels.empty() && extra.empty())
+    return name;
+  std::string out = name + "{" + labels;
+  if (!labels.empty() && !extra.empty())
+    out += ",";
+  return out + extra + "}";
+}
+
+} // namespace
+
+// --- MetricHistogram ---
+
+MetricHistogram::MetricHistogram(std::vector<double> upperBounds)
+    : m_Bounds(std::move(upperBounds)) {
+  std::sort(m_Bounds.begin(), m_Bounds.end());
+  m_Buckets.reset(new std::atomic<uint64_t>[m_Bounds.size() + 1]);
+  for (size_t i = 0; i <= m_Bounds.size(); ++i)
+    m_Buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void MetricHistogram::Observe(double v) {
+  // Bucket lists are short (a dozen bounds), a linear scan beats bsearch.
+  size_t i = 0;
+  while (i < m_Bounds.size() && v > m_Bounds[i])
+    ++i;
+  m_Buckets[i].fetch_add(1, std::memory_order_relaxed);
+  m_Count.fetch_add(1, std::memory_order_relaxed);
+  m_SumMicros.fetch_add((int64_t)(v * 1e6), std::memory_order_relaxed);
+}
+
+double MetricHistogram::Sum() const {
+  return (double)m_SumMicros.load(std::memory_order_relaxed) / 1e6;
+}
+
+// --- Metrics ---
+
+Metrics &Metrics::Get() {
+  static Metrics instance;
+  return instance;
+}
+
+Metrics::~Metrics() { StopFileExport(); }
+
+Metrics::Entry *Metrics::FindLocked(Kind kind, const std::string &name,
+                                    const std::string &labels) {
+  for (auto &e : m_Entries) {
+    if (e.kind == kind && e.name == name && e.labels == labels)
+      return &e;
+  }
+  return nullptr;
+}
+
+MetricCounter &Metrics::Counter(const std::string &name,
+                                const std::string &help,
+                                const std::string &labels) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (Entry *e = FindLocked(Kind::Counter, name, labels))
+    return *e->counter;
+  m_Counters.emplace_back();
+  Entry e{Kind::Counter, name, help, labels};
+  e.counter = &m_Counters.back();
+  m_Entries.push_back(e);
+  return m_Counters.back();
+}
+
+MetricGauge &Metrics::Gauge(const std::string &name, const std::string &help,
+                            const std::string &labels) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (Entry *e = FindLocked(Kind::Gauge, name, labels))
+    return *e->gauge;
+  m_Gauges.emplace_back();
+  Entry e{Kind::Gauge, name, help, labels};
+  e.gauge = &m_Gauges.back();
+  m_Entries.push_back(e);
+  return m_Gauges.back();
+}
+
+MetricHistogram &Metrics::Histogram(const std::string &name,
+                                    const std::string &help,
+                                    std::vector<double> upperBounds,
+                                    const std::string &labels) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (Entry *e = FindLocked(Kind::Histogram, name, labels))
+    return *e->histogram;
+  m_Histograms.emplace_back(std::move(upperBounds));
+  Entry e{Kind::Histogram, name, help, labels};
+  e.histogram = &m_Histograms.back();
+  m_Entries.push_back(e);
+  return m_Histograms.back();
+}
+
+std::string Metrics::FormatText() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+
+  // Group label variants under one HELP/TYPE header, names sorted.
+  std::map<std::string, std::vector<const Entry *>> families;
+  for (const auto &e : m_Entries)
+    families[e.name].push_back(&e);
+
+  std::string out;
+  for (const auto &family : families) {
+    const Entry &first = *family.second.front();
+    out += "# HELP " + first.name + " " + first.help + "\n";
+    const char *type = first.kind == Kind::Counter ? "counter"
+                       : first.kind == Kind::Gauge ? "gauge"
+                                                   : "histogram";
+    out += "# TYPE " + first.name + " " + type + "\n";
+    for (const Entry *e : family.second) {
+      switch (e->kind) {
+      case Kind::Counter:
+        out += Series(e->name, e->labels) + " " +
+               std::to_string(e->counter->Value()) + "\n";
+        break;
+      case Kind::Gauge:
+        out += Series(e->name, e->labels) + " " +
+               FormatValue(e->gauge->Value()) + "\n";
+        break;
+      case Kind::Histogram: {
+        const MetricHistogram &h = *e->histogram;
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < h.UpperBounds().size(); ++i) {
+          cumulative += h.BucketCount(i);
+          out += Series(e->name + "_bucket", e->labels,
+                        "le=\"" + FormatValue(h.UpperBounds()[i]) + "\"") +
+                 " " + std::to_string(cumulative) + "\n";
+        }
+        cumulative += h.BucketCount(h.UpperBounds().size());
+        out += Series(e->name + "_bucket", e->labels, "le=\"+Inf\"") + " " +
+               std::to_string(cumulative) + "\n";
+        out += Series(e->name + "_sum", e->labels) + " " +
+               FormatValue(h.Sum()) + "\n";
+        out += Series(e->name + "_count", e->labels) + " " +
+               std::to_string(cumulative) + "\n";
+        break;
+      }
+      }
+    }
+  }
+  return out;
+}
+
+bool Metrics::WriteFile(const std::string &path) const {
+  return BinaryIO::WriteFileAtomic(path, FormatText());
+}
+
+void Metrics::StartFileExport(const std::string &path,
+                              std::chrono::milliseconds interval) {
+  StopFileExport();
+  m_StopExport = false;
+  m_Exporter = std::thread([this, path, interval] {
+    std::unique_lock<std::mutex> lock(m_ExportMutex);
+    for (;;) {
+      bool stop = m_ExportCv.wait_for(lock, interval,
+                                      [this] { return m_StopExport; });
+      WriteFile(path); // Final write on stop keeps totals complete
+      if (stop)
+        return;
+    }
+  });
+}
+
+void Metrics::StopFileExport() {
+  if (!m_Exporter.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(m_ExportMutex);
+    m_StopExport = true;
+  }
+  m_ExportCv.notify_one();
+  m_Exporter.join();
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Counters, gauges and fixed-bucket histograms exported in the Prometheus
+// text format. Instruments are registered once (cache the returned
+// reference in a function-local static) and updated with relaxed atomics,
+// so the hot path never locks or allocates.
+class MetricCounter {
+public:
+  void Add(uint64_t n = 1) { m_Value.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t Value() const { return m_Value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> m_Value{0};
+};
+
+class MetricGauge {
+public:
+  void Set(double v) { m_Value.store(v, std::memory_order_relaxed); }
+  double Value() const { return m_Value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<double> m_Value{0.0};
+};
+
+class MetricHistogram {
+public:
+  explicit MetricHistogram(std::vector<double> upperBounds);
+  void Observe(double v);
+
+  const std::vector<double> &UpperBounds() const { return m_Bounds; }
+  uint64_t BucketCount(size_t i) const { return m_Buckets[i].load(); }
+  uint64_t Count() const { return m_Count.load(); }
+  double Sum() const;
+
+private:
+  std::vector<double> m_Bounds;
+  std::unique_ptr<std::atomic<uint64_t>[]> m_Buckets; // Non-cumulative
+  std::atomic<uint64_t> m_Count{0};
+  std::atomic<int64_t> m_SumMicros{0}; // Fixed point, avoids CAS on double
+};
+
+class Metrics {
+public:
+  static Metrics &Get();
+  ~Metrics();
+
+  // 'labels' is the inner part of a Prometheus label set, e.g.
+  // model="Phi-3.5". The same name+labels always returns the same instrument.
+  MetricCounter &Counter(const std::string &name, const std::string &help,
+                         const std::string &labels = "");
+  MetricGauge &Gauge(const std::string &name, const std::string &help,
+                     const std::string &labels = "");
+  MetricHistogram &Histogram(const std::string &name, const std::string &help,
+                             std::vector<double> upperBounds,
+                             const std::string &labels = "");
+
+  std::string FormatText() const;
+
+  // Writes to 'path' via a temporary file and rename, so scrapers never
+  // read a partial file.
+  bool WriteFile(const std::string &path) const;
+
+  // Rewrites 'path' every 'interval' on a background thread until stopped.
+  void StartFileExport(const std::string &path,
+                       std::chrono::milliseconds interval);
+  void StopFileExport();
+
+private:
+  Metrics() = default;
+
+  enum class Kind { Counter, Gauge, Histogram };
+  struct Entry {
+    Kind kind;
+    std::string name;
+    std::string help;
+    std::string labels;
+    MetricCounter *counter = nullptr;
+    MetricGauge *gauge = nullptr;
+    MetricHistogram *histogram = nullptr;
+  };
+  Entry *FindLocked(Kind kind, const std::string &name,
+                    const std::string &labels);
+
+  mutable std::mutex m_Mutex;
+  std::vector<Entry> m_Entries;
+  // Deques keep instrument addresses stable as more are registered.
+  std::deque<MetricCounter> m_Counters;
+  std::deque<MetricGauge> m_Gauges;
+  std::deque<MetricHistogram> m_Histograms;
+
+  std::thread m_Exporter;
+  std::mutex m_ExportMutex;
+  std::condition_variable m_ExportCv;
+  bool m_StopExport = false;
+};
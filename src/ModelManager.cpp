@@ -0,0 +1,162 @@
+#include "ModelManager.h"
+#include "LlamaManager.h"
+#include "Logger.h"
+#include "MappedFile.h"
+#include "Metrics.h"
+#include "ProcessMemory.h"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+
+uint64_t ModelManager::DefaultBudget() {
+  uint64_t physical = ProcessMemory::PhysicalBytes();
+  return physical ? physical / 2 : 4ull << 30;
+}
+
+void ModelManager::InitBackend() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+    llama_backend_init();
+    std::atexit(llama_backend_free);
+  });
+}
+
+ModelManager::ModelPtr ModelManager::LoadModel(const std::string &path,
+                                               const LlamaOptions &options) {
+  InitBackend();
+  auto params = llama_model_default_params();
+  params.n_gpu_layers = options.gpuLayers;
+  params.use_mmap = options.useMmap;
+  params.use_mlock = options.useMlock;
+
+  // Start the disk reads now; they overlap with llama.cpp parsing the
+  // GGUF metadata and share the page cache with its own mapping.
+  MappedFile prefetch;
+  if (options.useMmap && options.prefetch && prefetch.Open(path))
+    prefetch.Prefetch();
+
+  llama_model *model = llama_model_load_from_file(path.c_str(), params);
+  if (!model)
+    return nullptr;
+  return ModelPtr(model, llama_model_free);
+}
+
+ModelManager::ModelManager(uint64_t budgetBytes) : m_Budget(budgetBytes) {}
+
+ModelManager::ModelPtr ModelManager::Acquire(const std::string &path,
+                                             const LlamaOptions &options) {
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  for (;;) {
+    Slot *slot = FindLocked(path);
+    if (!slot)
+      break;
+    if (slot->model) {
+      slot->lastUse = ++m_UseClock;
+      return slot->model;
+    }
+    m_Loaded.wait(lock); // Another thread is loading it
+  }
+
+  // The GGUF size is a close estimate of the weights until they are
+  // loaded. The pending slot counts it against the budget meanwhile.
+  std::error_code ec;
+  uint64_t estimate = std::filesystem::file_size(path, ec);
+  if (ec)
+    estimate = 0;
+  EvictIdle(estimate);
+  m_Slots.push_back({path, nullptr, estimate, ++m_UseClock});
+
+  lock.unlock();
+  ModelPtr model = LoadModel(path, options);
+  lock.lock();
+
+  Slot *slot = FindLocked(path); // Pending slots are never evicted
+  if (model) {
+    slot->model = model;
+    slot->bytes = llama_model_size(model.get());
+  } else {
+    m_Slots.erase(m_Slots.begin() + (slot - m_Slots.data()));
+  }
+  m_Loaded.notify_all();
+  if (!model)
+    return nullptr;
+  EvictIdle(0);
+  if (ResidentLocked() > m_Budget)
+    LOG_WARNF("Models resident (%llu MB) exceed the %llu MB budget",
+                 (unsigned long long)(ResidentLocked() >> 20),
+                 (unsigned long long)(m_Budget >> 20));
+  PublishLocked();
+  return model;
+}
+
+void ModelManager::Trim() {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  EvictIdle(0);
+  PublishLocked();
+}
+
+uint64_t ModelManager::Budget() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Budget;
+}
+
+void ModelManager::SetBudget(uint64_t budgetBytes) {
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Budget = budgetBytes;
+  }
+  Trim();
+}
+
+uint64_t ModelManager::ResidentBytes() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return ResidentLocked();
+}
+
+std::vector<ModelManager::Resident> ModelManager::Models() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  std::vector<Resident> out;
+  for (const Slot &slot : m_Slots)
+    out.push_back(
+        {slot.path, slot.bytes, !slot.model || slot.model.use_count() > 1});
+  return out;
+}
+
+void ModelManager::EvictIdle(uint64_t incoming) {
+  while (ResidentLocked() + incoming > m_Budget) {
+    // Only this manager holds an idle model; a loading one has none yet
+    auto victim = m_Slots.end();
+    for (auto it = m_Slots.begin(); it != m_Slots.end(); ++it)
+      if (it->model.use_count() == 1 &&
+          (victim == m_Slots.end() || it->lastUse < victim->lastUse))
+        victim = it;
+    if (victim == m_Slots.end())
+      return;
+    LOG_INFOF("Unloading %s to stay within the model budget",
+              victim->path.c_str());
+    m_Slots.erase(victim);
+  }
+}
+
+ModelManager::Slot *ModelManager::FindLocked(const std::string &path) {
+  for (Slot &slot : m_Slots)
+    if (slot.path == path)
+      return &slot;
+  return nullptr;
+}
+
+uint64_t ModelManager::ResidentLocked() const {
+  uint64_t total = 0;
+  for (const Slot &slot : m_Slots)
+    total += slot.bytes;
+  return total;
+}
+
+void ModelManager::PublishLocked() const {
+  static MetricGauge &resident = Metrics::Get().Gauge(
+      "cmdai_models_resident_bytes", "Model weights kept loaded");
+  static MetricGauge &count = Metrics::Get().Gauge(
+      "cmdai_models_resident", "Models kept loaded, active or warm");
+  resident.Set((double)ResidentLocked());
+  count.Set((double)m_Slots.size());
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "llama.h"
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct LlamaOptions;
+
+// Owns loaded model weights so switching models never holds two copies it
+// cannot afford. Models stay warm after their LlamaManager goes away and
+// are evicted least recently used first once the RAM budget is exceeded.
+// Weights are memory-mapped (optionally mlocked) straight from the GGUF.
+//
+// Budgets count weights only (llama_model_size); the caller releases its
+// context, and with it the KV cache, before acquiring the next model.
+class ModelManager {
+public:
+  using ModelPtr = std::shared_ptr<llama_model>;
+
+  struct Resident {
+    std::string path;
+    uint64_t bytes;
+    bool inUse; // Held by a LlamaManager or still loading: not evictable
+  };
+
+  // Half the installed RAM: room for one or two small models plus the app.
+  static uint64_t DefaultBudget();
+  // llama_backend_init once per process; released at exit.
+  static void InitBackend();
+  // Loads without budget tracking (tools that load exactly one model).
+  static ModelPtr LoadModel(const std::string &path,
+                            const LlamaOptions &options);
+
+  explicit ModelManager(uint64_t budgetBytes = DefaultBudget());
+
+  // Warm model for 'path', or loads it after evicting idle models until it
+  // fits. Loads even if it cannot fit (a single model over budget must
+  // still run); null if loading fails. The load runs without the lock, so
+  // the accessors below stay quick meanwhile; a second Acquire of the same
+  // path waits for it.
+  ModelPtr Acquire(const std::string &path, const LlamaOptions &options);
+  // Evicts idle models until the resident total fits the budget.
+  void Trim();
+
+  uint64_t Budget() const;
+  void SetBudget(uint64_t budgetBytes); // Trims
+  uint64_t ResidentBytes() const;
+  std::vector<Resident> Models() const;
+
+private:
+  struct Slot {
+    std::string path;
+    ModelPtr model; // Null while loading
+    uint64_t bytes; // The file size until loaded
+    uint64_t lastUse;
+  };
+
+  // Drops idle slots, least recently used first, until 'incoming' more
+  // bytes fit. Caller holds m_Mutex.
+  void EvictIdle(uint64_t incoming);
+  Slot *FindLocked(const std::string &path);
+  uint64_t ResidentLocked() const;
+  void PublishLocked() const;
+
+  mutable std::mutex m_Mutex;
+  std::condition_variable m_Loaded;
+  uint64_t m_Budget;
+  uint64_t m_UseClock = 0;
+  std::vector<Slot> m_Slots;
+};
@@ -0,0 +1,142 @@
+#include "OutputDigest.h"
+#include "TextScan.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+struct Line {
+  std::string_view text;
+  size_t repeats;
+};
+
+// No tokenizer packs more than this many bytes into a token on average,
+// so longer lines cannot fit and are cut before being counted
+constexpr size_t kMaxBytesPerToken = 16;
+// Smallest room worth filling with the start of a line that is too long
+constexpr size_t kMinCutTokens = 16;
+
+std::string Render(const Line &line, size_t maxBytes) {
+  std::string_view text = line.text;
+  if (text.size() > maxBytes)
+    text = text.substr(
+        0, TextScan::Utf8CompletePrefix(text.substr(0, maxBytes)));
+  std::string out(text);
+  if (line.repeats > 1)
+    out += "  [repeated " + std::to_string(line.repeats) + " times]";
+  out += '\n';
+  return out;
+}
+
+// Start of 'text' that fits 'room' tokens; empty if none does
+std::string CutToFit(std::string_view text, size_t room,
+                     const OutputDigest::CountFn &countTokens,
+                     size_t &tokens) {
+  size_t len = std::min(text.size(), room * 4);
+  for (int tries = 0; tries < 8 && len > 0; ++tries) {
+    std::string out(text.substr(0, TextScan::Utf8CompletePrefix(
+                                       text.substr(0, len))));
+    out += " [line cut]\n";
+    tokens = countTokens(out);
+    if (tokens <= room)
+      return out;
+    len = len * room / tokens * 9 / 10;
+  }
+  tokens = 0;
+  return {};
+}
+
+std::string OmittedMarker(size_t lines) {
+  return "[... " + std::to_string(lines) + " lines omitted ...]\n";
+}
+
+} // namespace
+
+OutputDigest OutputDigest::Build(std::string_view output, size_t tokenBudget,
+                                 const CountFn &countTokens) {
+  OutputDigest digest;
+
+  std::vector<Line> folded;
+  size_t pos = 0;
+  while (pos < output.size()) {
+    size_t end = output.find('\n', pos);
+    if (end == std::string_view::npos)
+      end = output.size();
+    std::string_view line = output.substr(pos, end - pos);
+    pos = end + 1;
+    ++digest.lines;
+    while (!line.empty() &&
+           (line.back() == '\r' || line.back() == ' ' || line.back() == '\t'))
+      line.remove_suffix(1);
+    // Progress bars redraw the line after a bare CR; keep the final state
+    size_t cr = line.rfind('\r');
+    if (cr != std::string_view::npos)
+      line.remove_prefix(cr + 1);
+    if (!folded.empty() && folded.back().text == line) {
+      ++folded.back().repeats;
+      ++digest.foldedLines;
+      continue;
+    }
+    folded.push_back({line, 1});
+  }
+
+  // Head gets the first half, tail what is left after keeping room for the
+  // omission marker, and the head any tail budget that went unused. Lines
+  // are only rendered and counted as they are taken.
+  const size_t maxBytes = tokenBudget * kMaxBytesPerToken;
+  const size_t markerTokens = countTokens(OmittedMarker(digest.lines));
+  std::vector<std::string> head, tail;
+  size_t used = 0;
+  size_t lo = 0, hi = folded.size(); // Not taken yet
+  auto takeHead = [&](size_t limit) {
+    while (lo < hi) {
+      std::string text = Render(folded[lo], maxBytes);
+      size_t t = countTokens(text);
+      if (used + t > limit)
+        return;
+      used += t;
+      head.push_back(std::move(text));
+      ++lo;
+    }
+  };
+  const size_t room =
+      tokenBudget > markerTokens ? tokenBudget - markerTokens : 0;
+  takeHead(tokenBudget / 2);
+  while (hi > lo) {
+    std::string text = Render(folded[hi - 1], maxBytes);
+    size_t t = countTokens(text);
+    if (used + t > room)
+      break;
+    used += t;
+    tail.push_back(std::move(text));
+    --hi;
+  }
+  takeHead(room);
+
+  // A line longer than the space left (minified JSON, a base64 blob) still
+  // shows its start
+  if (lo < hi && room > used + kMinCutTokens) {
+    size_t t = 0;
+    std::string cut = CutToFit(folded[lo].text.substr(0, maxBytes),
+                               room - used, countTokens, t);
+    if (!cut.empty()) {
+      used += t;
+      head.push_back(std::move(cut));
+      digest.truncatedLine = true;
+      ++lo;
+    }
+  }
+
+  for (const std::string &line : head)
+    digest.text += line;
+  if (lo < hi) {
+    for (size_t i = lo; i < hi; ++i)
+      digest.omittedLines += folded[i].repeats;
+    digest.text += OmittedMarker(digest.omittedLines);
+    used += markerTokens;
+  }
+  for (auto it = tail.rbegin(); it != tail.rend(); ++it)
+    digest.text += *it;
+  digest.tokens = used;
+  return digest;
+}
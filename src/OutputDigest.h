@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Command output fitted into a token budget so it can go back to the
+// model. Runs of identical lines fold into one with a count, carriage-
+// return progress redraws keep only their last state, and whatever still
+// does not fit is cut from the middle: the head usually says what ran, the
+// tail how it ended (errors, summaries). Linear in the output size; only
+// the lines that are kept get their tokens counted.
+struct OutputDigest {
+  std::string text;
+  size_t lines = 0;         // In the original output
+  size_t foldedLines = 0;   // Repeats folded into the line before them
+  size_t omittedLines = 0;  // Cut from the middle
+  size_t tokens = 0;        // Of 'text', as counted by 'countTokens'
+  bool truncatedLine = false; // A single line was too long and was cut
+
+  using CountFn = std::function<size_t(std::string_view)>;
+  static OutputDigest Build(std::string_view output, size_t tokenBudget,
+                            const CountFn &countTokens);
+
+  // About four bytes per token; for providers without a tokenizer
+  static size_t EstimateTokens(std::string_view text) {
+    return text.size() / 4 + 1;
+  }
+};
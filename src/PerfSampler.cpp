@@ -0,0 +1,71 @@
+#include "PerfSampler.h"
+#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+void PerfSampler::FrameTick() {
+  double wall = WallMs();
+  double cpu = ThreadCpuMs();
+  if (m_HasLast)
+    AddSample((float)(wall - m_LastWallMs), (float)(cpu - m_LastCpuMs));
+  m_LastWallMs = wall;
+  m_LastCpuMs = cpu;
+  m_HasLast = true;
+}
+
+void PerfSampler::AddSample(float frameMs, float cpuMs) {
+  m_FrameMs[m_Head] = frameMs;
+  m_CpuMs[m_Head] = cpuMs;
+  m_Head = (m_Head + 1) % kCapacity;
+  if (m_Count < kCapacity)
+    ++m_Count;
+}
+
+float PerfSampler::LatestFrameMs() const {
+  return m_Count ? m_FrameMs[(m_Head + kCapacity - 1) % kCapacity] : 0.0f;
+}
+
+float PerfSampler::LatestCpuMs() const {
+  return m_Count ? m_CpuMs[(m_Head + kCapacity - 1) % kCapacity] : 0.0f;
+}
+
+float PerfSampler::AverageFrameMs() const {
+  if (m_Count == 0)
+    return 0.0f;
+  double sum = 0;
+  for (size_t i = 0; i < m_Count; ++i)
+    sum += m_FrameMs[i];
+  return (float)(sum / m_Count);
+}
+
+float PerfSampler::MaxFrameMs() const {
+  float max = 0.0f;
+  for (size_t i = 0; i < m_Count; ++i)
+    max = m_FrameMs[i] > max ? m_FrameMs[i] : max;
+  return max;
+}
+
+double PerfSampler::ThreadCpuMs() {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    return 0.0;
+  auto to100ns = [](const FILETIME &ft) {
+    return ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+  };
+  return (to100ns(kernel) + to100ns(user)) / 1e4;
+#else
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#endif
+}
+
+double PerfSampler::WallMs() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
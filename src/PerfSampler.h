@@ -0,0 +1,43 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Rolling window of per-frame wall and CPU times for the perf overlay.
+// Owned and fed by the UI thread; the arrays are laid out as a ring so they
+// can go straight to ImGui::PlotLines with Offset() as values_offset.
+class PerfSampler {
+public:
+  static constexpr size_t kCapacity = 240; // ~4s at 60 fps
+
+  // Call once at the top of every rendered frame. Records the time since
+  // the previous call; a gap (e.g. the window was hidden) restarts timing.
+  void FrameTick();
+  void Reset() { m_HasLast = false; }
+
+  void AddSample(float frameMs, float cpuMs);
+
+  const float *FrameTimes() const { return m_FrameMs.data(); }
+  const float *CpuTimes() const { return m_CpuMs.data(); }
+  size_t Count() const { return m_Count; }
+  size_t Offset() const { return m_Count < kCapacity ? 0 : m_Head; }
+
+  float LatestFrameMs() const;
+  float LatestCpuMs() const;
+  float AverageFrameMs() const;
+  float MaxFrameMs() const;
+
+  // CPU time consumed by the calling thread so far.
+  static double ThreadCpuMs();
+  static double WallMs();
+
+private:
+  std::array<float, kCapacity> m_FrameMs{};
+  std::array<float, kCapacity> m_CpuMs{};
+  size_t m_Head = 0; // Next write position
+  size_t m_Count = 0;
+
+  bool m_HasLast = false;
+  double m_LastWallMs = 0;
+  double m_LastCpuMs = 0;
+};
@@ -0,0 +1,78 @@
+#include "ProcessMemory.h"
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fstream>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+uint64_t ProcessMemory::CurrentRssBytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters{};
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return counters.WorkingSetSize;
+#else
+  std::ifstream statm("/proc/self/statm");
+  uint64_t sizePages = 0, residentPages = 0;
+  if (!(statm >> sizePages >> residentPages))
+    return 0;
+  return residentPages * (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+uint64_t ProcessMemory::PeakRssBytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters{};
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return (uint64_t)usage.ru_maxrss * 1024; // KiB on Linux
+#endif
+}
+
+uint64_t ProcessMemory::PhysicalBytes() {
+#ifdef _WIN32
+  MEMORYSTATUSEX status{};
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status))
+    return 0;
+  return status.ullTotalPhys;
+#else
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long pageSize = sysconf(_SC_PAGESIZE);
+  return pages > 0 && pageSize > 0 ? (uint64_t)pages * (uint64_t)pageSize : 0;
+#endif
+}
+
+PeakRssProbe::PeakRssProbe(std::chrono::milliseconds interval) {
+  Sample();
+  m_Thread = std::thread([this, interval]() {
+    while (!m_Stop.load(std::memory_order_relaxed)) {
+      std::this_thread::sleep_for(interval);
+      Sample();
+    }
+  });
+}
+
+uint64_t PeakRssProbe::Stop() {
+  m_Stop = true;
+  if (m_Thread.joinable()) {
+    m_Thread.join();
+    Sample(); // Whatever is left at the end counts too
+  }
+  return m_Peak.load();
+}
+
+void PeakRssProbe::Sample() {
+  uint64_t rss = ProcessMemory::CurrentRssBytes();
+  uint64_t peak = m_Peak.load(std::memory_order_relaxed);
+  while (rss > peak &&
+         !m_Peak.compare_exchange_weak(peak, rss, std::memory_order_relaxed)) {
+  }
+}
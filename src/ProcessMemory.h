@@ -0,0 +1,35 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// Process and machine memory figures for the model budget and reports.
+class ProcessMemory {
+public:
+  static uint64_t CurrentRssBytes(); // Working set / resident set now
+  static uint64_t PeakRssBytes();    // High-water mark since process start
+  static uint64_t PhysicalBytes();   // Installed RAM
+};
+
+// Samples the resident set on a background thread until stopped. The OS
+// high-water mark cannot be reset, so this is how one phase (a model
+// switch) gets its own peak.
+class PeakRssProbe {
+public:
+  explicit PeakRssProbe(
+      std::chrono::milliseconds interval = std::chrono::milliseconds(5));
+  ~PeakRssProbe() { Stop(); }
+  PeakRssProbe(const PeakRssProbe &) = delete;
+  PeakRssProbe &operator=(const PeakRssProbe &) = delete;
+
+  // Stops sampling (idempotent) and returns the peak in bytes.
+  uint64_t Stop();
+
+private:
+  void Sample();
+
+  std::atomic<bool> m_Stop{false};
+  std::atomic<uint64_t> m_Peak{0};
+  std::thread m_Thread;
+};
@@ -0,0 +1,203 @@
+#include "ReplayAIProvider.h"
+#include "TextScan.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Sleeping to absolute deadlines keeps rounding in each sleep from adding
+// up over a long response.
+void WaitUntil(Clock::time_point deadline) {
+  if (deadline > Clock::now())
+    std::this_thread::sleep_until(deadline);
+}
+
+} // namespace
+
+std::string RecordedResponse::Text() const {
+  std::string text;
+  for (const RecordedPiece &piece : pieces)
+    text += piece.text;
+  return text;
+}
+
+bool ResponseRecording::Save(const std::string &path,
+                             const std::vector<RecordedResponse> &responses) {
+  std::error_code ec;
+  std::filesystem::path target(path);
+  if (!target.parent_path().empty())
+    std::filesystem::create_directories(target.parent_path(), ec);
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file)
+    return false;
+  file << "# cmdAI response recording v1\n";
+  for (const RecordedResponse &response : responses) {
+    file << "request\t" << TextScan::EscapeField(response.input) << "\n";
+    for (const RecordedPiece &piece : response.pieces)
+      file << "piece\t" << piece.delayNs << "\t"
+           << TextScan::EscapeField(piece.text) << "\n";
+  }
+  return (bool)file;
+}
+
+bool ResponseRecording::Load(const std::string &path,
+                             std::vector<RecordedResponse> &responses) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.rfind("request\t", 0) == 0) {
+      responses.push_back({TextScan::UnescapeField(line.substr(8)), {}});
+    } else if (line.rfind("piece\t", 0) == 0 && !responses.empty()) {
+      size_t tab = line.find('\t', 6);
+      if (tab == std::string::npos)
+        continue;
+      RecordedPiece piece;
+      piece.delayNs = std::atoll(line.c_str() + 6);
+      piece.text = TextScan::UnescapeField(line.substr(tab + 1));
+      responses.back().pieces.push_back(std::move(piece));
+    }
+  }
+  return true;
+}
+
+ReplayAIProvider::ReplayAIProvider(std::vector<RecordedResponse> responses,
+                                   double speed, const std::string &name)
+    : m_Responses(std::move(responses)), m_Uses(m_Responses.size(), 0),
+      m_Speed(speed), m_Name(name) {}
+
+const RecordedResponse &ReplayAIProvider::Next(const std::string &input) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  // Least-replayed recording for this exact input first, so a session with
+  // repeated prompts replays each answer in its original order.
+  size_t best = m_Responses.size();
+  for (size_t i = 0; i < m_Responses.size(); ++i) {
+    if (m_Responses[i].input == input &&
+        (best == m_Responses.size() || m_Uses[i] < m_Uses[best]))
+      best = i;
+  }
+  if (best == m_Responses.size()) {
+    best = m_Cursor;
+    m_Cursor = (m_Cursor + 1) % m_Responses.size();
+  }
+  ++m_Uses[best];
+  return m_Responses[best];
+}
+
+std::string ReplayAIProvider::GenerateCommand(
+    const std::string &input,
+    std::function<void(const std::string &)> callback) {
+  if (m_Responses.empty())
+    return "Error: Nothing to replay.";
+
+  const RecordedResponse &response = Next(input);
+  std::string text;
+  Clock::time_point deadline = Clock::now();
+  for (const RecordedPiece &piece : response.pieces) {
+    if (m_Speed > 0) {
+      deadline += std::chrono::nanoseconds((int64_t)(piece.delayNs / m_Speed));
+      WaitUntil(deadline);
+    }
+    if (m_Cancel)
+      return kCancelled;
+    text += piece.text;
+    if (callback)
+      callback(piece.text);
+  }
+  return text;
+}
+
+SyntheticAIProvider::SyntheticAIProvider(double tokensPerSecond,
+                                         std::chrono::milliseconds ttft,
+                                         const std::string &name)
+    : m_TokensPerSecond(tokensPerSecond), m_Ttft(ttft), m_Name(name) {}
+
+std::vector<std::string>
+SyntheticAIProvider::Pieces(const std::string &input) {
+  // Echo the prompt (JSON-safe) so every request yields a distinct, valid
+  // and harmless command; split roughly the way a BPE vocabulary would.
+  std::string safe;
+  for (char c : input) {
+    if (c == '"' || c == '\\' || (unsigned char)c < 0x20)
+      continue;
+    safe += c;
+  }
+  const std::string response = "{\"cmd\": \"echo " + safe +
+                               "\", \"why\": \"Synthetic response for load "
+                               "testing.\"}";
+  std::vector<std::string> pieces;
+  size_t start = 0;
+  while (start < response.size()) {
+    size_t len = 1;
+    while (start + len < response.size() && len < 4 &&
+           response[start + len] != ' ')
+      ++len;
+    pieces.push_back(response.substr(start, len));
+    start += len;
+  }
+  return pieces;
+}
+
+std::string SyntheticAIProvider::GenerateCommand(
+    const std::string &input,
+    std::function<void(const std::string &)> callback) {
+  const bool paced = m_TokensPerSecond > 0;
+  const auto interval = std::chrono::nanoseconds(
+      paced ? (int64_t)(1e9 / m_TokensPerSecond) : 0);
+  Clock::time_point deadline = Clock::now() + m_Ttft;
+  if (paced || m_Ttft.count() > 0)
+    WaitUntil(deadline);
+
+  std::string text;
+  bool first = true;
+  for (const std::string &piece : Pieces(input)) {
+    if (paced && !first) {
+      deadline += interval;
+      WaitUntil(deadline);
+    }
+    first = false;
+    if (m_Cancel)
+      return kCancelled;
+    text += piece;
+    if (callback)
+      callback(piece);
+  }
+  return text;
+}
+
+RecordingAIProvider::RecordingAIProvider(std::unique_ptr<IAIProvider> inner)
+    : m_Inner(std::move(inner)) {}
+
+std::string RecordingAIProvider::GenerateCommand(
+    const std::string &input,
+    std::function<void(const std::string &)> callback) {
+  RecordedResponse response{input, {}};
+  Clock::time_point last = Clock::now();
+  std::string text =
+      m_Inner->GenerateCommand(input, [&](const std::string &piece) {
+        Clock::time_point now = Clock::now();
+        response.pieces.push_back(
+            {std::chrono::duration_cast<std::chrono::nanoseconds>(now - last)
+                 .count(),
+             piece});
+        last = now;
+        if (callback)
+          callback(piece);
+      });
+  // Errors come back without being streamed; keep them replayable.
+  if (response.pieces.empty() && !text.empty())
+    response.pieces.push_back({0, text});
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Recorded.push_back(std::move(response));
+  return text;
+}
+
+std::vector<RecordedResponse> RecordingAIProvider::Recorded() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Recorded;
+}
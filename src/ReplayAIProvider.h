@@ -0,0 +1,131 @@
+#pragma once
+#include "IAIProvider.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One streamed piece and the time since the previous one (or since the
+// request started, for the first piece).
+struct RecordedPiece {
+  int64_t delayNs = 0;
+  std::string text;
+};
+
+struct RecordedResponse {
+  std::string input;
+  std::vector<RecordedPiece> pieces;
+
+  std::string Text() const;
+};
+
+// Text file of recorded responses, one "request" line per response followed
+// by its "piece" lines. Tabs, newlines and backslashes are escaped.
+class ResponseRecording {
+public:
+  static bool Save(const std::string &path,
+                   const std::vector<RecordedResponse> &responses);
+  static bool Load(const std::string &path,
+                   std::vector<RecordedResponse> &responses);
+};
+
+// Replays recorded responses through the streaming callback with their
+// original inter-token timing scaled by 'speed' (0 streams without
+// waiting). A request is answered by the next recording made for the same
+// input, falling back to the recordings in order. Cancel() stops it before
+// the next piece. Safe to call from several threads at once.
+class ReplayAIProvider : public IAIProvider {
+public:
+  explicit ReplayAIProvider(std::vector<RecordedResponse> responses,
+                            double speed = 1.0,
+                            const std::string &name = "Replay");
+
+  std::string GenerateCommand(
+      const std::string &input,
+      std::function<void(const std::string &)> callback = nullptr) override;
+  void ResetContext() override {}
+  std::string GetModelName() const override { return m_Name; }
+  void Cancel() override { m_Cancel = true; }
+  void ResetCancel() override { m_Cancel = false; }
+
+private:
+  const RecordedResponse &Next(const std::string &input);
+
+  std::mutex m_Mutex; // Guards the selection state below
+  std::vector<RecordedResponse> m_Responses;
+  std::vector<size_t> m_Uses; // Times each recording has been replayed
+  size_t m_Cursor = 0;
+  double m_Speed;
+  std::string m_Name;
+  std::atomic<bool> m_Cancel = false;
+};
+
+// Streams a well-formed {"cmd", "why"} response for any input after
+// 'ttft', then at 'tokensPerSecond' (0 or less streams without waiting).
+// Output is a pure function of the input, so runs are reproducible.
+// Cancel() stops it before the next piece.
+class SyntheticAIProvider : public IAIProvider {
+public:
+  explicit SyntheticAIProvider(double tokensPerSecond = 30.0,
+                               std::chrono::milliseconds ttft =
+                                   std::chrono::milliseconds(150),
+                               const std::string &name = "Synthetic");
+
+  std::string GenerateCommand(
+      const std::string &input,
+      std::function<void(const std::string &)> callback = nullptr) override;
+  void ResetContext() override {}
+  std::string GetModelName() const override { return m_Name; }
+  void Cancel() override { m_Cancel = true; }
+  void ResetCancel() override { m_Cancel = false; }
+
+  // The pieces streamed for 'input', without any timing.
+  static std::vector<std::string> Pieces(const std::string &input);
+
+private:
+  double m_TokensPerSecond;
+  std::chrono::milliseconds m_Ttft;
+  std::string m_Name;
+  std::atomic<bool> m_Cancel = false;
+};
+
+// Passes requests through to another provider and keeps what it streamed,
+// with timings, so a session can be saved and replayed exactly.
+class RecordingAIProvider : public IAIProvider {
+public:
+  explicit RecordingAIProvider(std::unique_ptr<IAIProvider> inner);
+
+  std::string GenerateCommand(
+      const std::string &input,
+      std::function<void(const std::string &)> callback = nullptr) override;
+  void ResetContext() override { m_Inner->ResetContext(); }
+  std::string GetModelName() const override { return m_Inner->GetModelName(); }
+  std::string GetPromptFormat() const override {
+    return m_Inner->GetPromptFormat();
+  }
+  bool Embed(const std::string &text, std::vector<float> &out) override {
+    return m_Inner->Embed(text, out);
+  }
+  void Prefill(const std::string &partialInput) override {
+    m_Inner->Prefill(partialInput);
+  }
+  size_t TurnTokenBudget() override { return m_Inner->TurnTokenBudget(); }
+  size_t CountTokens(std::string_view text) const override {
+    return m_Inner->CountTokens(text);
+  }
+  float PrefillProgress() const override { return m_Inner->PrefillProgress(); }
+  void Cancel() override { m_Inner->Cancel(); }
+  void ResetCancel() override { m_Inner->ResetCancel(); }
+
+  std::vector<RecordedResponse> Recorded() const;
+  // Hands the wrapped provider back; this object is unusable afterwards.
+  std::unique_ptr<IAIProvider> Release() { return std::move(m_Inner); }
+
+private:
+  std::unique_ptr<IAIProvider> m_Inner;
+  mutable std::mutex m_Mutex;
+  std::vector<RecordedResponse> m_Recorded;
+};
@@ -0,0 +1,172 @@
+#include "ResponseCache.h"
+#include "BinaryIO.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+constexpr char kMagic[4] = {'C', 'M', 'D', 'C'};
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kMaxStringBytes = 64 * 1024;
+
+} // namespace
+
+ResponseCache::ResponseCache(size_t maxEntries)
+    : m_MaxEntries(maxEntries ? maxEntries : 1) {}
+
+std::string ResponseCache::NormalizeIntent(std::string_view intent) {
+  std::string out;
+  out.reserve(intent.size());
+  bool pendingSpace = false;
+  for (char c : intent) {
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+      pendingSpace = !out.empty();
+      continue;
+    }
+    if (pendingSpace)
+      out += ' ';
+    pendingSpace = false;
+    out += (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+  }
+  while (!out.empty() &&
+         (out.back() == '?' || out.back() == '.' || out.back() == '!'))
+    out.pop_back();
+  return out;
+}
+
+std::string ResponseCache::MakeKey(std::string_view intent,
+                                   std::string_view model,
+                                   std::string_view promptFormat) {
+  return JoinKey({NormalizeIntent(intent), model, promptFormat});
+}
+
+std::string ResponseCache::JoinKey(
+    std::initializer_list<std::string_view> parts) {
+  // Unit separators cannot come from the input bar
+  std::string key;
+  for (const std::string_view *part = parts.begin(); part != parts.end();
+       ++part) {
+    if (part != parts.begin())
+      key += '\x1f';
+    key.append(part->data(), part->size());
+  }
+  return key;
+}
+
+bool ResponseCache::Lookup(const std::string &key, Entry &out) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto it = m_Index.find(key);
+  if (it == m_Index.end()) {
+    ++m_Misses;
+    return false;
+  }
+  m_Items.splice(m_Items.begin(), m_Items, it->second);
+  out = it->second->second;
+  ++m_Hits;
+  return true;
+}
+
+void ResponseCache::Insert(const std::string &key, Entry entry) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto it = m_Index.find(key);
+  if (it != m_Index.end()) {
+    it->second->second = std::move(entry);
+    m_Items.splice(m_Items.begin(), m_Items, it->second);
+    return;
+  }
+  m_Items.emplace_front(key, std::move(entry));
+  m_Index.emplace(key, m_Items.begin());
+  EvictLocked();
+}
+
+bool ResponseCache::Invalidate(const std::string &key) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto it = m_Index.find(key);
+  if (it == m_Index.end())
+    return false;
+  m_Items.erase(it->second);
+  m_Index.erase(it);
+  return true;
+}
+
+void ResponseCache::Clear() {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Items.clear();
+  m_Index.clear();
+}
+
+void ResponseCache::EvictLocked() {
+  while (m_Items.size() > m_MaxEntries) {
+    m_Index.erase(m_Items.back().first);
+    m_Items.pop_back();
+  }
+}
+
+size_t ResponseCache::Size() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Items.size();
+}
+
+uint64_t ResponseCache::Hits() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Hits;
+}
+
+uint64_t ResponseCache::Misses() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Misses;
+}
+
+bool ResponseCache::Save(const std::string &path) const {
+  std::string data(kMagic, sizeof(kMagic));
+  BinaryIO::PutU32(data, kVersion);
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    BinaryIO::PutU32(data, (uint32_t)m_Items.size());
+    // Oldest first, so loading by Insert() rebuilds the same LRU order
+    for (auto it = m_Items.rbegin(); it != m_Items.rend(); ++it) {
+      BinaryIO::PutString(data, it->first);
+      BinaryIO::PutString(data, it->second.command);
+      BinaryIO::PutString(data, it->second.explanation);
+      BinaryIO::PutU32(data, (uint32_t)it->second.riskScore);
+      BinaryIO::PutU32(data, it->second.riskValid ? 1 : 0);
+      BinaryIO::PutString(data, it->second.riskReason);
+    }
+  }
+
+  return BinaryIO::WriteFileAtomic(path, data);
+}
+
+bool ResponseCache::Load(const std::string &path) {
+  Clear();
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+  std::string data((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  if (data.size() < 12 || std::memcmp(data.data(), kMagic, 4) != 0)
+    return false;
+
+  BinaryIO::Reader reader{data.data(), data.size(), 4};
+  if (reader.U32() != kVersion)
+    return false;
+  uint32_t count = reader.U32();
+  std::vector<Item> items;
+  for (uint32_t i = 0; i < count && reader.ok; ++i) {
+    Item item;
+    item.first = reader.String(kMaxStringBytes);
+    item.second.command = reader.String(kMaxStringBytes);
+    item.second.explanation = reader.String(kMaxStringBytes);
+    item.second.riskScore = (int)reader.U32();
+    item.second.riskValid = reader.U32() != 0;
+    item.second.riskReason = reader.String(kMaxStringBytes);
+    items.push_back(std::move(item));
+  }
+  if (!reader.ok)
+    return false; // Truncated or corrupt: start empty rather than half-full
+  for (Item &item : items)
+    Insert(item.first, std::move(item.second));
+  return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <initializer_list>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Exact-match cache of parsed model answers, keyed by normalized intent,
+// model and prompt template. Bounded with LRU eviction and persisted to a
+// small binary file, so the handful of everyday requests ("show my ip",
+// "check disk space") skip inference after the first time.
+class ResponseCache {
+public:
+  struct Entry {
+    std::string command;
+    std::string explanation;
+    // ShellManager::RiskAssessment at the time the answer was accepted
+    int riskScore = 0;
+    bool riskValid = false;
+    std::string riskReason;
+  };
+
+  explicit ResponseCache(size_t maxEntries = 512);
+
+  // Lowercase, whitespace collapsed, no trailing punctuation: "Show my IP?"
+  // and "show  my ip" share a key.
+  static std::string NormalizeIntent(std::string_view intent);
+  static std::string MakeKey(std::string_view intent, std::string_view model,
+                             std::string_view promptFormat);
+  // The parts joined with unit separators, for keys built the same way
+  static std::string JoinKey(std::initializer_list<std::string_view> parts);
+
+  // Copies the entry and marks it most recently used.
+  bool Lookup(const std::string &key, Entry &out);
+  void Insert(const std::string &key, Entry entry);
+  // For answers the user flagged as wrong. Returns false if 'key' was not
+  // cached.
+  bool Invalidate(const std::string &key);
+  void Clear();
+
+  size_t Size() const;
+  size_t Capacity() const { return m_MaxEntries; }
+  uint64_t Hits() const;
+  uint64_t Misses() const;
+
+  // Least recently used first, written via a temporary file and rename.
+  bool Save(const std::string &path) const;
+  // Replaces the contents; false (and an empty cache) if the file is
+  // missing or not a cache file of this version.
+  bool Load(const std::string &path);
+
+private:
+  using Item = std::pair<std::string, Entry>;
+
+  void EvictLocked();
+
+  size_t m_MaxEntries;
+  mutable std::mutex m_Mutex;
+  std::list<Item> m_Items; // Most recently used at the front
+  std::unordered_map<std::string, std::list<Item>::iterator> m_Index;
+  uint64_t m_Hits = 0;
+  uint64_t m_Misses = 0;
+};
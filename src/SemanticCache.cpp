@@ -0,0 +1,141 @@
+#include "SemanticCache.h"
+#include "BinaryIO.h"
+#include "MappedFile.h"
+#include "ResponseCache.h"
+#include <cstring>
+
+namespace {
+
+constexpr char kMagic[4] = {'C', 'M', 'D', 'S'};
+constexpr uint32_t kVersion = 1;
+constexpr size_t kSearchDepth = 8; // Enough to step over a few tombstones
+
+} // namespace
+
+SemanticCache::SemanticCache(float threshold, size_t graphThreshold)
+    : m_Threshold(threshold), m_GraphThreshold(graphThreshold),
+      m_Index(0, graphThreshold) {}
+
+bool SemanticCache::Lookup(const std::vector<float> &embedding,
+                           Hit &out) const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (m_LiveCount == 0 || embedding.size() != m_Index.Dims())
+    return false;
+  for (const VectorIndex::Match &m :
+       m_Index.Search(embedding.data(), kSearchDepth)) {
+    if (m.similarity < m_Threshold)
+      break;
+    if (!m_Live[m.id])
+      continue;
+    out = {m.id, m.similarity, m_Entries[m.id]};
+    return true;
+  }
+  return false;
+}
+
+bool SemanticCache::Insert(const std::vector<float> &embedding, Entry entry) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (embedding.empty())
+    return false;
+  if (m_Index.Size() == 0 && m_Index.Dims() != embedding.size())
+    m_Index = VectorIndex((uint32_t)embedding.size(), m_GraphThreshold);
+  if (embedding.size() != m_Index.Dims())
+    return false;
+
+  std::string key = ResponseCache::NormalizeIntent(entry.intent);
+  auto existing = m_ByIntent.find(key);
+  if (existing != m_ByIntent.end()) {
+    m_Live[existing->second] = 0;
+    --m_LiveCount;
+  }
+  m_ByIntent[std::move(key)] = m_Index.Add(embedding.data());
+  m_Entries.push_back(std::move(entry));
+  m_Live.push_back(1);
+  ++m_LiveCount;
+  return true;
+}
+
+bool SemanticCache::Invalidate(const std::string &intent) {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  auto it = m_ByIntent.find(ResponseCache::NormalizeIntent(intent));
+  if (it == m_ByIntent.end())
+    return false;
+  m_Live[it->second] = 0;
+  --m_LiveCount;
+  m_ByIntent.erase(it);
+  return true;
+}
+
+size_t SemanticCache::Size() const {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_LiveCount;
+}
+
+void SemanticCache::Clear() {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Index = VectorIndex(0, m_GraphThreshold);
+  m_Entries.clear();
+  m_Live.clear();
+  m_LiveCount = 0;
+  m_ByIntent.clear();
+}
+
+bool SemanticCache::Save(const std::string &path) const {
+  std::string data(kMagic, sizeof(kMagic));
+  BinaryIO::PutU32(data, kVersion);
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    // Tombstoned entries are kept: ids are positions in the index.
+    BinaryIO::PutU32(data, (uint32_t)m_Entries.size());
+    for (size_t id = 0; id < m_Entries.size(); ++id) {
+      BinaryIO::PutU32(data, m_Live[id]);
+      BinaryIO::PutString(data, m_Entries[id].intent);
+      BinaryIO::PutString(data, m_Entries[id].command);
+      BinaryIO::PutString(data, m_Entries[id].explanation);
+    }
+    m_Index.Serialize(data);
+  }
+
+  return BinaryIO::WriteFileAtomic(path, data);
+}
+
+bool SemanticCache::Load(const std::string &path) {
+  Clear();
+  MappedFile file;
+  if (!file.Open(path) || file.Size() < sizeof(kMagic) ||
+      std::memcmp(file.Data(), kMagic, sizeof(kMagic)) != 0)
+    return false;
+
+  BinaryIO::Reader r{file.Data(), file.Size(), sizeof(kMagic)};
+  if (r.U32() != kVersion)
+    return false;
+  uint32_t count = r.U32();
+  std::vector<Entry> entries;
+  std::vector<uint8_t> live;
+  std::unordered_map<std::string, uint32_t> byIntent;
+  for (uint32_t i = 0; i < count && r.ok; ++i) {
+    live.push_back(r.U32() ? 1 : 0);
+    Entry e;
+    e.intent = r.String();
+    e.command = r.String();
+    e.explanation = r.String();
+    if (live.back())
+      byIntent[ResponseCache::NormalizeIntent(e.intent)] = i;
+    entries.push_back(std::move(e));
+  }
+  if (!r.ok)
+    return false;
+
+  VectorIndex index(0, m_GraphThreshold);
+  if (index.Deserialize(file.Data() + r.pos, file.Size() - r.pos) == 0 ||
+      index.Size() != count)
+    return false;
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Index = std::move(index);
+  m_Entries = std::move(entries);
+  m_Live = std::move(live);
+  m_LiveCount = byIntent.size();
+  m_ByIntent = std::move(byIntent);
+  return true;
+}
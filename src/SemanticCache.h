@@ -0,0 +1,61 @@
+#pragma once
+#include "VectorIndex.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Paraphrase-tolerant companion to ResponseCache: accepted commands indexed
+// by the model's embedding of the intent, so "what's my IP" can reuse the
+// answer given to "show ip address" without decoding. One cache per model,
+// since embeddings from different models are not comparable.
+class SemanticCache {
+public:
+  // Mean-pooled hidden states of decoder models sit close together, so only
+  // near-paraphrases clear a high bar.
+  static constexpr float kDefaultThreshold = 0.95f;
+
+  struct Entry {
+    std::string intent;
+    std::string command;
+    std::string explanation;
+  };
+
+  struct Hit {
+    uint32_t id = 0;
+    float similarity = 0;
+    Entry entry;
+  };
+
+  explicit SemanticCache(float threshold = kDefaultThreshold,
+                         size_t graphThreshold = VectorIndex::kGraphThreshold);
+
+  float Threshold() const { return m_Threshold; }
+  void SetThreshold(float threshold) { m_Threshold = threshold; }
+
+  // Most similar live entry at or above the threshold.
+  bool Lookup(const std::vector<float> &embedding, Hit &out) const;
+  // Re-accepting a known intent (same normalized text) replaces its answer.
+  // Returns false if the embedding does not match the cache's dimensions.
+  bool Insert(const std::vector<float> &embedding, Entry entry);
+  // Drops the entry stored for 'intent' (normalized); false if none.
+  bool Invalidate(const std::string &intent);
+
+  size_t Size() const; // Live entries
+  void Clear();
+
+  bool Save(const std::string &path) const;
+  // Maps the file and restores entries and index without re-embedding.
+  bool Load(const std::string &path);
+
+private:
+  float m_Threshold;
+  size_t m_GraphThreshold;
+  mutable std::mutex m_Mutex;
+  VectorIndex m_Index;
+  std::vector<Entry> m_Entries; // By index id
+  std::vector<uint8_t> m_Live;  // Tombstones: the graph cannot delete
+  size_t m_LiveCount = 0;
+  // Normalized intent -> live id
+  std::unordered_map<std::string, uint32_t> m_ByIntent;
+};
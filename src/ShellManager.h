@@ -1,4 +1,7 @@
 #pragma once
+#include "LatencyStats.h"
+#include "Metrics.h"
+#include "TraceRecorder.h"
 #include <array>
 #include <atomic>
 #include <functional>
@@ -152,15 +155,9 @@ public:
     return assessment;
   }
 
-  // Executes a command and captures its output
-  static ExecuteResult
-  Execute(const std::string &command, std::atomic<bool> *stopSignal = nullptr,
-          std::function<void(const std::string &)> callback = nullptr) {
-    ExecuteResult result;
-    result.exitCode = -1;
-    if (command.empty())
-      return result;
-
+  // The command wrapped for CreateProcess: cmd /C, or PowerShell when it
+  // looks like a cmdlet or uses $variables
+  static std::string CommandLine(const std::string &command) {
     std::string fullCmdLine;
     // Smarter shell detection
     size_t firstHyphen = command.find("-");
@@ -202,6 +199,19 @@ public:
       // when passed to CreateProcess via cmdBuffer.
       fullCmdLine = "cmd /C \"" + command + "\"";
     }
+    return fullCmdLine;
+  }
+
+  // Executes a command and captures its output
+  static ExecuteResult
+  Execute(const std::string &command, std::atomic<bool> *stopSignal = nullptr,
+          std::function<void(const std::string &)> callback = nullptr) {
+    ExecuteResult result;
+    result.exitCode = -1;
+    if (command.empty())
+      return result;
+
+    const std::string fullCmdLine = CommandLine(command);
 
     // Win32 pipe setup
     HANDLE hRead, hWrite;
@@ -222,8 +232,17 @@ public:
     std::vector<char> cmdBuffer(fullCmdLine.begin(), fullCmdLine.end());
     cmdBuffer.push_back('\0');
 
-    if (!CreateProcessA(NULL, cmdBuffer.data(), NULL, NULL, TRUE,
-                        CREATE_NO_WINDOW, NULL, NULL, &si, &pi)) {
+    BOOL created;
+    {
+      ScopedTimer spawnTimer(Stage::Spawn);
+      created = CreateProcessA(NULL, cmdBuffer.data(), NULL, NULL, TRUE,
+                               CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+    }
+    if (!created) {
+      static MetricCounter &spawnFailures = Metrics::Get().Counter(
+          "cmdai_process_spawn_failures_total",
+          "CreateProcess calls that failed");
+      spawnFailures.Add();
       DWORD err = GetLastError();
       std::string errMsg =
           "Error: Failed to launch process (Error Code: " +
@@ -238,6 +257,11 @@ public:
     }
 
     CloseHandle(hWrite); // Close writer in parent else read hangs
+    static MetricCounter &spawned = Metrics::Get().Counter(
+        "cmdai_processes_spawned_total", "Shell processes started");
+    static MetricCounter &outputBytes = Metrics::Get().Counter(
+        "cmdai_output_bytes_total", "Process output captured from pipes");
+    spawned.Add();
 
     std::ostringstream ssOutput;
     std::mutex outputMutex;
@@ -246,11 +270,20 @@ public:
     // Thread to read from pipe
     std::thread reader([hRead, &ssOutput, &outputMutex, &threadFinished,
                         callback]() {
+      TraceRecorder::SetThreadName("ShellReader");
       char buffer[4096];
       DWORD bytesRead;
-      while (ReadFile(hRead, buffer, sizeof(buffer) - 1, &bytesRead, NULL) &&
-             bytesRead > 0) {
+      for (;;) {
+        BOOL ok;
+        {
+          TraceSpan span("ReadFile (pipe)", "shell");
+          ok = ReadFile(hRead, buffer, sizeof(buffer) - 1, &bytesRead, NULL);
+        }
+        if (!ok || bytesRead == 0)
+          break;
+        TraceSpan span("Deliver output", "shell");
         buffer[bytesRead] = '\0';
+        outputBytes.Add(bytesRead);
         std::string frag(buffer);
         {
           std::lock_guard<std::mutex> lock(outputMutex);
@@ -0,0 +1,39 @@
+#include "SpeculativePrefix.h"
+#include <algorithm>
+
+namespace {
+size_t CommonPrefix(const std::vector<SpeculativePrefix::Token> &a,
+                    const std::vector<SpeculativePrefix::Token> &b,
+                    size_t limit) {
+  limit = std::min(limit, std::min(a.size(), b.size()));
+  size_t n = 0;
+  while (n < limit && a[n] == b[n])
+    ++n;
+  return n;
+}
+} // namespace
+
+void SpeculativePrefix::DropUnstableTail(std::vector<Token> &tokens) {
+  tokens.resize(tokens.size() > kUnstableTailTokens
+                    ? tokens.size() - kUnstableTailTokens
+                    : 0);
+}
+
+size_t SpeculativePrefix::Reconcile(const std::vector<Token> &tokens) {
+  size_t keep = CommonPrefix(m_Tokens, tokens, tokens.size());
+  m_Tokens.resize(keep);
+  return keep;
+}
+
+void SpeculativePrefix::Extend(const std::vector<Token> &tokens) {
+  if (tokens.size() > m_Tokens.size())
+    m_Tokens.insert(m_Tokens.end(), tokens.begin() + m_Tokens.size(),
+                    tokens.end());
+}
+
+size_t SpeculativePrefix::Adopt(const std::vector<Token> &turn) {
+  size_t reused =
+      turn.empty() ? 0 : CommonPrefix(m_Tokens, turn, turn.size() - 1);
+  m_Tokens.clear();
+  return reused;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The tokens of a turn prefilled while the user is still typing it, and
+// how much of that work each new version of the turn can keep. Knows
+// nothing of the KV cache: the caller removes the cells past Reconcile's
+// result and decodes what Extend records.
+class SpeculativePrefix {
+public:
+  using Token = int32_t; // llama_token
+
+  // The last tokens of a partial turn may still merge with what is typed
+  // next, so they are never prefilled.
+  static constexpr size_t kUnstableTailTokens = 2;
+  static void DropUnstableTail(std::vector<Token> &tokens);
+
+  // Length of the common prefix of the held tokens and 'tokens'; the held
+  // tokens are cut to it. Zero means the speculative sequence must be
+  // rebuilt from the conversation.
+  size_t Reconcile(const std::vector<Token> &tokens);
+  // Records 'tokens' past the held ones as decoded; 'tokens' is the turn
+  // just passed to Reconcile.
+  void Extend(const std::vector<Token> &tokens);
+  // For the turn as sent: how many leading tokens were already decoded,
+  // leaving at least the last one for the caller to decode for its
+  // logits. Forgets the held tokens.
+  size_t Adopt(const std::vector<Token> &turn);
+  void Clear() { m_Tokens.clear(); }
+
+  size_t Size() const { return m_Tokens.size(); }
+  const std::vector<Token> &Tokens() const { return m_Tokens; }
+
+private:
+  std::vector<Token> m_Tokens;
+};
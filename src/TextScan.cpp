@@ -0,0 +1,542 @@
+#include "TextScan.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define TEXTSCAN_X64 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TEXTSCAN_AVX2_FN
+#else
+#define TEXTSCAN_AVX2_FN __attribute__((target("avx2")))
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define TEXTSCAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+inline char ToLowerAscii(char c) {
+  return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+inline char ToUpperAscii(char c) {
+  return (c >= 'a' && c <= 'z') ? (char)(c - ('a' - 'A')) : c;
+}
+
+inline unsigned CountTrailingZeros(uint32_t v) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward(&idx, v);
+  return (unsigned)idx;
+#else
+  return (unsigned)__builtin_ctz(v);
+#endif
+}
+
+// Kernel signatures. Both return 'count' when nothing matches.
+//  ByteSet: first i < count with p[i] in set (setLen <= 16).
+//  Pair:    first i < count with p[i] in {a1,a2} and p[i+gap] in {b1,b2}.
+using ByteSetFn = size_t (*)(const char *p, size_t count, const char *set,
+                             size_t setLen);
+using PairFn = size_t (*)(const char *p, size_t count, char a1, char a2,
+                          char b1, char b2, size_t gap);
+
+// --- Scalar ---
+
+size_t ByteSetScalar(const char *p, size_t count, const char *set,
+                     size_t setLen) {
+  if (count < 64) { // SIMD tails and short inputs: skip the table setup
+    for (size_t i = 0; i < count; ++i)
+      if (std::memchr(set, p[i], setLen))
+        return i;
+    return count;
+  }
+  bool table[256] = {};
+  for (size_t k = 0; k < setLen; ++k)
+    table[(unsigned char)set[k]] = true;
+  for (size_t i = 0; i < count; ++i)
+    if (table[(unsigned char)p[i]])
+      return i;
+  return count;
+}
+
+size_t PairScalar(const char *p, size_t count, char a1, char a2, char b1,
+                  char b2, size_t gap) {
+  for (size_t i = 0; i < count; ++i) {
+    char a = p[i];
+    char b = p[i + gap];
+    if ((a == a1 || a == a2) && (b == b1 || b == b2))
+      return i;
+  }
+  return count;
+}
+
+#ifdef TEXTSCAN_X64
+
+// --- SSE2 (baseline on every x64 CPU) ---
+
+size_t ByteSetSSE2(const char *p, size_t count, const char *set,
+                   size_t setLen) {
+  __m128i needles[16];
+  for (size_t k = 0; k < setLen; ++k)
+    needles[k] = _mm_set1_epi8(set[k]);
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i hit = _mm_setzero_si128();
+    for (size_t k = 0; k < setLen; ++k)
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, needles[k]));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+    if (mask)
+      return i + CountTrailingZeros(mask);
+  }
+  return i + ByteSetScalar(p + i, count - i, set, setLen);
+}
+
+size_t PairSSE2(const char *p, size_t count, char a1, char a2, char b1,
+                char b2, size_t gap) {
+  const __m128i va1 = _mm_set1_epi8(a1), va2 = _mm_set1_epi8(a2);
+  const __m128i vb1 = _mm_set1_epi8(b1), vb2 = _mm_set1_epi8(b2);
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i first = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i last = _mm_loadu_si128((const __m128i *)(p + i + gap));
+    __m128i hitA = _mm_or_si128(_mm_cmpeq_epi8(first, va1),
+                                _mm_cmpeq_epi8(first, va2));
+    __m128i hitB =
+        _mm_or_si128(_mm_cmpeq_epi8(last, vb1), _mm_cmpeq_epi8(last, vb2));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(hitA, hitB));
+    if (mask)
+      return i + CountTrailingZeros(mask);
+  }
+  return i + PairScalar(p + i, count - i, a1, a2, b1, b2, gap);
+}
+
+// --- AVX2 (selected at runtime) ---
+
+TEXTSCAN_AVX2_FN size_t ByteSetAVX2(const char *p, size_t count,
+                                    const char *set, size_t setLen) {
+  __m256i needles[16];
+  for (size_t k = 0; k < setLen; ++k)
+    needles[k] = _mm256_set1_epi8(set[k]);
+
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i hit = _mm256_setzero_si256();
+    for (size_t k = 0; k < setLen; ++k)
+      hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(block, needles[k]));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+    if (mask)
+      return i + CountTrailingZeros(mask);
+  }
+  return i + ByteSetSSE2(p + i, count - i, set, setLen);
+}
+
+TEXTSCAN_AVX2_FN size_t PairAVX2(const char *p, size_t count, char a1,
+                                 char a2, char b1, char b2, size_t gap) {
+  const __m256i va1 = _mm256_set1_epi8(a1), va2 = _mm256_set1_epi8(a2);
+  const __m256i vb1 = _mm256_set1_epi8(b1), vb2 = _mm256_set1_epi8(b2);
+
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i first = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i last = _mm256_loadu_si256((const __m256i *)(p + i + gap));
+    __m256i hitA = _mm256_or_si256(_mm256_cmpeq_epi8(first, va1),
+                                   _mm256_cmpeq_epi8(first, va2));
+    __m256i hitB = _mm256_or_si256(_mm256_cmpeq_epi8(last, vb1),
+                                   _mm256_cmpeq_epi8(last, vb2));
+    uint32_t mask =
+        (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(hitA, hitB));
+    if (mask)
+      return i + CountTrailingZeros(mask);
+  }
+  return i + PairSSE2(p + i, count - i, a1, a2, b1, b2, gap);
+}
+
+bool CpuHasAVX2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // TEXTSCAN_X64
+
+#ifdef TEXTSCAN_NEON
+
+// --- NEON (baseline on every ARM64 CPU) ---
+
+// Narrows a 0x00/0xFF byte mask to 4 bits per lane in a 64-bit integer.
+inline uint64_t NeonMask(uint8x16_t v) {
+  uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(v), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+
+inline size_t NeonFirstLane(uint64_t mask) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward64(&idx, mask);
+  return (size_t)idx >> 2;
+#else
+  return (size_t)__builtin_ctzll(mask) >> 2;
+#endif
+}
+
+size_t ByteSetNEON(const char *p, size_t count, const char *set,
+                   size_t setLen) {
+  uint8x16_t needles[16];
+  for (size_t k = 0; k < setLen; ++k)
+    needles[k] = vdupq_n_u8((uint8_t)set[k]);
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    uint8x16_t block = vld1q_u8((const uint8_t *)(p + i));
+    uint8x16_t hit = vdupq_n_u8(0);
+    for (size_t k = 0; k < setLen; ++k)
+      hit = vorrq_u8(hit, vceqq_u8(block, needles[k]));
+    uint64_t mask = NeonMask(hit);
+    if (mask)
+      return i + NeonFirstLane(mask);
+  }
+  return i + ByteSetScalar(p + i, count - i, set, setLen);
+}
+
+size_t PairNEON(const char *p, size_t count, char a1, char a2, char b1,
+                char b2, size_t gap) {
+  const uint8x16_t va1 = vdupq_n_u8((uint8_t)a1), va2 = vdupq_n_u8((uint8_t)a2);
+  const uint8x16_t vb1 = vdupq_n_u8((uint8_t)b1), vb2 = vdupq_n_u8((uint8_t)b2);
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    uint8x16_t first = vld1q_u8((const uint8_t *)(p + i));
+    uint8x16_t last = vld1q_u8((const uint8_t *)(p + i + gap));
+    uint8x16_t hitA = vorrq_u8(vceqq_u8(first, va1), vceqq_u8(first, va2));
+    uint8x16_t hitB = vorrq_u8(vceqq_u8(last, vb1), vceqq_u8(last, vb2));
+    uint64_t mask = NeonMask(vandq_u8(hitA, hitB));
+    if (mask)
+      return i + NeonFirstLane(mask);
+  }
+  return i + PairScalar(p + i, count - i, a1, a2, b1, b2, gap);
+}
+
+#endif // TEXTSCAN_NEON
+
+struct Kernels {
+  TextScan::Isa isa;
+  ByteSetFn byteSet;
+  PairFn pair;
+};
+
+Kernels KernelsFor(TextScan::Isa isa) {
+  switch (isa) {
+#ifdef TEXTSCAN_X64
+  case TextScan::Isa::AVX2:
+    return {isa, ByteSetAVX2, PairAVX2};
+  case TextScan::Isa::SSE2:
+    return {isa, ByteSetSSE2, PairSSE2};
+#endif
+#ifdef TEXTSCAN_NEON
+  case TextScan::Isa::NEON:
+    return {isa, ByteSetNEON, PairNEON};
+#endif
+  default:
+    return {TextScan::Isa::Scalar, ByteSetScalar, PairScalar};
+  }
+}
+
+TextScan::Isa DetectIsa() {
+#if defined(TEXTSCAN_X64)
+  return CpuHasAVX2() ? TextScan::Isa::AVX2 : TextScan::Isa::SSE2;
+#elif defined(TEXTSCAN_NEON)
+  return TextScan::Isa::NEON;
+#else
+  return TextScan::Isa::Scalar;
+#endif
+}
+
+// Selected once; ForceIsa may swap it (tests/benchmarks only).
+std::atomic<const Kernels *> g_Active{nullptr};
+
+const Kernels &Active() {
+  const Kernels *k = g_Active.load(std::memory_order_acquire);
+  if (!k) {
+    static const Kernels detected = KernelsFor(DetectIsa());
+    k = &detected;
+    g_Active.store(k, std::memory_order_release);
+  }
+  return *k;
+}
+
+size_t FindFirstOfImpl(const char *p, size_t n, std::string_view set) {
+  if (set.size() > 16)
+    return ByteSetScalar(p, n, set.data(), set.size());
+  return Active().byteSet(p, n, set.data(), set.size());
+}
+
+// Generic "first and last byte" filter: the SIMD kernel proposes candidates,
+// memcmp (or the case-folding compare) confirms them.
+template <bool CaseInsensitive>
+size_t FindImpl(std::string_view hay, std::string_view needle, size_t pos) {
+  if (needle.empty())
+    return pos <= hay.size() ? pos : TextScan::npos;
+  if (pos >= hay.size() || hay.size() - pos < needle.size())
+    return TextScan::npos;
+
+  const size_t gap = needle.size() - 1;
+  char a1 = needle.front(), a2 = needle.front();
+  char b1 = needle.back(), b2 = needle.back();
+  if (CaseInsensitive) {
+    a1 = ToLowerAscii(a1);
+    a2 = ToUpperAscii(a2);
+    b1 = ToLowerAscii(b1);
+    b2 = ToUpperAscii(b2);
+  }
+
+  const PairFn pair = Active().pair;
+  const char *base = hay.data();
+  size_t i = pos;
+  const size_t end = hay.size() - needle.size() + 1; // Candidate starts
+  while (i < end) {
+    size_t hit = pair(base + i, end - i, a1, a2, b1, b2, gap);
+    if (hit == end - i)
+      return TextScan::npos;
+    i += hit;
+
+    bool match = true;
+    if (CaseInsensitive) {
+      for (size_t k = 1; k < gap; ++k) {
+        if (ToLowerAscii(base[i + k]) != ToLowerAscii(needle[k])) {
+          match = false;
+          break;
+        }
+      }
+    } else if (gap > 1) {
+      match = std::memcmp(base + i + 1, needle.data() + 1, gap - 1) == 0;
+    }
+    if (match)
+      return i;
+    ++i;
+  }
+  return TextScan::npos;
+}
+
+} // namespace
+
+TextScan::Isa TextScan::ActiveIsa() { return Active().isa; }
+
+const char *TextScan::IsaName(Isa isa) {
+  switch (isa) {
+  case Isa::SSE2:
+    return "SSE2";
+  case Isa::AVX2:
+    return "AVX2";
+  case Isa::NEON:
+    return "NEON";
+  default:
+    return "Scalar";
+  }
+}
+
+bool TextScan::IsSupported(Isa isa) {
+  switch (isa) {
+  case Isa::Scalar:
+    return true;
+#ifdef TEXTSCAN_X64
+  case Isa::SSE2:
+    return true;
+  case Isa::AVX2:
+    return CpuHasAVX2();
+#endif
+#ifdef TEXTSCAN_NEON
+  case Isa::NEON:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+void TextScan::ForceIsa(Isa isa) {
+  static const Kernels scalar = KernelsFor(Isa::Scalar);
+#ifdef TEXTSCAN_X64
+  static const Kernels sse2 = KernelsFor(Isa::SSE2);
+  static const Kernels avx2 = KernelsFor(Isa::AVX2);
+#endif
+#ifdef TEXTSCAN_NEON
+  static const Kernels neon = KernelsFor(Isa::NEON);
+#endif
+
+  const Kernels *k = nullptr;
+  if (IsSupported(isa)) {
+    switch (isa) {
+    case Isa::Scalar:
+      k = &scalar;
+      break;
+#ifdef TEXTSCAN_X64
+    case Isa::SSE2:
+      k = &sse2;
+      break;
+    case Isa::AVX2:
+      k = &avx2;
+      break;
+#endif
+#ifdef TEXTSCAN_NEON
+    case Isa::NEON:
+      k = &neon;
+      break;
+#endif
+    default:
+      break;
+    }
+  }
+  if (!k) {
+    g_Active.store(nullptr, std::memory_order_release);
+    Active();
+    return;
+  }
+  g_Active.store(k, std::memory_order_release);
+}
+
+size_t TextScan::FindFirstOf(std::string_view haystack, std::string_view set,
+                             size_t pos) {
+  if (pos >= haystack.size() || set.empty())
+    return npos;
+  if (haystack.size() < 256)
+    return haystack.find_first_of(set, pos);
+  size_t n = haystack.size() - pos;
+  size_t hit = FindFirstOfImpl(haystack.data() + pos, n, set);
+  return hit == n ? npos : pos + hit;
+}
+
+size_t TextScan::Find(std::string_view haystack, std::string_view needle,
+                      size_t pos) {
+  // Typical model responses are a few dozen bytes; the library memchr-based
+  // search wins there and the vector kernel only pays off on large inputs.
+  if (haystack.size() < 256)
+    return haystack.find(needle, pos);
+  return FindImpl<false>(haystack, needle, pos);
+}
+
+size_t TextScan::FindCaseInsensitive(std::string_view haystack,
+                                     std::string_view needle, size_t pos) {
+  return FindImpl<true>(haystack, needle, pos);
+}
+
+bool TextScan::EqualsCaseInsensitive(std::string_view a, std::string_view b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); ++i)
+    if (ToLowerAscii(a[i]) != ToLowerAscii(b[i]))
+      return false;
+  return true;
+}
+
+size_t TextScan::RemoveAll(std::string &text,
+                           std::initializer_list<std::string_view> tags) {
+  // Candidate bytes: a tag can only be completed by its last character.
+  char lastBytes[256];
+  size_t nLast = 0;
+  for (const auto &tag : tags) {
+    if (!tag.empty() && std::memchr(lastBytes, tag.back(), nLast) == nullptr)
+      lastBytes[nLast++] = tag.back();
+  }
+  if (nLast == 0 || text.empty())
+    return 0;
+  const std::string_view lastSet(lastBytes, nLast);
+
+  // Compact in place. Every written byte that could end a tag is checked
+  // against the output written so far; since the output is tag-free up to
+  // that point, one suffix check per candidate byte is enough.
+  char *buf = &text[0];
+  const size_t n = text.size();
+  size_t r = 0, w = 0, removed = 0;
+  while (r < n) {
+    size_t run = FindFirstOfImpl(buf + r, n - r, lastSet);
+    if (run) {
+      if (w != r)
+        std::memmove(buf + w, buf + r, run);
+      w += run;
+      r += run;
+    }
+    if (r >= n)
+      break;
+
+    buf[w++] = buf[r++];
+    for (const auto &tag : tags) {
+      if (!tag.empty() && w >= tag.size() &&
+          std::memcmp(buf + w - tag.size(), tag.data(), tag.size()) == 0) {
+        w -= tag.size();
+        removed++;
+        break;
+      }
+    }
+  }
+  text.resize(w);
+  return removed;
+}
+
+size_t TextScan::Utf8CompletePrefix(std::string_view text) {
+  // Only the last three bytes can belong to an unfinished sequence
+  const size_t n = text.size();
+  for (size_t back = 1; back <= 3 && back <= n; ++back) {
+    unsigned char c = (unsigned char)text[n - back];
+    if ((c & 0xC0) == 0x80)
+      continue; // Continuation byte; keep looking for the lead
+    size_t need = (c & 0xE0) == 0xC0   ? 2
+                  : (c & 0xF0) == 0xE0 ? 3
+                  : (c & 0xF8) == 0xF0 ? 4
+                                       : 1;
+    return need > back ? n - back : n;
+  }
+  return n;
+}
+
+std::string TextScan::EscapeField(std::string_view text) {
+  std::string out;
+  out.reserve(text.size());
+  size_t start = 0;
+  size_t i;
+  // Copies the plain runs whole; most fields have nothing to escape
+  while ((i = FindFirstOf(text, "\\\t\n\r", start)) != npos) {
+    out.append(text.data() + start, i - start);
+    char c = text[i];
+    out += '\\';
+    out += c == '\t' ? 't' : c == '\n' ? 'n' : c == '\r' ? 'r' : c;
+    start = i + 1;
+  }
+  out.append(text.data() + start, text.size() - start);
+  return out;
+}
+
+std::string TextScan::UnescapeField(std::string_view text) {
+  std::string out;
+  out.reserve(text.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] != '\\' || i + 1 == text.size()) {
+      out += text[i];
+      continue;
+    }
+    char c = text[++i];
+    out += c == 't' ? '\t' : c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+  }
+  return out;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+// Shared byte-scanning primitives for the parser, firewall and prompt
+// sanitizer. Hot loops are vectorized (AVX2/SSE2 on x64, NEON on ARM64) with a
+// scalar fallback; the variant is picked once at startup from CPUID.
+class TextScan {
+public:
+  enum class Isa { Scalar, SSE2, AVX2, NEON };
+
+  static constexpr size_t npos = std::string_view::npos;
+
+  static Isa ActiveIsa();
+  static const char *IsaName(Isa isa);
+  // Override the detected variant (tests/benchmarks). Falls back to the
+  // detected one if the CPU does not support the request.
+  static void ForceIsa(Isa isa);
+  static bool IsSupported(Isa isa);
+
+  // First position >= pos holding any byte from 'set'.
+  static size_t FindFirstOf(std::string_view haystack, std::string_view set,
+                            size_t pos = 0);
+
+  // Exact substring search.
+  static size_t Find(std::string_view haystack, std::string_view needle,
+                     size_t pos = 0);
+
+  // ASCII case-insensitive substring search.
+  static size_t FindCaseInsensitive(std::string_view haystack,
+                                    std::string_view needle, size_t pos = 0);
+  static bool ContainsCaseInsensitive(std::string_view haystack,
+                                      std::string_view needle) {
+    return FindCaseInsensitive(haystack, needle) != npos;
+  }
+  static bool EqualsCaseInsensitive(std::string_view a, std::string_view b);
+
+  // Removes every occurrence of every tag in one linear in-place pass. Tags
+  // formed by joining the text around a removed tag are removed as well, so
+  // the result never contains any of them. Returns the number of removals.
+  static size_t RemoveAll(std::string &text,
+                          std::initializer_list<std::string_view> tags);
+
+  // Length of the longest prefix that does not end inside a UTF-8 sequence,
+  // so streamed text can be handed on without splitting a character.
+  // Invalid bytes count as complete.
+  static size_t Utf8CompletePrefix(std::string_view text);
+
+  // Backslash-escapes backslashes, tabs, CRs and newlines so a field fits
+  // in one tab-separated line of a journal or recording file.
+  static std::string EscapeField(std::string_view text);
+  static std::string UnescapeField(std::string_view text);
+};
@@ -0,0 +1,200 @@
+#include "TraceRecorder.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+  const char *name;
+  const char *category;
+  int64_t startNs;
+  int64_t endNs;
+};
+
+// One per thread that ever recorded. Owned by the registry so events from
+// short-lived std::async workers survive the thread itself. The mutex is
+// only contended while a trace is being written.
+struct ThreadBuffer {
+  std::mutex mutex;
+  std::vector<TraceEvent> events;
+  std::string name;
+  uint32_t tid = 0;
+  size_t dropped = 0;
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  int64_t startNs = 0;
+  uint32_t nextTid = 1;
+};
+
+Registry &GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+thread_local std::shared_ptr<ThreadBuffer> t_Buffer;
+// Kept without a buffer, so naming a thread costs nothing until it records
+thread_local const char *t_Name = nullptr;
+
+ThreadBuffer &LocalBuffer() {
+  if (!t_Buffer) {
+    Registry &reg = GetRegistry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    t_Buffer = std::make_shared<ThreadBuffer>();
+    if (t_Name)
+      t_Buffer->name = t_Name;
+    t_Buffer->tid = reg.nextTid++;
+    t_Buffer->events.reserve(4096);
+    reg.buffers.push_back(t_Buffer);
+  }
+  return *t_Buffer;
+}
+
+int64_t SteadyNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void AppendEscaped(std::string &out, const char *s) {
+  for (; *s; ++s) {
+    char c = *s;
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+}
+
+} // namespace
+
+std::atomic<bool> TraceRecorder::s_Active{false};
+
+int64_t TraceSpan::Now() { return SteadyNowNs(); }
+
+void TraceRecorder::Start() {
+  Registry &reg = GetRegistry();
+  {
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    // Forget threads that have exited (the registry holds the last
+    // reference); per-exec reader threads would otherwise pile up.
+    auto &buffers = reg.buffers;
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+                                 [](const std::shared_ptr<ThreadBuffer> &b) {
+                                   return b.use_count() == 1;
+                                 }),
+                  buffers.end());
+    for (auto &buffer : buffers) {
+      std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+      buffer->events.clear();
+      buffer->dropped = 0;
+    }
+    reg.startNs = SteadyNowNs();
+  }
+  s_Active = true;
+}
+
+bool TraceRecorder::Stop(const std::string &path) {
+  s_Active = false;
+  std::error_code ec;
+  std::filesystem::path target(path);
+  if (!target.parent_path().empty())
+    std::filesystem::create_directories(target.parent_path(), ec);
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file)
+    return false;
+  std::string json = ToJson();
+  file.write(json.data(), (std::streamsize)json.size());
+  return (bool)file;
+}
+
+void TraceRecorder::SetThreadName(const char *name) {
+  t_Name = name;
+  if (!t_Buffer)
+    return; // Named when it first records
+  std::lock_guard<std::mutex> lock(t_Buffer->mutex);
+  t_Buffer->name = name;
+}
+
+void TraceRecorder::Record(const char *name, const char *category,
+                           int64_t startNs, int64_t endNs) {
+  if (!IsActive())
+    return;
+  ThreadBuffer &buffer = LocalBuffer();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  if (buffer.events.size() >= kMaxEventsPerThread) {
+    ++buffer.dropped;
+    return;
+  }
+  buffer.events.push_back({name, category, startNs, endNs});
+}
+
+size_t TraceRecorder::DroppedEvents() {
+  Registry &reg = GetRegistry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  size_t dropped = 0;
+  for (auto &buffer : reg.buffers) {
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    dropped += buffer->dropped;
+  }
+  return dropped;
+}
+
+std::string TraceRecorder::ToJson() {
+  Registry &reg = GetRegistry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  char num[96];
+  auto separator = [&] {
+    if (!first)
+      out += ",\n";
+    first = false;
+  };
+
+  for (auto &buffer : reg.buffers) {
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    if (!buffer->name.empty()) {
+      separator();
+      std::snprintf(num, sizeof(num),
+                    "{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":"
+                    "\"thread_name\",\"args\":{\"name\":\"",
+                    buffer->tid);
+      out += num;
+      AppendEscaped(out, buffer->name.c_str());
+      out += "\"}}";
+    }
+    for (const TraceEvent &e : buffer->events) {
+      if (e.startNs < reg.startNs)
+        continue; // Span began before this recording started
+      separator();
+      out += "{\"ph\":\"X\",\"name\":\"";
+      AppendEscaped(out, e.name);
+      out += "\",\"cat\":\"";
+      AppendEscaped(out, e.category);
+      // Microseconds with ns precision, as the format expects
+      std::snprintf(num, sizeof(num),
+                    "\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    buffer->tid, (e.startNs - reg.startNs) / 1e3,
+                    (e.endNs - e.startNs) / 1e3);
+      out += num;
+    }
+  }
+  out += "\n]}\n";
+  return out;
+}
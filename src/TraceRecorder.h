@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Opt-in timeline recorder. While active, TraceSpan scopes on any thread
+// append complete events to a buffer owned by that thread; Stop() writes
+// them all as Chrome trace JSON (chrome://tracing, ui.perfetto.dev), so
+// rendering, decoding and process I/O can be seen side by side.
+//
+// Names and categories must be string literals (or otherwise outlive the
+// recording): only the pointers are stored.
+class TraceRecorder {
+public:
+  static constexpr size_t kMaxEventsPerThread = 256 * 1024;
+
+  static bool IsActive() { return s_Active.load(std::memory_order_relaxed); }
+
+  // Clears previous events and starts recording.
+  static void Start();
+  // Stops recording and writes the trace. Returns false if the file could
+  // not be written.
+  static bool Stop(const std::string &path);
+
+  // Label for the calling thread in the trace viewer. Call it at the top of
+  // a thread's work; threads started before a recording keep the name.
+  // Must be a string literal, like span names.
+  static void SetThreadName(const char *name);
+
+  static void Record(const char *name, const char *category, int64_t startNs,
+                     int64_t endNs);
+  static size_t DroppedEvents();
+
+  static std::string ToJson();
+
+private:
+  static std::atomic<bool> s_Active;
+};
+
+class TraceSpan {
+public:
+  TraceSpan(const char *name, const char *category)
+      : m_Name(TraceRecorder::IsActive() ? name : nullptr),
+        m_Category(category), m_Start(m_Name ? Now() : 0) {}
+  ~TraceSpan() {
+    if (m_Name)
+      TraceRecorder::Record(m_Name, m_Category, m_Start, Now());
+  }
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+  static int64_t Now();
+
+  const char *m_Name;
+  const char *m_Category;
+  int64_t m_Start;
+};
@@ -0,0 +1,453 @@
+#include "VectorIndex.h"
+#include "BinaryIO.h"
+#include "TextScan.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define VECTORINDEX_X64 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define VECTORINDEX_AVX2_FN
+#else
+#define VECTORINDEX_AVX2_FN __attribute__((target("avx2")))
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define VECTORINDEX_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+constexpr char kMagic[4] = {'C', 'M', 'D', 'V'};
+constexpr uint32_t kVersion = 1;
+constexpr int kMaxLevel = 15;
+
+using DotFn = float (*)(const float *, const float *, size_t);
+
+float DotScalar(const float *a, const float *b, size_t n) {
+  // Four accumulators so the compiler is not serialized on one add chain
+  float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 += a[i] * b[i];
+    s1 += a[i + 1] * b[i + 1];
+    s2 += a[i + 2] * b[i + 2];
+    s3 += a[i + 3] * b[i + 3];
+  }
+  for (; i < n; ++i)
+    s0 += a[i] * b[i];
+  return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef VECTORINDEX_X64
+
+float DotSSE2(const float *a, const float *b, size_t n) {
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                       _mm_loadu_ps(b + i)));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                       _mm_loadu_ps(b + i + 4)));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+         DotScalar(a + i, b + i, n - i);
+}
+
+VECTORINDEX_AVX2_FN float DotAVX2(const float *a, const float *b, size_t n) {
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                                             _mm256_loadu_ps(b + i)));
+    acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8),
+                                             _mm256_loadu_ps(b + i + 8)));
+  }
+  for (; i + 8 <= n; i += 8)
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                                             _mm256_loadu_ps(b + i)));
+  __m256 acc = _mm256_add_ps(acc0, acc1);
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+                          _mm256_extractf128_ps(acc, 1));
+  float lanes[4];
+  _mm_storeu_ps(lanes, sum);
+  // Tail stays in this function: calling the non-VEX SSE2 kernel with dirty
+  // upper halves costs an AVX/SSE transition stall per call.
+  float tail = 0;
+  for (; i < n; ++i)
+    tail += a[i] * b[i];
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + tail;
+}
+
+#endif // VECTORINDEX_X64
+
+#ifdef VECTORINDEX_NEON
+
+float DotNEON(const float *a, const float *b, size_t n) {
+  float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  return vaddvq_f32(vaddq_f32(acc0, acc1)) + DotScalar(a + i, b + i, n - i);
+}
+
+#endif // VECTORINDEX_NEON
+
+// Follows TextScan's choice, including ForceIsa overrides in benchmarks.
+DotFn ActiveDot() {
+  switch (TextScan::ActiveIsa()) {
+#ifdef VECTORINDEX_X64
+  case TextScan::Isa::AVX2:
+    return DotAVX2;
+  case TextScan::Isa::SSE2:
+    return DotSSE2;
+#endif
+#ifdef VECTORINDEX_NEON
+  case TextScan::Isa::NEON:
+    return DotNEON;
+#endif
+  default:
+    return DotScalar;
+  }
+}
+
+} // namespace
+
+VectorIndex::VectorIndex(uint32_t dims, size_t graphThreshold)
+    : m_Dims(dims), m_GraphThreshold(graphThreshold) {}
+
+void VectorIndex::Normalize(float *v, size_t n) {
+  float norm = std::sqrt(DotScalar(v, v, n));
+  if (norm <= 0)
+    return;
+  for (size_t i = 0; i < n; ++i)
+    v[i] /= norm;
+}
+
+float VectorIndex::Dot(const float *a, const float *b, size_t n) {
+  return ActiveDot()(a, b, n);
+}
+
+void VectorIndex::Clear() {
+  m_Count = 0;
+  m_Vectors.clear();
+  m_Levels.clear();
+  m_Links.clear();
+  m_Entry = 0;
+  m_MaxLevel = -1;
+  m_Visited.clear();
+}
+
+uint32_t VectorIndex::Add(const float *vec) {
+  uint32_t id = (uint32_t)m_Count++;
+  m_Vectors.insert(m_Vectors.end(), vec, vec + m_Dims);
+  Normalize(m_Vectors.data() + (size_t)id * m_Dims, m_Dims);
+
+  if (UsesGraph())
+    InsertIntoGraph(id);
+  else if (m_Count > m_GraphThreshold)
+    BuildGraph();
+  return id;
+}
+
+std::vector<VectorIndex::Match> VectorIndex::Search(const float *query,
+                                                     size_t k) const {
+  if (m_Count == 0 || k == 0)
+    return {};
+  std::vector<float> q(query, query + m_Dims);
+  Normalize(q.data(), m_Dims);
+  if (!UsesGraph())
+    return SearchFlat(q.data(), k);
+
+  const DotFn dot = ActiveDot();
+  uint32_t entry = m_Entry;
+  float best = dot(q.data(), Vector(entry), m_Dims);
+  // Greedy descent through the upper layers
+  for (int level = m_MaxLevel; level > 0; --level) {
+    bool moved = true;
+    while (moved) {
+      moved = false;
+      for (uint32_t n : m_Links[entry][level]) {
+        float sim = dot(q.data(), Vector(n), m_Dims);
+        if (sim > best) {
+          best = sim;
+          entry = n;
+          moved = true;
+        }
+      }
+    }
+  }
+
+  std::vector<Candidate> found =
+      SearchLayer(q.data(), entry, std::max(kEfSearch, k), 0);
+  std::vector<Match> matches;
+  for (size_t i = 0; i < found.size() && i < k; ++i)
+    matches.push_back({found[i].second, found[i].first});
+  return matches;
+}
+
+std::vector<VectorIndex::Match> VectorIndex::SearchFlat(const float *query,
+                                                         size_t k) const {
+  const DotFn dot = ActiveDot();
+  std::vector<Match> matches;
+  matches.reserve(std::min(k, m_Count) + 1);
+  for (uint32_t id = 0; id < m_Count; ++id) {
+    float sim = dot(query, Vector(id), m_Dims);
+    if (matches.size() == k && sim <= matches.back().similarity)
+      continue;
+    auto pos = std::upper_bound(
+        matches.begin(), matches.end(), sim,
+        [](float s, const Match &m) { return s > m.similarity; });
+    matches.insert(pos, {id, sim});
+    if (matches.size() > k)
+      matches.pop_back();
+  }
+  return matches;
+}
+
+std::vector<VectorIndex::Candidate>
+VectorIndex::SearchLayer(const float *query, uint32_t entry, size_t ef,
+                         int level) const {
+  const DotFn dot = ActiveDot();
+  if (m_Visited.size() < m_Count)
+    m_Visited.resize(m_Count, 0);
+  if (++m_Epoch == 0) { // Wrapped: reset the marks once
+    std::fill(m_Visited.begin(), m_Visited.end(), 0);
+    m_Epoch = 1;
+  }
+
+  // 'frontier' pops the most similar candidate; 'results' keeps the ef best
+  // with the least similar on top so it can be dropped.
+  std::priority_queue<Candidate> frontier;
+  std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>>
+      results;
+  float sim = dot(query, Vector(entry), m_Dims);
+  frontier.push({sim, entry});
+  results.push({sim, entry});
+  m_Visited[entry] = m_Epoch;
+
+  while (!frontier.empty()) {
+    Candidate current = frontier.top();
+    frontier.pop();
+    if (results.size() >= ef && current.first < results.top().first)
+      break;
+    for (uint32_t n : m_Links[current.second][level]) {
+      if (m_Visited[n] == m_Epoch)
+        continue;
+      m_Visited[n] = m_Epoch;
+      float s = dot(query, Vector(n), m_Dims);
+      if (results.size() < ef || s > results.top().first) {
+        frontier.push({s, n});
+        results.push({s, n});
+        if (results.size() > ef)
+          results.pop();
+      }
+    }
+  }
+
+  std::vector<Candidate> out;
+  out.reserve(results.size());
+  while (!results.empty()) {
+    out.push_back(results.top());
+    results.pop();
+  }
+  std::reverse(out.begin(), out.end());
+  return out;
+}
+
+std::vector<uint32_t>
+VectorIndex::SelectNeighbors(std::vector<Candidate> candidates,
+                             size_t max) const {
+  // HNSW heuristic: skip a candidate that is closer to an already chosen
+  // neighbour than to the base node, so links spread across clusters.
+  // Skipped ones fill any remaining slots.
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate &a, const Candidate &b) {
+              return a.first > b.first;
+            });
+  const DotFn dot = ActiveDot();
+  std::vector<uint32_t> chosen, skipped;
+  for (const Candidate &c : candidates) {
+    if (chosen.size() >= max)
+      break;
+    bool diverse = true;
+    for (uint32_t r : chosen) {
+      if (dot(Vector(c.second), Vector(r), m_Dims) > c.first) {
+        diverse = false;
+        break;
+      }
+    }
+    (diverse ? chosen : skipped).push_back(c.second);
+  }
+  for (size_t i = 0; i < skipped.size() && chosen.size() < max; ++i)
+    chosen.push_back(skipped[i]);
+  return chosen;
+}
+
+int VectorIndex::RandomLevel() {
+  // xorshift64*: deterministic, so a rebuilt graph matches the saved one
+  m_RngState ^= m_RngState >> 12;
+  m_RngState ^= m_RngState << 25;
+  m_RngState ^= m_RngState >> 27;
+  uint64_t bits = m_RngState * 0x2545F4914F6CDD1Dull;
+  double u = ((bits >> 11) + 1) * (1.0 / 9007199254740992.0); // (0, 1]
+  int level = (int)(-std::log(u) / std::log((double)kLinks));
+  return std::min(level, kMaxLevel);
+}
+
+void VectorIndex::InsertIntoGraph(uint32_t id) {
+  const int level = RandomLevel();
+  m_Levels.push_back((uint8_t)level);
+  m_Links.emplace_back(level + 1);
+  if (m_MaxLevel < 0) {
+    m_Entry = id;
+    m_MaxLevel = level;
+    return;
+  }
+
+  const float *vec = Vector(id);
+  const DotFn dot = ActiveDot();
+  uint32_t entry = m_Entry;
+  float best = dot(vec, Vector(entry), m_Dims);
+  for (int l = m_MaxLevel; l > level; --l) {
+    bool moved = true;
+    while (moved) {
+      moved = false;
+      for (uint32_t n : m_Links[entry][l]) {
+        float sim = dot(vec, Vector(n), m_Dims);
+        if (sim > best) {
+          best = sim;
+          entry = n;
+          moved = true;
+        }
+      }
+    }
+  }
+
+  for (int l = std::min(level, m_MaxLevel); l >= 0; --l) {
+    std::vector<Candidate> found = SearchLayer(vec, entry, kEfConstruction, l);
+    entry = found.front().second;
+    std::vector<uint32_t> neighbors = SelectNeighbors(found, kLinks);
+    m_Links[id][l] = neighbors;
+    for (uint32_t n : neighbors) {
+      std::vector<uint32_t> &links = m_Links[n][l];
+      links.push_back(id);
+      if (links.size() > MaxLinks(l)) {
+        std::vector<Candidate> pool;
+        pool.reserve(links.size());
+        for (uint32_t m : links)
+          pool.push_back({dot(Vector(n), Vector(m), m_Dims), m});
+        links = SelectNeighbors(std::move(pool), MaxLinks(l));
+      }
+    }
+  }
+
+  if (level > m_MaxLevel) {
+    m_MaxLevel = level;
+    m_Entry = id;
+  }
+}
+
+void VectorIndex::BuildGraph() {
+  m_Levels.reserve(m_Count);
+  m_Links.reserve(m_Count);
+  for (uint32_t id = 0; id < m_Count; ++id)
+    InsertIntoGraph(id);
+}
+
+void VectorIndex::Serialize(std::string &out) const {
+  out.append(kMagic, sizeof(kMagic));
+  BinaryIO::PutU32(out, kVersion);
+  BinaryIO::PutU32(out, m_Dims);
+  BinaryIO::PutU32(out, (uint32_t)m_Count);
+  BinaryIO::PutU32(out, UsesGraph() ? 1 : 0);
+  BinaryIO::PutU32(out, m_Entry);
+  BinaryIO::PutU32(out, (uint32_t)m_MaxLevel);
+  BinaryIO::PutU64(out, m_RngState);
+  out.append((const char *)m_Vectors.data(), m_Vectors.size() * sizeof(float));
+  if (!UsesGraph())
+    return;
+  for (size_t id = 0; id < m_Count; ++id) {
+    BinaryIO::PutU32(out, m_Levels[id]);
+    for (const std::vector<uint32_t> &links : m_Links[id]) {
+      BinaryIO::PutU32(out, (uint32_t)links.size());
+      out.append((const char *)links.data(), links.size() * sizeof(uint32_t));
+    }
+  }
+}
+
+size_t VectorIndex::Deserialize(const char *data, size_t size) {
+  Clear();
+  if (size < sizeof(kMagic) || std::memcmp(data, kMagic, sizeof(kMagic)) != 0)
+    return 0;
+  BinaryIO::Reader r{data, size, sizeof(kMagic)};
+  if (r.U32() != kVersion)
+    return 0;
+  uint32_t dims = r.U32();
+  uint32_t count = r.U32();
+  bool graph = r.U32() != 0;
+  uint32_t entry = r.U32();
+  int maxLevel = (int)r.U32();
+  uint64_t rng = r.U64();
+  size_t vectorBytes = (size_t)count * dims * sizeof(float);
+  const char *vectorData = r.Bytes(vectorBytes);
+  if (!r.ok || (count && entry >= count))
+    return 0;
+
+  std::vector<float> vectors((size_t)count * dims);
+  std::memcpy(vectors.data(), vectorData, vectorBytes);
+
+  std::vector<uint8_t> levels;
+  std::vector<std::vector<std::vector<uint32_t>>> links;
+  if (graph) {
+    levels.resize(count);
+    links.resize(count);
+    for (uint32_t id = 0; id < count && r.ok; ++id) {
+      uint32_t level = r.U32();
+      if (level > (uint32_t)kMaxLevel) {
+        r.ok = false;
+        break;
+      }
+      levels[id] = (uint8_t)level;
+      links[id].resize(level + 1);
+      for (uint32_t l = 0; l <= level && r.ok; ++l) {
+        uint32_t n = r.U32();
+        const char *linkData = r.Bytes((size_t)n * sizeof(uint32_t));
+        if (!r.ok)
+          break;
+        links[id][l].resize(n);
+        std::memcpy(links[id][l].data(), linkData, n * sizeof(uint32_t));
+        for (uint32_t m : links[id][l])
+          if (m >= count)
+            r.ok = false;
+      }
+    }
+    if (r.ok && (count == 0 || levels[entry] != maxLevel))
+      r.ok = false;
+    // Links may only point at nodes that exist on that level
+    for (uint32_t id = 0; id < count && r.ok; ++id)
+      for (size_t l = 0; l < links[id].size(); ++l)
+        for (uint32_t m : links[id][l])
+          if (l > levels[m])
+            r.ok = false;
+  }
+  if (!r.ok)
+    return 0;
+
+  m_Dims = dims;
+  m_Count = count;
+  m_Vectors = std::move(vectors);
+  m_Levels = std::move(levels);
+  m_Links = std::move(links);
+  m_Entry = entry;
+  m_MaxLevel = graph ? maxLevel : -1;
+  m_RngState = rng;
+  return r.pos;
+}
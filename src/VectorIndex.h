@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Nearest-neighbour search over unit-length float vectors by cosine
+// similarity (a dot product once normalized). Small sets are scanned
+// exhaustively; past 'graphThreshold' entries an HNSW graph takes over.
+// Dot products use the SIMD variant TextScan selected for this CPU.
+//
+// Not thread-safe: searches reuse a visited-set scratch buffer, so callers
+// serialize all access (SemanticCache holds a mutex).
+class VectorIndex {
+public:
+  static constexpr size_t kGraphThreshold = 4096;
+  static constexpr size_t kLinks = 16; // Per node and level; 2x on level 0
+  static constexpr size_t kEfConstruction = 64;
+  static constexpr size_t kEfSearch = 64;
+
+  struct Match {
+    uint32_t id;
+    float similarity;
+  };
+
+  explicit VectorIndex(uint32_t dims = 0,
+                       size_t graphThreshold = kGraphThreshold);
+
+  uint32_t Dims() const { return m_Dims; }
+  size_t Size() const { return m_Count; }
+  bool UsesGraph() const { return !m_Levels.empty(); }
+
+  // Stores a normalized copy and returns its id (ids are dense, in order).
+  uint32_t Add(const float *vec);
+  // Best 'k' matches, most similar first.
+  std::vector<Match> Search(const float *query, size_t k) const;
+  const float *Vector(uint32_t id) const {
+    return m_Vectors.data() + (size_t)id * m_Dims;
+  }
+  void Clear();
+
+  static void Normalize(float *v, size_t n);
+  static float Dot(const float *a, const float *b, size_t n);
+
+  // Vectors and graph, so a reload neither re-embeds nor rebuilds.
+  void Serialize(std::string &out) const;
+  // Parses what Serialize wrote; returns bytes consumed, 0 if malformed.
+  size_t Deserialize(const char *data, size_t size);
+
+private:
+  using Candidate = std::pair<float, uint32_t>; // similarity, id
+
+  std::vector<Match> SearchFlat(const float *query, size_t k) const;
+  std::vector<Candidate> SearchLayer(const float *query, uint32_t entry,
+                                     size_t ef, int level) const;
+  std::vector<uint32_t> SelectNeighbors(std::vector<Candidate> candidates,
+                                        size_t max) const;
+  void InsertIntoGraph(uint32_t id);
+  void BuildGraph();
+  int RandomLevel();
+  size_t MaxLinks(int level) const { return level ? kLinks : 2 * kLinks; }
+
+  uint32_t m_Dims;
+  size_t m_GraphThreshold;
+  size_t m_Count = 0;
+  std::vector<float> m_Vectors;
+
+  // HNSW state, empty until the threshold is crossed
+  std::vector<uint8_t> m_Levels;
+  std::vector<std::vector<std::vector<uint32_t>>> m_Links; // [id][level]
+  uint32_t m_Entry = 0;
+  int m_MaxLevel = -1;
+  uint64_t m_RngState = 0x9E3779B97F4A7C15ull;
+
+  mutable std::vector<uint32_t> m_Visited; // Search epoch per id
+  mutable uint32_t m_Epoch = 0;
+};
@@ -1,7 +1,35 @@
+#include "../src/BinaryIO.h"
+#include "../src/CandidateRanker.h"
+#include "../src/ChatJournal.h"
+#include "../src/ChatStore.h"
+#include "../src/CommandHistory.h"
 #include "../src/CommandParser.h"
+#include "../src/EventLog.h"
+#include "../src/InferenceProfile.h"
+#include "../src/JobScheduler.h"
+#include "../src/LatencyStats.h"
+#include "../src/Logger.h"
+#include "../src/Metrics.h"
+#include "../src/OutputDigest.h"
+#include "../src/PerfSampler.h"
+#include "../src/ProcessMemory.h"
+#include "../src/ReplayAIProvider.h"
+#include "../src/ResponseCache.h"
+#include "../src/SemanticCache.h"
+#include "../src/SpeculativePrefix.h"
 #include "../src/ShellManager.h"
+#include "../src/TextScan.h"
+#include "../src/TraceRecorder.h"
+#include "../src/VectorIndex.h"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 
@@ -136,6 +164,1202 @@ bool TestCommandParsing() {
   return true;
 }
 
+bool TestZeroCopyParsing() {
+  std::cout << "\n--- Testing Zero-Copy Parsing (ParseView) ---" << std::endl;
+  std::string scratch;
+
+  // 1. Plain JSON values are views into the caller's buffer
+  {
+    std::string input = "{\"cmd\": \"ipconfig /all\", \"why\": \"Shows IP\"}";
+    auto pv = CommandParser::ParseView(input, scratch);
+    ASSERT_EQ(std::string(pv.command), "ipconfig /all", "ParseView JSON cmd");
+    bool inInput = pv.command.data() >= input.data() &&
+                   pv.command.data() < input.data() + input.size();
+    ASSERT_EQ(inInput, true, "ParseView JSON cmd points into input");
+    ASSERT_EQ(scratch.empty(), true, "No scratch used without escapes");
+  }
+
+  // 2. Escaped values are materialized into scratch
+  {
+    std::string input =
+        "{\"cmd\": \"echo \\\"Hi\\\"\", \"why\": \"Say \\\"Hi\\\"\"}";
+    auto pv = CommandParser::ParseView(input, scratch);
+    ASSERT_EQ(std::string(pv.command), "echo \"Hi\"", "ParseView unescaped cmd");
+    ASSERT_EQ(std::string(pv.explanation), "Say \"Hi\"",
+              "ParseView unescaped why survives second materialization");
+  }
+
+  // 3. Same results as the owning API on every tier
+  {
+    const std::vector<std::string> inputs = {
+        "[CMD] dir /w [WHY] Lists files in wide format",
+        "```cmd\n# Check network\nipconfig\n```",
+        "Run `ipconfig /all` to see network info.",
+        "C:\\Users\\Admin> tasklist /v", "{\"cmd\": \"dir", ""};
+    for (const auto &input : inputs) {
+      auto owned = CommandParser::Parse(input);
+      auto view = CommandParser::ParseView(input, scratch).ToOwned();
+      ASSERT_EQ(view.command, owned.command, "ParseView matches Parse");
+      ASSERT_EQ(view.success, owned.success, "ParseView success matches");
+    }
+  }
+
+  return true;
+}
+
+bool TestTextScan() {
+  std::cout << "\n--- Testing TextScan (SIMD scanning) ---" << std::endl;
+  const TextScan::Isa detected = TextScan::ActiveIsa();
+  std::cout << "Detected ISA: " << TextScan::IsaName(detected) << std::endl;
+
+  // Long enough to cross several vector blocks plus a scalar tail.
+  std::string text(1000, 'x');
+  text += "Show My IP {\"cmd\": \"ipconfig\"} `dir` <|im_start|>user|";
+
+  const TextScan::Isa isas[] = {TextScan::Isa::Scalar, TextScan::Isa::SSE2,
+                                TextScan::Isa::AVX2, TextScan::Isa::NEON};
+  for (TextScan::Isa isa : isas) {
+    if (!TextScan::IsSupported(isa))
+      continue;
+    TextScan::ForceIsa(isa);
+    std::string name = TextScan::IsaName(isa);
+
+    ASSERT_EQ(TextScan::FindFirstOf(text, "{`"), text.find_first_of("{`"),
+              name + " FindFirstOf");
+    ASSERT_EQ(TextScan::Find(text, "\"cmd\""), text.find("\"cmd\""),
+              name + " Find");
+    ASSERT_EQ(TextScan::FindCaseInsensitive(text, "show my ip"), (size_t)1000,
+              name + " FindCaseInsensitive");
+    ASSERT_EQ(TextScan::FindCaseInsensitive(text, "show my ipv6"),
+              TextScan::npos, name + " FindCaseInsensitive miss");
+
+    std::string sanitized = "<|im_start|>system\nhi<<||im_end|>user|";
+    TextScan::RemoveAll(sanitized, {"<|", "im_start", "im_end", "assistant|",
+                                    "user|", "system|"});
+    ASSERT_EQ(sanitized, std::string("|>system\nhi|>"),
+              name + " RemoveAll strips nested tags");
+  }
+  TextScan::ForceIsa(detected);
+
+  const std::string euro = "cost \xE2\x82\xAC"; // U+20AC, three bytes
+  ASSERT_EQ(TextScan::Utf8CompletePrefix(euro), euro.size(),
+            "Complete UTF-8 kept whole");
+  ASSERT_EQ(TextScan::Utf8CompletePrefix(euro.substr(0, euro.size() - 1)),
+            (size_t)5, "Split character held back");
+  ASSERT_EQ(TextScan::Utf8CompletePrefix("dir \xF0\x9F"), (size_t)4,
+            "Split 4-byte character held back");
+
+  const std::string field = "dir C:\\temp\t\"a\r\nb\"\\";
+  ASSERT_EQ(TextScan::EscapeField(field),
+            std::string("dir C:\\\\temp\\t\"a\\r\\nb\"\\\\"),
+            "Field escaped onto one line");
+  ASSERT_EQ(TextScan::UnescapeField(TextScan::EscapeField(field)), field,
+            "Escaped field round-trips");
+  ASSERT_EQ(TextScan::EscapeField("ipconfig /all"),
+            std::string("ipconfig /all"), "Plain field unchanged");
+
+  return true;
+}
+
+bool TestAsyncLogger() {
+  std::cout << "\n--- Testing Async Logger ---" << std::endl;
+  Logger &logger = Logger::Get();
+  logger.SetOverflowPolicy(Logger::OverflowPolicy::Block);
+
+  // 4 producers, each tags its last message; Flush must make all visible.
+  std::vector<std::thread> producers;
+  for (int t = 0; t < 4; ++t) {
+    producers.emplace_back([t]() {
+      for (int i = 0; i < 2000; ++i)
+        LOG_DEBUG("logger test " + std::to_string(t) + ":" + std::to_string(i));
+    });
+  }
+  for (auto &p : producers)
+    p.join();
+  logger.Flush();
+
+  std::ifstream file("logs/app.log");
+  std::stringstream content;
+  content << file.rdbuf();
+  std::string text = content.str();
+  for (int t = 0; t < 4; ++t) {
+    bool found = text.find("logger test " + std::to_string(t) + ":1999") !=
+                 std::string::npos;
+    ASSERT_EQ(found, true, "Last message of producer " + std::to_string(t) +
+                               " flushed to disk");
+  }
+  ASSERT_EQ(logger.GetDroppedCount(), (size_t)0,
+            "Block policy never drops messages");
+
+  logger.SetOverflowPolicy(Logger::OverflowPolicy::Drop);
+  return true;
+}
+
+bool TestLogLevelFiltering() {
+  std::cout << "\n--- Testing Log Level Filtering ---" << std::endl;
+  Logger &logger = Logger::Get();
+  Logger::Level previous = logger.GetMinLevel();
+
+  int evaluations = 0;
+  auto expensive = [&evaluations]() {
+    evaluations++;
+    return std::string("expensive message");
+  };
+
+  logger.SetMinLevel(Logger::WARNING);
+  LOG_DEBUG(expensive());
+  LOG_INFO(expensive());
+  LOG_INFOF("%s", expensive().c_str());
+  ASSERT_EQ(evaluations, 0, "Filtered levels do not evaluate their message");
+
+  LOG_WARN(expensive());
+  ASSERT_EQ(evaluations, 1, "Enabled levels evaluate their message once");
+
+  logger.SetMinLevel(previous);
+  LOG_INFOF("format api %d/%s", 42, "ok");
+  logger.Flush();
+  std::ifstream file("logs/app.log");
+  std::stringstream content;
+  content << file.rdbuf();
+  bool found = content.str().find("format api 42/ok") != std::string::npos;
+  ASSERT_EQ(found, true, "Logf formats into the log");
+
+  return true;
+}
+
+bool TestEventLog() {
+  std::cout << "\n--- Testing Binary Event Log ---" << std::endl;
+  const std::string path = "logs/test_events.bin";
+  std::error_code ec;
+  for (int i = 0; i < 4; ++i)
+    std::filesystem::remove(i ? "logs/test_events." + std::to_string(i) +
+                                    ".bin"
+                              : path,
+                            ec);
+
+  {
+    EventLog log(path, 4096, 3);
+    EventLog::RequestScope scope(42);
+    log.Emit(EventId::RequestBegin, {17}, "Qwen 2.5 Coder 1.5B");
+    log.Emit(EventId::Parse, {1500, 1});
+    log.Emit(EventId::Execute, {900000, 0, 128}, "ipconfig /all");
+    log.Emit(EventId::RequestEnd, {2500000});
+  }
+
+  std::vector<EventLog::Record> records;
+  bool ok = EventLog::ReadFile(
+      path, [&](const EventLog::Record &r) { records.push_back(r); });
+  ASSERT_EQ(ok, true, "Event log file decodes");
+  ASSERT_EQ(records.size(), (size_t)4, "All events recorded");
+  ASSERT_EQ(records[0].text, std::string("Qwen 2.5 Coder 1.5B"),
+            "Interned string resolved");
+  ASSERT_EQ(records[1].requestId, (uint64_t)42, "Request id from scope");
+  ASSERT_EQ(records[2].fields[2], (int64_t)128, "Numeric fields round-trip");
+  ASSERT_EQ(std::string(EventLog::EventName(records[3].id)),
+            std::string("RequestEnd"), "Event id round-trips");
+  // Version, then the first string record's length, little-endian on disk
+  std::ifstream raw(path, std::ios::binary);
+  std::string bytes((std::istreambuf_iterator<char>(raw)),
+                    std::istreambuf_iterator<char>());
+  ASSERT_EQ(bytes.size() > 44 &&
+                bytes.compare(8, 4, std::string("\x01\0\0\0", 4)) == 0 &&
+                bytes[32] == EventLog::kKindString &&
+                bytes.compare(40, 4, std::string("\x13\0\0\0", 4)) == 0,
+            true, "Integers written little-endian");
+
+  // Rotation: a small size bound spills over into numbered files
+  {
+    EventLog log(path, 1024, 3);
+    for (int i = 0; i < 200; ++i)
+      log.Emit(EventId::Decode, {i, i, i}, "Phi-3.5 Mini 3.8B");
+  }
+  bool rotated = std::filesystem::exists("logs/test_events.2.bin") &&
+                 !std::filesystem::exists("logs/test_events.3.bin");
+  ASSERT_EQ(rotated, true, "Size-based rotation");
+  size_t rotatedRecords = 0;
+  EventLog::ReadFile(path, [&](const EventLog::Record &r) {
+    rotatedRecords += (r.text == "Phi-3.5 Mini 3.8B");
+  });
+  ASSERT_EQ(rotatedRecords > 0, true,
+            "Strings re-defined in every rotated file");
+
+  return true;
+}
+
+bool TestLatencyHistogram() {
+  std::cout << "\n--- Testing Latency Histograms ---" << std::endl;
+
+  // 1us..10ms uniform: percentiles must land within the bucket precision
+  LatencyHistogram h;
+  for (int64_t us = 1; us <= 10000; ++us)
+    h.Record(us * 1000);
+  auto near = [](int64_t got, int64_t want) {
+    return got >= want * 97 / 100 && got <= want * 103 / 100;
+  };
+  ASSERT_EQ(h.Count(), (uint64_t)10000, "Histogram sample count");
+  ASSERT_EQ(near(h.PercentileNs(50), 5000000), true, "p50 within 3%");
+  ASSERT_EQ(near(h.PercentileNs(99), 9900000), true, "p99 within 3%");
+  ASSERT_EQ(h.Max(), (int64_t)10000000, "Exact max retained");
+  ASSERT_EQ(h.PercentileNs(100) <= h.Max(), true, "p100 clamped to max");
+
+  // Bucket mapping is monotonic and exact for small values
+  bool monotonic = true;
+  for (int64_t v = 1; v < 5000000; v = v * 5 / 4 + 1)
+    monotonic &= LatencyHistogram::BucketIndex(v) <=
+                 LatencyHistogram::BucketIndex(v + 1);
+  ASSERT_EQ(monotonic, true, "Bucket index monotonic");
+  ASSERT_EQ(LatencyHistogram::BucketMidpoint(
+                LatencyHistogram::BucketIndex(17)),
+            (int64_t)17, "Small values are exact");
+
+  // Samples are attributed to the model installed by ModelScope
+  LatencyStats &stats = LatencyStats::Get();
+  int qwen = stats.ModelSlot("Test Qwen");
+  int phi = stats.ModelSlot("Test Phi");
+  ASSERT_EQ(stats.ModelSlot("Test Qwen"), qwen, "Model slot is stable");
+  {
+    LatencyStats::ModelScope scope(qwen);
+    stats.Record(Stage::Parse, 2000);
+    stats.Record(Stage::Parse, 4000);
+  }
+  {
+    LatencyStats::ModelScope scope(phi);
+    EventLog::ScopedEvent ev(EventId::Assess);
+  }
+  ASSERT_EQ(stats.Find(qwen, Stage::Parse)->Count(), (uint64_t)2,
+            "Per-model stage samples");
+  ASSERT_EQ(stats.Find(phi, Stage::Parse)->Count(), (uint64_t)0,
+            "Models kept separate");
+  ASSERT_EQ(stats.Find(phi, Stage::Assess)->Count(), (uint64_t)1,
+            "ScopedEvent feeds its stage histogram");
+  bool listed = stats.Format().find("Test Qwen") != std::string::npos;
+  ASSERT_EQ(listed, true, "Dump table lists models");
+
+  return true;
+}
+
+bool TestMetricsExport() {
+  std::cout << "\n--- Testing Prometheus Metrics Export ---" << std::endl;
+  Metrics &m = Metrics::Get();
+
+  MetricCounter &c = m.Counter("test_requests_total", "Test counter");
+  c.Add();
+  c.Add(2);
+  ASSERT_EQ(&m.Counter("test_requests_total", "Test counter"), &c,
+            "Same name returns same counter");
+  m.Gauge("test_load_seconds", "Test gauge", "model=\"A\"").Set(1.5);
+  m.Gauge("test_load_seconds", "Test gauge", "model=\"B\"").Set(2);
+  MetricHistogram &h = m.Histogram("test_risk", "Test histogram", {0, 5, 10});
+  h.Observe(0);
+  h.Observe(4);
+  h.Observe(7);
+  h.Observe(12);
+
+  std::string text = m.FormatText();
+  auto has = [&](const char *line) {
+    return text.find(line) != std::string::npos;
+  };
+  ASSERT_EQ(has("# TYPE test_requests_total counter\ntest_requests_total 3\n"),
+            true, "Counter exposition");
+  ASSERT_EQ(has("test_load_seconds{model=\"A\"} 1.5\n"), true,
+            "Labelled gauge A");
+  ASSERT_EQ(has("test_load_seconds{model=\"B\"} 2\n"), true,
+            "Labelled gauge B");
+  size_t typeLines = 0;
+  for (size_t p = 0; (p = text.find("# TYPE test_load_seconds", p)) !=
+                     std::string::npos;
+       ++p)
+    ++typeLines;
+  ASSERT_EQ(typeLines, (size_t)1, "One TYPE header per family");
+  ASSERT_EQ(has("test_risk_bucket{le=\"5\"} 2\n"), true,
+            "Histogram buckets cumulative");
+  ASSERT_EQ(has("test_risk_bucket{le=\"+Inf\"} 4\n"), true,
+            "Histogram +Inf bucket");
+  ASSERT_EQ(has("test_risk_sum 23\n"), true, "Histogram sum");
+
+  const std::string path = "logs/test_metrics.prom";
+  ASSERT_EQ(m.WriteFile(path), true, "Metrics file written");
+  std::ifstream in(path);
+  std::stringstream file;
+  file << in.rdbuf();
+  ASSERT_EQ(file.str() == m.FormatText(), true, "File matches exposition");
+  ASSERT_EQ(std::filesystem::exists(path + ".tmp"), false,
+            "Temp file renamed into place");
+  return true;
+}
+
+bool TestTraceRecorder() {
+  std::cout << "\n--- Testing Chrome Trace Recorder ---" << std::endl;
+
+  { TraceSpan ignored("BeforeStart", "test"); }
+  // A long-lived thread names itself before any recording starts
+  std::atomic<int> phase{0};
+  std::thread early([&phase] {
+    TraceRecorder::SetThreadName("Early");
+    phase = 1;
+    while (phase != 2)
+      std::this_thread::yield();
+    TraceSpan late("Late", "test");
+  });
+  while (phase != 1)
+    std::this_thread::yield();
+  TraceRecorder::Start();
+  phase = 2;
+  TraceRecorder::SetThreadName("Main");
+  {
+    TraceSpan outer("Outer", "test");
+    TraceSpan inner("Inner", "test");
+  }
+  std::thread worker([] {
+    TraceRecorder::SetThreadName("Worker");
+    for (int i = 0; i < 3; ++i)
+      TraceSpan step("Step", "test");
+  });
+  worker.join();
+  early.join();
+
+  const std::string path = "logs/test_trace.json";
+  ASSERT_EQ(TraceRecorder::Stop(path), true, "Trace file written");
+  { TraceSpan ignored("AfterStop", "test"); }
+
+  std::ifstream in(path);
+  std::stringstream file;
+  file << in.rdbuf();
+  std::string json = file.str();
+  auto count = [&](const std::string &needle) {
+    size_t n = 0;
+    for (size_t p = 0; (p = json.find(needle, p)) != std::string::npos; ++p)
+      ++n;
+    return n;
+  };
+  ASSERT_EQ(json.rfind("{\"displayTimeUnit\"", 0), (size_t)0,
+            "Chrome trace object");
+  ASSERT_EQ(count("\"ph\":\"X\""), (size_t)6, "Only spans while active");
+  ASSERT_EQ(count("\"name\":\"Step\""), (size_t)3,
+            "Worker thread spans kept after exit");
+  ASSERT_EQ(count("\"args\":{\"name\":\"Worker\"}"), (size_t)1,
+            "Thread name metadata");
+  ASSERT_EQ(count("\"args\":{\"name\":\"Early\"}"), (size_t)1,
+            "Name set before the recording kept");
+  ASSERT_EQ(count("BeforeStart") + count("AfterStop"), (size_t)0,
+            "Inactive spans not recorded");
+  return true;
+}
+
+bool TestPerfSampler() {
+  std::cout << "\n--- Testing Perf Overlay Sampler ---" << std::endl;
+  PerfSampler ps;
+  ASSERT_EQ(ps.LatestFrameMs(), 0.0f, "Empty sampler reads zero");
+
+  for (size_t i = 0; i < PerfSampler::kCapacity + 10; ++i)
+    ps.AddSample((float)i, 1.0f);
+  ASSERT_EQ(ps.Count(), PerfSampler::kCapacity, "Ring holds capacity");
+  ASSERT_EQ(ps.LatestFrameMs(), (float)(PerfSampler::kCapacity + 9),
+            "Latest sample");
+  ASSERT_EQ(ps.FrameTimes()[ps.Offset()], 10.0f,
+            "Offset points at oldest sample");
+  ASSERT_EQ(ps.MaxFrameMs(), (float)(PerfSampler::kCapacity + 9),
+            "Max over window");
+
+  // FrameTick measures wall time between calls
+  PerfSampler ticks;
+  ticks.FrameTick();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ticks.FrameTick();
+  ASSERT_EQ(ticks.Count(), (size_t)1, "First tick only starts timing");
+  ASSERT_EQ(ticks.LatestFrameMs() >= 19.0f, true, "Frame time measured");
+  ASSERT_EQ(ticks.LatestCpuMs() < ticks.LatestFrameMs(), true,
+            "Sleeping frame uses little CPU");
+  return true;
+}
+
+bool TestReplayProviders() {
+  std::cout << "\n--- Testing Mock and Replay Providers ---" << std::endl;
+  // Synthetic output is deterministic and parses like a real response
+  SyntheticAIProvider synthetic(0.0, std::chrono::milliseconds(0));
+  std::string streamed;
+  std::string full = synthetic.GenerateCommand(
+      "list files", [&](const std::string &t) { streamed += t; });
+  ASSERT_EQ(streamed, full, "Synthetic pieces add up to the response");
+  ParsedCommand pc = CommandParser::Parse(full);
+  ASSERT_EQ(pc.success, true, "Synthetic response parses");
+  ASSERT_EQ(pc.command, std::string("echo list files"), "Synthetic command");
+  ASSERT_EQ(synthetic.GenerateCommand("list files"), full,
+            "Synthetic output is reproducible");
+
+  // Paced synthesis honours TTFT and the token rate
+  SyntheticAIProvider paced(1000.0, std::chrono::milliseconds(20));
+  auto start = std::chrono::steady_clock::now();
+  paced.GenerateCommand("dir");
+  auto pacedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  size_t pieces = SyntheticAIProvider::Pieces("dir").size();
+  ASSERT_EQ(pacedMs >= (long long)(20 + pieces - 1), true,
+            "Paced synthesis takes TTFT plus one interval per piece");
+
+  // A Cancel that lands before the request starts generating still stops
+  // it; only ResetCancel, at the start of the next request, forgets it
+  RecordingAIProvider cancelled(std::make_unique<SyntheticAIProvider>(
+      0.0, std::chrono::milliseconds(0)));
+  cancelled.ResetCancel();
+  cancelled.Cancel();
+  streamed.clear();
+  ASSERT_EQ(cancelled.GenerateCommand(
+                "dir", [&](const std::string &t) { streamed += t; }),
+            std::string(IAIProvider::kCancelled),
+            "Early Cancel stops the request");
+  ASSERT_EQ(streamed.empty(), true, "Nothing streamed after an early Cancel");
+  ASSERT_EQ(cancelled.GenerateCommand("dir"),
+            std::string(IAIProvider::kCancelled),
+            "Cancel holds until reset");
+  cancelled.ResetCancel();
+  ASSERT_EQ(cancelled.GenerateCommand("dir"), synthetic.GenerateCommand("dir"),
+            "Next request runs after ResetCancel");
+
+  // Record a session, save it, load it back and replay it
+  RecordingAIProvider recorder(std::make_unique<SyntheticAIProvider>(
+      0.0, std::chrono::milliseconds(0)));
+  recorder.GenerateCommand("first");
+  recorder.GenerateCommand("second\twith tab");
+  recorder.GenerateCommand("first");
+  const std::string path = "logs/test_session.replay";
+  ASSERT_EQ(ResponseRecording::Save(path, recorder.Recorded()), true,
+            "Recording saved");
+  std::vector<RecordedResponse> loaded;
+  ASSERT_EQ(ResponseRecording::Load(path, loaded), true, "Recording loaded");
+  ASSERT_EQ(loaded.size(), (size_t)3, "All responses loaded");
+  ASSERT_EQ(loaded[1].input, std::string("second\twith tab"),
+            "Escaped input round-trips");
+  ASSERT_EQ(loaded[1].Text(), recorder.Recorded()[1].Text(),
+            "Pieces round-trip");
+
+  // Hand-written timings: 30ms before the first piece, 10ms between pieces
+  loaded[0].pieces = {{30000000, "{\"cmd\": \"ipconfig\""},
+                      {10000000, ", \"why\": \"ip\"}"}};
+  ReplayAIProvider replay(loaded);
+  start = std::chrono::steady_clock::now();
+  std::string first = replay.GenerateCommand("first");
+  auto replayMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  ASSERT_EQ(CommandParser::Parse(first).command, std::string("ipconfig"),
+            "Replay answers with the recording for the same input");
+  ASSERT_EQ(replayMs >= 40, true, "Replay keeps recorded timings");
+  ASSERT_EQ(replay.GenerateCommand("first"), loaded[2].Text(),
+            "Repeated input replays the next recording");
+  ASSERT_EQ(replay.GenerateCommand("unknown"), loaded[0].Text(),
+            "Unknown input falls back to recording order");
+
+  ReplayAIProvider fast(loaded, 0.0);
+  start = std::chrono::steady_clock::now();
+  fast.GenerateCommand("first");
+  ASSERT_EQ(std::chrono::steady_clock::now() - start <
+                std::chrono::milliseconds(30),
+            true, "Speed 0 replays without waiting");
+  std::filesystem::remove(path);
+  return true;
+}
+
+bool TestBinaryIO() {
+  std::cout << "\n--- Testing Binary Encoding and Atomic Writes ---"
+            << std::endl;
+  std::string data;
+  BinaryIO::PutU32(data, 0x04030201u);
+  BinaryIO::PutU64(data, 0x0C0B0A0908070605ull);
+  BinaryIO::PutString(data, "abc");
+  const char kLittleEndian[] = "\x01\x02\x03\x04\x05\x06"
+                               "\x07\x08\x09\x0A\x0B\x0C";
+  ASSERT_EQ(data.compare(0, 12, kLittleEndian, 12), 0,
+            "Little-endian whatever the host");
+
+  BinaryIO::Reader r{data.data(), data.size()};
+  ASSERT_EQ(r.U32(), 0x04030201u, "U32 round-trips");
+  ASSERT_EQ(r.U64(), 0x0C0B0A0908070605ull, "U64 round-trips");
+  ASSERT_EQ(r.String(), "abc", "String round-trips");
+  ASSERT_EQ(r.ok && r.pos == data.size(), true, "Whole buffer consumed");
+  ASSERT_EQ(r.U32(), 0u, "Read past the end is zero");
+  ASSERT_EQ(r.ok, false, "Read past the end fails");
+  BinaryIO::Reader capped{data.data(), data.size(), 12};
+  ASSERT_EQ(capped.String(2).empty() && !capped.ok, true,
+            "Over-long string rejected");
+
+  const std::string path = "logs/test_binaryio/atomic.bin";
+  ASSERT_EQ(BinaryIO::WriteFileAtomic(path, "old"), true,
+            "Parent directories created");
+  ASSERT_EQ(BinaryIO::WriteFileAtomic(path, data), true, "File replaced");
+  std::ifstream in(path, std::ios::binary);
+  std::string back((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  ASSERT_EQ(back == data, true, "New contents in place");
+  ASSERT_EQ(std::filesystem::exists(path + ".tmp"), false,
+            "Temp file renamed into place");
+  return true;
+}
+
+bool TestResponseCache() {
+  std::cout << "\n--- Testing Response Cache ---" << std::endl;
+  ASSERT_EQ(ResponseCache::NormalizeIntent("  Show   my IP?! "),
+            std::string("show my ip"), "Intent normalized");
+  ASSERT_EQ(ResponseCache::MakeKey("Show my IP", "Qwen", "qwen") ==
+                ResponseCache::MakeKey("show my ip?", "Qwen", "qwen"),
+            true, "Paraphrase-free variants share a key");
+  ASSERT_EQ(ResponseCache::MakeKey("show my ip", "Qwen", "qwen") ==
+                ResponseCache::MakeKey("show my ip", "Phi", "phi3"),
+            false, "Models do not share entries");
+  ASSERT_EQ(ResponseCache::MakeKey("Show my IP", "Qwen", "qwen"),
+            ResponseCache::JoinKey({"show my ip", "Qwen", "qwen"}),
+            "Key joins the normalized parts");
+
+  ResponseCache cache(3);
+  for (int i = 0; i < 3; ++i)
+    cache.Insert("k" + std::to_string(i),
+                 {"cmd" + std::to_string(i), "why", i, true, ""});
+  ResponseCache::Entry e;
+  ASSERT_EQ(cache.Lookup("k0", e), true, "Hit");
+  ASSERT_EQ(e.command, std::string("cmd0"), "Hit returns the entry");
+  cache.Insert("k3", {"cmd3", "why", 3, false, "risky"});
+  ASSERT_EQ(cache.Size(), (size_t)3, "Size bounded");
+  ASSERT_EQ(cache.Lookup("k1", e), false, "Least recently used evicted");
+  ASSERT_EQ(cache.Lookup("k0", e), true, "Recently used entry kept");
+  ASSERT_EQ(cache.Invalidate("k2"), true, "Invalidate existing entry");
+  ASSERT_EQ(cache.Lookup("k2", e), false, "Invalidated entry gone");
+  ASSERT_EQ(cache.Hits(), (uint64_t)2, "Hits counted");
+  ASSERT_EQ(cache.Misses(), (uint64_t)2, "Misses counted");
+
+  const std::string path = "logs/test_response_cache.bin";
+  ASSERT_EQ(cache.Save(path), true, "Cache saved");
+  ResponseCache loaded(3);
+  ASSERT_EQ(loaded.Load(path), true, "Cache loaded");
+  ASSERT_EQ(loaded.Size(), (size_t)2, "Entries restored");
+  ASSERT_EQ(loaded.Lookup("k3", e), true, "Entry restored");
+  ASSERT_EQ(e.riskScore, 3, "Risk score restored");
+  ASSERT_EQ(e.riskReason, std::string("risky"), "Risk reason restored");
+  // k0 was most recently used before saving; k3 is now, so adding two
+  // entries must evict k0 first
+  loaded.Insert("k4", {});
+  loaded.Insert("k5", {});
+  ASSERT_EQ(loaded.Lookup("k0", e), false, "LRU order survives reload");
+
+  {
+    std::ofstream truncate(path, std::ios::binary | std::ios::trunc);
+    truncate << "CMDC\x01\0\0\0\x05\0\0\0";
+  }
+  ASSERT_EQ(loaded.Load(path), false, "Truncated file rejected");
+  ASSERT_EQ(loaded.Size(), (size_t)0, "Rejected file leaves cache empty");
+  std::filesystem::remove(path);
+  return true;
+}
+
+bool TestSemanticCache() {
+  std::cout << "\n--- Testing Semantic Cache ---" << std::endl;
+  // Deterministic pseudo-random vectors; their small perturbations stand in
+  // for the embeddings of paraphrases
+  const uint32_t dims = 48;
+  uint32_t seed = 12345;
+  auto next = [&seed]() {
+    seed = seed * 1664525u + 1013904223u;
+    return (float)(seed >> 8) / (float)(1u << 24) - 0.5f;
+  };
+  std::vector<std::vector<float>> vecs(300, std::vector<float>(dims));
+  for (auto &v : vecs)
+    for (float &x : v)
+      x = next();
+
+  VectorIndex flat(dims, 1000), graph(dims, 64);
+  for (const auto &v : vecs) {
+    flat.Add(v.data());
+    graph.Add(v.data());
+  }
+  ASSERT_EQ(flat.UsesGraph(), false, "Small index scans exhaustively");
+  ASSERT_EQ(graph.UsesGraph(), true, "Graph built past the threshold");
+  int agreed = 0;
+  for (size_t i = 0; i < vecs.size(); i += 10) {
+    std::vector<float> q = vecs[i];
+    for (float &x : q)
+      x += next() * 0.05f;
+    auto f = flat.Search(q.data(), 1);
+    auto g = graph.Search(q.data(), 1);
+    if (!f.empty() && f[0].id == i && !g.empty() && g[0].id == i)
+      agreed++;
+  }
+  ASSERT_EQ(agreed, 30, "Flat and graph search find the near duplicate");
+  auto top = flat.Search(vecs[7].data(), 5);
+  ASSERT_EQ(top.size(), (size_t)5, "k matches returned");
+  ASSERT_EQ(top[0].similarity >= top[4].similarity, true,
+            "Matches sorted by similarity");
+
+  std::string blob;
+  graph.Serialize(blob);
+  VectorIndex restored;
+  ASSERT_EQ(restored.Deserialize(blob.data(), blob.size()), blob.size(),
+            "Index round-trips");
+  ASSERT_EQ(restored.Search(vecs[42].data(), 1)[0].id, (uint32_t)42,
+            "Restored graph searchable");
+  ASSERT_EQ(restored.Deserialize(blob.data(), blob.size() / 2), (size_t)0,
+            "Truncated index rejected");
+
+  SemanticCache cache(0.95f, 64);
+  SemanticCache::Hit hit;
+  ASSERT_EQ(cache.Lookup(vecs[0], hit), false, "Empty cache misses");
+  cache.Insert(vecs[0], {"show my ip", "ipconfig", "Shows addresses"});
+  cache.Insert(vecs[1], {"list files", "dir", "Lists the folder"});
+  std::vector<float> near = vecs[0];
+  near[0] += 0.01f;
+  ASSERT_EQ(cache.Lookup(near, hit), true, "Paraphrase hits");
+  ASSERT_EQ(hit.entry.command, std::string("ipconfig"), "Hit returns entry");
+  ASSERT_EQ(hit.similarity > 0.95f, true, "Similarity reported");
+  ASSERT_EQ(cache.Lookup(vecs[2], hit), false, "Unrelated intent misses");
+  ASSERT_EQ(cache.Insert(std::vector<float>(dims + 1, 1.0f), {}), false,
+            "Mismatched dimensions rejected");
+
+  cache.Insert(vecs[0], {"Show my IP?", "ipconfig /all", "More detail"});
+  ASSERT_EQ(cache.Size(), (size_t)2, "Re-accepted intent replaces entry");
+  ASSERT_EQ(cache.Lookup(vecs[0], hit), true, "Replacement hits");
+  ASSERT_EQ(hit.entry.command, std::string("ipconfig /all"),
+            "Replacement answer returned");
+
+  const std::string path = "logs/test_semantic_cache.bin";
+  ASSERT_EQ(cache.Save(path), true, "Cache saved");
+  ASSERT_EQ(cache.Invalidate("list files"), true, "Invalidate entry");
+  ASSERT_EQ(cache.Lookup(vecs[1], hit), false, "Invalidated entry skipped");
+  ASSERT_EQ(cache.Invalidate("list files"), false, "Invalidate is one-shot");
+
+  SemanticCache loaded(0.95f, 64);
+  ASSERT_EQ(loaded.Load(path), true, "Cache loaded through mapping");
+  ASSERT_EQ(loaded.Size(), (size_t)2, "Live entries restored");
+  ASSERT_EQ(loaded.Lookup(vecs[1], hit), true, "Entry restored");
+  ASSERT_EQ(hit.entry.explanation, std::string("Lists the folder"),
+            "Explanation restored");
+  ASSERT_EQ(loaded.Lookup(vecs[0], hit) && hit.entry.command == "ipconfig /all",
+            true, "Tombstones survive reload");
+  {
+    std::ofstream truncate(path, std::ios::binary | std::ios::trunc);
+    truncate << "CMDS\x01\0\0\0\x09\0\0\0";
+  }
+  ASSERT_EQ(loaded.Load(path), false, "Truncated file rejected");
+  ASSERT_EQ(loaded.Size(), (size_t)0, "Rejected file leaves cache empty");
+  std::filesystem::remove(path);
+  return true;
+}
+
+bool TestCommandHistory() {
+  std::cout << "\n--- Testing Command History ---" << std::endl;
+  const int64_t now = 1700000000;
+  const int64_t day = 24 * 60 * 60;
+  ASSERT_EQ(CommandHistory::Frecency(3, now - day, now), 300u,
+            "Recent uses weigh fully");
+  ASSERT_EQ(CommandHistory::Frecency(3, now - 200 * day, now), 30u,
+            "Old uses decay");
+
+  const std::string path = "logs/test_command_history.log";
+  std::filesystem::remove(path);
+  {
+    CommandHistory history;
+    ASSERT_EQ(history.Open(path), true, "Journal opened");
+    history.Record("show my ip", "ipconfig", now - 100 * day);
+    history.Record("Show my IP?", "ipconfig /all", now);
+    history.Record("show ip configuration", "ipconfig /all", now);
+    history.Record("list files", "dir", now);
+    history.Record("list files", "dir", now);
+    history.Record("list processes", "tasklist", now - 20 * day);
+    ASSERT_EQ(history.Size(), (size_t)5, "Repeated pair merged");
+
+    CommandHistory::Suggestion s;
+    ASSERT_EQ(history.Resolve("SHOW my ip", s), true, "Intent resolved");
+    ASSERT_EQ(s.command, std::string("ipconfig /all"),
+              "Most frecent command wins");
+    ASSERT_EQ(history.Resolve("show my", s), false,
+              "Resolve needs the whole intent");
+
+    auto list = history.Suggest("li", 5, now);
+    ASSERT_EQ(list.size(), (size_t)2, "Prefix matches");
+    ASSERT_EQ(list[0].command, std::string("dir"), "Ranked by frecency");
+    ASSERT_EQ(list[0].uses, 2u, "Use count reported");
+    auto ip = history.Suggest("ip con", 5, now);
+    ASSERT_EQ(ip.size(), (size_t)1, "Multi-word query, one per command");
+    ASSERT_EQ(ip[0].command, std::string("ipconfig /all"),
+              "Intent text matched");
+    auto task = history.Suggest("taskl", 5, now);
+    ASSERT_EQ(task.size() == 1 && task[0].intent == "list processes", true,
+              "Command text matched");
+    ASSERT_EQ(history.Suggest("ist", 5, now).empty(), true,
+              "Matches start at a word");
+    ASSERT_EQ(history.Suggest("files list", 5, now).empty(), true,
+              "Scattered trigrams rejected");
+    ASSERT_EQ(history.Suggest("l", 5, now).empty(), true,
+              "Single character ignored");
+
+    ASSERT_EQ(history.Forget("list files", "dir"), true, "Pair forgotten");
+    ASSERT_EQ(history.Resolve("list files", s), false, "Forgotten intent");
+    ASSERT_EQ(history.Suggest("list", 5, now).size(), (size_t)1,
+              "Forgotten pair not suggested");
+  }
+
+  CommandHistory reloaded;
+  ASSERT_EQ(reloaded.Open(path), true, "Journal reopened");
+  ASSERT_EQ(reloaded.Size(), (size_t)4, "History survives restart");
+  CommandHistory::Suggestion s;
+  ASSERT_EQ(reloaded.Resolve("show ip configuration", s) &&
+                s.command == "ipconfig /all",
+            true, "Entry restored");
+  ASSERT_EQ(reloaded.Resolve("list files", s), false, "Forget replayed");
+  reloaded.Record("list files", "dir");
+  ASSERT_EQ(reloaded.Resolve("list files", s) && s.uses == 1, true,
+            "Forgotten pair starts over");
+  reloaded.Clear();
+  std::filesystem::remove(path);
+  return true;
+}
+
+bool TestChatStore() {
+  std::cout << "\n--- Testing Chat Store ---" << std::endl;
+  ChatStore store;
+  std::string text = "Lists the files in the folder.";
+  ChatStore::Message m;
+  m.content = text;
+  m.command = "dir /b";
+  m.riskReason = "Reads only";
+  m.hasCommand = true;
+  uint32_t first = store.Add(m);
+  text.assign(text.size(), '?'); // The store has its own copy
+  const char *content = store[0].content.data();
+  ASSERT_EQ(store[0].content == "Lists the files in the folder.", true,
+            "Text copied in");
+  ASSERT_EQ(content[store[0].content.size()], '\0', "NUL-terminated");
+
+  ChatStore::Message ask;
+  ask.role = ChatStore::Role::User;
+  // Contents are stored per message, command and reason once
+  size_t expected = 2001 * (m.content.size() + 1) + 7 + 11;
+  for (int i = 0; i < 2000; ++i) {
+    std::string q = "question " + std::to_string(i);
+    ask.content = q;
+    store.Add(ask);
+    store.Add(m);
+    expected += q.size() + 1;
+  }
+  ASSERT_EQ(store.Size(), (size_t)4001, "All added");
+  ASSERT_EQ(store[0].content.data(), content, "Views survive growth");
+  ASSERT_EQ(store[4000].command.data(), store[0].command.data(),
+            "Repeated command interned");
+  ASSERT_EQ(store[1].IsUser() && store[1].content == "question 0" &&
+                store[1].command.empty() && !store[1].hasCommand,
+            true, "Fields kept");
+  ASSERT_EQ(store.TextBytes(), expected, "Interned text stored once");
+
+  uint32_t lastId = store[4000].id;
+  store.DropFront(4000);
+  ASSERT_EQ(store.Size() == 1 && store[0].id == lastId &&
+                store[0].command == "dir /b",
+            true, "Dropped from the front, ids kept");
+  ASSERT_EQ(store.TextBytes() < 256, true, "Dropped text released");
+
+  std::vector<ChatStore::Message> older(2, ask);
+  older[0].content = "oldest";
+  older[1].content = "older"; // 'ask' still views the loop's dead string
+  store.Prepend(older);
+  ASSERT_EQ(store.Size() == 3 && store[0].content == "oldest" &&
+                store[1].content == "older" &&
+                store[2].id == lastId,
+            true, "Prepended oldest first");
+  ASSERT_EQ(store[0].id != first && store[0].id != store[1].id &&
+                store[0].id != lastId,
+            true, "Prepended messages get new ids");
+  store.Clear();
+  ASSERT_EQ(store.Empty() && store.Bytes() == 0, true, "Cleared");
+  return true;
+}
+
+bool TestChatJournal() {
+  std::cout << "\n--- Testing Chat Journal ---" << std::endl;
+  const std::string path = "logs/test_chat.journal";
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".idx");
+
+  auto message = [](std::string_view content) {
+    ChatStore::Message m;
+    m.content = content;
+    return m;
+  };
+  {
+    ChatJournal journal;
+    ASSERT_EQ(journal.Open(path), true, "Journal created");
+    ChatStore::Message ask = message("list files");
+    ask.role = ChatStore::Role::User;
+    journal.Append(ask);
+    ChatStore::Message answer = message("Lists the folder.");
+    answer.command = "dir";
+    answer.hasCommand = true;
+    answer.riskValid = true;
+    answer.riskScore = 2;
+    answer.riskReason = "Reads only";
+    answer.requestId = 42;
+    answer.cacheIntent = "list files";
+    ASSERT_EQ(journal.Append(answer), (size_t)1, "Record numbers count up");
+    journal.Append(ChatJournal::Execution{"dir", "a.txt\nb.txt\n", 0});
+    journal.Append(message("third"));
+    ASSERT_EQ(journal.Records(), (size_t)4, "Executions are records too");
+
+    ChatStore page;
+    size_t next = journal.ReadBefore(journal.Records(), 2, page);
+    ASSERT_EQ(page.Size() == 2 && page[0].content == "Lists the folder." &&
+                  page[1].content == "third",
+              true, "Newest messages, oldest first");
+    ASSERT_EQ(next, (size_t)1, "Next page ends at the first message read");
+    ASSERT_EQ(page[0].command == "dir" && page[0].hasCommand &&
+                  page[0].riskValid && page[0].riskScore == 2 &&
+                  page[0].riskReason == "Reads only" &&
+                  page[0].requestId == 42 && !page[0].IsUser() &&
+                  page[0].cacheIntent == "list files" && page[0].time > 0 &&
+                  page[0].journalRecord == 1,
+              true, "Message fields round-trip");
+    next = journal.ReadBefore(next, 2, page);
+    ASSERT_EQ(page.Size() == 3 && page[0].IsUser() && next == 0, true,
+              "Older page goes in front and reaches the start");
+  }
+
+  ChatJournal journal;
+  ASSERT_EQ(journal.Open(path), true, "Journal reopened");
+  ASSERT_EQ(journal.Records(), (size_t)4, "Records survive restart");
+  ChatJournal::Execution last;
+  ASSERT_EQ(journal.LastExecution(last) && last.command == "dir" &&
+                last.output == "a.txt\nb.txt\n",
+            true, "Last command result restored");
+  journal.Append(message("fourth"));
+  ChatStore page;
+  journal.ReadBefore(journal.Records(), 1, page);
+  ASSERT_EQ(page.Size() == 1 && page[0].content == "fourth", true,
+            "Appended after the mapping was made");
+  journal.Close();
+
+  // A write cut short by a crash: the torn record is dropped
+  {
+    std::ofstream torn(path, std::ios::binary | std::ios::app);
+    torn.write("\x40\0\0\0garbage", 11);
+  }
+  ASSERT_EQ(journal.Open(path), true, "Torn journal opened");
+  ASSERT_EQ(journal.Records(), (size_t)5, "Torn record dropped");
+  ASSERT_EQ(journal.Append(message("after crash")), (size_t)5,
+            "Appends continue after the last good record");
+  journal.Close();
+
+  std::filesystem::remove(path + ".idx");
+  ASSERT_EQ(journal.Open(path), true, "Opened without its index");
+  page.Clear();
+  journal.ReadBefore(journal.Records(), 1, page);
+  ASSERT_EQ(journal.Records() == 6 && page.Size() == 1 &&
+                page[0].content == "after crash",
+            true, "Index rebuilt from the journal");
+  journal.Close();
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".idx");
+  return true;
+}
+
+bool TestProcessMemory() {
+  std::cout << "\n--- Testing Process Memory ---" << std::endl;
+  ASSERT_EQ(ProcessMemory::PhysicalBytes() > 0, true, "Installed RAM known");
+  const uint64_t before = ProcessMemory::CurrentRssBytes();
+  ASSERT_EQ(before > 0, true, "Resident set known");
+
+  // Touch 64 MB while the probe samples, then release it before Stop
+  const size_t size = 64u << 20;
+  PeakRssProbe probe(std::chrono::milliseconds(1));
+  {
+    std::vector<char> block(size);
+    for (size_t i = 0; i < size; i += 4096)
+      block[i] = (char)i;
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  }
+  const uint64_t peak = probe.Stop();
+  ASSERT_EQ(peak >= before + size / 2, true, "Probe saw the allocation");
+  ASSERT_EQ(probe.Stop(), peak, "Stop is idempotent");
+  ASSERT_EQ(ProcessMemory::PeakRssBytes() >= peak / 2, true,
+            "High-water mark covers the peak");
+  return true;
+}
+
+bool TestInferenceProfile() {
+  std::cout << "\n--- Testing Inference Profile ---" << std::endl;
+  CpuTopology detected = CpuTopology::Detect();
+  ASSERT_EQ(detected.physical >= detected.performance &&
+                detected.logical >= detected.physical &&
+                detected.performance > 0,
+            true, "Detected topology is consistent");
+
+  // 6 P-cores with hyperthreads plus 4 E-cores
+  CpuTopology hybrid{16, 10, 6};
+  InferenceProfile p = InferenceProfile::Auto(hybrid, false);
+  ASSERT_EQ(p.gpuLayers, 0, "No offload without a GPU backend");
+  ASSERT_EQ(p.threads, 6, "Decode on the performance cores");
+  ASSERT_EQ(p.batchThreads, 10, "Prompt on every physical core");
+
+  p.kvType = KvCacheType::Q4_0;
+  p.flashAttn = FlashAttention::Off;
+  p.Normalize();
+  ASSERT_EQ(p.flashAttn == FlashAttention::On, true,
+            "Quantized KV turns flash attention on");
+
+  const std::string path = "logs/test_inference.ini";
+  ASSERT_EQ(p.Save(path), true, "Profile saved");
+  InferenceProfile loaded;
+  ASSERT_EQ(loaded.Load(path), true, "Profile loaded");
+  ASSERT_EQ(loaded.Describe(), p.Describe(), "Round trip keeps settings");
+  std::filesystem::remove(path);
+
+  // Fake machine: decode peaks at 3 threads, prompt at 10, ubatch 256 is
+  // best, q8_0 is only 2% faster so f16 stays
+  int runs = 0;
+  auto measure = [&](const InferenceProfile &c) {
+    ++runs;
+    InferenceProfile::Throughput t;
+    t.decodeTokensPerSecond = 20.0 - std::abs(c.threads - 3);
+    t.prefillTokensPerSecond = 100.0 - std::abs(c.batchThreads - 10) -
+                               (c.ubatchSize == 256 ? 0 : 5);
+    if (c.kvType == KvCacheType::Q8_0) {
+      t.decodeTokensPerSecond *= 1.02;
+      t.prefillTokensPerSecond *= 1.02;
+    }
+    return t;
+  };
+  InferenceProfile tuned = InferenceProfile::Calibrate(
+      InferenceProfile::Auto(hybrid, false), hybrid, measure);
+  ASSERT_EQ(tuned.threads, 3, "Decode threads tuned");
+  ASSERT_EQ(tuned.batchThreads, 10, "Prompt threads tuned");
+  ASSERT_EQ(tuned.ubatchSize, 256u, "Ubatch tuned");
+  ASSERT_EQ(tuned.kvType == KvCacheType::F16, true,
+            "Marginal KV quantization gain rejected");
+  ASSERT_EQ(runs < 16, true, "One setting at a time");
+  return true;
+}
+
+bool TestSpeculativePrefix() {
+  std::cout << "\n--- Testing Speculative Prefill Reconciliation ---"
+            << std::endl;
+  using Tokens = std::vector<SpeculativePrefix::Token>;
+  SpeculativePrefix spec;
+
+  // Typing: the unstable tail is never prefilled
+  Tokens typed = {1, 2, 3, 4, 5, 6, 7, 8};
+  SpeculativePrefix::DropUnstableTail(typed);
+  ASSERT_EQ(typed == (Tokens{1, 2, 3, 4, 5, 6}), true, "Unstable tail dropped");
+  Tokens tiny = {1, 2};
+  SpeculativePrefix::DropUnstableTail(tiny);
+  ASSERT_EQ(tiny.empty(), true, "Short turn not prefilled at all");
+  ASSERT_EQ(spec.Reconcile(typed), (size_t)0, "Fresh turn keeps nothing");
+  spec.Extend(typed);
+  ASSERT_EQ(spec.Tokens() == typed, true, "Decoded tokens recorded");
+
+  // More typing, with the old tail re-tokenized differently
+  Tokens longer = {1, 2, 3, 4, 5, 6, 70, 80, 9, 10};
+  SpeculativePrefix::DropUnstableTail(longer);
+  ASSERT_EQ(spec.Reconcile(longer), (size_t)6, "Tail edit keeps the prefix");
+  spec.Extend(longer);
+  ASSERT_EQ(spec.Size(), (size_t)8, "Only the new tokens appended");
+
+  // An edit in the middle rolls back everything after it
+  Tokens edited = {1, 2, 30, 4, 5, 6, 70, 80};
+  ASSERT_EQ(spec.Reconcile(edited), (size_t)2, "Middle edit keeps the head");
+  ASSERT_EQ(spec.Tokens() == (Tokens{1, 2}), true,
+            "Held tokens cut to the edit");
+  spec.Extend(edited);
+  ASSERT_EQ(spec.Tokens() == edited, true, "Rest decoded again");
+
+  // Deleting text only rolls back
+  Tokens shorter = {1, 2, 30, 4};
+  ASSERT_EQ(spec.Reconcile(shorter), (size_t)4, "Deletion keeps all it can");
+  ASSERT_EQ(spec.Size(), (size_t)4, "Deleted tokens dropped");
+
+  // Sending: the held prefix is adopted, the last token always decoded
+  ASSERT_EQ(spec.Adopt({1, 2, 30, 4, 5, 6, 100, 101}), (size_t)4,
+            "Held prefix adopted");
+  ASSERT_EQ(spec.Size(), (size_t)0, "Adopting forgets the held tokens");
+  spec.Extend({1, 2, 3});
+  ASSERT_EQ(spec.Adopt({1, 2, 3}), (size_t)2,
+            "Last token left for its logits");
+  spec.Extend({1, 2, 3});
+  ASSERT_EQ(spec.Adopt({9, 2, 3, 4}), (size_t)0, "Divergent turn adopts none");
+
+  // After a reset the next turn starts over
+  spec.Extend({1, 2, 3});
+  spec.Clear();
+  ASSERT_EQ(spec.Reconcile({1, 2, 3, 4}), (size_t)0,
+            "Reset turn rebuilt from the conversation");
+  ASSERT_EQ(spec.Adopt({1, 2, 3, 4}), (size_t)0, "Nothing adopted after reset");
+  return true;
+}
+
+bool TestCandidateRanker() {
+  std::cout << "\n--- Testing Best-of-N Candidate Ranking ---" << std::endl;
+  const std::string safe = "[CMD] dir [WHY] Lists files";
+  const std::string risky = "[CMD] del /s /q build [WHY] Deletes the build";
+  const std::string refusal = "{\"cmd\": \"DENIED\", \"why\": \"Unsafe\"}";
+  const std::string invalid = "[CMD] no_such_tool_xyz --all [WHY] Made up";
+  const std::string unparsable = "{";
+
+  auto rank = &CandidateRanker::Rank;
+  ASSERT_EQ(rank(safe, false), 0, "Riskless runnable command ranks 0");
+  ASSERT_EQ(rank(safe, false) < rank(risky, false), true,
+            "Risk score orders runnable commands");
+  ASSERT_EQ(rank(refusal, true) < rank(safe, false), true,
+            "First candidate's refusal stands");
+  ASSERT_EQ(rank(risky, false) < rank(refusal, false), true,
+            "Fork's refusal loses to a runnable command");
+  ASSERT_EQ(rank(refusal, false) < rank(invalid, false), true,
+            "Fork's refusal beats a command that does not exist");
+  ASSERT_EQ(rank(invalid, false) < rank(unparsable, false), true,
+            "Unparsable answers rank last");
+
+  // A fork rescues an answer that cannot run
+  {
+    CandidateRanker ranker;
+    ASSERT_EQ(ranker.Finish(1, risky, false), false,
+              "Risky best does not settle");
+    ranker.Finish(0, invalid, true);
+    ranker.Finish(2, unparsable, true);
+    ASSERT_EQ(ranker.Best(), 1, "Runnable fork beats invalid first answer");
+  }
+  // Settles early only once candidate 0 can no longer refuse
+  {
+    CandidateRanker ranker;
+    ASSERT_EQ(ranker.Finish(2, safe, false), false,
+              "Waits for candidate 0 to finish");
+    ASSERT_EQ(ranker.Finish(0, safe, true), true,
+              "Settles with a riskless answer and candidate 0 done");
+    ASSERT_EQ(ranker.Best(), 2, "Equal ranks keep the earlier finisher");
+  }
+  {
+    CandidateRanker ranker;
+    ranker.Finish(1, safe, false);
+    ASSERT_EQ(ranker.Finish(0, refusal, true), true,
+              "First candidate's refusal settles");
+    ASSERT_EQ(ranker.Best(), 0, "Refusal chosen over a fork's command");
+  }
+  return true;
+}
+
+bool TestOutputDigest() {
+  std::cout << "\n--- Testing Output Digest ---" << std::endl;
+  auto count = [](std::string_view s) {
+    return OutputDigest::EstimateTokens(s);
+  };
+
+  OutputDigest small =
+      OutputDigest::Build("a\r\nb\nb\nb\n50%\r100%\n", 1000, count);
+  ASSERT_EQ(small.text, "a\nb  [repeated 3 times]\n100%\n",
+            "Repeats folded, progress redraws collapsed");
+  ASSERT_EQ(small.lines, 5u, "Original lines counted");
+  ASSERT_EQ(small.foldedLines, 2u, "Folded lines counted");
+  ASSERT_EQ(small.omittedLines, 0u, "Nothing omitted when it fits");
+
+  // 20k distinct lines, a few MB: head and tail kept, the middle cut
+  std::string big;
+  for (int i = 0; i < 20000; ++i)
+    big += "line " + std::to_string(i) + " of a long listing with detail\n";
+  OutputDigest cut = OutputDigest::Build(big, 400, count);
+  ASSERT_EQ(cut.tokens <= 400, true, "Digest within budget");
+  ASSERT_EQ(cut.tokens > 300, true, "Budget mostly used");
+  ASSERT_EQ(cut.text.rfind("line 0 ", 0), 0u, "Head kept");
+  ASSERT_EQ(cut.text.find("line 19999 ") != std::string::npos, true,
+            "Tail kept");
+  ASSERT_EQ(cut.text.find(" lines omitted ...]") != std::string::npos, true,
+            "Omission marked");
+  ASSERT_EQ(cut.omittedLines > 19000, true, "Middle omitted");
+
+  OutputDigest blob =
+      OutputDigest::Build(std::string(1 << 20, 'x'), 200, count);
+  ASSERT_EQ(blob.truncatedLine && blob.tokens <= 200 && blob.tokens > 100,
+            true, "Single huge line cut to fit");
+  return true;
+}
+
+bool TestJobScheduler() {
+  std::cout << "\n--- Testing Job Scheduler ---" << std::endl;
+
+  // Bounded output: the newest bytes kept, readers resume where they were
+  {
+    JobOutput out(100);
+    std::string mirror;
+    uint64_t seen = 0;
+    out.Append("first\n", 6);
+    ASSERT_EQ(out.ReadSince(seen, mirror), true, "New output read");
+    ASSERT_EQ(mirror, "first\n", "Reader sees the start");
+    ASSERT_EQ(out.ReadSince(seen, mirror), false, "Nothing new twice");
+    for (int i = 0; i < 40; ++i)
+      out.Append("0123456789", 10);
+    ASSERT_EQ(out.Text().size() <= 125, true, "Kept text bounded");
+    ASSERT_EQ(out.Dropped() + out.Text().size(), out.Total(),
+              "Dropped bytes accounted");
+    ASSERT_EQ(out.ReadSince(seen, mirror), true, "Reader catches up");
+    ASSERT_EQ(mirror.size() <= 125, true, "Reader's copy bounded too");
+    ASSERT_EQ(mirror.substr(mirror.size() - 10), "0123456789",
+              "Reader's copy ends with the newest output");
+  }
+
+  JobScheduler jobs;
+  jobs.SetMaxRunning(2);
+
+  // Plain jobs run to completion with their own output
+  uint64_t a = jobs.Submit("echo JobA");
+  uint64_t b = jobs.Submit("echo JobB && exit /b 3");
+  ASSERT_EQ(jobs.Wait(a, 10000) && jobs.Wait(b, 10000), true, "Jobs finished");
+  JobInfo infoA, infoB;
+  jobs.Info(a, infoA);
+  jobs.Info(b, infoB);
+  ASSERT_EQ(infoA.status == JobStatus::Exited && infoA.exitCode == 0, true,
+            "First job exited cleanly");
+  ASSERT_EQ(infoB.exitCode, 3, "Second job's exit code kept");
+  std::string output;
+  uint64_t seen = 0;
+  jobs.ReadOutput(b, seen, output);
+  ASSERT_EQ(output.find("JobB") != std::string::npos &&
+                output.find("JobA") == std::string::npos,
+            true, "Output kept per job");
+  ASSERT_EQ(jobs.TakeFinished().size(), 2u, "Finished jobs handed over");
+
+  // Two slots: a third long job waits; stopping works queued or running
+  uint64_t slow1 = jobs.Submit("ping -n 20 127.0.0.1");
+  uint64_t slow2 = jobs.Submit("ping -n 20 127.0.0.1");
+  uint64_t slow3 = jobs.Submit("ping -n 20 127.0.0.1");
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  JobInfo info3;
+  jobs.Info(slow3, info3);
+  ASSERT_EQ(jobs.Running(), 2u, "Parallelism capped");
+  ASSERT_EQ(info3.status == JobStatus::Queued, true, "Third job queued");
+  jobs.Stop(slow3);
+  jobs.Stop(slow1);
+  ASSERT_EQ(jobs.Wait(slow1, 5000), true, "Running job stopped promptly");
+  JobInfo info1;
+  jobs.Info(slow1, info1);
+  jobs.Info(slow3, info3);
+  ASSERT_EQ(info1.status == JobStatus::Stopped, true, "Stopped job marked");
+  ASSERT_EQ(info3.status == JobStatus::Stopped && info3.startNs == 0, true,
+            "Queued job dropped without running");
+  jobs.StopAll();
+  ASSERT_EQ(jobs.Wait(slow2, 5000), true, "Stop all");
+
+  // With a sink, ended jobs go to the I/O thread instead of TakeFinished
+  jobs.TakeFinished();
+  std::promise<std::thread::id> sinkThread;
+  std::string sunk;
+  jobs.SetFinishedSink([&](JobScheduler::Finished &done) {
+    sunk = std::move(done.output);
+    sinkThread.set_value(std::this_thread::get_id());
+  });
+  jobs.Submit("echo JobSink");
+  std::future<std::thread::id> delivered = sinkThread.get_future();
+  ASSERT_EQ(delivered.wait_for(std::chrono::seconds(10)) ==
+                std::future_status::ready,
+            true, "Sink called");
+  ASSERT_EQ(delivered.get() != std::this_thread::get_id(), true,
+            "Sink runs on the I/O thread");
+  ASSERT_EQ(sunk.find("JobSink") != std::string::npos, true,
+            "Sink gets the output");
+  ASSERT_EQ(jobs.TakeFinished().empty(), true, "Nothing left to take");
+  return true;
+}
+
 bool TestDirectoryManagement() {
   std::cout << "\n--- Testing Directory Management (mkdir/rmdir) ---"
             << std::endl;
@@ -303,12 +1527,56 @@ int main() {
   std::cout << "========================================" << std::endl;
 
   int passed = 0;
-  int total = 7;
+  int total = 29;
 
   if (TestShellExecution())
     passed++;
   if (TestCommandParsing())
     passed++;
+  if (TestZeroCopyParsing())
+    passed++;
+  if (TestTextScan())
+    passed++;
+  if (TestAsyncLogger())
+    passed++;
+  if (TestLogLevelFiltering())
+    passed++;
+  if (TestEventLog())
+    passed++;
+  if (TestLatencyHistogram())
+    passed++;
+  if (TestMetricsExport())
+    passed++;
+  if (TestTraceRecorder())
+    passed++;
+  if (TestPerfSampler())
+    passed++;
+  if (TestReplayProviders())
+    passed++;
+  if (TestBinaryIO())
+    passed++;
+  if (TestResponseCache())
+    passed++;
+  if (TestSemanticCache())
+    passed++;
+  if (TestCommandHistory())
+    passed++;
+  if (TestChatStore())
+    passed++;
+  if (TestChatJournal())
+    passed++;
+  if (TestProcessMemory())
+    passed++;
+  if (TestInferenceProfile())
+    passed++;
+  if (TestSpeculativePrefix())
+    passed++;
+  if (TestCandidateRanker())
+    passed++;
+  if (TestOutputDigest())
+    passed++;
+  if (TestJobScheduler())
+    passed++;
   if (TestDirectoryManagement())
     passed++;
   if (TestSystemQueryCommands())
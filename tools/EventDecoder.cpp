@@ -0,0 +1,95 @@
+#include "../src/EventLog.h"
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Offline decoder for logs/events.bin (and rotated events.N.bin files).
+// Usage: EventDecoder [--csv] <events.bin> [more files...]
+// Default output is one JSON object per line.
+
+static std::string Escape(const std::string &s, bool csv) {
+  std::string out;
+  for (char c : s) {
+    if (csv) {
+      if (c == '\"')
+        out += "\"\"";
+      else
+        out += c;
+    } else if (c == '\"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if ((unsigned char)c < 0x20) {
+      out += ' ';
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+static void PrintJson(const EventLog::Record &r) {
+  std::cout << "{\"session\":" << r.sessionId << ",\"request\":" << r.requestId
+            << ",\"event\":\"" << EventLog::EventName(r.id)
+            << "\",\"wallTimeNs\":" << r.wallTimeNs
+            << ",\"monotonicNs\":" << r.monotonicNs;
+  auto names = EventLog::FieldNames(r.id);
+  for (size_t i = 0; i < r.fields.size(); ++i) {
+    std::string name = i < names.size() ? names[i] : "f" + std::to_string(i);
+    std::cout << ",\"" << name << "\":" << r.fields[i];
+  }
+  if (!r.text.empty())
+    std::cout << ",\"text\":\"" << Escape(r.text, false) << "\"";
+  std::cout << "}\n";
+}
+
+static void PrintCsv(const EventLog::Record &r) {
+  std::cout << r.sessionId << "," << r.requestId << ","
+            << EventLog::EventName(r.id) << "," << r.wallTimeNs << ","
+            << r.monotonicNs << ",\"" << Escape(r.text, true) << "\"";
+  for (size_t i = 0; i < EventLog::kMaxFields; ++i) {
+    std::cout << ",";
+    if (i < r.fields.size())
+      std::cout << r.fields[i];
+  }
+  std::cout << "\n";
+}
+
+int main(int argc, char **argv) {
+  bool csv = false;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--csv") == 0)
+      csv = true;
+    else
+      files.push_back(argv[i]);
+  }
+  if (files.empty()) {
+    std::cerr << "Usage: EventDecoder [--csv] <events.bin> [more files...]"
+              << std::endl;
+    return 2;
+  }
+
+  if (csv) {
+    // f0.. follow the per-event layout documented on EventId (f0 is
+    // durationNs for every stage event).
+    std::cout << "session,request,event,wall_time_ns,monotonic_ns,text";
+    for (size_t i = 0; i < EventLog::kMaxFields; ++i)
+      std::cout << ",f" << i;
+    std::cout << "\n";
+  }
+
+  int rc = 0;
+  for (const auto &file : files) {
+    bool ok = EventLog::ReadFile(
+        file, [csv](const EventLog::Record &r) { csv ? PrintCsv(r) : PrintJson(r); });
+    if (!ok) {
+      std::cerr << "Warning: " << file << " is unreadable or truncated"
+                << std::endl;
+      rc = 1;
+    }
+  }
+  return rc;
+}
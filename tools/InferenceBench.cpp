@@ -0,0 +1,390 @@
+// Offline end-to-end inference benchmark.
+//
+//   InferenceBench --model <file.gguf> [--template qwen|phi|tinyllama]
+//                  [--label <name>] [--corpus <intents.tsv>]
+//                  [--profile <inference.ini>] [--calibrate]
+//                  [--gpu-layers <n>] [--ctx <n>] [--threads <n>]
+//                  [--batch-threads <n>] [--ubatch <n>]
+//                  [--kv-type f16|q8_0|q4_0] [--flash-attn auto|on|off]
+//                  [--max-tokens <n>] [--seed <n>] [--warmup <n>]
+//                  [--json <results.jsonl>] [--min-parse <fraction>]
+//                  [--min-match <fraction>] [--speculate]
+//                  [--no-mmap] [--mlock] [--candidates <n>]
+//
+// Replays every intent of the golden corpus through the same path as the
+// app (firewall, GenerateCommand, CommandParser) with a fresh context per
+// intent, and reports TTFT, prefill/decode rates, end-to-end latency
+// percentiles, peak RSS and parse/match rates for the configuration.
+// Defaults to CPU only (--gpu-layers 0) and a fixed seed so runs compare.
+//
+// Peak RSS is the process high-water mark, so benchmark one configuration
+// per process. --json appends one line per run; --min-parse/--min-match turn
+// the run into a gate that exits with 1 when the rates fall short.
+// --speculate prefills each intent through LlamaManager::Prefill before the
+// clock starts, as the app does while the user types, so TTFT only covers
+// the end-of-turn tail.
+//
+// --profile starts from a saved inference profile; flags after it override
+// single settings. --calibrate tunes the profile on this machine first (see
+// InferenceProfile::Calibrate), writes it to the --profile path or
+// config/inference.ini, and benchmarks the result.
+//
+// The model is warmed up as in the app (LlamaManager::Warmup), so "ready"
+// is load plus warmup and the first intent shows what is left of the
+// first-request cost. --warmup adds throwaway requests on top.
+//
+// --candidates samples n completions per intent in one batched decode and
+// keeps the best valid, lowest-risk one; compare its total latency and
+// match rate against a run without it.
+#include "../src/CommandFirewall.h"
+#include "../src/CommandParser.h"
+#include "../src/LatencyStats.h"
+#include "../src/LlamaManager.h"
+#include "../src/Metrics.h"
+#include "../src/ModelManager.h"
+#include "../src/ProcessMemory.h"
+#include "../src/TextScan.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct IntentCase {
+  std::string intent;
+  std::string expected;
+};
+
+struct InferenceBenchOptions {
+  std::string modelPath;
+  std::string label;
+  std::string templateName = "qwen";
+  std::string corpusPath = "tests/intent_corpus.tsv";
+  std::string jsonPath;
+  std::string profilePath;
+  InferenceProfile profile; // Machine-specific part of 'llama'
+  LlamaOptions llama;
+  int warmup = 0;
+  double minParse = 0.0;
+  double minMatch = 0.0;
+  bool speculate = false;
+  bool calibrate = false;
+};
+
+static int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static std::vector<IntentCase> LoadCorpus(const std::string &path) {
+  std::vector<IntentCase> cases;
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.empty() || line[0] == '#')
+      continue;
+    size_t tab = line.find('\t');
+    if (tab == std::string::npos)
+      continue;
+    cases.push_back({line.substr(0, tab), line.substr(tab + 1)});
+  }
+  return cases;
+}
+
+static ChatTemplate TemplateFor(const std::string &name) {
+  if (name == "qwen")
+    return LlamaManager::GetQwenTemplate();
+  if (name == "phi")
+    return LlamaManager::GetPhi3Template();
+  return LlamaManager::GetTinyLlamaTemplate();
+}
+
+static bool ParseArgs(int argc, char **argv, InferenceBenchOptions &opt) {
+  opt.llama.seed = 42;
+  for (int i = 1; i < argc; ++i) {
+    auto value = [&]() -> const char * {
+      return i + 1 < argc ? argv[++i] : nullptr;
+    };
+    const char *arg = argv[i];
+    const char *v = nullptr;
+    if (std::strcmp(arg, "--model") == 0 && (v = value()))
+      opt.modelPath = v;
+    else if (std::strcmp(arg, "--label") == 0 && (v = value()))
+      opt.label = v;
+    else if (std::strcmp(arg, "--template") == 0 && (v = value()))
+      opt.templateName = v;
+    else if (std::strcmp(arg, "--corpus") == 0 && (v = value()))
+      opt.corpusPath = v;
+    else if (std::strcmp(arg, "--json") == 0 && (v = value()))
+      opt.jsonPath = v;
+    else if (std::strcmp(arg, "--profile") == 0 && (v = value())) {
+      opt.profilePath = v;
+      if (!opt.profile.Load(v))
+        std::cerr << "No profile at " << v << ", using defaults" << std::endl;
+    } else if (std::strcmp(arg, "--calibrate") == 0)
+      opt.calibrate = true;
+    else if (std::strcmp(arg, "--gpu-layers") == 0 && (v = value()))
+      opt.profile.gpuLayers = std::atoi(v);
+    else if (std::strcmp(arg, "--ctx") == 0 && (v = value()))
+      opt.profile.contextSize = (uint32_t)std::atoi(v);
+    else if (std::strcmp(arg, "--threads") == 0 && (v = value()))
+      opt.profile.threads = std::atoi(v);
+    else if (std::strcmp(arg, "--batch-threads") == 0 && (v = value()))
+      opt.profile.batchThreads = std::atoi(v);
+    else if (std::strcmp(arg, "--ubatch") == 0 && (v = value()))
+      opt.profile.ubatchSize = (uint32_t)std::atoi(v);
+    else if (std::strcmp(arg, "--kv-type") == 0 && (v = value())) {
+      if (!InferenceProfile::ParseKvType(v, opt.profile.kvType))
+        return false;
+    } else if (std::strcmp(arg, "--flash-attn") == 0 && (v = value())) {
+      if (!InferenceProfile::ParseFlashAttention(v, opt.profile.flashAttn))
+        return false;
+    }
+    else if (std::strcmp(arg, "--max-tokens") == 0 && (v = value()))
+      opt.llama.maxTokens = std::atoi(v);
+    else if (std::strcmp(arg, "--seed") == 0 && (v = value()))
+      opt.llama.seed = (uint32_t)std::strtoul(v, nullptr, 10);
+    else if (std::strcmp(arg, "--warmup") == 0 && (v = value()))
+      opt.warmup = std::atoi(v);
+    else if (std::strcmp(arg, "--min-parse") == 0 && (v = value()))
+      opt.minParse = std::atof(v);
+    else if (std::strcmp(arg, "--min-match") == 0 && (v = value()))
+      opt.minMatch = std::atof(v);
+    else if (std::strcmp(arg, "--speculate") == 0)
+      opt.speculate = true;
+    else if (std::strcmp(arg, "--no-mmap") == 0)
+      opt.llama.useMmap = false;
+    else if (std::strcmp(arg, "--mlock") == 0)
+      opt.llama.useMlock = true;
+    else if (std::strcmp(arg, "--candidates") == 0 && (v = value()))
+      opt.llama.candidates = std::atoi(v);
+    else
+      return false;
+  }
+  if (opt.label.empty())
+    opt.label = opt.modelPath;
+  opt.llama.Apply(opt.profile);
+  return !opt.modelPath.empty();
+}
+
+static std::string JsonEscape(const std::string &s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    if ((unsigned char)c >= 0x20)
+      out += c;
+  }
+  return out;
+}
+
+int main(int argc, char **argv) {
+  InferenceBenchOptions opt;
+  if (!ParseArgs(argc, argv, opt)) {
+    std::cerr << "Usage: InferenceBench --model <file.gguf> [--template "
+                 "qwen|phi|tinyllama] [--label <name>] [--corpus <tsv>] "
+                 "[--profile <ini>] [--calibrate] [--gpu-layers <n>] "
+                 "[--ctx <n>] [--threads <n>] [--batch-threads <n>] "
+                 "[--ubatch <n>] [--kv-type f16|q8_0|q4_0] "
+                 "[--flash-attn auto|on|off] "
+                 "[--max-tokens <n>] [--seed <n>] [--warmup <n>] [--json "
+                 "<out.jsonl>] [--min-parse <f>] [--min-match <f>] "
+                 "[--speculate] [--no-mmap] [--mlock] [--candidates <n>]"
+              << std::endl;
+    return 2;
+  }
+
+  std::vector<IntentCase> corpus = LoadCorpus(opt.corpusPath);
+  if (corpus.empty()) {
+    std::cerr << "No intents in " << opt.corpusPath << std::endl;
+    return 2;
+  }
+
+  const int64_t loadStart = NowNs();
+  ModelManager::ModelPtr model =
+      ModelManager::LoadModel(opt.modelPath, opt.llama);
+  if (!model) {
+    std::cerr << "Could not load " << opt.modelPath << std::endl;
+    return 1;
+  }
+
+  if (opt.calibrate) {
+    // Every candidate gets a fresh context on the same weights
+    auto measure = [&](const InferenceProfile &candidate) {
+      LlamaOptions options = opt.llama;
+      options.Apply(candidate);
+      LlamaManager probe(model, opt.label, options);
+      probe.SetTemplate(TemplateFor(opt.templateName));
+      return probe.MeasureThroughput();
+    };
+    opt.profile = InferenceProfile::Calibrate(
+        opt.profile, CpuTopology::Detect(), measure);
+    opt.llama.Apply(opt.profile);
+    const std::string path =
+        opt.profilePath.empty() ? "config/inference.ini" : opt.profilePath;
+    std::cout << (opt.profile.Save(path) ? "Calibrated profile written to "
+                                         : "Could not write ")
+              << path << ": " << opt.profile.Describe() << std::endl;
+  }
+
+  LlamaManager llm(model, opt.label, opt.llama);
+  llm.SetTemplate(TemplateFor(opt.templateName));
+  const double loadSeconds = (NowNs() - loadStart) / 1e9;
+  if (!llm.Warmup()) {
+    std::cerr << "[" << opt.label << "] warmup failed" << std::endl;
+    return 1;
+  }
+  const double readySeconds = (NowNs() - loadStart) / 1e9;
+
+  MetricGauge &prefillRate = Metrics::Get().Gauge(
+      "cmdai_prefill_tokens_per_second", "Prompt rate of the last request");
+  MetricGauge &decodeRate = Metrics::Get().Gauge(
+      "cmdai_decode_tokens_per_second", "Decode rate of the last request");
+
+  for (int i = 0; i < opt.warmup; ++i) {
+    llm.ResetContext();
+    std::string response = llm.GenerateCommand(corpus[0].intent);
+    if (response.rfind("Error:", 0) == 0) {
+      std::cerr << "[" << opt.label << "] " << response << std::endl;
+      return 1;
+    }
+  }
+  LatencyStats::Get().Reset();
+
+  LatencyHistogram total, ttft;
+  int64_t firstRequestNs = 0;
+  double prefillSum = 0, decodeSum = 0;
+  size_t generated = 0, parsed = 0, matched = 0, blocked = 0;
+
+  for (const IntentCase &c : corpus) {
+    llm.ResetContext();
+    prefillRate.Set(0);
+    decodeRate.Set(0);
+    if (opt.speculate)
+      llm.Prefill(c.intent); // Typing paused on the complete intent
+
+    int64_t start = NowNs();
+    int64_t firstPiece = 0;
+    std::string command;
+    bool ok = false;
+    CommandFirewall::BlockResult block = CommandFirewall::Assess(c.intent);
+    if (block.blocked) {
+      ++blocked;
+      command = "BLOCKED";
+      ok = true;
+    } else {
+      std::string response =
+          llm.GenerateCommand(c.intent, [&](const std::string &) {
+            if (!firstPiece)
+              firstPiece = NowNs();
+          });
+      ParsedCommand pc = CommandParser::Parse(response);
+      command = pc.command;
+      ok = pc.success;
+      ++generated;
+      if (ok)
+        ++parsed;
+      if (firstPiece)
+        ttft.Record(firstPiece - start);
+      prefillSum += prefillRate.Value();
+      decodeSum += decodeRate.Value();
+    }
+    int64_t elapsed = NowNs() - start;
+    if (!block.blocked) {
+      total.Record(elapsed);
+      if (!firstRequestNs)
+        firstRequestNs = elapsed;
+    }
+
+    bool match = ok && (c.expected == "BLOCKED" || c.expected == "DENIED"
+                            ? command == c.expected
+                            : TextScan::ContainsCaseInsensitive(command,
+                                                                c.expected));
+    if (match)
+      ++matched;
+    std::cout << (match ? "[MATCH] " : "[MISS]  ") << std::setw(8)
+              << std::fixed << std::setprecision(1) << elapsed / 1e6
+              << " ms  " << c.intent << " -> " << command << std::endl;
+  }
+
+  const double parseRate = generated ? (double)parsed / generated : 1.0;
+  const double matchRate = (double)matched / corpus.size();
+  const double peakRss = ProcessMemory::PeakRssBytes() / (1024.0 * 1024.0);
+  auto ms = [](int64_t ns) { return ns / 1e6; };
+
+  std::cout << std::fixed << std::setprecision(1) << "\n--- " << opt.label
+            << " (" << opt.profile.Describe() << ", ctx "
+            << opt.llama.contextSize
+            << (opt.speculate ? ", speculative prefill" : "")
+            << (opt.llama.candidates > 1
+                    ? ", best of " + std::to_string(opt.llama.candidates)
+                    : "")
+            << ") ---\n"
+            << "load:            " << loadSeconds << " s\n"
+            << "ready:           " << readySeconds << " s (after warmup)\n"
+            << "first request:   " << ms(firstRequestNs) << " ms\n"
+            << "intents:         " << corpus.size() << " (" << blocked
+            << " blocked by firewall)\n"
+            << "ttft p50/p95:    " << ms(ttft.PercentileNs(50)) << " / "
+            << ms(ttft.PercentileNs(95)) << " ms\n"
+            << "total p50/p95/p99: " << ms(total.PercentileNs(50)) << " / "
+            << ms(total.PercentileNs(95)) << " / "
+            << ms(total.PercentileNs(99)) << " ms\n"
+            << "prefill:         "
+            << (generated ? prefillSum / generated : 0.0) << " tok/s\n"
+            << "decode:          " << (generated ? decodeSum / generated : 0.0)
+            << " tok/s\n"
+            << "peak rss:        " << peakRss << " MB\n"
+            << std::setprecision(3) << "parse rate:      " << parseRate
+            << "\nmatch rate:      " << matchRate << std::endl;
+  std::cout << "\n" << LatencyStats::Get().Format();
+
+  if (!opt.jsonPath.empty()) {
+    std::ofstream out(opt.jsonPath, std::ios::app);
+    out << std::fixed << std::setprecision(3) << "{\"label\": \""
+        << JsonEscape(opt.label) << "\", \"model\": \""
+        << JsonEscape(opt.modelPath) << "\", \"gpu_layers\": "
+        << opt.llama.gpuLayers << ", \"ctx\": " << opt.llama.contextSize
+        << ", \"threads\": " << opt.llama.threads
+        << ", \"batch_threads\": " << opt.llama.batchThreads
+        << ", \"ubatch\": " << opt.llama.ubatchSize << ", \"kv_type\": \""
+        << InferenceProfile::KvTypeName(opt.llama.kvType)
+        << "\", \"flash_attn\": \""
+        << InferenceProfile::FlashAttentionName(opt.llama.flashAttn) << "\""
+        << ", \"speculate\": " << (opt.speculate ? "true" : "false")
+        << ", \"candidates\": " << opt.llama.candidates
+        << ", \"intents\": " << corpus.size()
+        << ", \"load_s\": " << loadSeconds
+        << ", \"ready_s\": " << readySeconds
+        << ", \"first_request_ms\": " << ms(firstRequestNs)
+        << ", \"ttft_p50_ms\": " << ms(ttft.PercentileNs(50))
+        << ", \"ttft_p95_ms\": " << ms(ttft.PercentileNs(95))
+        << ", \"total_p50_ms\": " << ms(total.PercentileNs(50))
+        << ", \"total_p95_ms\": " << ms(total.PercentileNs(95))
+        << ", \"total_p99_ms\": " << ms(total.PercentileNs(99))
+        << ", \"prefill_tps\": " << (generated ? prefillSum / generated : 0.0)
+        << ", \"decode_tps\": " << (generated ? decodeSum / generated : 0.0)
+        << ", \"peak_rss_mb\": " << peakRss
+        << ", \"parse_rate\": " << parseRate
+        << ", \"match_rate\": " << matchRate << "}\n";
+  }
+
+  bool failed = false;
+  if (parseRate < opt.minParse) {
+    std::cerr << "[GATE] parse rate " << parseRate << " < " << opt.minParse
+              << std::endl;
+    failed = true;
+  }
+  if (matchRate < opt.minMatch) {
+    std::cerr << "[GATE] match rate " << matchRate << " < " << opt.minMatch
+              << std::endl;
+    failed = true;
+  }
+  return failed ? 1 : 0;
+}